@@ -87,6 +87,7 @@
 		static HTTP_IO_RESULT HTTPPostDDNSConfig(void);
 	#endif
 #endif
+static BYTE HTTPLedState(WORD num);
 
 // RAM allocated for DDNS parameters
 #if defined(STACK_USE_DYNAMICDNS_CLIENT)
@@ -246,6 +247,9 @@ HTTP_IO_RESULT HTTPExecuteGet(void)
 		{
 		    //RELAY2_IO = (*ptr == '1');
 		}
+
+		// Pages must show the new states
+		HTTPCacheInvalidate();
 	}
 	
 	// If it's the LED updater file
@@ -609,9 +613,7 @@ static HTTP_IO_RESULT HTTPPostConfig(void)
 		    XEEEndWrite();
 	        while(XEEIsBusy());
 	        #elif defined(MPFS_USE_SPI_FLASH)
-	        SPIFlashBeginWrite(0x00);
-	        SPIFlashWrite(0x60);
-	        SPIFlashWriteArray(ptr, sizeof(AppConfig));
+	        ParamWrite(PARAM_KEY_APPCONFIG, ptr, sizeof(AppConfig));
 	        #endif
 			
 			// Set the board to reboot to the new address
@@ -1306,6 +1308,7 @@ static HTTP_IO_RESULT HTTPPostDDNSConfig(void)
 		case SM_DDNS_DONE:
 			// Since user name and password changed, force an update immediately
 			DDNSForceUpdate();
+			HTTPCacheInvalidate();
 			
 			// Redirect to prevent POST errors
 			lastSuccess = TRUE;
@@ -1321,6 +1324,207 @@ static HTTP_IO_RESULT HTTPPostDDNSConfig(void)
 #endif //(use_post)
 
 
+/****************************************************************************
+  Section:
+	Event Stream and WebSocket Handlers
+  ***************************************************************************/
+#if defined(HTTP_EVENT_STREAM) || defined(HTTP_WEBSOCKET)
+
+// Room for the JSON object HTTPGetStatus builds, including its terminator
+#define HTTP_STATUS_LEN		(48u)
+
+/*****************************************************************************
+  Function:
+	static WORD HTTPGetStatus(BYTE* cStatus)
+	
+  Summary:
+	Reports the LED, button, and potentiometer values as JSON.
+
+  Description:
+	Builds the same values status.xml reports as a JSON object, for 
+	pushing to clients whenever one of them changes.
+
+  Precondition:
+	None
+
+  Parameters:
+	cStatus - where to store the object, HTTP_STATUS_LEN bytes long
+
+  Returns:
+  	The length of the object, not counting its terminator.
+  ***************************************************************************/
+static WORD HTTPGetStatus(BYTE* cStatus)
+{
+	BYTE *ptr;
+	BYTE i;
+	WORD ADval;
+
+	// LEDs, as HTTPPrint_led() reports them
+	strcpypgm2ram((char*)cStatus, (ROM char*)"{\"led\":\"");
+	ptr = cStatus + strlen((char*)cStatus);
+	for(i = 0; i < 8u; i++)
+		*ptr++ = HTTPLedState(i) ? '1' : '0';
+
+	// Buttons, as HTTPPrint_btn() reports them
+	strcpypgm2ram((char*)ptr, (ROM char*)"\",\"btn\":\"");
+	ptr += strlen((char*)ptr);
+	for(i = 0; i < 4u; i++)
+		*ptr++ = '1';
+
+	// Potentiometer, as HTTPPrint_pot() reports it
+	ADval = 111;
+	strcpypgm2ram((char*)ptr, (ROM char*)"\",\"pot\":");
+	ptr += strlen((char*)ptr);
+	uitoa(ADval, ptr);
+	ptr += strlen((char*)ptr);
+	*ptr++ = '}';
+	*ptr = '\0';
+
+	return (WORD)(ptr - cStatus);
+}
+
+#endif
+
+#if defined(HTTP_EVENT_STREAM)
+
+/*****************************************************************************
+  Function:
+	HTTP_IO_RESULT HTTPExecuteEvents(void)
+	
+  Internal:
+  	See documentation in the TCP/IP Stack API or HTTP2.h for details.
+  	
+  	Streams the LED, button, and potentiometer values status.xml reports,
+  	as a JSON object, whenever one of them changes.  The last object sent 
+  	is kept in curHTTP.data for comparison.
+  ***************************************************************************/
+HTTP_IO_RESULT HTTPExecuteEvents(void)
+{
+	BYTE cStatus[HTTP_STATUS_LEN];
+	WORD len;
+
+	len = HTTPGetStatus(cStatus);
+
+	// Only send an event if something changed since the last one
+	if(curHTTP.callbackPos != 0u && strcmp((char*)cStatus, (char*)curHTTP.data) == 0)
+		return HTTP_IO_WAITING;
+
+	// Wait until the whole event fits
+	if(TCPIsPutReady(sktHTTP) < len + 8u)
+		return HTTP_IO_WAITING;
+
+	TCPPutROMString(sktHTTP, (ROM BYTE*)"data: ");
+	TCPPutString(sktHTTP, cStatus);
+	TCPPutROMString(sktHTTP, (ROM BYTE*)"\n\n");
+	strcpy((char*)curHTTP.data, (char*)cStatus);
+	curHTTP.callbackPos = 1;
+
+	return HTTP_IO_WAITING;
+}
+
+#endif
+
+#if defined(HTTP_WEBSOCKET)
+
+// Longest command HTTPExecuteWebSocket keeps.  The 3 bytes left over 
+// hold the terminators HTTPURLDecode and HTTPGetArg need.
+#define HTTP_WS_CMD_LEN		(HTTP_MAX_DATA_LEN - HTTP_STATUS_LEN - 3u)
+
+/*****************************************************************************
+  Function:
+	HTTP_IO_RESULT HTTPExecuteWebSocket(void)
+	
+  Internal:
+  	See documentation in the TCP/IP Stack API or HTTP2.h for details.
+  	
+  	Pushes the same JSON object as HTTPExecuteEvents whenever it changes, 
+  	as a text message, keeping the last one sent at the front of 
+  	curHTTP.data.  Text messages from the client are LED settings in 
+  	the form index.htm submits, such as "led3=1&led5=0".  Each is 
+  	gathered in curHTTP.data after the last object, with 1 more than its 
+  	length so far kept in curHTTP.callbackPos.
+  ***************************************************************************/
+HTTP_IO_RESULT HTTPExecuteWebSocket(void)
+{
+	BYTE cStatus[HTTP_STATUS_LEN];
+	BYTE cName[5];
+	BYTE *cCmd, *ptr;
+	WORD len;
+	BYTE i;
+
+	// Send each change as a single frame
+	len = HTTPGetStatus(cStatus);
+	if(curHTTP.callbackPos == 0u || strcmp((char*)cStatus, (char*)curHTTP.data) != 0)
+	{
+		if(TCPIsPutReady(sktHTTP) < len + 2u)
+			return HTTP_IO_WAITING;
+		HTTPWebSocketPutArray(cStatus, len, HTTP_WS_TEXT, TRUE);
+		strcpy((char*)curHTTP.data, (char*)cStatus);
+		if(curHTTP.callbackPos == 0u)
+			curHTTP.callbackPos = 1;
+	}
+
+	// Gather the next command, dropping whatever doesn't fit
+	cCmd = curHTTP.data + HTTP_STATUS_LEN;
+	len = (WORD)curHTTP.callbackPos - 1;
+	len += HTTPWebSocketGetArray(cCmd + len, HTTP_WS_CMD_LEN - len);
+	if(len == HTTP_WS_CMD_LEN)
+		HTTPWebSocketGetArray(NULL, 0xffff);
+	curHTTP.callbackPos = len + 1;
+	if(!HTTPWebSocketIsMessageEnd())
+		return HTTP_IO_WAITING;
+	curHTTP.callbackPos = 1;
+	if(!HTTPWebSocketIsText())
+		return HTTP_IO_WAITING;
+
+	// Set each LED the command names.  An extra terminator stops 
+	// HTTPGetArg after a name with no value.
+	cCmd[len] = '\0';
+	cCmd[len+2] = '\0';
+	HTTPURLDecode(cCmd);
+	strcpypgm2ram((char*)cName, (ROM char*)"led0");
+	for(i = 0; i < 8u; i++)
+	{
+		cName[3] = '0' + i;
+		ptr = HTTPGetArg(cCmd, cName);
+		if(ptr == NULL)
+			continue;
+		switch(i)
+		{
+			case 0:
+				//LED0_IO = (*ptr == '1');
+				break;
+			case 1:
+				//LED1_IO = (*ptr == '1');
+				break;
+			case 2:
+				//LED2_IO = (*ptr == '1');
+				break;
+			case 3:
+				//LED3_IO = (*ptr == '1');
+				break;
+			case 4:
+				//LED4_IO = (*ptr == '1');
+				break;
+			case 5:
+				//LED5_IO = (*ptr == '1');
+				break;
+			case 6:
+				//LED6_IO = (*ptr == '1');
+				break;
+			case 7:
+				//LED7_IO = (*ptr == '1');
+				break;
+		}
+	}
+	HTTPCacheInvalidate();
+
+	return HTTP_IO_WAITING;
+}
+
+#endif
+
+
 /****************************************************************************
   Section:
 	Dynamic Variable Callback Functions
@@ -1342,11 +1546,13 @@ void HTTPPrint_builddate(void)
 	
 	curHTTP.callbackPos = 0x00;
 	TCPPutROMString(sktHTTP, (ROM void*)__DATE__" "__TIME__);
+	HTTPCacheOutput(0);
 }
 
 void HTTPPrint_version(void)
 {
 	TCPPutROMString(sktHTTP, (ROM void*)VERSION);
+	HTTPCacheOutput(0);
 }
 
 
@@ -1380,12 +1586,14 @@ void HTTPPrint_btn(WORD num)
 			num = 0;
 	}
 
-	// Print the output
+	// Print the output, which may be reused until the next sample
 	TCPPutROMString(sktHTTP, (num?HTML_UP_ARROW:HTML_DOWN_ARROW));
+	HTTPCacheOutput(1);
 	return;
 }
 	
-void HTTPPrint_led(WORD num)
+// Returns the state of an LED, or 0 for a number with no LED
+static BYTE HTTPLedState(WORD num)
 {
 	// Determine which LED
 	switch(num)
@@ -1419,48 +1627,26 @@ void HTTPPrint_led(WORD num)
 			num = 0;
 	}
 
-	// Print the output
-	TCPPut(sktHTTP, (num?'1':'0'));
+	return num ? 1 : 0;
+}
+
+void HTTPPrint_led(WORD num)
+{
+	// Print the output, which holds until an LED is set
+	TCPPut(sktHTTP, (HTTPLedState(num)?'1':'0'));
+	HTTPCacheOutput(0);
 	return;
 }
 
 void HTTPPrint_ledSelected(WORD num, WORD state)
 {
 	// Determine which LED to check
-	switch(num)
-	{
-		case 0:
-			//num = LED0_IO;
-			break;
-		case 1:
-			//num = LED1_IO;
-			break;
-		case 2:
-			//num = LED2_IO;
-			break;
-		case 3:
-			//num = LED3_IO;
-			break;
-		case 4:
-			//num = LED4_IO;
-			break;
-		case 5:
-			//num = LED5_IO;
-			break;
-		case 6:
-			//num = LED6_IO;
-			break;
-		case 7:
-			//num = LED7_IO;
-			break;
-
-		default:
-			num = 0;
-	}
+	num = HTTPLedState(num);
 	
 	// Print output if TRUE and ON or if FALSE and OFF
 	if((state && num) || (!state && !num))
 		TCPPutROMString(sktHTTP, (ROM BYTE*)"SELECTED");
+	HTTPCacheOutput(0);
 	return;
 }
 
@@ -1482,6 +1668,7 @@ void HTTPPrint_devSelected(WORD num, WORD state)
 	// Print output if TRUE and ON or if FALSE and OFF
 	if((state && num) || (!state && !num))
 		TCPPutROMString(sktHTTP, (ROM BYTE*)"SELECTED");
+	HTTPCacheOutput(0);
 	return;
 }
 
@@ -1505,6 +1692,7 @@ void HTTPPrint_TP(void)
     	uitoa(TP_temp, TPString);
 	}
    	TCPPutArray(sktHTTP,(void *)TPString, strlen((char*)TPString));
+	HTTPCacheOutput(1);
 	return;
 }
 void HTTPPrint_YR(void)
@@ -1524,6 +1712,7 @@ void HTTPPrint_YR(void)
 		uitoa(YR_temp, YRString);
 	}
    	TCPPutArray(sktHTTP,(void *)YRString, strlen((char*)YRString));
+	HTTPCacheOutput(1);
 	return;
 }
 
@@ -1536,6 +1725,7 @@ void HTTPPrint_MH(void)
 	MH_temp = TEMP;
    	uitoa(MH_temp, MHString);
    	TCPPutArray(sktHTTP,(void *)MHString, strlen((char*)MHString));
+	HTTPCacheOutput(1);
 	return;
 }
 void HTTPPrint_DA(void)
@@ -1547,6 +1737,7 @@ void HTTPPrint_DA(void)
 	DA_temp = TEMP;
    	uitoa(DA_temp, DAString);
    	TCPPutArray(sktHTTP,(void *)DAString, strlen((char*)DAString));
+	HTTPCacheOutput(1);
 	return;
 }
 void HTTPPrint_HR(void)
@@ -1558,6 +1749,7 @@ void HTTPPrint_HR(void)
 	HR_temp = TEMP;
    	uitoa(HR_temp, HRString);
    	TCPPutArray(sktHTTP,(void *)HRString, strlen((char*)HRString));
+	HTTPCacheOutput(1);
 	return;
 }
 
@@ -1570,6 +1762,7 @@ void HTTPPrint_ME(void)
 	ME_temp = TEMP;
    	uitoa(ME_temp, MEString);
    	TCPPutArray(sktHTTP,(void *)MEString, strlen((char*)MEString));
+	HTTPCacheOutput(1);
 	return;
 }
 void HTTPPrint_SD(void)
@@ -1581,6 +1774,7 @@ void HTTPPrint_SD(void)
 	SD_temp = TEMP;
    	uitoa(SD_temp, SDString);
    	TCPPutArray(sktHTTP,(void *)SDString, strlen((char*)SDString));
+	HTTPCacheOutput(1);
 	return;
 }
 
@@ -1626,6 +1820,7 @@ void HTTPPrint_pot(void)
 #endif
 
    	TCPPutString(sktHTTP, AN0String);
+	HTTPCacheOutput(1);
 }
 
 void HTTPPrint_lcdtext(void)
@@ -1749,6 +1944,7 @@ void HTTPPrintIP(IP_ADDR ip)
 void HTTPPrint_config_hostname(void)
 {
 	TCPPutString(sktHTTP, AppConfig.NetBIOSName);
+	HTTPCacheOutput(0);
 	return;
 }
 
@@ -1756,36 +1952,42 @@ void HTTPPrint_config_dhcpchecked(void)
 {
 	if(AppConfig.Flags.bIsDHCPEnabled)
 		TCPPutROMString(sktHTTP, (ROM BYTE*)"checked");
+	HTTPCacheOutput(0);
 	return;
 }
 
 void HTTPPrint_config_ip(void)
 {
 	HTTPPrintIP(AppConfig.MyIPAddr);
+	HTTPCacheOutput(1);
 	return;
 }
 
 void HTTPPrint_config_gw(void)
 {
 	HTTPPrintIP(AppConfig.MyGateway);
+	HTTPCacheOutput(1);
 	return;
 }
 
 void HTTPPrint_config_subnet(void)
 {
 	HTTPPrintIP(AppConfig.MyMask);
+	HTTPCacheOutput(1);
 	return;
 }
 
 void HTTPPrint_config_dns1(void)
 {
 	HTTPPrintIP(AppConfig.PrimaryDNSServer);
+	HTTPCacheOutput(1);
 	return;
 }
 
 void HTTPPrint_config_dns2(void)
 {
 	HTTPPrintIP(AppConfig.SecondaryDNSServer);
+	HTTPCacheOutput(1);
 	return;
 }
 
@@ -1810,6 +2012,7 @@ void HTTPPrint_config_mac(void)
 	
 	// Indicate that we're done
 	curHTTP.callbackPos = 0x00;
+	HTTPCacheOutput(0);
 	return;
 }
 
@@ -1829,6 +2032,7 @@ void HTTPPrint_rebootaddr(void)
 void HTTPPrint_ddns_user(void)
 {
 	#if defined(STACK_USE_DYNAMICDNS_CLIENT)
+	HTTPCacheOutput(0);
 	if(DDNSClient.ROMPointers.Username || !DDNSClient.Username.szRAM)
 		return;
 	if(curHTTP.callbackPos == 0x00)
@@ -1842,6 +2046,7 @@ void HTTPPrint_ddns_user(void)
 void HTTPPrint_ddns_pass(void)
 {
 	#if defined(STACK_USE_DYNAMICDNS_CLIENT)
+	HTTPCacheOutput(0);
 	if(DDNSClient.ROMPointers.Password || !DDNSClient.Password.szRAM)
 		return;
 	if(curHTTP.callbackPos == 0x00)
@@ -1855,6 +2060,7 @@ void HTTPPrint_ddns_pass(void)
 void HTTPPrint_ddns_host(void)
 {
 	#if defined(STACK_USE_DYNAMICDNS_CLIENT)
+	HTTPCacheOutput(0);
 	if(DDNSClient.ROMPointers.Host || !DDNSClient.Host.szRAM)
 		return;
 	if(curHTTP.callbackPos == 0x00)
@@ -1869,6 +2075,7 @@ extern ROM char *ddnsServiceHosts[];
 void HTTPPrint_ddns_service(WORD i)
 {
 	#if defined(STACK_USE_DYNAMICDNS_CLIENT)
+	HTTPCacheOutput(0);
 	if(!DDNSClient.ROMPointers.UpdateServer || !DDNSClient.UpdateServer.szROM)
 		return;
 	if((ROM char*)DDNSClient.UpdateServer.szROM == ddnsServiceHosts[i])
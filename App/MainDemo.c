@@ -198,6 +198,124 @@ static void InitAppConfig(void)
 #endif
 }
 
+/*********************************************************************
+ * Function:        void MPFSReadBenchmark(void)
+ *
+ * PreCondition:    MPFSInit() and TickInit() are already called.
+ *
+ * Input:           None
+ *
+ * Output:          Prints the sequential read throughput of the MPFS 
+ *                  image in KB/s, once reading a byte at a time with 
+ *                  MPFSGet() and once in blocks with MPFSGetArray().
+ *
+ * Side Effects:    None
+ *
+ * Overview:        Every file in the image is read start to end.
+ *
+ * Note:            None
+ ********************************************************************/
+#if defined(MPFS_READ_BENCHMARK) && defined(STACK_USE_MPFS2)
+static void MPFSReadBenchmark(void)
+{
+	BYTE pass;
+	BYTE buffer[512];
+	WORD id;
+	WORD len;
+	MPFS_HANDLE hFile;
+	DWORD dwBytes;
+	TICK start;
+	TICK elapsed;
+
+	for(pass = 0; pass < 2u; pass++)
+	{
+		dwBytes = 0;
+		start = TickGet();
+		for(id = 0; ; id++)
+		{
+			hFile = MPFSOpenID(id);
+			if(hFile == MPFS_INVALID_HANDLE)
+				break;
+
+			if(pass == 0u)
+			{
+				while(MPFSGet(hFile, buffer))
+					dwBytes++;
+			}
+			else
+			{
+				while((len = MPFSGetArray(hFile, buffer, sizeof(buffer))))
+					dwBytes += len;
+			}
+
+			MPFSClose(hFile);
+		}
+		elapsed = TickGet() - start;
+		if(elapsed == 0u)
+			elapsed = 1;
+
+		printf("MPFS %s: %lu bytes, %lu KB/s\r\n", pass ? "MPFSGetArray" : "MPFSGet", 
+			dwBytes, (DWORD)((QWORD)dwBytes * TICK_SECOND / elapsed / 1024u));
+	}
+}
+#endif
+
+/*********************************************************************
+ * Function:        void MPFSUploadBenchmark(void)
+ *
+ * PreCondition:    MPFSInit() and TickInit() are already called.
+ *
+ * Input:           None
+ *
+ * Output:          Prints the write throughput of an MPFS image 
+ *                  upload to SPI Flash in KB/s.
+ *
+ * Side Effects:    Overwrites the inactive bank.
+ *
+ * Overview:        Half a bank is written the way HTTPMPFSUpload() 
+ *                  writes an image, taking only what MPFSGetPutReady() 
+ *                  allows while SPIFlashTask() erases and programs in 
+ *                  the background.  The network is left out, so this 
+ *                  is the fastest an upload can be written.
+ *
+ * Note:            MPFSPutEnd(FALSE) leaves the active image in place.
+ ********************************************************************/
+#if defined(MPFS_UPLOAD_BENCHMARK) && defined(STACK_USE_MPFS2) && defined(MPFS_USE_SPI_FLASH)
+static void MPFSUploadBenchmark(void)
+{
+	BYTE buffer[256];
+	WORD len;
+	MPFS_HANDLE hFile;
+	DWORD dwBytes;
+	TICK start;
+	TICK elapsed;
+
+	// Any pattern but erased flash, so that every page is programmed
+	for(len = 0; len < sizeof(buffer); len++)
+		buffer[len] = (BYTE)len;
+
+	dwBytes = 0;
+	start = TickGet();
+	hFile = MPFSFormat();
+	while(dwBytes < MPFS_BANK_SIZE/2)
+	{
+		SPIFlashTask();
+		len = MPFSGetPutReady(hFile);
+		if(len > sizeof(buffer))
+			len = sizeof(buffer);
+		if(len)
+			dwBytes += MPFSPutArray(hFile, buffer, len);
+	}
+	MPFSPutEnd(FALSE);
+	elapsed = TickGet() - start;
+	if(elapsed == 0u)
+		elapsed = 1;
+
+	printf("MPFS upload: %lu bytes, %lu KB/s\r\n", 
+		dwBytes, (DWORD)((QWORD)dwBytes * TICK_SECOND / elapsed / 1024u));
+}
+#endif
+
 int main(void)
 {
 	InitVariables();
@@ -215,6 +333,13 @@ int main(void)
 	MPFSInit();
 #endif
 
+#if defined(MPFS_READ_BENCHMARK) && defined(STACK_USE_MPFS2)
+	MPFSReadBenchmark();
+#endif
+#if defined(MPFS_UPLOAD_BENCHMARK) && defined(STACK_USE_MPFS2) && defined(MPFS_USE_SPI_FLASH)
+	MPFSUploadBenchmark();
+#endif
+
 	// Initialize core stack layers (MAC, ARP, TCP, UDP) and
 	// application modules (HTTP, SNMP, etc.)
 	StackInit();
@@ -246,6 +371,9 @@ int main(void)
 
 		// This tasks invokes each of the core stack application tasks
 		StackApplications();
+
+		// Compact the parameter store in the background
+		ParamTask();
 	
 		// Process application specific tasks here.
 		// For this demo app, this will include the Generic TCP
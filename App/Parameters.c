@@ -5,114 +5,308 @@
 
 APP_CONFIG AppConfig;
 
-#define FLASH_START_ADDRESS   0
-#define FLASH_SECTOR_SIZE     4096
-#define FLASH_SECTOR_COUNT    8
-#define FLASH_END_ADDRESS     (FLASH_START_ADDRESS + FLASH_SECTOR_SIZE * FLASH_SECTOR_COUNT)
+/*
+ * Parameters are kept as a log of key/value records in the SPI flash 
+ * below MPFS_RESERVE_BLOCK.  Each 4 KB sector starts with a header 
+ * holding its sequence number, and records are appended after it:
+ *
+ *     BYTE key, BYTE len, BYTE data[len], DWORD CRC-32 of key to data
+ *
+ * A record with len 0 deletes the key.  Sectors are used in order as a 
+ * ring, sequence number s living in sector s % PARAM_SECTORS, so the log 
+ * is the run of consecutive sequence numbers ending at the newest one.  
+ * At boot the log is replayed once to find the newest record of every 
+ * key, and after that reads go straight to it.  ParamTask compacts the 
+ * log by copying the records still in use out of the oldest sector, 
+ * which can then be reused.
+ */
+#define PARAM_START_ADDRESS     0
+#define PARAM_SECTOR_SIZE       4096ul
+#define PARAM_SECTORS           (MPFS_RESERVE_BLOCK / PARAM_SECTOR_SIZE)
+
+#define PARAM_HEADER_SIZE       8       // DWORD sequence number, DWORD CRC-32 of it
+#define PARAM_RECORD_OVERHEAD   6       // key, len and CRC-32
+
+// ParamTask compacts the log once fewer sectors than this are free
+#define PARAM_COMPACT_FREE      3u
+
+#define PARAM_INVALID           0xFFFFFFFFul
+
+#if PARAM_SECTORS < 4
+    #error MPFS_RESERVE_BLOCK must hold at least 4 sectors for the parameter store
+#endif
+
+// Header of the configuration written by older firmware, a whole 
+// APP_CONFIG at the start of one of the sectors
+#define LEGACY_HEADER           0xA7
+
+#define _SectorAddr(seq)        (PARAM_START_ADDRESS + ((seq) % PARAM_SECTORS) * PARAM_SECTOR_SIZE)
+
+// Flash address of the newest record of each key, PARAM_INVALID if none
+static DWORD paramIndex[PARAM_MAX_KEYS];
+
+// The log is empty when tailSeq == headSeq + 1
+static DWORD headSeq = PARAM_SECTORS - 1;   // Sector being appended to
+static DWORD tailSeq = PARAM_SECTORS;       // Oldest sector of the log
+static DWORD headAddr = _SectorAddr(PARAM_SECTORS - 1) + PARAM_SECTOR_SIZE;   // Next free address in the head sector
+
+static DWORD _FreeSectors(void)
+{
+    return PARAM_SECTORS - (headSeq + 1 - tailSeq);
+}
 
-#define INVALID_PARAMATER_START    (DWORD)-1
+static BOOL _HasRoom(BYTE len)
+{
+    return headAddr + PARAM_RECORD_OVERHEAD + len <= _SectorAddr(headSeq) + PARAM_SECTOR_SIZE;
+}
 
-static DWORD curParameterStart = INVALID_PARAMATER_START;
+static BOOL _ReadSectorSeq(DWORD sector, DWORD *seq)
+{
+    DWORD header[2];
+
+    SPIFlashReadArray(PARAM_START_ADDRESS + sector * PARAM_SECTOR_SIZE, (BYTE *)header, sizeof(header));
 
-static BOOL CheckAppConfig(const APP_CONFIG *appConfig)
+    if (header[0] == PARAM_INVALID || header[0] % PARAM_SECTORS != sector)
+        return FALSE;
+    if (CalcCRC32(0, (BYTE *)&header[0], sizeof(header[0])) != header[1])
+        return FALSE;
+
+    *seq = header[0];
+    return TRUE;
+}
+
+// Calculates the CRC-32 of len bytes of flash continuing crc
+static DWORD _FlashCRC32(DWORD crc, DWORD addr, BYTE len)
 {
-    BYTE sum;
-    WORD size;
-    BYTE *p = (BYTE*)appConfig;
-    WORD i;
+    BYTE buf[16];
+    BYTE n;
 
-    if (appConfig->header != EEPROM_HEADER)
+    while (len)
     {
-        return FALSE;
+        n = len < sizeof(buf) ? len : sizeof(buf);
+        SPIFlashReadArray(addr, buf, n);
+        crc = CalcCRC32(crc, buf, n);
+        addr += n;
+        len -= n;
     }
 
-    size = appConfig->size;
-    if (size != sizeof(*appConfig) - sizeof(appConfig->header) - sizeof(appConfig->size) - sizeof(appConfig->sum))
+    return crc;
+}
+
+// Replays the records of one sector into paramIndex.  Returns the address 
+// following the last good record, or the end of the sector if a damaged 
+// record means nothing more can be appended to it.
+static DWORD _ScanSector(DWORD seq)
+{
+    DWORD addr = _SectorAddr(seq) + PARAM_HEADER_SIZE;
+    DWORD end = _SectorAddr(seq) + PARAM_SECTOR_SIZE;
+    BYTE hdr[2];
+    DWORD crc;
+
+    while (addr + PARAM_RECORD_OVERHEAD <= end)
     {
-        return FALSE;
+        SPIFlashReadArray(addr, hdr, sizeof(hdr));
+
+        // Erased space ends the records
+        if (hdr[0] == 0xFF && hdr[1] == 0xFF)
+            return addr;
+
+        if (addr + PARAM_RECORD_OVERHEAD + hdr[1] > end)
+            return end;
+
+        SPIFlashReadArray(addr + sizeof(hdr) + hdr[1], (BYTE *)&crc, sizeof(crc));
+        if (_FlashCRC32(CalcCRC32(0, hdr, sizeof(hdr)), addr + sizeof(hdr), hdr[1]) != crc)
+            return end;
+
+        if (hdr[0] < PARAM_MAX_KEYS)
+            paramIndex[hdr[0]] = hdr[1] ? addr : PARAM_INVALID;
+
+        addr += PARAM_RECORD_OVERHEAD + hdr[1];
     }
 
-    sum = 0;
+    return end;
+}
+
+static void _BuildIndex(void)
+{
+    DWORD seq, newest = 0;
+    DWORD i;
+    BOOL found = FALSE;
+
+    for (i = 0; i < PARAM_MAX_KEYS; i++)
+        paramIndex[i] = PARAM_INVALID;
 
-    p += sizeof(appConfig->header) + sizeof(appConfig->size);
-    for (i = 0; i < size; i++)
+    // Find the newest sector
+    for (i = 0; i < PARAM_SECTORS; i++)
     {
-        sum += *p++;
+        if (_ReadSectorSeq(i, &seq) && (!found || seq > newest))
+        {
+            newest = seq;
+            found = TRUE;
+        }
     }
 
-    if (sum != appConfig->sum)
+    if (!found)
+        return;
+
+    // Walk back over the sectors that precede it
+    headSeq = newest;
+    tailSeq = newest;
+    while (headSeq - tailSeq < PARAM_SECTORS - 1 && 
+        _ReadSectorSeq((tailSeq - 1) % PARAM_SECTORS, &seq) && seq == tailSeq - 1)
     {
-        return FALSE;
+        tailSeq--;
     }
 
-    return TRUE;
+    for (seq = tailSeq; seq != headSeq + 1; seq++)
+        headAddr = _ScanSector(seq);
 }
 
-BOOL LoadParameters(void)
+// Starts the next sector of the ring.  At least one sector must be free.
+static void _OpenSector(void)
 {
-    int validStorageCount = 0;
+    DWORD header[2];
 
-    DWORD firstValidAddr = INVALID_PARAMATER_START, secondValidAddr = INVALID_PARAMATER_START;
+    header[0] = headSeq + 1;
+    header[1] = CalcCRC32(0, (BYTE *)&header[0], sizeof(header[0]));
 
-    curParameterStart = INVALID_PARAMATER_START;
+    // Writing the front of the sector erases it first
+    SPIFlashBeginWrite(_SectorAddr(header[0]));
+    SPIFlashWriteArray((BYTE *)header, sizeof(header));
 
-    for (int i = 0; i < FLASH_SECTOR_COUNT; i++)
-    {
-        SPIFlashReadArray(FLASH_START_ADDRESS + FLASH_SECTOR_SIZE * i, (BYTE *)&AppConfig, sizeof(AppConfig));
+    headSeq = header[0];
+    headAddr = _SectorAddr(headSeq) + PARAM_HEADER_SIZE;
+}
 
-        if (CheckAppConfig(&AppConfig))
+// Appends a record to the head sector, taking its value from data, or 
+// from flash at src when data is NULL
+static void _WriteRecord(BYTE key, BYTE *data, DWORD src, BYTE len)
+{
+    BYTE buf[16];
+    BYTE n, i;
+    DWORD crc;
+    DWORD addr = headAddr;
+
+    buf[0] = key;
+    buf[1] = len;
+    crc = CalcCRC32(0, buf, 2);
+
+    SPIFlashBeginWrite(addr);
+    SPIFlashWriteArray(buf, 2);
+    if (data)
+    {
+        crc = CalcCRC32(crc, data, len);
+        SPIFlashWriteArray(data, len);
+    }
+    else
+    {
+        for (i = 0; i < len; i += n)
         {
-            if (validStorageCount == 0)
-            {
-                firstValidAddr = FLASH_START_ADDRESS + FLASH_SECTOR_SIZE * i;
-            }
-            else if (validStorageCount == 1)
-            {
-                secondValidAddr = FLASH_START_ADDRESS + FLASH_SECTOR_SIZE * i;
-            }
-
-            validStorageCount++;
-
-            if (validStorageCount == 2)
-            {
-                break;
-            }
+            n = len - i;
+            if (n > sizeof(buf))
+                n = sizeof(buf);
+            SPIFlashReadArray(src + i, buf, n);
+            crc = CalcCRC32(crc, buf, n);
+            SPIFlashWriteArray(buf, n);
         }
     }
+    SPIFlashWriteArray((BYTE *)&crc, sizeof(crc));
+
+    headAddr += PARAM_RECORD_OVERHEAD + len;
+    paramIndex[key] = len ? addr : PARAM_INVALID;
+}
+
+// Moves one record that is still in use out of the oldest sector, or 
+// drops the oldest sector from the log once none remain
+static void _CompactStep(void)
+{
+    DWORD start = _SectorAddr(tailSeq);
+    BYTE key;
+    BYTE len;
 
-    if (validStorageCount == 2)
+    for (key = 0; key < PARAM_MAX_KEYS; key++)
     {
-        if (firstValidAddr + FLASH_SECTOR_SIZE == secondValidAddr)
+        if (paramIndex[key] - start < PARAM_SECTOR_SIZE)
         {
-            //erase sector
-            SPIFlashBeginWrite(firstValidAddr);
-            SPIFlashWrite(0xFF);
+            SPIFlashReadArray(paramIndex[key] + 1, &len, 1);
+            if (!_HasRoom(len))
+                _OpenSector();
+            _WriteRecord(key, NULL, paramIndex[key] + 2, len);
+            return;
+        }
+    }
 
-            curParameterStart = secondValidAddr;
+    tailSeq++;
+}
 
-            SPIFlashReadArray(curParameterStart, (BYTE *)&AppConfig, sizeof(AppConfig));
+// Checks if the newest record of key already holds data
+static BOOL _IsStored(BYTE key, BYTE *data, BYTE len)
+{
+    BYTE buf[16];
+    BYTE n, i;
+    DWORD addr = paramIndex[key];
 
-            return TRUE;
-        }
-        else if (firstValidAddr == FLASH_START_ADDRESS && secondValidAddr + FLASH_SECTOR_SIZE == FLASH_END_ADDRESS)
-        {
-            //erase sector
-            SPIFlashBeginWrite(secondValidAddr);
-            SPIFlashWrite(0xFF);
+    if (addr == PARAM_INVALID)
+        return len == 0;
+
+    SPIFlashReadArray(addr + 1, buf, 1);
+    if (buf[0] != len)
+        return FALSE;
+
+    for (i = 0; i < len; i += n)
+    {
+        n = len - i;
+        if (n > sizeof(buf))
+            n = sizeof(buf);
+        SPIFlashReadArray(addr + 2 + i, buf, n);
+        if (memcmp(buf, data + i, n) != 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Looks for a configuration saved by older firmware, which kept a whole 
+// APP_CONFIG with an 8-bit sum in one of the sectors
+static BOOL _LoadLegacy(void)
+{
+    BYTE header[3];
+    BYTE sum;
+    BYTE *p;
+    WORD i;
+    DWORD sector;
+
+    for (sector = 0; sector < PARAM_SECTORS; sector++)
+    {
+        SPIFlashReadArray(PARAM_START_ADDRESS + sector * PARAM_SECTOR_SIZE, header, sizeof(header));
+        if (header[0] != LEGACY_HEADER || (header[1] | (header[2] << 8)) != sizeof(AppConfig))
+            continue;
 
-            curParameterStart = firstValidAddr;
+        SPIFlashReadArray(PARAM_START_ADDRESS + sector * PARAM_SECTOR_SIZE + sizeof(header), (BYTE *)&AppConfig, sizeof(AppConfig));
+        SPIFlashReadArray(PARAM_START_ADDRESS + sector * PARAM_SECTOR_SIZE + sizeof(header) + sizeof(AppConfig), &sum, 1);
 
-            SPIFlashReadArray(curParameterStart, (BYTE *)&AppConfig, sizeof(AppConfig));
+        p = (BYTE *)&AppConfig;
+        for (i = 0; i < sizeof(AppConfig); i++)
+            sum -= *p++;
 
+        if (sum == 0)
             return TRUE;
-        }
     }
-    else if (validStorageCount == 1)
-    {
-        curParameterStart = firstValidAddr;
 
-        SPIFlashReadArray(curParameterStart, (BYTE *)&AppConfig, sizeof(AppConfig));
+    return FALSE;
+}
 
+BOOL LoadParameters(void)
+{
+    _BuildIndex();
+
+    if (ParamRead(PARAM_KEY_APPCONFIG, (BYTE *)&AppConfig, sizeof(AppConfig)) == sizeof(AppConfig))
+        return TRUE;
+
+    // Convert the configuration saved by older firmware
+    if (tailSeq == headSeq + 1 && _LoadLegacy())
+    {
+        SaveParameters();
         return TRUE;
     }
 
@@ -121,62 +315,83 @@ BOOL LoadParameters(void)
 
 void SaveParameters(void)
 {
-    WORD i;
-    BYTE *p;
-    BYTE sum;
+    ParamWrite(PARAM_KEY_APPCONFIG, (BYTE *)&AppConfig, sizeof(AppConfig));
+}
 
-    WORD size;
+void ClearParameters(void)
+{
+    ParamWrite(PARAM_KEY_APPCONFIG, NULL, 0);
+}
 
-    AppConfig.header = EEPROM_HEADER;
-    AppConfig.size = sizeof(AppConfig) - sizeof(AppConfig.header) - sizeof(AppConfig.size) - sizeof(AppConfig.sum);
+/*
+ * Reads the value of key into data, copying at most len bytes.  Returns 
+ * the length of the stored value, or 0 if the key has none.
+ */
+BYTE ParamRead(BYTE key, BYTE *data, BYTE len)
+{
+    BYTE stored;
 
-    size = AppConfig.size;
+    if (key >= PARAM_MAX_KEYS || paramIndex[key] == PARAM_INVALID)
+        return 0;
 
-    p = (BYTE *)&AppConfig;
-    p += sizeof(AppConfig.header) + sizeof(AppConfig.size);
+    SPIFlashReadArray(paramIndex[key] + 1, &stored, 1);
+    SPIFlashReadArray(paramIndex[key] + 2, data, stored < len ? stored : len);
 
-    sum = 0;
-    for (i = 0; i < size; i++)
-    {
-        sum += *p++;
-    }
+    return stored;
+}
 
-    AppConfig.sum = sum;
+/*
+ * Stores len bytes of data as the value of key, or deletes the key when 
+ * len is 0.  Nothing is written if the value is unchanged.  Usually only 
+ * the record itself is programmed; when the current sector is full, the 
+ * next one is erased first, and if ParamTask has fallen behind, the log 
+ * is compacted here to make room.  Returns FALSE if key is out of range.
+ */
+BOOL ParamWrite(BYTE key, BYTE *data, BYTE len)
+{
+    DWORD savedAddr;
 
-    //write
-    p = (BYTE *)&AppConfig;
+    if (key >= PARAM_MAX_KEYS)
+        return FALSE;
 
-    if (curParameterStart == INVALID_PARAMATER_START)
-    {
-        SPIFlashBeginWrite(FLASH_START_ADDRESS);
-        SPIFlashWriteArray(p, sizeof(AppConfig));
+    if (_IsStored(key, data, len))
+        return TRUE;
 
-        curParameterStart = FLASH_START_ADDRESS;
-    }
-    else
-    {
-        DWORD nextParameterStart = curParameterStart + FLASH_SECTOR_SIZE;
-        if (nextParameterStart == FLASH_END_ADDRESS)
-            nextParameterStart = FLASH_START_ADDRESS;
+    // Another module may be part way through its own writes
+    savedAddr = SPIFlashGetWriteAddr();
 
-        SPIFlashBeginWrite(nextParameterStart);
-        SPIFlashWriteArray(p, sizeof(AppConfig));
+    if (!_HasRoom(len))
+    {
+        // Keep a free sector for compaction to move records into
+        while (_FreeSectors() < 2u)
+            _CompactStep();
+        _OpenSector();
+    }
+    _WriteRecord(key, data, 0, len);
 
-        //erase sector
-        SPIFlashBeginWrite(curParameterStart);
-        SPIFlashWrite(0xFF);
+    SPIFlashBeginWrite(savedAddr);
 
-        curParameterStart = nextParameterStart;
-    }
+    return TRUE;
 }
 
-void ClearParameters(void)
+/*
+ * Compacts the log one record at a time as it fills up, so that writes 
+ * seldom have to wait for it.  Call from the main loop.
+ */
+void ParamTask(void)
 {
-    //erase sector
-    SPIFlashBeginWrite(curParameterStart);
-    SPIFlashWrite(0xFF);
+    DWORD savedAddr;
+
+    if (_FreeSectors() >= PARAM_COMPACT_FREE || tailSeq == headSeq)
+        return;
+
+    // Let queued writes of an MPFS upload drain first
+    if (SPIFlashIsBusy())
+        return;
 
-    curParameterStart = INVALID_PARAMATER_START;
+    savedAddr = SPIFlashGetWriteAddr();
+    _CompactStep();
+    SPIFlashBeginWrite(savedAddr);
 }
 
 void LoadDefaultParameters(void)
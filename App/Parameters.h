@@ -14,8 +14,6 @@ typedef struct __attribute__((__packed__)) _NODE_INFO
     MAC_ADDR    MACAddr;
 } NODE_INFO;
 
-#define EEPROM_HEADER       0xA7
-
 #define OUTLET_COUNT        8
 
 #define NETBIOSNAME_LEN     16
@@ -30,9 +28,6 @@ typedef struct __attribute__((__packed__)) _NODE_INFO
 
 typedef struct __attribute__((__packed__)) _APP_CONFIG 
 {	
-	BYTE        header;
-    WORD        size;
-	
 	IP_ADDR		MyIPAddr;
 	IP_ADDR		MyMask;
 	IP_ADDR		MyGateway;
@@ -51,10 +46,15 @@ typedef struct __attribute__((__packed__)) _APP_CONFIG
 	
 	BYTE        UserName[USERNAME_LEN];
 	BYTE        Password[PASSWORD_LEN];
-	
-	BYTE        sum;
 } APP_CONFIG;
 
+// Number of keys the parameter store indexes (4 bytes of RAM each).  
+// Keys 0 to PARAM_MAX_KEYS-1 may be used, each holding up to 255 bytes.
+#define PARAM_MAX_KEYS      16
+
+// Keys used by the application.  Add new ones here.
+#define PARAM_KEY_APPCONFIG 0       // APP_CONFIG, via Load/SaveParameters
+
 extern APP_CONFIG AppConfig;
 
 extern BOOL LoadParameters(void);
@@ -62,4 +62,8 @@ extern void SaveParameters(void);
 extern void ClearParameters(void);
 extern void LoadDefaultParameters(void);
 
+extern BYTE ParamRead(BYTE key, BYTE *data, BYTE len);
+extern BOOL ParamWrite(BYTE key, BYTE *data, BYTE len);
+extern void ParamTask(void);
+
 #endif
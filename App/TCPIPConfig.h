@@ -88,6 +88,7 @@
 //#define STACK_USE_SNTP_CLIENT			// Simple Network Time Protocol for obtaining current date/time from Internet
 //#define STACK_USE_UDP_PERFORMANCE_TEST	// Module for testing UDP TX performance characteristics.  NOTE: Enabling this will cause a huge amount of UDP broadcast packets to flood your network on various ports.  Use care when enabling this on production networks, especially with VPNs (could tunnel broadcast traffic across a limited bandwidth connection).
 //#define STACK_USE_TCP_PERFORMANCE_TEST	// Module for testing TCP TX performance characteristics
+#define STACK_USE_IGMP					// IGMPv2 multicast group membership for UDP sockets (UDPJoinGroup())
 //omit for temp
 //#define STACK_USE_DYNAMICDNS_CLIENT		// Dynamic DNS client module
 //#define STACK_USE_BERKELEY_API			// Berekely Sockets APIs are used
@@ -126,7 +127,8 @@
 /* EEPROM Reserved Area
  *   Number of EEPROM bytes to be reserved before MPFS storage starts.
  *   These bytes host application configurations such as IP Address,
- *   MAC Address, and any other required variables.
+ *   MAC Address, and any other required variables.  On SPI Flash they 
+ *   hold the parameter store's log, which needs at least 4 sectors.
  *
  *   For MPFS Classic, this setting must match the Reserved setting
  *	 on the Advanced Settings page of the MPFS2 Utility.
@@ -137,7 +139,48 @@
  *   Maximum number of simultaneously open MPFS2 files.
  *   For MPFS Classic, this has no effect.
  */
-#define MAX_MPFS_HANDLES				(7ul)
+#define MAX_MPFS_HANDLES				(19ul)
+
+/* MPFS File Index
+ *   MPFSOpen looks files up in a RAM index of name hashes built when 
+ *   the image is loaded.  Uses 4 bytes of RAM per file; images with 
+ *   more files than this are searched in flash instead.  Set to 0 to 
+ *   disable the index.
+ */
+#define MPFS_INDEX_MAX_FILES			(512u)
+
+/* MPFS Block Cache
+ *   Images in SPI Flash are read through a RAM cache of 
+ *   MPFS_CACHE_BLOCKS blocks of MPFS_CACHE_BLOCK_SIZE bytes each, 
+ *   replaced least recently used first.  Set MPFS_CACHE_BLOCKS to 0 
+ *   to read the flash directly.  Hit and miss counts are kept in 
+ *   MPFSCacheStats.
+ */
+#define MPFS_CACHE_BLOCKS				(8u)
+#define MPFS_CACHE_BLOCK_SIZE			(256u)
+
+/* MPFS Image Banks
+ *   Images in SPI Flash are kept in two banks of MPFS_BANK_SIZE 
+ *   bytes, the first at MPFS_RESERVE_BLOCK.  Uploads are written to 
+ *   the bank that is not being served and replace the active image 
+ *   only once complete, so the web pages stay up during an upload 
+ *   and a failed one leaves the old image in place.  The two 4 KB 
+ *   sectors after the banks record which one is active.
+ */
+#define MPFS_BANK_SIZE					(4096ul * 128)
+
+/* MPFS Read Benchmark
+ *   Uncomment to print the sequential read throughput of the MPFS 
+ *   image in KB/s at startup.
+ */
+//#define MPFS_READ_BENCHMARK
+
+/* MPFS Upload Benchmark
+ *   Uncomment to print the rate at which an uploaded image can be 
+ *   written to SPI Flash in KB/s at startup.  The inactive bank is 
+ *   overwritten, but the active image is kept.
+ */
+//#define MPFS_UPLOAD_BENCHMARK
 
 
 // =======================================================================
@@ -170,6 +213,28 @@
  */
 //#define STACK_CLIENT_MODE
 
+/* Receive Budget
+ *   Maximum number of received frames StackTask() will process per 
+ *   call.  Lower values bound main loop latency during broadcast 
+ *   storms; higher values favor RX throughput.
+ */
+#define STACK_RX_BUDGET					(8u)
+
+/* Early RX Filter
+ *   Drops frames addressed to closed UDP/TCP ports, unjoined multicast 
+ *   groups, and unhandled protocols before any checksum is computed.  
+ *   Drop counts are kept in RxFilterStats.
+ */
+#define STACK_USE_RX_FILTER
+
+/* In-Place ICMP Echo Replies
+ *   Echo replies are built by rewriting the request in the RX DMA 
+ *   buffer and handing that buffer to the TX ring, instead of copying 
+ *   the payload into the TX buffer.  Comment out to always use the 
+ *   copy path.
+ */
+#define ICMP_REPLY_IN_PLACE
+
 /* TCP Socket Memory Allocation
  *   TCP needs memory to buffer incoming and outgoing data.  The 
  *   amount and medium of storage can be allocated on a per-socket
@@ -178,7 +243,7 @@
 	// Allocate how much total RAM (in bytes) you want to allocate 
 	// for use by your TCP TCBs, RX FIFOs, and TX FIFOs.  
 	#define TCP_ETH_RAM_SIZE					(0ul)
-	#define TCP_PIC_RAM_SIZE					(2000ul)
+	#define TCP_PIC_RAM_SIZE					(5500ul)
 	#define TCP_SPI_RAM_SIZE					(0ul)
 	#define TCP_SPI_RAM_BASE_ADDRESS			(0x00)
 	
@@ -230,6 +295,12 @@
 			//{TCP_PURPOSE_UART_2_TCP_BRIDGE, TCP_PIC_RAM, 256, 256},
 			{TCP_PURPOSE_HTTP_SERVER, TCP_PIC_RAM, 300, 300},
 			{TCP_PURPOSE_HTTP_SERVER, TCP_PIC_RAM, 300, 300},
+			{TCP_PURPOSE_HTTP_SERVER, TCP_PIC_RAM, 300, 300},
+			{TCP_PURPOSE_HTTP_SERVER, TCP_PIC_RAM, 300, 300},
+			{TCP_PURPOSE_HTTP_SERVER, TCP_PIC_RAM, 300, 300},
+			{TCP_PURPOSE_HTTP_SERVER, TCP_PIC_RAM, 300, 300},
+			{TCP_PURPOSE_HTTP_SERVER, TCP_PIC_RAM, 300, 300},
+			{TCP_PURPOSE_HTTP_SERVER, TCP_PIC_RAM, 300, 300},
 			//{TCP_PURPOSE_DEFAULT, TCP_PIC_RAM, 200, 200},
 			//{TCP_PURPOSE_BERKELEY_SERVER, TCP_PIC_RAM, 25, 20},
 			//{TCP_PURPOSE_BERKELEY_SERVER, TCP_PIC_RAM, 25, 20},
@@ -247,6 +318,7 @@
  */
 #define MAX_UDP_SOCKETS     (10u)
 #define UDP_USE_TX_CHECKSUM		// This slows UDP TX performance by nearly 50%
+#define UDP_TX_STAGING_BUFFERS	(2u)	// Datagrams that can be built or queued for TX concurrently (~1.5kB RAM each)
 
 
 /* Berkeley API Sockets Configuration
@@ -269,8 +341,11 @@
 // -- HTTP2 Server options -----------------------------------------------
 
 	// Maximum numbers of simultaneous HTTP connections allowed.
-	// Each connection consumes 2 bytes of RAM and a TCP socket
-	#define MAX_HTTP_CONNECTIONS	(2u)
+	// Each connection needs about 600 bytes of RAM, plus its own 
+	// TCP_PURPOSE_HTTP_SERVER socket in TCPSocketInitializer[] and 
+	// 2 MPFS handles (see MAX_MPFS_HANDLES).  Event streams and 
+	// WebSockets hold their connection for as long as they are open.
+	#define MAX_HTTP_CONNECTIONS	(8u)
 	
 	// Indicate what file to serve when no specific one is requested
 	#define HTTP_DEFAULT_FILE		"index.htm"
@@ -284,6 +359,24 @@
 	#define HTTP_MPFS_UPLOAD_REQUIRES_AUTH	// Require password for MPFS uploads
 		// Certain firewall and router combinations cause the MPFS2 Utility to fail 
 		// when uploading.  If this happens, comment out this definition.
+
+	// Configure the Server-Sent Events stream of live status updates
+	// Comment this line to disable the stream
+	#define HTTP_EVENT_STREAM		"events"
+
+	// Configure the WebSocket for live status updates and commands
+	// Comment this line to disable WebSockets
+	#define HTTP_WEBSOCKET			"ws"
+
+	// Configure the request timing statistics, served as JSON at this path 
+	// and in binary with ".bin" appended
+	// Comment this line to disable the statistics (~600b RAM)
+	#define HTTP_STATS				"stats"
+
+	// Decompress gzip'd files for clients that don't send "Accept-Encoding: gzip",
+	// and allow pages with dynamic variables to be stored gzip'd
+	// Comment this line to send gzip'd files as they are to every client (~9kb RAM)
+	#define HTTP_USE_INFLATE
 	
 	// Define which HTTP modules to use
 	// If not using a specific module, comment it to save resources
@@ -69,6 +69,37 @@
 	#define HTTP_CACHE_LEN			("600")	// Max lifetime (sec) of static responses as string
 	#define HTTP_TIMEOUT			(45u)	// Max time (sec) to await more data before
 
+	#if !defined(HTTP_KEEP_ALIVE_TIMEOUT)
+		#define HTTP_KEEP_ALIVE_TIMEOUT	(5u)	// Max time (sec) a persistent connection may wait for its next request
+	#endif
+	#if !defined(HTTP_INDEX_BATCH)
+		#define HTTP_INDEX_BATCH	(16u)	// Dynamic variable index entries read from MPFS at once
+	#endif
+	#if !defined(HTTP_VAR_LEN_CACHE)
+		#define HTTP_VAR_LEN_CACHE	(64u)	// Callback IDs whose ~name~ length is remembered, 0 to disable
+	#endif
+	#if !defined(HTTP_RENDER_CACHE_SIZE)
+		#define HTTP_RENDER_CACHE_SIZE	(512u)	// Bytes of dynamic variable output kept for reuse, 0 to disable
+	#endif
+	#if !defined(HTTP_RENDER_CACHE_ENTRIES)
+		#define HTTP_RENDER_CACHE_ENTRIES	(16u)	// Max dynamic variables whose output is kept at once
+	#endif
+	#if !defined(HTTP_EVENT_HEARTBEAT)
+		#define HTTP_EVENT_HEARTBEAT	(15u)	// Max time (sec) an event stream may stay silent
+	#endif
+	#if !defined(HTTP_WEBSOCKET_PING)
+		#define HTTP_WEBSOCKET_PING	(15u)	// Max time (sec) a WebSocket may stay silent before it is pinged
+	#endif
+	#if !defined(HTTP_STATS_CALLBACKS)
+		#define HTTP_STATS_CALLBACKS	(32u)	// Callback IDs whose run time is totaled by HTTP_STATS
+	#endif
+	#if !defined(HTTP_MAX_BOUNDARY_LEN)
+		#define HTTP_MAX_BOUNDARY_LEN	(70u)	// Max length of a multipart/form-data boundary, 70 per RFC 2046
+	#endif
+	#if !defined(HTTP_SWEEP_INTERVAL)
+		#define HTTP_SWEEP_INTERVAL	(TICK_SECOND/4)	// Max time between visits to connections whose sockets are quiet
+	#endif
+
 	// Authentication requires Base64 decoding
 	#if defined(HTTP_USE_AUTHENTICATION)
 		#ifndef STACK_USE_BASE64_DECODE
@@ -98,7 +129,20 @@
 		HTTP_MPFS_ERROR,				// An MPFS Upload was not a valid image
 		#endif
 		HTTP_REDIRECT,					// 302 Redirect will be returned
-		HTTP_SSL_REQUIRED				// 403 Forbidden is returned, indicating SSL is required
+		HTTP_SSL_REQUIRED,				// 403 Forbidden is returned, indicating SSL is required
+		HTTP_NOT_MODIFIED,				// 304 Not Modified is returned for a cached static file
+		HTTP_RANGE_NOT_SATISFIABLE,		// 416 Range Not Satisfiable is returned
+		#if defined(HTTP_EVENT_STREAM)
+		HTTP_EVENTS,					// A Server-Sent Events stream is being served
+		#endif
+		#if defined(HTTP_WEBSOCKET)
+		HTTP_WS_UPGRADE,				// 101 Switching Protocols is returned and a WebSocket is served
+		HTTP_WS_BAD_REQUEST,			// 400 Bad Request is returned for an invalid WebSocket handshake
+		#endif
+		#if defined(HTTP_STATS)
+		HTTP_STATS_JSON,				// The request timing statistics are served as JSON
+		HTTP_STATS_BINARY,				// The request timing statistics are served as an HTTP_STATS_DATA
+		#endif
 	} HTTP_STATUS;
 	
 /****************************************************************************
@@ -120,7 +164,17 @@
 		SM_HTTP_SERVE_COOKIES,			// Adds any cookies to the response
 		SM_HTTP_SERVE_BODY,				// Serves the actual content
 		SM_HTTP_SEND_FROM_CALLBACK,		// Invokes a dynamic variable callback
-		SM_HTTP_DISCONNECT				// Disconnects the server and closes all files
+		SM_HTTP_DISCONNECT,				// Disconnects the server and closes all files
+		SM_HTTP_KEEP_ALIVE,				// Waits for the next request on a persistent connection
+		#if defined(HTTP_EVENT_STREAM)
+		SM_HTTP_SERVE_EVENTS,			// Sends Server-Sent Events until either side closes
+		#endif
+		#if defined(HTTP_WEBSOCKET)
+		SM_HTTP_SERVE_WEBSOCKET,		// Exchanges WebSocket frames until either side closes
+		#endif
+		#if defined(HTTP_STATS)
+		SM_HTTP_SERVE_STATS,			// Sends the request timing statistics
+		#endif
 	} SM_HTTP2;
 	
 	// Result states for execution callbacks
@@ -139,6 +193,46 @@
 		HTTP_READ_INCOMPLETE	// Entire object is not yet in the buffer.  Try again later.
 	} HTTP_READ_STATUS;
 	
+	// States of HTTPReadMultipart, kept in curHTTP.smPart
+	typedef enum
+	{
+		HTTP_PART_START = 0u,	// Reading the delimiter before the first part
+		HTTP_PART_HEADERS,		// Reading the headers of a part
+		HTTP_PART_DATA,			// Passing the data of a part to the sink
+		HTTP_PART_NEXT,			// Checking whether another part follows a delimiter
+		HTTP_PART_END,			// Discarding anything after the last part
+		HTTP_PART_ERROR			// Body was malformed, and the rest was discarded
+	} SM_HTTP_PART;
+
+	// Receives the parts of a multipart/form-data body from HTTPReadMultipart.  
+	// Either function pointer may be NULL.
+	typedef struct
+	{
+		void (*Header)(BYTE* cLine);			// Called with each header line of a part
+		WORD (*Data)(BYTE* cData, WORD wLen);	// Called with part data, returns bytes accepted
+	} HTTP_MULTIPART_SINK;
+	
+	// WebSocket frame opcodes, per RFC 6455
+	#define HTTP_WS_CONTINUATION	(0x00u)	// Frame continues a fragmented message
+	#define HTTP_WS_TEXT			(0x01u)	// Frame starts a UTF-8 text message
+	#define HTTP_WS_BINARY			(0x02u)	// Frame starts a binary message
+	#define HTTP_WS_CLOSE			(0x08u)	// Frame closes the connection
+	#define HTTP_WS_PING			(0x09u)	// Frame asks for a Pong
+	#define HTTP_WS_PONG			(0x0Au)	// Frame answers a Ping
+
+	// Flags for curHTTP.wsFlags
+	#define HTTP_WS_KEY				(0x01u)	// Sec-WebSocket-Key was valid, and wsAccept holds the reply
+	#define HTTP_WS_RX_MESSAGE		(0x02u)	// A message is being received
+	#define HTTP_WS_RX_FIN			(0x04u)	// The frame being received ends its message
+	#define HTTP_WS_RX_TEXT			(0x08u)	// The last message received is text rather than binary
+	#define HTTP_WS_RX_END			(0x10u)	// The last byte of a message has been read
+	#define HTTP_WS_TX_MESSAGE		(0x20u)	// A message is being sent in fragments
+	#define HTTP_WS_CLOSED			(0x40u)	// A Close frame has been sent
+
+	// Length of the Sec-WebSocket-Key and Sec-WebSocket-Accept values
+	#define HTTP_WS_KEY_LEN			(24u)
+	#define HTTP_WS_ACCEPT_LEN		(28u)
+	
 	// File type definitions
 	typedef enum
 	{
@@ -175,28 +269,104 @@
 		DWORD nextCallback;					// Byte index of the next callback
 		DWORD callbackID;					// Callback ID to execute, also used as watchdog timer
 		DWORD callbackPos;					// Callback position indicator
+		DWORD rangeStart;					// First byte of a requested byte range
+		DWORD rangeEnd;						// Last byte of a requested byte range
 		BYTE *ptrData;						// Points to first free byte in data
 		BYTE *ptrRead;						// Points to current read location
 		MPFS_HANDLE file;					// File pointer for the file being served
-	    MPFS_HANDLE offsets;				// File pointer for any offset info being used
+	    MPFS_HANDLE offsets;				// File pointer for index entries not yet read
 		BYTE hasArgs;						// True if there were get or cookie arguments	
 		BYTE isAuthorized;					// 0x00-0x79 on fail, 0x80-0xff on pass
+		BYTE keepAlive;						// True if the connection should persist after this response
+		WORD conditional;					// HTTP_COND_* flags from If-None-Match/If-Modified-Since
+		#if defined(STACK_USE_INFLATE)
+		BYTE encoding;						// HTTP_ENC_* flags for the response body
+		#endif
 		HTTP_STATUS httpStatus;				// Request method/status
 	    HTTP_FILE_TYPE fileType;			// File type to return with Content-Type
 		BYTE data[HTTP_MAX_DATA_LEN];		// General purpose data buffer
 		#if defined(HTTP_USE_POST)
 		BYTE smPost;						// POST state machine variable
+		BYTE smPart;						// SM_HTTP_PART state of HTTPReadMultipart
+		BYTE partDelimLen;					// Bytes in partDelim
+		WORD partClear;						// Bytes at the front of the RX FIFO known to be part data
+		BYTE partDelim[HTTP_MAX_BOUNDARY_LEN+4];	// CRLF, "--" and the boundary, which ends each part
+		#endif
+		#if defined(HTTP_WEBSOCKET)
+		BYTE wsFlags;						// HTTP_WS_* flags for a WebSocket connection
+		BYTE wsMaskPos;						// Index into wsMask of the next payload byte's key
+		BYTE wsMask[4];						// Masking key of the frame being received
+		BYTE wsAccept[HTTP_WS_ACCEPT_LEN];	// Sec-WebSocket-Accept value for the handshake
+		#endif
+		#if HTTP_RENDER_CACHE_SIZE > 0
+		BYTE isReplay;						// True if every variable in the response is sent from the render cache
+		#endif
+		#if defined(HTTP_STATS)
+		DWORD statStart;					// Tick when the request's first byte was seen
+		DWORD statMark;						// Tick when the phase being timed began
+		DWORD statBlocked;					// Tick when the TX FIFO was last found full, or 0 if it wasn't
+		DWORD statWait;						// Ticks of the response spent waiting for TX FIFO space
+		DWORD statBytes;					// Body bytes of the response sent so far
 		#endif
 	} HTTP_CONN;
 	
 	#define RESERVED_HTTP_MEMORY ( (DWORD)MAX_HTTP_CONNECTIONS * (DWORD)sizeof(HTTP_CONN))
 
+	// One record of a template's dynamic variable index file.  Indexes 
+	// from older image builders store the callback ID as a DWORD, which 
+	// reads back here with wLength = 0.
+	typedef struct
+	{
+		DWORD dwOffset;						// Offset of the variable's opening '~' in the template
+		WORD wCallbackID;					// Callback ID to pass to HTTPPrint()
+		WORD wLength;						// Bytes in the ~name~ token, or 0 if not stored
+	} HTTP_INDEX_ENTRY;
+
+	// Histograms kept by HTTP_STATS.  Each counts events by the bit length 
+	// of their value, so bucket 0 holds 0, bucket n holds 2^(n-1) to 
+	// 2^n - 1, and the last bucket holds everything larger.
+	typedef enum
+	{
+		HTTP_STAT_PARSE = 0u,				// Ticks from a request's first byte to the end of its headers
+		HTTP_STAT_OPEN,						// Ticks spent opening the requested file in MPFS
+		HTTP_STAT_EXECUTE,					// Ticks from calling HTTPExecuteGet to HTTPExecutePost finishing
+		HTTP_STAT_TTFB,						// Ticks from a request's first byte to its first response byte
+		HTTP_STAT_SEND,						// Ticks from the first response byte to the last body byte queued
+		HTTP_STAT_WAIT,						// Ticks of HTTP_STAT_SEND spent waiting for TX FIFO space
+		HTTP_STAT_RATE,						// Body bytes per second of each response
+		HTTP_STAT_COUNT
+	} HTTP_STAT;
+	#define HTTP_STATS_BUCKETS		(24u)	// Buckets in each HTTP_STAT histogram
+	#define HTTP_STATS_VERSION		(1u)	// HTTP_STATS_DATA layout, for host tools
+
+	// Request timing statistics.  The binary form of the statistics page 
+	// is this structure as stored, in little-endian order with natural 
+	// alignment.  Counts stop at their maximum rather than wrapping.
+	typedef struct
+	{
+		BYTE vVersion;						// HTTP_STATS_VERSION
+		BYTE vStats;						// HTTP_STAT_COUNT
+		BYTE vBuckets;						// HTTP_STATS_BUCKETS
+		BYTE vCallbacks;					// HTTP_STATS_CALLBACKS
+		DWORD dwTickRate;					// Ticks per second
+		DWORD dwRequests;					// Responses started
+		DWORD dwBytes;						// Body bytes of responses sent in full
+		DWORD dwTicks;						// HTTP_STAT_SEND ticks of those responses
+		WORD wHist[HTTP_STAT_COUNT][HTTP_STATS_BUCKETS];	// Counts by HTTP_STAT and bucket
+		struct
+		{
+			DWORD dwCalls;					// Times HTTPPrint ran the callback
+			DWORD dwTicks;					// Ticks spent in those calls
+		} callbacks[HTTP_STATS_CALLBACKS];	// Dynamic variable cost by callback ID
+	} HTTP_STATS_DATA;
+
 /****************************************************************************
   Section:
 	Global HTTP Variables
   ***************************************************************************/
 
-extern HTTP_CONN curHTTP;
+extern HTTP_CONN *pCurHTTP;
+#define curHTTP		(*pCurHTTP)		// Access the current connection's extended state
 extern HTTP_STUB httpStubs[MAX_HTTP_CONNECTIONS];
 extern BYTE curHTTPID;
 
@@ -221,6 +391,22 @@ void HTTPIncFile(ROM BYTE* cFile);
 #if defined(HTTP_USE_POST)
 	HTTP_READ_STATUS HTTPReadPostName(BYTE* cData, WORD wLen);
 	HTTP_READ_STATUS HTTPReadPostValue(BYTE* cData, WORD wLen);
+	HTTP_IO_RESULT HTTPReadMultipart(ROM HTTP_MULTIPART_SINK* sink);
+#endif
+
+#if defined(HTTP_WEBSOCKET)
+	WORD HTTPWebSocketGetArray(BYTE* cData, WORD wLen);
+	WORD HTTPWebSocketPutArray(BYTE* cData, WORD wLen, BYTE vOpcode, BOOL bFinal);
+	#define HTTPWebSocketIsMessageEnd()	((curHTTP.wsFlags & HTTP_WS_RX_END) != 0u)
+	#define HTTPWebSocketIsText()		((curHTTP.wsFlags & HTTP_WS_RX_TEXT) != 0u)
+#endif
+
+#if HTTP_RENDER_CACHE_SIZE > 0
+	void HTTPCacheOutput(WORD wSeconds);
+	void HTTPCacheInvalidate(void);
+#else
+	#define HTTPCacheOutput(a)
+	#define HTTPCacheInvalidate()
 #endif
 
 /*****************************************************************************
@@ -416,6 +602,112 @@ HTTP_IO_RESULT HTTPExecuteGet(void);
 HTTP_IO_RESULT HTTPExecutePost(void);
 #endif
 
+/*****************************************************************************
+  Function:
+	HTTP_IO_RESULT HTTPExecuteEvents(void)
+
+  Summary:
+	Writes Server-Sent Events to a stream connection.
+
+  Description:
+	This function is implemented by the application developer in 
+	CustomHTTPApp.c.  It is called repeatedly for each connection that 
+	has requested the HTTP_EVENT_STREAM path, for as long as that 
+	connection stays open.  Instead of having browsers poll a status 
+	page, the application compares the values it reports to those it 
+	sent last, and writes an event only when something has changed.
+	
+	Each event must be written whole, in the text/event-stream format:
+	one or more "data: " lines followed by a blank line.  Check that 
+	TCPIsPutReady() has room for the entire event first, and return 
+	without writing anything if it does not.  Events are flushed to 
+	the client as soon as this function returns.  If nothing is sent 
+	for HTTP_EVENT_HEARTBEAT seconds, the server writes a comment line 
+	so idle streams stay open through proxies and dead clients are 
+	eventually detected.
+	
+	On the first call for each connection, curHTTP.callbackPos is 0.  
+	Set it to a non-zero value once the initial state has been sent.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Return Values:
+	HTTP_IO_DONE - the stream is finished and the connection is closed
+	HTTP_IO_NEED_DATA - same as HTTP_IO_WAITING
+	HTTP_IO_WAITING - keep the stream open and call again later
+
+  Remarks:
+	This function is only called once at least HTTP_MIN_CALLBACK_FREE 
+	bytes are free in the TX FIFO.
+	
+	This function may service multiple HTTP requests simultaneously.  
+	Exercise caution when using global or static variables inside this 
+	routine.  Use curHTTP.callbackPos or curHTTP.data for storage associated 
+	with individual requests.
+  ***************************************************************************/
+#if defined(HTTP_EVENT_STREAM)
+HTTP_IO_RESULT HTTPExecuteEvents(void);
+#endif
+
+/*****************************************************************************
+  Function:
+	HTTP_IO_RESULT HTTPExecuteWebSocket(void)
+
+  Summary:
+	Exchanges messages over a WebSocket connection.
+
+  Description:
+	This function is implemented by the application developer in 
+	CustomHTTPApp.c.  It is called repeatedly for each connection that 
+	has been upgraded to a WebSocket at the HTTP_WEBSOCKET path, for as 
+	long as that connection stays open.  Unlike an event stream, the 
+	client can send messages back on the same connection.
+	
+	Read incoming messages with HTTPWebSocketGetArray, which unmasks the 
+	payload and joins fragmented messages together.  Once it has 
+	returned the last byte of a message, HTTPWebSocketIsMessageEnd() is 
+	TRUE until this function returns, and HTTPWebSocketIsText() tells 
+	text messages from binary ones.  Every message must be read, if 
+	only by passing NULL to discard it, or later messages will wait 
+	behind it.
+	
+	Write messages with HTTPWebSocketPutArray.  A message too large for 
+	the TX FIFO is sent as several fragments; call again with the rest 
+	of the data to continue it.  Pings, Pongs, and Close frames are 
+	handled by the server.  Frames are flushed to the client as soon as 
+	this function returns.
+	
+	On the first call for each connection, curHTTP.callbackPos is 0, 
+	and curHTTP.data is free for the application's use.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Return Values:
+	HTTP_IO_DONE - close the WebSocket and the connection
+	HTTP_IO_NEED_DATA - same as HTTP_IO_WAITING
+	HTTP_IO_WAITING - keep the WebSocket open and call again later
+
+  Remarks:
+	This function is only called once at least HTTP_MIN_CALLBACK_FREE 
+	bytes are free in the TX FIFO.
+	
+	This function may service multiple HTTP requests simultaneously.  
+	Exercise caution when using global or static variables inside this 
+	routine.  Use curHTTP.callbackPos or curHTTP.data for storage associated 
+	with individual requests.
+  ***************************************************************************/
+#if defined(HTTP_WEBSOCKET)
+HTTP_IO_RESULT HTTPExecuteWebSocket(void);
+#endif
+
 /*****************************************************************************
   Function:
 	BYTE HTTPNeedsAuth(BYTE* cFile)
@@ -550,6 +842,12 @@ HTTP_IO_RESULT HTTPExecutePost(void);
 	available.  Once the callback completes, set this value back to zero
 	to resume normal servicing of the request.
 
+	A function whose output doesn't depend on the request may call 
+	HTTPCacheOutput to let the server reuse what it writes.  Until the 
+	output expires or HTTPCacheInvalidate is called, later requests are 
+	sent the saved bytes without calling the function, and pages whose 
+	variables are all saved this way are sent with a Content-Length.
+
   Precondition:
 	None
 	
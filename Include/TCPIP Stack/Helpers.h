@@ -89,6 +89,8 @@ DWORD   swapl(DWORD v);
 
 WORD    CalcIPChecksum(BYTE* buffer, WORD len);
 WORD    CalcIPBufferChecksum(WORD len);
+WORD    UpdateIPChecksum(WORD checksum, WORD oldVal, WORD newVal);
+DWORD   CalcCRC32(DWORD crc, BYTE* buffer, WORD len);
 
 #if defined(__18CXX)
 	DWORD leftRotateDWORD(DWORD val, BYTE bits);
@@ -0,0 +1,12 @@
+#ifndef __IGMP_H
+#define __IGMP_H
+
+void IGMPInit(void);
+void IGMPTask(void);
+void IGMPProcess(NODE_INFO *remote, IP_ADDR *localIP, WORD len);
+
+BOOL IGMPJoinGroup(IP_ADDR group);
+void IGMPLeaveGroup(IP_ADDR group);
+BOOL IGMPIsMember(IP_ADDR group);
+
+#endif
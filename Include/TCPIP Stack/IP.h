@@ -56,6 +56,7 @@
 
 
 #define IP_PROT_ICMP    (1u)
+#define IP_PROT_IGMP    (2u)
 #define IP_PROT_TCP     (6u)
 #define IP_PROT_UDP     (17u)
 
@@ -155,6 +156,21 @@ WORD    IPPutHeader(NODE_INFO *remote,
                     BYTE protocol,
                     WORD len);
 
+WORD    IPPutHeaderEx(NODE_INFO *remote,
+                      BYTE protocol,
+                      WORD len,
+                      BYTE ttl,
+                      BYTE *options,
+                      BYTE optionsLen);
+
+BOOL    IPReplyInPlace(NODE_INFO *remote,
+                       BYTE *header,
+                       BYTE headerLen,
+                       WORD len);
+
+// Evaluates to TRUE if the IP_ADDR a is in the class D (multicast) range
+#define IPIsMulticast(a)	(((a).v[0] & 0xF0u) == 0xE0u)
+
 
 /*********************************************************************
  * Function:        BOOL IPGetHeader( IP_ADDR    *localIP,
@@ -0,0 +1,51 @@
+/*********************************************************************
+ *
+ *	DEFLATE Decompression Headers
+ *
+ *********************************************************************
+ * FileName:        Inflate.h
+ * Dependencies:    MPFS2
+ * Processor:       CH32V307
+ * Compiler:        GCC
+ ********************************************************************/
+#ifndef __INFLATE_H
+#define __INFLATE_H
+
+// Bytes of decompressed history kept for back-references.  Streams
+// must have been compressed with a window no larger than this, which
+// any file no longer than this satisfies.  Must be a power of 2, 
+// 32768 at most.
+#if !defined(INFLATE_WINDOW_SIZE)
+	#define INFLATE_WINDOW_SIZE		(8192u)
+#endif
+#if (INFLATE_WINDOW_SIZE & (INFLATE_WINDOW_SIZE - 1)) != 0
+	#error INFLATE_WINDOW_SIZE must be a power of 2
+#endif
+
+// Decompression state for one gzip stream.
+// The program need not access any of these values directly, but rather
+// only store the structure and use InflateInit to set it up.
+typedef struct
+{
+	MPFS_HANDLE hFile;		// File holding the compressed stream
+	DWORD dwSize;			// Decompressed length, from the gzip trailer
+	DWORD dwOut;			// Bytes decompressed so far
+	DWORD bitBuf;			// Input bits not yet consumed, LSB first
+	BYTE bitCnt;			// Number of valid bits in bitBuf
+	BYTE state;				// Current INFLATE_STATE
+	BOOL isLast;			// The current block is the final one
+	WORD wRem;				// Bytes left in a stored block or pending match
+	WORD wDist;				// Distance back into the window of the pending match
+	WORD wPos;				// Next write position in window
+	WORD lenCount[16];		// Literal/length codes of each bit length
+	WORD lenSymbol[288];	// Literal/length symbols in code order
+	WORD distCount[16];		// Distance codes of each bit length
+	WORD distSymbol[30];	// Distance symbols in code order
+	BYTE window[INFLATE_WINDOW_SIZE];	// Most recent decompressed bytes
+} INFLATE_CTX;
+
+BOOL InflateInit(INFLATE_CTX* ctx, MPFS_HANDLE hFile);
+WORD InflateGetArray(INFLATE_CTX* ctx, BYTE* cData, WORD wLen);
+BOOL InflateIsDone(INFLATE_CTX* ctx);
+
+#endif
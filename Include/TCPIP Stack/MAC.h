@@ -98,6 +98,9 @@ WORD CalcIPBufferChecksum(WORD len);
 void MACInit(void);
 BOOL MACIsLinked(void);
 
+BOOL MACAddMulticast(MAC_ADDR *addr);
+void MACRemoveMulticast(MAC_ADDR *addr);
+
 BOOL MACGetHeader(MAC_ADDR *remote, BYTE* type);
 void MACSetReadPtrInRx(WORD offset);
 WORD MACSetWritePtr(WORD address);
@@ -117,6 +120,10 @@ void MACPut(BYTE val);
 void MACPutArray(BYTE *val, WORD len);
 void MACFlush(void);
 
+BYTE* MACGetRxFrame(void);
+BYTE* MACGetTxFrame(void);
+BOOL MACFlushRxInPlace(MAC_ADDR *remote, WORD dataLen);
+
 BOOL MACIsDataTransceiving(void);
 void MACSetDataTransceiving(BOOL transceiving);
 
@@ -70,6 +70,33 @@
 		#endif
 	#endif
 
+	// RAM index of file name hashes used by MPFSOpen
+	#if !defined(MPFS_INDEX_MAX_FILES)
+		#define MPFS_INDEX_MAX_FILES			(512u)	// Largest image that can be indexed, 0 to disable
+	#endif
+
+	// Image banks and RAM block cache for images in SPI Flash
+	#if defined(MPFS_USE_SPI_FLASH)
+		#if !defined(MPFS_CACHE_BLOCKS)
+			#define MPFS_CACHE_BLOCKS			(8u)	// Number of cached blocks, 0 to disable
+		#endif
+		#if !defined(MPFS_CACHE_BLOCK_SIZE)
+			#define MPFS_CACHE_BLOCK_SIZE		(256u)	// Bytes per block; must be a power of 2
+		#endif
+		#if !defined(MPFS_BANK_SIZE)
+			#define MPFS_BANK_SIZE				(4096ul * 128)	// Bytes per image bank
+		#endif
+		#if (MPFS_BANK_SIZE & 0x0fff) != 0
+			#error MPFS_BANK_SIZE must be a multiple of 4096
+		#endif
+		#if MPFS_CACHE_BLOCKS > 0
+			#define MPFS_USE_CACHE
+			#if (MPFS_CACHE_BLOCK_SIZE & (MPFS_CACHE_BLOCK_SIZE - 1)) != 0
+				#error MPFS_CACHE_BLOCK_SIZE must be a power of 2
+			#endif
+		#endif
+	#endif
+
 /****************************************************************************
   Section:
 	Type Definitions
@@ -112,6 +139,18 @@
 		WORD flags;			// Flags for this file
 	} MPFS_FAT_RECORD;
 
+	// Counters for the MPFS block cache
+	typedef struct
+	{
+		DWORD dwHits;			// Block lookups served from RAM
+		DWORD dwMisses;			// Block lookups that had to read the flash
+		DWORD dwReadAheads;		// Blocks prefetched after sequential misses
+	} MPFS_CACHE_STATS;
+
+	#if defined(MPFS_USE_CACHE) && !defined(__MPFS2_C)
+		extern MPFS_CACHE_STATS MPFSCacheStats;
+	#endif
+
 /****************************************************************************
   Section:
 	Function Definitions
@@ -127,6 +166,7 @@ MPFS_HANDLE MPFSOpen(BYTE* cFile);
 	#define MPFSOpenROM(a)	MPFSOpen((BYTE*) a);
 #endif
 MPFS_HANDLE MPFSOpenID(WORD hFatID);
+BOOL MPFSIsFileID(WORD hFatID);
 void MPFSClose(MPFS_HANDLE hMPFS);
 
 BOOL MPFSGet(MPFS_HANDLE hMPFS, BYTE* c);
@@ -139,8 +179,9 @@ BOOL MPFSSeek(MPFS_HANDLE hMPFS, DWORD dwOffset, MPFS_SEEK_MODE tMode);
 #endif
 
 MPFS_HANDLE MPFSFormat(void);
-void MPFSPutEnd(BOOL final);
+BOOL MPFSPutEnd(BOOL final);
 WORD MPFSPutArray(MPFS_HANDLE hMPFS, BYTE* cData, WORD wLen);
+WORD MPFSGetPutReady(MPFS_HANDLE hMPFS);
 
 DWORD MPFSGetTimestamp(MPFS_HANDLE hMPFS);
 DWORD MPFSGetMicrotime(MPFS_HANDLE hMPFS);
@@ -0,0 +1,23 @@
+#ifndef __RXFILTER_H
+#define __RXFILTER_H
+
+// Counts of received frames handled by the early RX filter, by outcome
+typedef struct
+{
+	DWORD dwAccepted;			// Frames passed on to protocol dispatch
+	DWORD dwUnknownType;		// EtherType is neither IPv4 nor ARP
+	DWORD dwBadIPHeader;		// Not IPv4, or an IP fragment we cannot reassemble
+	DWORD dwMulticast;			// IP multicast to a group that has not been joined
+	DWORD dwUnknownProtocol;	// IP protocol with no handler in this build
+	DWORD dwUDPClosedPort;		// UDP to a port with no open socket
+	DWORD dwTCPClosedPort;		// TCP to a port with no open or listening socket
+} RX_FILTER_STATS;
+
+extern RX_FILTER_STATS RxFilterStats;
+
+void RxFilterInit(void);
+void RxFilterInvalidate(void);
+void RxFilterAddPort(BYTE protocol, WORD port);
+BOOL RxFilterAccept(BYTE cFrameType);
+
+#endif
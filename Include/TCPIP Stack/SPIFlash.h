@@ -58,7 +58,14 @@ void SPIFlashInit(void);
 void SPIFlashReadArray(DWORD dwAddress, BYTE *vData, WORD wLen);
 
 void SPIFlashBeginWrite(DWORD dwAddr);
+DWORD SPIFlashGetWriteAddr(void);
 void SPIFlashWrite(BYTE vData);
 void SPIFlashWriteArray(BYTE *vData, WORD wLen);
 
+WORD SPIFlashPutArray(BYTE *vData, WORD wLen);
+WORD SPIFlashGetPutReady(void);
+void SPIFlashPutEnd(void);
+BOOL SPIFlashIsBusy(void);
+void SPIFlashTask(void);
+
 #endif
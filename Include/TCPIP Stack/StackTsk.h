@@ -69,10 +69,19 @@
 #error Invalid MAX_HTTP_CONNECTIONS value specified.
 #endif
 
+// Maximum number of received frames StackTask() handles per call
+#if !defined(STACK_RX_BUDGET)
+	#define STACK_RX_BUDGET		(8u)
+#endif
+
+#if (STACK_RX_BUDGET <= 0)
+#error Invalid STACK_RX_BUDGET value specified.
+#endif
+
 #include "Parameters.h"
 
 void StackInit(void);
-void StackTask(void);
+WORD StackTask(void);
 void StackApplications(void);
 
 #endif
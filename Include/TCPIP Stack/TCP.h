@@ -137,7 +137,8 @@ typedef struct _TCB_STUB
 		unsigned char bTXFIN : 1;					// FIN needs to be transmitted
 		unsigned char bSocketReset : 1;				// Socket has been reset (self-clearing semaphore)
 		unsigned char bSSLHandshaking : 1;			// Socket is in an SSL handshake
-		unsigned char filler : 2;					// Future expansion
+		unsigned char bTXFile : 1;					// MPFS file data queued by TCPSendFile() is not yet fully ACKed
+		unsigned char bActivity : 1;				// A segment arrived or the socket closed (self-clearing semaphore)
     } Flags;
 	WORD_VAL remoteHash;	// Consists of remoteIP, remotePort, localPort for connected sockets.  It is a localPort number only for listening server sockets.
 
@@ -186,6 +187,16 @@ typedef struct _TCB
     } flags;
 	BYTE		retryCount;				// Counter for transmission retries
 	BYTE		vSocketPurpose;			// Purpose of socket (as defined in TCPIPConfig.h)
+    #if defined(STACK_USE_MPFS2)
+	struct
+	{
+		DWORD	dwStart;				// File position of the first queued byte
+		DWORD	dwLen;					// Number of bytes queued
+		DWORD	dwSent;					// Bytes transmitted since the last retransmission rollback
+		DWORD	dwAcked;				// Bytes acknowledged by the remote node
+		WORD	wFatID;					// MPFS FAT entry of the file
+	} txFile;							// File data sent after the TX FIFO by TCPSendFile()
+    #endif
 } TCB;
 
 // Information about a socket
@@ -203,6 +214,7 @@ typedef struct _SOCKET_INFO
 void TCPInit(void);
 SOCKET_INFO* TCPGetRemoteInfo(TCP_SOCKET hTCP);
 BOOL TCPWasReset(TCP_SOCKET hTCP);
+BOOL TCPWasActive(TCP_SOCKET hTCP);
 BOOL TCPIsConnected(TCP_SOCKET hTCP);
 void TCPDisconnect(TCP_SOCKET hTCP);
 WORD TCPIsPutReady(TCP_SOCKET hTCP);
@@ -213,6 +225,8 @@ WORD TCPIsGetReady(TCP_SOCKET hTCP);
 WORD TCPGetRxFIFOFree(TCP_SOCKET hTCP);
 BOOL TCPGet(TCP_SOCKET hTCP, BYTE* byte);
 WORD TCPGetArray(TCP_SOCKET hTCP, BYTE* buffer, WORD count);
+WORD TCPPeekArray(TCP_SOCKET hTCP, BYTE *vBuffer, WORD wLen, WORD wStart);
+WORD TCPPeekTxArray(TCP_SOCKET hTCP, BYTE *vBuffer, WORD wLen);
 WORD TCPFindEx(TCP_SOCKET hTCP, BYTE cFind, WORD wStart, WORD wSearchLen, BOOL bTextCompare);
 WORD TCPFindArrayEx(TCP_SOCKET hTCP, BYTE* cFindArray, WORD wLen, WORD wStart, WORD wSearchLen, BOOL bTextCompare);
 void TCPDiscard(TCP_SOCKET hTCP);
@@ -220,6 +234,15 @@ BOOL TCPProcess(NODE_INFO* remote, IP_ADDR* localIP, WORD len);
 void TCPTick(void);
 void TCPFlush(TCP_SOCKET hTCP);
 
+#if defined(STACK_USE_MPFS2)
+	#include "TCPIP Stack/MPFS2.h"
+	DWORD TCPSendFile(TCP_SOCKET hTCP, MPFS_HANDLE hMPFS, DWORD dwLen);
+#endif
+
+#if defined(STACK_USE_RX_FILTER)
+	void TCPAddRxFilterPorts(void);
+#endif
+
 // Create a server socket and ignore dwRemoteHost.
 #define TCP_OPEN_SERVER		0
 #if defined(STACK_CLIENT_MODE)
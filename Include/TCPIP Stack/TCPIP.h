@@ -217,7 +217,8 @@
 		defined(STACK_USE_ANNOUNCE) || \
 		defined(STACK_USE_UDP_PERFORMANCE_TEST) || \
 		defined(STACK_USE_SNTP_CLIENT) || \
-		defined(STACK_USE_BERKELEY_API)
+		defined(STACK_USE_BERKELEY_API) || \
+		defined(STACK_USE_IGMP)
 	    #if !defined(STACK_USE_UDP)
 	        #define STACK_USE_UDP
 	    #endif
@@ -235,6 +236,17 @@
 		#define STACK_USE_SSL
 	#endif
 
+	// HTTP2 decompresses gzip'd files with the Inflate module
+	#if defined(STACK_USE_HTTP2_SERVER) && defined(HTTP_USE_INFLATE)
+		#define STACK_USE_INFLATE
+	#endif
+
+	// HTTP2 WebSocket handshakes require SHA-1 and Base64 encoding
+	#if defined(STACK_USE_HTTP2_SERVER) && defined(HTTP_WEBSOCKET)
+		#define STACK_USE_SHA1
+		#define STACK_USE_BASE64_ENCODE
+	#endif
+
 	// If using SSL (either), include the rest of the support modules
 	#if defined(STACK_USE_SSL)
 		#define STACK_USE_ARCFOUR
@@ -311,6 +323,10 @@
 	#include "TCPIP Stack/UDP.h"
 #endif
 
+#if defined(STACK_USE_IGMP)
+	#include "TCPIP Stack/IGMP.h"
+#endif
+
 #if defined(STACK_USE_TCP)
 	#include "TCPIP Stack/TCP.h"
 #endif
@@ -355,6 +371,10 @@
 	#include "TCPIP Stack/HTTP.h"
 #endif
 
+#if defined(STACK_USE_INFLATE)
+	#include "TCPIP Stack/Inflate.h"
+#endif
+
 #if defined(STACK_USE_HTTP2_SERVER)
 	#include "TCPIP Stack/HTTP2.h"
 #endif
@@ -420,4 +440,8 @@
 	#include "TCPIP Stack/SSL.h"
 #endif
 
+#if defined(STACK_USE_RX_FILTER)
+	#include "TCPIP Stack/RxFilter.h"
+#endif
+
 #endif
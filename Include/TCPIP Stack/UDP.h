@@ -64,6 +64,9 @@ typedef struct _UDP_SOCKET_INFO
     NODE_INFO   remoteNode;		// IP and MAC of remote node
     UDP_PORT    remotePort;		// Remote node's UDP port number
     UDP_PORT    localPort;		// Local UDP port number, or INVALID_UDP_PORT when free
+#if defined(STACK_USE_IGMP)
+    IP_ADDR     multicastGroup;	// Multicast group joined by this socket, or 0
+#endif
 } UDP_SOCKET_INFO;
 
 
@@ -118,6 +121,15 @@ void UDPFlush(void);
 	#define UDPPutROMString(a)	UDPPutString((BYTE*)a)
 #endif
 
+#if defined(STACK_USE_RX_FILTER)
+	void UDPAddRxFilterPorts(void);
+#endif
+
+#if defined(STACK_USE_IGMP)
+	BOOL UDPJoinGroup(UDP_SOCKET s, IP_ADDR group);
+	void UDPLeaveGroup(UDP_SOCKET s);
+#endif
+
 WORD UDPIsGetReady(UDP_SOCKET s);
 BOOL UDPGet(BYTE *v);
 WORD UDPGetArray(BYTE *cData, WORD wDataLen);
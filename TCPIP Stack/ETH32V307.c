@@ -12,6 +12,11 @@
 #define ETH_RXBUFNB        5
 #define ETH_TXBUFNB        4
 
+// Number of distinct multicast MAC addresses that can be subscribed to
+#if !defined(MAC_MULTICAST_ENTRIES)
+    #define MAC_MULTICAST_ENTRIES   (8u)
+#endif
+
 __attribute__ ((aligned(4))) ETH_DMADESCTypeDef DMARxDscrTab[ETH_RXBUFNB];/* rx dscriptor */
 __attribute__ ((aligned(4))) ETH_DMADESCTypeDef DMATxDscrTab[ETH_TXBUFNB];/* tx descriptor */
 
@@ -32,6 +37,16 @@ static BOOL rxPtrToRxBuffer;
 
 static BOOL dataTransceiving;
 
+// Subscribed multicast addresses.  The hash table is rebuilt from this 
+// list since several addresses can share a hash bit.
+static struct
+{
+    MAC_ADDR addr;
+    BYTE refCount;      // Number of MACAddMulticast() calls outstanding, 0 when free
+} multicastTable[MAC_MULTICAST_ENTRIES];
+
+static void UpdateMulticastHash(void);
+
 #define  ETH_DMARxDesc_FrameLengthShift           16
 
 #define ETHER_IP	(0x00u)
@@ -64,6 +79,8 @@ void MACInit(void)
 
     dataTransceiving = FALSE;
 
+    memset((void*)multicastTable, 0x00, sizeof(multicastTable));
+
     timeout = ETH_TIMEOUT_SWRESET;
 
     /* Wait for software reset */
@@ -99,7 +116,7 @@ void MACInit(void)
     ETH_InitStructure.ETH_BroadcastFramesReception = ETH_BroadcastFramesReception_Enable;
     ETH_InitStructure.ETH_PassControlFrames = ETH_PassControlFrames_BlockAll;
     ETH_InitStructure.ETH_PromiscuousMode = ETH_PromiscuousMode_Disable;
-    ETH_InitStructure.ETH_MulticastFramesFilter = ETH_MulticastFramesFilter_Perfect;
+    ETH_InitStructure.ETH_MulticastFramesFilter = ETH_MulticastFramesFilter_HashTable;
     ETH_InitStructure.ETH_UnicastFramesFilter = ETH_UnicastFramesFilter_Perfect;
     ETH_InitStructure.ETH_ChecksumOffload = ETH_ChecksumOffload_Disable;
     /*------------------------   DMA   -----------------------------------*/
@@ -299,6 +316,148 @@ void MACInit(void)
     TRACE("eth init ok\n");
 }
 
+/*********************************************************************
+ * Function:        BOOL MACAddMulticast(MAC_ADDR *addr)
+ *
+ * PreCondition:    MACInit() is already called.
+ *
+ * Input:           addr - Multicast MAC address to receive
+ *
+ * Output:          TRUE if the address is now being received
+ *                  FALSE if the subscription table is full
+ *
+ * Side Effects:    None
+ *
+ * Note:            Subscriptions are reference counted; every
+ *                  successful call must be balanced by a call to
+ *                  MACRemoveMulticast().  Because the MAC filters
+ *                  multicast frames through a 64 bit hash table,
+ *                  some unsubscribed groups may also be received.
+ ********************************************************************/
+BOOL MACAddMulticast(MAC_ADDR *addr)
+{
+    BYTE i;
+    BYTE freeEntry = MAC_MULTICAST_ENTRIES;
+
+    for (i = 0; i < MAC_MULTICAST_ENTRIES; i++)
+    {
+        if (multicastTable[i].refCount == 0u)
+        {
+            if (freeEntry == MAC_MULTICAST_ENTRIES)
+            {
+                freeEntry = i;
+            }
+            continue;
+        }
+
+        if (memcmp((void*)multicastTable[i].addr.v, (void*)addr->v, sizeof(addr->v)) == 0)
+        {
+            multicastTable[i].refCount++;
+            return TRUE;
+        }
+    }
+
+    if (freeEntry == MAC_MULTICAST_ENTRIES)
+    {
+        return FALSE;
+    }
+
+    memcpy((void*)&multicastTable[freeEntry].addr, (void*)addr, sizeof(*addr));
+    multicastTable[freeEntry].refCount = 1;
+
+    UpdateMulticastHash();
+
+    return TRUE;
+}
+
+/*********************************************************************
+ * Function:        void MACRemoveMulticast(MAC_ADDR *addr)
+ *
+ * PreCondition:    MACInit() is already called.
+ *
+ * Input:           addr - Multicast MAC address to stop receiving
+ *
+ * Output:          None
+ *
+ * Side Effects:    None
+ *
+ * Note:            The address keeps being received until every
+ *                  MACAddMulticast() call for it has been undone.
+ ********************************************************************/
+void MACRemoveMulticast(MAC_ADDR *addr)
+{
+    BYTE i;
+
+    for (i = 0; i < MAC_MULTICAST_ENTRIES; i++)
+    {
+        if (multicastTable[i].refCount == 0u)
+        {
+            continue;
+        }
+
+        if (memcmp((void*)multicastTable[i].addr.v, (void*)addr->v, sizeof(addr->v)) == 0)
+        {
+            if (--multicastTable[i].refCount == 0u)
+            {
+                UpdateMulticastHash();
+            }
+            return;
+        }
+    }
+}
+
+// Reprograms MACHTHR/MACHTLR from the subscription table.  The MAC
+// indexes its hash table with the upper 6 bits of the bit reversed
+// Ethernet CRC of the destination address.
+static void UpdateMulticastHash(void)
+{
+    DWORD hash[2] = {0, 0};
+    DWORD crc;
+    BYTE i, j, k, data;
+    BYTE bit;
+
+    for (i = 0; i < MAC_MULTICAST_ENTRIES; i++)
+    {
+        if (multicastTable[i].refCount == 0u)
+        {
+            continue;
+        }
+
+        // Standard reflected Ethernet CRC-32
+        crc = 0xFFFFFFFFul;
+        for (j = 0; j < sizeof(multicastTable[i].addr.v); j++)
+        {
+            data = multicastTable[i].addr.v[j];
+            for (k = 0; k < 8; k++)
+            {
+                if ((crc ^ data) & 0x01)
+                {
+                    crc = (crc >> 1) ^ 0xEDB88320ul;
+                }
+                else
+                {
+                    crc >>= 1;
+                }
+                data >>= 1;
+            }
+        }
+        crc = ~crc;
+
+        // The upper 6 bits of the bit reversed value are the lower 6
+        // bits of the CRC, in reverse order
+        bit = 0;
+        for (k = 0; k < 6; k++)
+        {
+            bit = (bit << 1) | (BYTE)((crc >> k) & 0x01);
+        }
+
+        hash[bit >> 5] |= 1ul << (bit & 0x1F);
+    }
+
+    ETH->MACHTHR = hash[1];
+    ETH->MACHTLR = hash[0];
+}
+
 BOOL MACIsLinked(void)
 {
     if ((ETH_ReadPHYRegister(PHY_ADDRESS, PHY_BSR) & PHY_Linked_Status) == PHY_Linked_Status)
@@ -494,6 +653,98 @@ void MACFlush(void)
     }
 }
 
+/*********************************************************************
+ * Function:        BYTE* MACGetRxFrame(void)
+ *
+ * PreCondition:    MACGetHeader() returned TRUE and the frame has not
+ *                  been discarded.
+ *
+ * Input:           None
+ *
+ * Output:          Pointer to the Ethernet header of the current RX frame
+ *
+ * Side Effects:    None
+ *
+ * Note:            Gives direct access to the RX DMA buffer so a reply
+ *                  can be built in place.  The IP header following the
+ *                  Ethernet header is only 2 byte aligned.
+ ********************************************************************/
+BYTE* MACGetRxFrame(void)
+{
+    return (BYTE*)DMARxDescToGet->Buffer1Addr;
+}
+
+/*********************************************************************
+ * Function:        BYTE* MACGetTxFrame(void)
+ *
+ * PreCondition:    MACIsTxReady() returned TRUE
+ *
+ * Input:           None
+ *
+ * Output:          Pointer to the start of the TX buffer
+ *
+ * Side Effects:    None
+ *
+ * Note:            Offsets into the returned buffer are the same
+ *                  addresses used with MACSetWritePtr(), so callers
+ *                  can fill part of a frame directly instead of
+ *                  staging it for MACPutArray().
+ ********************************************************************/
+BYTE* MACGetTxFrame(void)
+{
+    return (BYTE*)DMATxDescToSet->Buffer1Addr;
+}
+
+/*********************************************************************
+ * Function:        BOOL MACFlushRxInPlace(MAC_ADDR *remote, WORD dataLen)
+ *
+ * PreCondition:    MACGetHeader() returned TRUE, the frame has not
+ *                  been discarded, and the frame data has been
+ *                  rewritten into a reply.
+ *
+ * Input:           remote  - Destination MAC address of the reply
+ *                  dataLen - Length of the reply after the Ethernet
+ *                            header
+ *
+ * Output:          TRUE if the current RX frame was queued for
+ *                  transmission and discarded from the RX ring
+ *                  FALSE if no TX descriptor is free; the frame is
+ *                  left unchanged
+ *
+ * Side Effects:    Any unflushed data in the TX buffer is lost
+ *
+ * Note:            Rather than copying the frame, the RX buffer is
+ *                  swapped with the free TX descriptor's buffer.  The
+ *                  RX descriptor is returned to the DMA with the old
+ *                  TX buffer, which is the same size.
+ ********************************************************************/
+BOOL MACFlushRxInPlace(MAC_ADDR *remote, WORD dataLen)
+{
+    UINT8 *data;
+    UINT32 txBuffer;
+
+    if (WasDiscarded || (DMATxDescToSet->Status & ETH_DMATxDesc_OWN) != (u32)RESET)
+    {
+        return FALSE;
+    }
+
+    // Address the frame back to the requester, from us
+    data = (UINT8 *)DMARxDescToGet->Buffer1Addr;
+    memcpy(&data[0], (void*)remote, sizeof(*remote));
+    memcpy(&data[sizeof(*remote)], (void*)&AppConfig.MyMACAddr, sizeof(AppConfig.MyMACAddr));
+
+    // Trade buffers between the two rings
+    txBuffer = DMATxDescToSet->Buffer1Addr;
+    DMATxDescToSet->Buffer1Addr = DMARxDescToGet->Buffer1Addr;
+    DMARxDescToGet->Buffer1Addr = txBuffer;
+
+    txCount = dataLen + (WORD)sizeof(ETHER_HEADER);
+    MACFlush();
+    MACDiscardRx();
+
+    return TRUE;
+}
+
 void MACSetReadPtrInRx(WORD offset)
 {
     rxPtr = sizeof(ETHER_HEADER) + offset;
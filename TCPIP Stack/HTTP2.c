@@ -61,9 +61,6 @@
 
 #if defined(STACK_USE_HTTP2_SERVER)
 
-static BYTE http_memory[RESERVED_HTTP_MEMORY];
-static WORD http_mem_wp,http_mem_rp;
-
 /****************************************************************************
   Section:
 	String Constants
@@ -71,6 +68,17 @@ static WORD http_mem_wp,http_mem_rp;
 	static ROM BYTE HTTP_CRLF[] = "\r\n";	// New line sequence
 	#define HTTP_CRLF_LEN	2				// Length of above string
 		
+/****************************************************************************
+  Section:
+	Name Lookup
+  ***************************************************************************/
+	// Header names and file extensions are found by hashing their length 
+	// and first and last characters, case-insensitively, into a table of 
+	// HTTP_HASH_SLOTS entries.  The hash is perfect over the known names, 
+	// so a single comparison confirms or rejects the candidate it selects.
+	#define HTTP_HASH_SLOTS			(32u)
+	#define HTTPNameHash(s, len)	((BYTE)(((s)[0] | 0x20) + (((s)[(len)-1] | 0x20) << 1) + ((len) << 3)) & (HTTP_HASH_SLOTS - 1))
+
 /****************************************************************************
   Section:
 	File and Content Type Settings
@@ -92,6 +100,17 @@ static WORD http_mem_wp,http_mem_rp;
 		"\0\0\0"		// HTTP_UNKNOWN
 	};
 	
+	// Index into httpFileExtensions of the extension hashing to each 
+	// slot under HTTPNameHash, or 0xff if none does.  Rebuild this 
+	// whenever an extension is added.
+	static ROM BYTE httpExtensionSlots[HTTP_HASH_SLOTS] =
+	{
+		2,    5,    0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		4,    0xff, 0xff, 6,    0xff, 3,    0xff, 0xff,
+		8,    0xff, 0xff, 0xff, 0,    0xff, 7,    0xff,
+		0xff, 0xff, 1,    10,   0xff, 9,    0xff, 0xff
+	};
+	
 	// Content-type strings corresponding to HTTP_FILE_TYPE
 	static ROM char *httpContentTypes[HTTP_UNKNOWN+1] =
 	{
@@ -117,8 +136,8 @@ static WORD http_mem_wp,http_mem_rp;
 	// Initial response strings (Corresponding to HTTP_STATUS)
 	static ROM char *HTTPResponseHeaders[] =
 	{
-		"HTTP/1.1 200 OK\r\nConnection: close\r\n",
-		"HTTP/1.1 200 OK\r\nConnection: close\r\n",
+		"HTTP/1.1 200 OK\r\n",
+		"HTTP/1.1 200 OK\r\n",
 		"HTTP/1.1 401 Unauthorized\r\nWWW-Authenticate: Basic realm=\"DEMO\"\r\nConnection: close\r\n\r\n401 Unauthorized: Password required\r\n",
 		#if defined(HTTP_MPFS_UPLOAD)
 		"HTTP/1.1 404 Not found\r\nConnection: close\r\nContent-Type: text/html\r\n\r\n404: File not found<br>Use <a href=\"/" HTTP_MPFS_UPLOAD "\">MPFS Upload</a> to program web pages\r\n",
@@ -135,39 +154,173 @@ static WORD http_mem_wp,http_mem_rp;
 		"HTTP/1.1 500 Internal Server Error\r\nConnection: close\r\nContent-Type: text/html\r\n\r\n<html><body style=\"margin:100px\"><b>MPFS Image Corrupt or Wrong Version</b><p><a href=\"/" HTTP_MPFS_UPLOAD "\">һ?</a></body></html>",
 		#endif
 		"HTTP/1.1 302 Found\r\nConnection: close\r\nLocation: ",
-		"HTTP/1.1 403 Forbidden\r\nConnection: close\r\n\r\n403 Forbidden: SSL Required - use HTTPS\r\n"
+		"HTTP/1.1 403 Forbidden\r\nConnection: close\r\n\r\n403 Forbidden: SSL Required - use HTTPS\r\n",
+		"HTTP/1.1 304 Not Modified\r\n",
+		"HTTP/1.1 416 Range Not Satisfiable\r\nConnection: close\r\nContent-Range: bytes */",
+		#if defined(HTTP_EVENT_STREAM)
+		"HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n\r\n",
+		#endif
+		#if defined(HTTP_WEBSOCKET)
+		"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ",
+		"HTTP/1.1 400 Bad Request\r\nConnection: close\r\nSec-WebSocket-Version: 13\r\n\r\n400 Bad Request: Invalid WebSocket handshake\r\n",
+		#endif
+		#if defined(HTTP_STATS)
+		"HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Type: application/json\r\nCache-Control: no-cache\r\n\r\n",
+		"HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Type: application/octet-stream\r\nCache-Control: no-cache\r\n\r\n",
+		#endif
 	};
 	
 /****************************************************************************
   Section:
 	Header Parsing Configuration
   ***************************************************************************/
-	#define HTTP_NUM_HEADERS		3
+	#define HTTP_NUM_HEADERS		10
 	
 	// Header strings for which we'd like to parse
 	static ROM char *HTTPRequestHeaders[HTTP_NUM_HEADERS] =
 	{
-		"Cookie:",
-		"Authorization:",
-		"Content-Length:"
+		"Cookie",
+		"Authorization",
+		"Content-Length",
+		"Connection",
+		"If-None-Match",
+		"If-Modified-Since",
+		"Range",
+		"If-Range",
+		"Accept-Encoding",
+		"Sec-WebSocket-Key"
+	};
+	
+	// Index into HTTPRequestHeaders of the name hashing to each slot 
+	// under HTTPNameHash, or 0xff if none does.  Rebuild this whenever 
+	// a header is added.
+	static ROM BYTE httpHeaderSlots[HTTP_HASH_SLOTS] =
+	{
+		0xff, 4,    0xff, 2,    6,    1,    0xff, 8,
+		0xff, 0xff, 0xff, 0xff, 0xff, 9,    0xff, 3,
+		0xff, 0xff, 0xff, 7,    0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0xff, 5,    0xff, 0,    0xff, 0xff
 	};
 	
-	// Set to length of longest string above
-	#define HTTP_MAX_HEADER_LEN		(15u)
+	// Set to length of longest string above, plus its colon
+	#define HTTP_MAX_HEADER_LEN		(18u)
+
+	// Flags for curHTTP.conditional
+	#define HTTP_COND_ETAG_SENT		(0x01u)	// Client sent If-None-Match
+	#define HTTP_COND_ETAG_MATCH	(0x02u)	// If-None-Match named the current ETag
+	#define HTTP_COND_DATE_MATCH	(0x04u)	// If-Modified-Since equals the current Last-Modified
+	#define HTTP_COND_RANGE			(0x08u)	// Range held a satisfiable byte range
+	#define HTTP_COND_RANGE_BAD		(0x10u)	// Range held a byte range past the end of the file
+	#define HTTP_COND_IFRANGE_SENT	(0x20u)	// Client sent If-Range
+	#define HTTP_COND_IFRANGE_MATCH	(0x40u)	// If-Range equals the current ETag or Last-Modified
+	#define HTTP_COND_PARTIAL		(0x80u)	// Response is 206 Partial Content
+	#define HTTP_COND_ETAG_INFLATED	(0x0100u)	// If-None-Match named the ETag of the file sent decompressed
+
+	// Flags for curHTTP.encoding
+	#define HTTP_ENC_GZIP			(0x01u)	// Accept-Encoding allows gzip
+	#define HTTP_ENC_INFLATE		(0x02u)	// Body is decompressed through httpInflate
+
+	// Length of an ETag including quotes, of the ETag given to a gzip'd 
+	// file sent decompressed, and of an RFC 1123 date
+	#define HTTP_ETAG_LEN			(14u)
+	#define HTTP_ETAG_INFLATED_LEN	(16u)
+	#define HTTP_DATE_LEN			(29u)
+
+	// WebSocket frame header bits
+	#define HTTP_WS_FIN				(0x80u)	// First byte: frame ends its message
+	#define HTTP_WS_OPCODE			(0x0Fu)	// First byte: frame opcode
+	#define HTTP_WS_RSV				(0x70u)	// First byte: extension bits, which must be clear
+	#define HTTP_WS_MASKED			(0x80u)	// Second byte: payload is masked
+	#define HTTP_WS_LEN				(0x7Fu)	// Second byte: payload length or length code
+
+	// WebSocket Close frame status codes
+	#define HTTP_WS_STATUS_NORMAL	(1000u)	// Closing normally
+	#define HTTP_WS_STATUS_PROTOCOL	(1002u)	// Client broke the protocol
+	#define HTTP_WS_STATUS_TOO_BIG	(1009u)	// Frame too large to handle
+
+	// Appended to the Sec-WebSocket-Key before hashing it, per RFC 6455
+	static ROM BYTE HTTP_WS_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
 /****************************************************************************
   Section:
 	HTTP Connection State Global Variables
   ***************************************************************************/
-	HTTP_CONN curHTTP;							// Current HTTP connection state
+	static HTTP_CONN httpConns[MAX_HTTP_CONNECTIONS];	// Extended state for each connection
+	HTTP_CONN *pCurHTTP;						// Current HTTP connection state, accessed through curHTTP
 	HTTP_STUB httpStubs[MAX_HTTP_CONNECTIONS];	// HTTP stubs with state machine and socket
 	BYTE curHTTPID;								// ID of the currently loaded HTTP_CONN
+	static DWORD httpLastSweep;					// Tick when every connection was last visited
+
+	// Dynamic variable index entries read ahead for each connection
+	static struct
+	{
+		HTTP_INDEX_ENTRY entries[HTTP_INDEX_BATCH];
+		BYTE count;								// Number of entries loaded
+		BYTE next;								// Next entry to use
+	} httpIndex[MAX_HTTP_CONNECTIONS];
+
+	#if HTTP_VAR_LEN_CACHE > 0
+	static BYTE httpVarLen[HTTP_VAR_LEN_CACHE];	// ~name~ token lengths learned by callback ID, 0 if unknown
+	#endif
+
+	#if HTTP_RENDER_CACHE_SIZE > 0
+	// Saved output of dynamic variables whose callbacks used HTTPCacheOutput
+	static struct
+	{
+		DWORD dwExpires;						// Tick when the output goes stale, or 0 to keep it until invalidated
+		WORD wCallbackID;						// Callback ID that wrote the output
+		WORD wOffset;							// Start of the output in httpCacheData
+		BYTE bLen;								// Length of the output
+		BYTE bVersion;							// httpCacheVersion when the output was saved
+	} httpCacheEntries[HTTP_RENDER_CACHE_ENTRIES];
+	static BYTE httpCacheData[HTTP_RENDER_CACHE_SIZE];	// Output bytes, allocated in order until full
+	static WORD httpCacheUsed;					// Bytes of httpCacheData allocated
+	static BYTE httpCacheCount;					// Entries of httpCacheEntries in use
+	static BYTE httpCacheVersion;				// Incremented by HTTPCacheInvalidate
+	static BYTE httpCacheUsers;					// Connections replaying a page, during which nothing is saved
+	static BOOL httpCacheWanted;				// The running callback called HTTPCacheOutput
+	static DWORD httpCacheExpires;				// Expiry tick it asked for, or 0 for none
+
+	#define HTTPIsReplaying()	(curHTTP.isReplay)
+	#else
+	#define HTTPIsReplaying()	(FALSE)
+	#endif
+
+	#if defined(HTTP_STATS)
+	static HTTP_STATS_DATA httpStats;			// Request timing statistics
+
+	// Names of the HTTP_STAT histograms in the JSON statistics
+	static ROM char *httpStatNames[HTTP_STAT_COUNT] =
+	{
+		"parse", "open", "execute", "ttfb", "send", "wait", "rate"
+	};
+	#endif
+
+	#if defined(STACK_USE_INFLATE)
+	static INFLATE_CTX httpInflate;				// Decompresses gzip'd files for one connection at a time
+	static BYTE httpInflateOwner;				// Connection using httpInflate, or 0xff if free
+
+	// TRUE if curHTTP.file is stored gzip'd but must be sent decompressed, 
+	// because the client can't accept gzip or variables must be filled in
+	#define HTTPNeedsInflate()	((MPFSGetFlags(curHTTP.file) & MPFS2_FLAG_ISZIPPED) && \
+		(!(curHTTP.encoding & HTTP_ENC_GZIP) || (MPFSGetFlags(curHTTP.file) & MPFS2_FLAG_HASINDEX)))
+	#define HTTPIsInflating()	(curHTTP.encoding & HTTP_ENC_INFLATE)
+	#else
+	#define HTTPNeedsInflate()	(FALSE)
+	#define HTTPIsInflating()	(FALSE)
+	#endif
 
 /****************************************************************************
   Section:
 	Function Prototypes
   ***************************************************************************/
 	static void HTTPHeaderParseLookup(BYTE i);
+	#if defined(HTTP_WEBSOCKET)
+	static void HTTPHeaderParseWebSocketKey(void);
+	static void HTTPWebSocketReadHeader(void);
+	static void HTTPWebSocketUnmask(BYTE* cData, WORD wLen);
+	static void HTTPWebSocketClose(WORD wStatus);
+	#endif
 	#if defined(HTTP_USE_COOKIES)
 	static void HTTPHeaderParseCookie(void);
 	#endif
@@ -178,13 +331,48 @@ static WORD http_mem_wp,http_mem_rp;
 	static void HTTPHeaderParseContentLength(void);
 	static HTTP_READ_STATUS HTTPReadTo(BYTE delim, BYTE* buf, WORD len);
 	#endif
+	static void HTTPHeaderParseConnection(void);
+	static void HTTPHeaderParseIfNoneMatch(void);
+	static void HTTPHeaderParseIfModifiedSince(void);
+	static void HTTPHeaderParseRange(void);
+	static void HTTPHeaderParseIfRange(void);
+	static BOOL HTTPReadRangePosition(BYTE** p, DWORD* dwPos);
+	static void HTTPGetETag(BYTE* cTag, BOOL bInflated);
+	static void HTTPGetLastModified(BYTE* cDate);
+	static void HTTPPutValidators(void);
+	static WORD HTTPReadFile(BYTE* cData, WORD wLen);
+	#if defined(STACK_USE_INFLATE)
+	static void HTTPHeaderParseAcceptEncoding(void);
+	static void HTTPEndInflate(void);
+	#endif
+	#if HTTP_RENDER_CACHE_SIZE > 0
+	static BYTE HTTPCacheFind(WORD wCallbackID);
+	static void HTTPCacheStore(WORD wLen);
+	static DWORD HTTPCacheMeasure(void);
+	static void HTTPCacheRelease(void);
+	#endif
+	#if defined(HTTP_STATS)
+	static void HTTPStatsAdd(BYTE vStat, DWORD dwValue);
+	static void HTTPStatsWait(void);
+	static void HTTPStatsCallback(DWORD dwStart, WORD wLen);
+	static void HTTPStatsEnd(void);
+	static BOOL HTTPStatsPut(void);
+	static BYTE* HTTPStatsAppend(BYTE* cData, ROM char* cName, DWORD dwValue);
+	#endif
 	
 	static void HTTPProcess(void);
 	static BOOL HTTPSendFile(void);
+	static void HTTPNextCallback(void);
 	static void HTTPLoadConn(BYTE hHTTP);
 
 	#if defined(HTTP_MPFS_UPLOAD)
 	static HTTP_IO_RESULT HTTPMPFSUpload(void);
+	static WORD HTTPMPFSUploadData(BYTE* cData, WORD wLen);
+
+	// curHTTP.smPost values of an MPFS upload beyond the bytes of the 
+	// version tag matched so far
+	#define HTTP_MPFS_SKIP		(0xfeu)	// Part doesn't hold an image
+	#define HTTP_MPFS_INSTALLED	(0xffu)	// Image has been written
 	#endif
 
 	#define mMIN(a, b)	((a<b)?a:b)
@@ -215,12 +403,6 @@ static WORD http_mem_wp,http_mem_rp;
   ***************************************************************************/
 void HTTPInit(void)
 {
-	WORD oldPtr;
-
-	// Make sure the file handles are invalidated
-	curHTTP.file = MPFS_INVALID_HANDLE;
-	curHTTP.offsets = MPFS_INVALID_HANDLE;
-		
     for(curHTTPID = 0; curHTTPID < MAX_HTTP_CONNECTIONS; curHTTPID++)
     {
 		smHTTP = SM_HTTP_IDLE;
@@ -229,19 +411,27 @@ void HTTPInit(void)
 		TCPAddSSLListener(sktHTTP, HTTPS_PORT);
 		#endif
 		
-	    // Save the default record (just invalid file handles)
-    	//oldPtr = MACSetWritePtr(BASE_HTTPB_ADDR + curHTTPID*sizeof(HTTP_CONN));
-		oldPtr = http_mem_wp;
-		http_mem_wp = curHTTPID*sizeof(HTTP_CONN);
-
-    	//MACPutArray((BYTE*)&curHTTP, sizeof(HTTP_CONN));
-    	memcpy(&http_memory[http_mem_wp],(BYTE*)&curHTTP, sizeof(HTTP_CONN));
-
-		//MACSetWritePtr(oldPtr);
-		http_mem_wp = oldPtr;
+		// Make sure the file handles are invalidated
+		httpConns[curHTTPID].file = MPFS_INVALID_HANDLE;
+		httpConns[curHTTPID].offsets = MPFS_INVALID_HANDLE;
+		#if HTTP_RENDER_CACHE_SIZE > 0
+		httpConns[curHTTPID].isReplay = FALSE;
+		#endif
     }
 
     curHTTPID = 0;
+    pCurHTTP = &httpConns[0];
+    httpLastSweep = TickGet();
+	#if defined(HTTP_STATS)
+	httpStats.vVersion = HTTP_STATS_VERSION;
+	httpStats.vStats = HTTP_STAT_COUNT;
+	httpStats.vBuckets = HTTP_STATS_BUCKETS;
+	httpStats.vCallbacks = HTTP_STATS_CALLBACKS;
+	httpStats.dwTickRate = TICK_SECOND;
+	#endif
+	#if defined(STACK_USE_INFLATE)
+	httpInflateOwner = 0xff;
+	#endif
 }
 
 
@@ -254,7 +444,10 @@ void HTTPInit(void)
 
   Description:
 	Browses through each open connection and attempts to process any
-	pending operations.
+	pending operations.  Connections that are waiting on their sockets 
+	are only processed once TCPWasActive() reports a segment for them, 
+	or every HTTP_SWEEP_INTERVAL so their timeouts can expire.  Other 
+	connections are processed on every call.
 
   Precondition:
 	HTTPInit() must already be called.
@@ -274,12 +467,19 @@ void HTTPInit(void)
 void HTTPServer(void)
 {
 	BYTE conn;
+	BOOL bSweep, bActive;
+
+	bSweep = (TickGet() - httpLastSweep) >= (DWORD)HTTP_SWEEP_INTERVAL;
+	if(bSweep)
+		httpLastSweep = TickGet();
 
 	for(conn = 0; conn < MAX_HTTP_CONNECTIONS; conn++)
 	{
 		if(httpStubs[conn].socket == INVALID_SOCKET)
 			continue;
 		
+		bActive = TCPWasActive(httpStubs[conn].socket);
+		
 		// If a socket is disconnected at any time 
 		// forget about it and return to idle state.
 		// Must do this here, otherwise we will wait until a new
@@ -288,6 +488,7 @@ void HTTPServer(void)
 		{
 			HTTPLoadConn(conn);
 			smHTTP = SM_HTTP_IDLE;
+			curHTTP.keepAlive = FALSE;
 
 			// Make sure any opened files are closed
 			if(curHTTP.file != MPFS_INVALID_HANDLE)
@@ -300,18 +501,49 @@ void HTTPServer(void)
 				MPFSClose(curHTTP.offsets);
 				curHTTP.offsets = MPFS_INVALID_HANDLE;
 			}
+			#if defined(STACK_USE_INFLATE)
+			HTTPEndInflate();
+			#endif
+			#if HTTP_RENDER_CACHE_SIZE > 0
+			HTTPCacheRelease();
+			#endif
 
 			// Adjust FIFO sizes to half and half.  Default state must remain
 			// here so that SSL handshakes, if required, can proceed
 			TCPAdjustFIFOSize(sktHTTP, 1, 0, TCP_ADJUST_PRESERVE_RX);
 		}
 		
-		// Determine if this connection is eligible for processing
-		if(httpStubs[conn].sm != SM_HTTP_IDLE || TCPIsGetReady(httpStubs[conn].socket))
+		// Determine if this connection is eligible for processing.  Some 
+		// states only make progress once RX data or TX space arrives, 
+		// which always comes with a segment.
+		#if defined(STACK_USE_SSL_SERVER)
+		// Decrypted data can appear after the segment carrying it
+		if(TCPIsSSL(httpStubs[conn].socket))
+			bActive = TRUE;
+		#endif
+		if(!bActive && !bSweep)
 		{
-			HTTPLoadConn(conn);
-			HTTPProcess();
+			switch(httpStubs[conn].sm)
+			{
+				case SM_HTTP_IDLE:
+				case SM_HTTP_PARSE_REQUEST:
+				case SM_HTTP_PARSE_HEADERS:
+				case SM_HTTP_KEEP_ALIVE:
+					continue;
+
+				case SM_HTTP_SERVE_BODY:
+				case SM_HTTP_SEND_FROM_CALLBACK:
+					if(TCPIsPutReady(httpStubs[conn].socket) < HTTP_MIN_CALLBACK_FREE)
+						continue;
+					break;
+
+				default:
+					break;
+			}
 		}
+		
+		HTTPLoadConn(conn);
+		HTTPProcess();
 	}
 }
 
@@ -323,9 +555,8 @@ void HTTPServer(void)
 	Switches the currently loaded connection for the HTTP2 module.
 
   Description:
-	Saves the currently loaded HTTP connection back to Ethernet buffer
-	RAM, then loads the selected connection into curHTTP in local RAM
-	for processing.
+	Points curHTTP at the selected connection's state.  Each connection 
+	keeps its HTTP_CONN in place, so nothing is copied.
 
   Precondition:
 	None
@@ -338,35 +569,10 @@ void HTTPServer(void)
   ***************************************************************************/
 static void HTTPLoadConn(BYTE hHTTP)
 {
-    WORD oldPtr;
-    
-    // Return if already loaded
-    if(hHTTP == curHTTPID)
-    	return;
-    
-    // Save the old one
-    //oldPtr = MACSetWritePtr(BASE_HTTPB_ADDR + curHTTPID*sizeof(HTTP_CONN));
-	//MACPutArray((BYTE*)&curHTTP, sizeof(HTTP_CONN));
-    //MACSetWritePtr(oldPtr);
-
-    oldPtr = http_mem_wp;
-    http_mem_wp = curHTTPID*sizeof(HTTP_CONN);
-    memcpy(&http_memory[http_mem_wp],(BYTE*)&curHTTP, sizeof(HTTP_CONN));
-    http_mem_wp = oldPtr;
-	
-	// Load the new one
-    //oldPtr = MACSetReadPtr(BASE_HTTPB_ADDR + hHTTP*sizeof(HTTP_CONN));
-	//MACGetArray((BYTE*)&curHTTP, sizeof(HTTP_CONN));
-	//MACSetReadPtr(oldPtr);
-	
-    oldPtr = http_mem_rp;
-    http_mem_rp = hHTTP*sizeof(HTTP_CONN);
-    memcpy((BYTE*)&curHTTP, &http_memory[http_mem_rp], sizeof(HTTP_CONN));
-    http_mem_rp = oldPtr;
+	pCurHTTP = &httpConns[hHTTP];
 
 	// Remember which one is loaded
 	curHTTPID = hHTTP;
-			
 }
 
 /*****************************************************************************
@@ -392,6 +598,12 @@ static void HTTPProcess(void)
     BOOL isDone;
 	BYTE *ext;
 	BYTE buffer[HTTP_MAX_HEADER_LEN+1];
+	#if HTTP_RENDER_CACHE_SIZE > 0
+	DWORD dwLen;
+	#endif
+	#if defined(HTTP_STATS)
+	DWORD dwTick;
+	#endif
 
     do
     {
@@ -412,16 +624,36 @@ static void HTTPProcess(void)
 				smHTTP = SM_HTTP_PARSE_REQUEST;
 				curHTTP.isAuthorized = 0xff;
 				curHTTP.hasArgs = FALSE;
+				curHTTP.conditional = 0x0000;
+				#if defined(STACK_USE_INFLATE)
+				curHTTP.encoding = 0x00;
+				#endif
 				curHTTP.callbackID = TickGet() + HTTP_TIMEOUT*TICK_SECOND;
 				curHTTP.callbackPos = 0xffffffff;
 				curHTTP.byteCount = 0;
 				#if defined(HTTP_USE_POST)
 				curHTTP.smPost = 0x00;
+				curHTTP.smPart = HTTP_PART_START;
+				#endif
+				#if defined(HTTP_WEBSOCKET)
+				curHTTP.wsFlags = 0x00;
+				#endif
+				#if defined(HTTP_STATS)
+				curHTTP.statStart = TickGet();
+				curHTTP.statBlocked = 0;
+				curHTTP.statWait = 0;
+				curHTTP.statBytes = 0;
 				#endif
 				
 				// Adjust the TCP FIFOs for optimal reception of 
-				// the next HTTP request from the browser
-				TCPAdjustFIFOSize(sktHTTP, 1, 0, TCP_ADJUST_PRESERVE_RX | TCP_ADJUST_GIVE_REST_TO_RX);
+				// the next HTTP request from the browser.  Persistent 
+				// connections split them evenly, so the response can 
+				// start without discarding further pipelined requests.
+				if(curHTTP.keepAlive)
+					TCPAdjustFIFOSize(sktHTTP, 1, 0, TCP_ADJUST_PRESERVE_RX);
+				else
+					TCPAdjustFIFOSize(sktHTTP, 1, 0, TCP_ADJUST_PRESERVE_RX | TCP_ADJUST_GIVE_REST_TO_RX);
+				curHTTP.keepAlive = FALSE;
  			}
  			else
  				// Don't break for new connections.  There may be 
@@ -451,16 +683,17 @@ static void HTTPProcess(void)
 			// Reset the watchdog timer
 			curHTTP.callbackID = TickGet() + HTTP_TIMEOUT*TICK_SECOND;
 
-			// Determine the request method
+			// Determine the request method.  Its length alone tells the 
+			// supported methods apart, leaving one comparison to confirm it.
 			lenA = TCPFind(sktHTTP, ' ', 0, FALSE);
 			if(lenA > 5)
 				lenA = 5;
 			TCPGetArray(sktHTTP, curHTTP.data, lenA+1);
 
-		    if ( memcmppgm2ram(curHTTP.data, (ROM void*)"GET", 3) == 0)
+		    if (lenA == 3u && memcmppgm2ram(curHTTP.data, (ROM void*)"GET", 3) == 0)
 			    curHTTP.httpStatus = HTTP_GET;
 			#if defined(HTTP_USE_POST)
-		    else if ( memcmppgm2ram(curHTTP.data, (ROM void*)"POST", 4) == 0)
+		    else if (lenA == 4u && memcmppgm2ram(curHTTP.data, (ROM void*)"POST", 4) == 0)
 			    curHTTP.httpStatus = HTTP_POST;
 			#endif
 		    else
@@ -508,6 +741,61 @@ static void HTTPProcess(void)
 			}
 			#endif
 			
+			// Check if this is a request for the event stream
+			#if defined(HTTP_EVENT_STREAM)
+			if(curHTTP.httpStatus == HTTP_GET &&
+				strcmppgm2ram((char*)&curHTTP.data[1], (ROM char*)HTTP_EVENT_STREAM) == 0)
+			{// Read remainder of line, and bypass all file opening, etc.
+				#if defined(HTTP_USE_AUTHENTICATION)
+				curHTTP.isAuthorized = HTTPNeedsAuth(&curHTTP.data[1]);
+				#endif
+				curHTTP.httpStatus = HTTP_EVENTS;
+
+				smHTTP = SM_HTTP_PARSE_HEADERS;
+				isDone = FALSE;
+				break;
+			}
+			#endif
+			
+			// Check if this is a request to open the WebSocket
+			#if defined(HTTP_WEBSOCKET)
+			if(curHTTP.httpStatus == HTTP_GET &&
+				strcmppgm2ram((char*)&curHTTP.data[1], (ROM char*)HTTP_WEBSOCKET) == 0)
+			{// Read remainder of line, and bypass all file opening, etc.
+				#if defined(HTTP_USE_AUTHENTICATION)
+				curHTTP.isAuthorized = HTTPNeedsAuth(&curHTTP.data[1]);
+				#endif
+				curHTTP.httpStatus = HTTP_WS_UPGRADE;
+
+				smHTTP = SM_HTTP_PARSE_HEADERS;
+				isDone = FALSE;
+				break;
+			}
+			#endif
+			
+			// Check if this is a request for the statistics
+			#if defined(HTTP_STATS)
+			if(curHTTP.httpStatus == HTTP_GET &&
+				(strcmppgm2ram((char*)&curHTTP.data[1], (ROM char*)HTTP_STATS) == 0 ||
+				strcmppgm2ram((char*)&curHTTP.data[1], (ROM char*)HTTP_STATS ".bin") == 0))
+			{// Read remainder of line, and bypass all file opening, etc.
+				#if defined(HTTP_USE_AUTHENTICATION)
+				curHTTP.isAuthorized = HTTPNeedsAuth(&curHTTP.data[1]);
+				#endif
+				curHTTP.httpStatus = HTTP_STATS_JSON;
+				if(curHTTP.data[1 + strlenpgm((ROM char*)HTTP_STATS)] != '\0')
+					curHTTP.httpStatus = HTTP_STATS_BINARY;
+
+				smHTTP = SM_HTTP_PARSE_HEADERS;
+				isDone = FALSE;
+				break;
+			}
+			#endif
+			
+			#if defined(HTTP_STATS)
+			curHTTP.statMark = TickGet();
+			#endif
+
 			// If the last character is a not a directory delimiter, then try to open the file
 			// String starts at 2nd character, because the first is always a '/'
 			if(curHTTP.data[lenB-1] != '/')
@@ -537,17 +825,25 @@ static void HTTPProcess(void)
 				// Try to open again
 				curHTTP.file = MPFSOpen(&curHTTP.data[1]);
 			}
+			#if defined(HTTP_STATS)
+			HTTPStatsAdd(HTTP_STAT_OPEN, TickGet() - curHTTP.statMark);
+			#endif
 			
 			// Find the extension in the filename
 			for(ext = curHTTP.data + lenB-1; ext != curHTTP.data; ext--)
 				if(*ext == '.')
 					break;
 					
-			// Compare to known extensions to determine Content-Type
+			// Look up the extension to determine Content-Type
 			ext++;
-			for(curHTTP.fileType = HTTP_TXT; curHTTP.fileType < HTTP_UNKNOWN; curHTTP.fileType++)
-				if(!stricmppgm2ram(ext, (ROM void*)httpFileExtensions[curHTTP.fileType]))
-					break;
+			lenA = (WORD)(curHTTP.data + lenB - ext);
+			curHTTP.fileType = HTTP_UNKNOWN;
+			if(lenA != 0u)
+			{
+				i = httpExtensionSlots[HTTPNameHash(ext, lenA)];
+				if(i != 0xffu && !stricmppgm2ram(ext, (ROM BYTE*)httpFileExtensions[i]))
+					curHTTP.fileType = (HTTP_FILE_TYPE)i;
+			}
 			
 			// Perform first round authentication (pass file name only)
 			#if defined(HTTP_USE_AUTHENTICATION)
@@ -586,8 +882,12 @@ static void HTTPProcess(void)
 
 			}
 
-			// Clear the rest of the line
+			// HTTP/1.1 connections persist unless the client asks otherwise
 			lenA = TCPFind(sktHTTP, '\n', 0, FALSE);
+			if(TCPFindROMArrayEx(sktHTTP, (ROM BYTE*)"HTTP/1.1", 8, 0, lenA, FALSE) != 0xffff)
+				curHTTP.keepAlive = TRUE;
+
+			// Clear the rest of the line
 			TCPGetArray(sktHTTP, NULL, lenA + 1);
 
 			// Move to parsing the headers
@@ -626,6 +926,9 @@ static void HTTPProcess(void)
 				if(lenA == 1)
 				{// Remove the CRLF and move to next state
 					TCPGetArray(sktHTTP, NULL, 2);
+					#if defined(HTTP_STATS)
+					HTTPStatsAdd(HTTP_STAT_PARSE, TickGet() - curHTTP.statStart);
+					#endif
 					smHTTP = SM_HTTP_AUTHENTICATE;
 					isDone = FALSE;
 					break;
@@ -635,27 +938,24 @@ static void HTTPProcess(void)
 				lenB = TCPFindEx(sktHTTP, ':', 0, lenA, FALSE) + 2;
 				isDone = FALSE;
 	
-				// If name is too long or this line isn't a header, ignore it
-				if(lenB > sizeof(buffer))
+				// If name is empty or too long, or this line isn't a header, ignore it
+				if(lenB < 3u || lenB > sizeof(buffer))
 				{
 					TCPGetArray(sktHTTP, NULL, lenA+1);
 					continue;
 				}
 				
-				// Read in the header name
+				// Read in the header name, dropping its colon
 				TCPGetArray(sktHTTP, buffer, lenB);
-				buffer[lenB-1] = '\0';
+				buffer[lenB-2] = '\0';
 				lenA -= lenB;
 		
-				// Compare header read to ones we're interested in
-				for(i = 0; i < HTTP_NUM_HEADERS; i++)
+				// Parse the header if it's one we're interested in
+				i = httpHeaderSlots[HTTPNameHash(buffer, lenB-2)];
+				if(i != 0xffu && stricmppgm2ram(buffer, (ROM BYTE*)HTTPRequestHeaders[i]) == 0)
 				{
-					if(strcmppgm2ram((char*)buffer, (ROM char *)HTTPRequestHeaders[i]) == 0)
-					{// Parse the header and stop the loop
-						HTTPHeaderParseLookup(i);
-						isDone = TRUE;
-						break;
-					}
+					HTTPHeaderParseLookup(i);
+					isDone = TRUE;
 				}
 				
 				// Clear the rest of the line, and call the loop again
@@ -700,8 +1000,43 @@ static void HTTPProcess(void)
 				break;
 			}
 			#endif
+
+			// Event streams have no file or arguments to process
+			#if defined(HTTP_EVENT_STREAM)
+			if(curHTTP.httpStatus == HTTP_EVENTS)
+			{
+				smHTTP = SM_HTTP_SERVE_HEADERS;
+				isDone = FALSE;
+				break;
+			}
+			#endif
+
+			// Neither do WebSockets, which can only open with a valid key
+			#if defined(HTTP_WEBSOCKET)
+			if(curHTTP.httpStatus == HTTP_WS_UPGRADE)
+			{
+				if(!(curHTTP.wsFlags & HTTP_WS_KEY))
+					curHTTP.httpStatus = HTTP_WS_BAD_REQUEST;
+				smHTTP = SM_HTTP_SERVE_HEADERS;
+				isDone = FALSE;
+				break;
+			}
+			#endif
+
+			// The statistics are generated by the server itself
+			#if defined(HTTP_STATS)
+			if(curHTTP.httpStatus == HTTP_STATS_JSON || curHTTP.httpStatus == HTTP_STATS_BINARY)
+			{
+				smHTTP = SM_HTTP_SERVE_HEADERS;
+				isDone = FALSE;
+				break;
+			}
+			#endif
 			
 			// Move on to GET args, unless there are none
+			#if defined(HTTP_STATS)
+			curHTTP.statMark = TickGet();
+			#endif
 			smHTTP = SM_HTTP_PROCESS_GET;
 			if(!curHTTP.hasArgs)
 				smHTTP = SM_HTTP_PROCESS_POST;
@@ -783,6 +1118,9 @@ static void HTTPProcess(void)
 			#endif
 
 			// We're done with POST
+			#if defined(HTTP_STATS)
+			HTTPStatsAdd(HTTP_STAT_EXECUTE, TickGet() - curHTTP.statMark);
+			#endif
 			smHTTP = SM_HTTP_PROCESS_REQUEST;
 			// No break, continue to sending request
 
@@ -797,29 +1135,112 @@ static void HTTPProcess(void)
                 break;
             }
 
+			// Answer a conditional GET for an unchanged static file 
+			// without reading any of its data.  If-None-Match takes 
+			// precedence over If-Modified-Since when both are sent.  
+			// HTTPExecuteGet sets hasArgs to the number of cookies it 
+			// left in curHTTP.data, and those are only sent by 
+			// SM_HTTP_SERVE_COOKIES on a full response.
+			if(curHTTP.httpStatus == HTTP_GET && !curHTTP.hasArgs &&
+				!(MPFSGetFlags(curHTTP.file) & MPFS2_FLAG_HASINDEX))
+			{
+				if((curHTTP.conditional & HTTP_COND_ETAG_SENT) ?
+					(curHTTP.conditional & (HTTPNeedsInflate() ? HTTP_COND_ETAG_INFLATED : HTTP_COND_ETAG_MATCH)) :
+					(curHTTP.conditional & HTTP_COND_DATE_MATCH))
+				{
+					curHTTP.httpStatus = HTTP_NOT_MODIFIED;
+					smHTTP = SM_HTTP_SERVE_HEADERS;
+					isDone = FALSE;
+					break;
+				}
+
+				// Serve only the requested byte range, unless If-Range 
+				// shows the client's partial copy is of an older file.  
+				// Decompressed files are always sent whole.
+				if(!HTTPNeedsInflate() && (!(curHTTP.conditional & HTTP_COND_IFRANGE_SENT) ||
+					(curHTTP.conditional & HTTP_COND_IFRANGE_MATCH)))
+				{
+					if(curHTTP.conditional & HTTP_COND_RANGE_BAD)
+					{
+						curHTTP.httpStatus = HTTP_RANGE_NOT_SATISFIABLE;
+						smHTTP = SM_HTTP_SERVE_HEADERS;
+						isDone = FALSE;
+						break;
+					}
+					if(curHTTP.conditional & HTTP_COND_RANGE)
+					{
+						MPFSSeek(curHTTP.file, curHTTP.rangeStart, MPFS_SEEK_START);
+						curHTTP.conditional |= HTTP_COND_PARTIAL;
+					}
+				}
+			}
+
+			// Claim the decompressor, waiting while another connection 
+			// is using it
+			#if defined(STACK_USE_INFLATE)
+			if(HTTPNeedsInflate())
+			{
+				if(httpInflateOwner != 0xffu)
+					break;
+				if(!InflateInit(&httpInflate, curHTTP.file))
+				{
+					curHTTP.httpStatus = HTTP_INTERNAL_SERVER_ERROR;
+					smHTTP = SM_HTTP_SERVE_HEADERS;
+					isDone = FALSE;
+					break;
+				}
+				httpInflateOwner = curHTTPID;
+				curHTTP.encoding |= HTTP_ENC_INFLATE;
+			}
+			#endif
+
 			// Set up the dynamic substitutions
 			curHTTP.byteCount = 0;
-			if(curHTTP.offsets == MPFS_INVALID_HANDLE)
-            {// If no index file, then set next offset to huge
-	            curHTTP.nextCallback = 0xffffffff;
-            }
-            else
-            {// Read in the next callback index
-	            MPFSGetLong(curHTTP.offsets, &(curHTTP.nextCallback));
-			}
+			httpIndex[curHTTPID].count = 0;
+			httpIndex[curHTTPID].next = 0;
+			HTTPNextCallback();
 			
 			// Move to next state
 			smHTTP = SM_HTTP_SERVE_HEADERS;
 
 		case SM_HTTP_SERVE_HEADERS:
 
+			#if defined(HTTP_STATS)
+			if(httpStats.dwRequests != 0xffffffffu)
+				httpStats.dwRequests++;
+			HTTPStatsAdd(HTTP_STAT_TTFB, TickGet() - curHTTP.statStart);
+			curHTTP.statMark = TickGet();
+			#endif
+
 			// We're in write mode now:
 			// Adjust the TCP FIFOs for optimal transmission of 
 			// the HTTP response to the browser
-			TCPAdjustFIFOSize(sktHTTP, 1, 0, TCP_ADJUST_GIVE_REST_TO_TX);
+			#if defined(HTTP_WEBSOCKET)
+			if(curHTTP.httpStatus == HTTP_WS_UPGRADE)
+			{// WebSockets receive as much as they send, so split the FIFOs evenly
+				TCPAdjustFIFOSize(sktHTTP, 1, 0, TCP_ADJUST_GIVE_REST_TO_RX | TCP_ADJUST_GIVE_REST_TO_TX | TCP_ADJUST_PRESERVE_RX);
+			}
+			else
+			#endif
+			if(curHTTP.keepAlive && TCPIsGetReady(sktHTTP))
+			{// Pipelined requests are waiting, so they must be preserved.
+			 // If the RX FIFO can't shrink around them, keep the current 
+			 // split, or close after this response if TX has no room.
+				if(!TCPAdjustFIFOSize(sktHTTP, 1, 0, TCP_ADJUST_GIVE_REST_TO_TX | TCP_ADJUST_PRESERVE_RX) &&
+					TCPIsPutReady(sktHTTP) < HTTP_MIN_CALLBACK_FREE)
+				{
+					curHTTP.keepAlive = FALSE;
+					TCPAdjustFIFOSize(sktHTTP, 1, 0, TCP_ADJUST_GIVE_REST_TO_TX);
+				}
+			}
+			else
+				TCPAdjustFIFOSize(sktHTTP, 1, 0, TCP_ADJUST_GIVE_REST_TO_TX);
 				
 			// Send headers
-			TCPPutROMString(sktHTTP, (ROM BYTE*)HTTPResponseHeaders[curHTTP.httpStatus]);
+			if(curHTTP.conditional & HTTP_COND_PARTIAL)
+				TCPPutROMString(sktHTTP, (ROM BYTE*)"HTTP/1.1 206 Partial Content\r\n");
+			else
+				TCPPutROMString(sktHTTP, (ROM BYTE*)HTTPResponseHeaders[curHTTP.httpStatus]);
 			
 			// If this is a redirect, print the rest of the Location: header			   
 			if(curHTTP.httpStatus == HTTP_REDIRECT)
@@ -830,6 +1251,79 @@ static void HTTPProcess(void)
 				TCPPutROMString(sktHTTP, (ROM BYTE*)HTTP_CRLF);
 			}
 
+			// If the range was unsatisfiable, finish the Content-Range: header
+			if(curHTTP.httpStatus == HTTP_RANGE_NOT_SATISFIABLE)
+			{
+				ultoa(MPFSGetSize(curHTTP.file), buffer);
+				TCPPutString(sktHTTP, buffer);
+				TCPPutROMString(sktHTTP, (ROM BYTE*)"\r\n\r\n416 Range Not Satisfiable\r\n");
+			}
+
+			// A 304 repeats the validators and has no body, so a 
+			// persistent connection can go straight back to waiting
+			if(curHTTP.httpStatus == HTTP_NOT_MODIFIED)
+			{
+				HTTPPutValidators();
+				MPFSClose(curHTTP.file);
+				curHTTP.file = MPFS_INVALID_HANDLE;
+				if(curHTTP.keepAlive)
+				{
+					TCPPutROMString(sktHTTP, (ROM BYTE*)"Connection: keep-alive\r\n\r\n");
+					TCPFlush(sktHTTP);
+					curHTTP.callbackID = TickGet() + HTTP_KEEP_ALIVE_TIMEOUT*TICK_SECOND;
+					smHTTP = SM_HTTP_KEEP_ALIVE;
+				}
+				else
+				{
+					TCPPutROMString(sktHTTP, (ROM BYTE*)"Connection: close\r\n\r\n");
+					smHTTP = SM_HTTP_DISCONNECT;
+				}
+				break;
+			}
+
+			// Event streams stay open, sending events as the application 
+			// provides them
+			#if defined(HTTP_EVENT_STREAM)
+			if(curHTTP.httpStatus == HTTP_EVENTS)
+			{
+				curHTTP.keepAlive = FALSE;
+				curHTTP.callbackPos = 0;
+				curHTTP.callbackID = TickGet() + HTTP_EVENT_HEARTBEAT*TICK_SECOND;
+				TCPFlush(sktHTTP);
+				smHTTP = SM_HTTP_SERVE_EVENTS;
+				break;
+			}
+			#endif
+
+			// Finish the handshake, after which the connection carries 
+			// WebSocket frames in both directions
+			#if defined(HTTP_WEBSOCKET)
+			if(curHTTP.httpStatus == HTTP_WS_UPGRADE)
+			{
+				TCPPutArray(sktHTTP, curHTTP.wsAccept, HTTP_WS_ACCEPT_LEN);
+				TCPPutROMString(sktHTTP, (ROM BYTE*)"\r\n\r\n");
+				curHTTP.keepAlive = FALSE;
+				curHTTP.callbackPos = 0;
+				curHTTP.byteCount = 0;
+				curHTTP.callbackID = TickGet() + HTTP_WEBSOCKET_PING*TICK_SECOND;
+				TCPFlush(sktHTTP);
+				smHTTP = SM_HTTP_SERVE_WEBSOCKET;
+				break;
+			}
+			#endif
+
+			// The statistics have no length until they are written
+			#if defined(HTTP_STATS)
+			if(curHTTP.httpStatus == HTTP_STATS_JSON || curHTTP.httpStatus == HTTP_STATS_BINARY)
+			{
+				curHTTP.keepAlive = FALSE;
+				curHTTP.callbackPos = 0;
+				smHTTP = SM_HTTP_SERVE_STATS;
+				isDone = FALSE;
+				break;
+			}
+			#endif
+
 			// If not GET or POST, we're done
 			if(curHTTP.httpStatus != HTTP_GET && curHTTP.httpStatus != HTTP_POST)
 			{// Disconnect
@@ -837,6 +1331,66 @@ static void HTTPProcess(void)
 				break;
 			}
 
+			// Dynamic pages have no length until their callbacks have 
+			// run, unless the render cache already holds all of their 
+			// output
+			#if HTTP_RENDER_CACHE_SIZE > 0
+			if(curHTTP.httpStatus == HTTP_GET && curHTTP.nextCallback != 0xffffffff)
+			{
+				dwLen = HTTPCacheMeasure();
+				if(dwLen != 0xffffffff)
+				{
+					curHTTP.isReplay = TRUE;
+					httpCacheUsers++;
+				}
+			}
+			#endif
+
+			// Only responses of known length can persist.  POSTs always 
+			// close in case the application left part of the body unread.
+			if(curHTTP.httpStatus != HTTP_GET || (curHTTP.nextCallback != 0xffffffff && !HTTPIsReplaying()))
+				curHTTP.keepAlive = FALSE;
+			if(curHTTP.keepAlive)
+				TCPPutROMString(sktHTTP, (ROM BYTE*)"Connection: keep-alive\r\n");
+			else
+				TCPPutROMString(sktHTTP, (ROM BYTE*)"Connection: close\r\n");
+
+			// Static files have a known length, which persistent 
+			// connections and byte ranges must report
+			if(curHTTP.conditional & HTTP_COND_PARTIAL)
+			{
+				TCPPutROMString(sktHTTP, (ROM BYTE*)"Content-Range: bytes ");
+				ultoa(curHTTP.rangeStart, buffer);
+				TCPPutString(sktHTTP, buffer);
+				TCPPut(sktHTTP, '-');
+				ultoa(curHTTP.rangeEnd, buffer);
+				TCPPutString(sktHTTP, buffer);
+				TCPPut(sktHTTP, '/');
+				ultoa(MPFSGetSize(curHTTP.file), buffer);
+				TCPPutString(sktHTTP, buffer);
+				TCPPutROMString(sktHTTP, (ROM BYTE*)"\r\nContent-Length: ");
+				ultoa(curHTTP.rangeEnd - curHTTP.rangeStart + 1, buffer);
+				TCPPutString(sktHTTP, buffer);
+				TCPPutROMString(sktHTTP, HTTP_CRLF);
+			}
+			else if(curHTTP.keepAlive || HTTPIsReplaying())
+			{
+				TCPPutROMString(sktHTTP, (ROM BYTE*)"Content-Length: ");
+				#if HTTP_RENDER_CACHE_SIZE > 0
+				if(HTTPIsReplaying())
+					ultoa(dwLen, buffer);
+				else
+				#endif
+				#if defined(STACK_USE_INFLATE)
+				if(HTTPIsInflating())
+					ultoa(httpInflate.dwSize, buffer);
+				else
+				#endif
+				ultoa(MPFSGetSize(curHTTP.file), buffer);
+				TCPPutString(sktHTTP, buffer);
+				TCPPutROMString(sktHTTP, HTTP_CRLF);
+			}
+
 			// Output the content type, if known
 			if(curHTTP.fileType != HTTP_UNKNOWN)
 			{
@@ -846,23 +1400,29 @@ static void HTTPProcess(void)
 			}
 			
 			// Output the gzip encoding header if needed
-			if(MPFSGetFlags(curHTTP.file) & MPFS2_FLAG_ISZIPPED)
+			if((MPFSGetFlags(curHTTP.file) & MPFS2_FLAG_ISZIPPED) && !HTTPIsInflating())
 			{
 				TCPPutROMString(sktHTTP, (ROM BYTE*)"Content-Encoding: gzip\r\n");
 			}
 						
 			// Output the cache-control
-			TCPPutROMString(sktHTTP, (ROM BYTE*)"Cache-Control: ");
 			if(curHTTP.httpStatus == HTTP_POST || curHTTP.nextCallback != 0xffffffff)
 			{// This is a dynamic page or a POST request, so no cache
-				TCPPutROMString(sktHTTP, (ROM BYTE*)"no-cache");
+				TCPPutROMString(sktHTTP, (ROM BYTE*)"Cache-Control: no-cache\r\n");
 			}
 			else
 			{// This is a static page, so save it for the specified amount of time
-				TCPPutROMString(sktHTTP, (ROM BYTE*)"max-age=");
-				TCPPutROMString(sktHTTP, (ROM BYTE*)HTTP_CACHE_LEN);
+			 // and let the browser revalidate or resume it afterwards
+				HTTPPutValidators();
+				if(!HTTPIsInflating())
+					TCPPutROMString(sktHTTP, (ROM BYTE*)"Accept-Ranges: bytes\r\n");
+
+				// gzip'd files are sent decompressed to some clients
+				#if defined(STACK_USE_INFLATE)
+				if(MPFSGetFlags(curHTTP.file) & MPFS2_FLAG_ISZIPPED)
+					TCPPutROMString(sktHTTP, (ROM BYTE*)"Vary: Accept-Encoding\r\n");
+				#endif
 			}
-			TCPPutROMString(sktHTTP, HTTP_CRLF);
 			
 			// Check if we should output cookies
 			if(curHTTP.hasArgs)
@@ -934,14 +1494,38 @@ static void HTTPProcess(void)
 		case SM_HTTP_SERVE_BODY:
 
 			isDone = FALSE;
+			#if defined(HTTP_STATS)
+			HTTPStatsWait();
+			#endif
 
 			// Try to send next packet
 			if(HTTPSendFile())
 			{// If EOF, then we're done so close and disconnect
+				#if defined(STACK_USE_INFLATE)
+				// The end of the stream follows the last byte of output, and 
+				// a corrupt file ends short of its Content-Length or past it
+				if(HTTPIsInflating() && (InflateGetArray(&httpInflate, NULL, 1) != 0u || !InflateIsDone(&httpInflate)))
+					curHTTP.keepAlive = FALSE;
+				HTTPEndInflate();
+				#endif
+				#if HTTP_RENDER_CACHE_SIZE > 0
+				HTTPCacheRelease();
+				#endif
+				#if defined(HTTP_STATS)
+				HTTPStatsEnd();
+				#endif
 				MPFSClose(curHTTP.file);
 				curHTTP.file = MPFS_INVALID_HANDLE;
 				smHTTP = SM_HTTP_DISCONNECT;
 				isDone = TRUE;
+
+				// Persistent connections wait for the next request instead
+				if(curHTTP.keepAlive)
+				{
+					TCPFlush(sktHTTP);
+					curHTTP.callbackID = TickGet() + HTTP_KEEP_ALIVE_TIMEOUT*TICK_SECOND;
+					smHTTP = SM_HTTP_KEEP_ALIVE;
+				}
 			}
 			
 			// If the TX FIFO is full, then return to main app loop
@@ -952,13 +1536,57 @@ static void HTTPProcess(void)
 		case SM_HTTP_SEND_FROM_CALLBACK:
 
 			isDone = TRUE;
+			#if defined(HTTP_STATS)
+			HTTPStatsWait();
+			#endif
 
 			// Check that at least the minimum bytes are free
 			if(TCPIsPutReady(sktHTTP) < HTTP_MIN_CALLBACK_FREE)
 				break;
 
+			#if HTTP_RENDER_CACHE_SIZE > 0
+			// Send saved output instead, if there is any.  Other 
+			// connections may replace it at any time, so it must be 
+			// sent in one go unless this response is replaying, which 
+			// freezes the cache.
+			i = HTTPCacheFind(curHTTP.callbackID);
+			if(i != 0xffu && (HTTPIsReplaying() || (curHTTP.callbackPos == 0u && TCPIsPutReady(sktHTTP) >= httpCacheEntries[i].bLen)))
+			{
+				lenA = TCPPutArray(sktHTTP, &httpCacheData[httpCacheEntries[i].wOffset + curHTTP.callbackPos], httpCacheEntries[i].bLen - curHTTP.callbackPos);
+				curHTTP.callbackPos += lenA;
+				#if defined(HTTP_STATS)
+				curHTTP.statBytes += lenA;
+				#endif
+				if(curHTTP.callbackPos == httpCacheEntries[i].bLen)
+				{
+					curHTTP.callbackPos = 0;
+					isDone = FALSE;
+					smHTTP = SM_HTTP_SERVE_BODY;
+				}
+				break;
+			}
+
+			// Note whether the callback starts its output now, so it can 
+			// be saved if the callback asks for that and writes it all
+			c = (curHTTP.callbackPos == 0u);
+			httpCacheWanted = FALSE;
+			#endif
+			lenA = TCPIsPutReady(sktHTTP);
+			#if defined(HTTP_STATS)
+			dwTick = TickGet();
+			#endif
+
 			// Fill TX FIFO from callback
 			HTTPPrint(curHTTP.callbackID);
+			lenA -= TCPIsPutReady(sktHTTP);
+
+			#if defined(HTTP_STATS)
+			HTTPStatsCallback(dwTick, lenA);
+			#endif
+			#if HTTP_RENDER_CACHE_SIZE > 0
+			if(httpCacheWanted && c && curHTTP.callbackPos == 0u)
+				HTTPCacheStore(lenA);
+			#endif
 			
 			if(curHTTP.callbackPos == 0)
 			{// Callback finished its output, so move on
@@ -980,23 +1608,136 @@ static void HTTPProcess(void)
 				MPFSClose(curHTTP.offsets);
 				curHTTP.offsets = MPFS_INVALID_HANDLE;
 			}
+			#if defined(STACK_USE_INFLATE)
+			HTTPEndInflate();
+			#endif
+			#if HTTP_RENDER_CACHE_SIZE > 0
+			HTTPCacheRelease();
+			#endif
 
 			TCPDisconnect(sktHTTP);
             smHTTP = SM_HTTP_IDLE;
             break;
-		}
-	} while(!isDone);
-
-}
-
 
-/*****************************************************************************
-  Function:
+		case SM_HTTP_KEEP_ALIVE:
+			// Close connections the client has abandoned or left idle 
+			// too long, so the socket goes back to listening
+			if(!TCPIsConnected(sktHTTP) || (LONG)(TickGet() - curHTTP.callbackID) > (LONG)0)
+			{
+				smHTTP = SM_HTTP_DISCONNECT;
+				isDone = FALSE;
+				break;
+			}
+
+			// The FIFOs can't be resized until the last response has 
+			// been acknowledged, so leave pipelined requests in the RX 
+			// FIFO until then
+			if(TCPGetTxFIFOFull(sktHTTP) != 0u)
+				break;
+
+			if(TCPIsGetReady(sktHTTP))
+			{
+				smHTTP = SM_HTTP_IDLE;
+				isDone = FALSE;
+			}
+			break;
+
+		#if defined(HTTP_EVENT_STREAM)
+		case SM_HTTP_SERVE_EVENTS:
+			// Nothing more is expected from the client
+			TCPDiscard(sktHTTP);
+
+			// Check that at least the minimum bytes are free
+			lenA = TCPIsPutReady(sktHTTP);
+			if(lenA < HTTP_MIN_CALLBACK_FREE)
+				break;
+
+			if(HTTPExecuteEvents() == HTTP_IO_DONE)
+			{
+				smHTTP = SM_HTTP_DISCONNECT;
+				isDone = FALSE;
+				break;
+			}
+
+			// Push new events out immediately, and send a comment when 
+			// the stream has been silent too long
+			if(TCPIsPutReady(sktHTTP) == lenA &&
+				(LONG)(TickGet() - curHTTP.callbackID) > (LONG)0)
+				TCPPutROMString(sktHTTP, (ROM BYTE*)":\n");
+			if(TCPIsPutReady(sktHTTP) != lenA)
+			{
+				TCPFlush(sktHTTP);
+				curHTTP.callbackID = TickGet() + HTTP_EVENT_HEARTBEAT*TICK_SECOND;
+			}
+			break;
+		#endif
+
+		#if defined(HTTP_WEBSOCKET)
+		case SM_HTTP_SERVE_WEBSOCKET:
+			lenA = TCPIsPutReady(sktHTTP);
+
+			// Answer control frames and find the start of the next message
+			HTTPWebSocketReadHeader();
+
+			// Let the application read and write messages
+			if(!(curHTTP.wsFlags & HTTP_WS_CLOSED) && 
+				TCPIsPutReady(sktHTTP) >= HTTP_MIN_CALLBACK_FREE)
+			{
+				if(HTTPExecuteWebSocket() == HTTP_IO_DONE)
+					HTTPWebSocketClose(HTTP_WS_STATUS_NORMAL);
+				curHTTP.wsFlags &= ~HTTP_WS_RX_END;
+			}
+
+			// Nothing may follow a Close frame
+			if(curHTTP.wsFlags & HTTP_WS_CLOSED)
+			{
+				smHTTP = SM_HTTP_DISCONNECT;
+				isDone = FALSE;
+				break;
+			}
+
+			// Push new frames out immediately, and ping the client when 
+			// the connection has been silent too long
+			if(TCPIsPutReady(sktHTTP) == lenA && lenA >= 2u &&
+				(LONG)(TickGet() - curHTTP.callbackID) > (LONG)0)
+			{
+				TCPPut(sktHTTP, HTTP_WS_FIN | HTTP_WS_PING);
+				TCPPut(sktHTTP, 0x00);
+			}
+			if(TCPIsPutReady(sktHTTP) != lenA)
+			{
+				TCPFlush(sktHTTP);
+				curHTTP.callbackID = TickGet() + HTTP_WEBSOCKET_PING*TICK_SECOND;
+			}
+			break;
+		#endif
+
+		#if defined(HTTP_STATS)
+		case SM_HTTP_SERVE_STATS:
+			// Write as much of the statistics as fits, then close
+			if(HTTPStatsPut())
+			{
+				smHTTP = SM_HTTP_DISCONNECT;
+				isDone = FALSE;
+			}
+			break;
+		#endif
+		}
+	} while(!isDone);
+
+}
+
+
+/*****************************************************************************
+  Function:
 	static BOOL HTTPSendFile(void)
 
   Description:
 	Serves up the next chunk of curHTTP's file, up to a) available TX FIFO
-	space or b) the next callback index, whichever comes first.
+	space or b) the next callback index, whichever comes first.  Once no
+	callbacks remain, the rest of the file is queued with TCPSendFile()
+	instead of being copied through the TX FIFO, unless it is being 
+	decompressed.
 
   Precondition:
 	curHTTP.file and curHTTP.offsets have both been opened for reading.
@@ -1011,17 +1752,47 @@ static void HTTPProcess(void)
 static BOOL HTTPSendFile(void)
 {
 	WORD numBytes, len;
+	DWORD dwRem;
 	BYTE c, data[64];
+	HTTP_INDEX_ENTRY *entry;
 	
 	// Determine how many bytes we can read right now
 	len = TCPIsPutReady(sktHTTP);
-	numBytes = mMIN(len, curHTTP.nextCallback - curHTTP.byteCount);
+
+	// Past the last dynamic variable, the rest of the file (or of the 
+	// requested range) is handed to TCP, which reads it from MPFS 
+	// straight into each outgoing segment
+	if(curHTTP.nextCallback == 0xffffffff)
+	{
+		dwRem = MPFSGetBytesRem(curHTTP.file);
+		if(curHTTP.conditional & HTTP_COND_PARTIAL)
+			dwRem -= MPFSGetSize(curHTTP.file) - 1 - curHTTP.rangeEnd;
+		#if defined(STACK_USE_INFLATE)
+		if(HTTPIsInflating())
+			dwRem = httpInflate.dwSize - curHTTP.byteCount;
+		#endif
+		if(dwRem == 0u)
+			return TRUE;
+		if(!HTTPIsInflating() && TCPSendFile(sktHTTP, curHTTP.file, dwRem))
+		{
+			#if defined(HTTP_STATS)
+			curHTTP.statBytes += dwRem;
+			#endif
+			return TRUE;
+		}
+		numBytes = mMIN(len, dwRem);
+	}
+	else
+		numBytes = mMIN(len, curHTTP.nextCallback - curHTTP.byteCount);
 	
 	// Get/put as many bytes as possible
 	curHTTP.byteCount += numBytes;
+	#if defined(HTTP_STATS)
+	curHTTP.statBytes += numBytes;
+	#endif
 	while(numBytes > 0)
 	{
-		len = MPFSGetArray(curHTTP.file, data, mMIN(numBytes, 64));
+		len = HTTPReadFile(data, mMIN(numBytes, 64));
 		if(len == 0)
 			return TRUE;
 		else
@@ -1036,29 +1807,162 @@ static BOOL HTTPSendFile(void)
 		smHTTP = SM_HTTP_SEND_FROM_CALLBACK;
 		curHTTP.callbackPos = 0;
 
-		// Read past the variable name and close the MPFS
-		MPFSGet(curHTTP.file, NULL);
-		do
+		// Find the length of the variable name, if it is known
+		entry = &httpIndex[curHTTPID].entries[httpIndex[curHTTPID].next - 1];
+		len = entry->wLength;
+		#if HTTP_VAR_LEN_CACHE > 0
+		if(len == 0u && entry->wCallbackID < HTTP_VAR_LEN_CACHE)
+			len = httpVarLen[entry->wCallbackID];
+		#endif
+
+		// Seek past the variable name, making sure it ends where expected.  
+		// Decompressed files can't seek back if it doesn't.
+		c = 0;
+		if(len != 0u && !HTTPIsInflating() && MPFSSeek(curHTTP.file, len - 1, MPFS_SEEK_FORWARD))
+			MPFSGet(curHTTP.file, &c);
+
+		if(c == '~')
 		{
-			if(!MPFSGet(curHTTP.file, &c))
-				break;
+			curHTTP.byteCount += len;
+		}
+		else
+		{
+			// Read past the variable name one byte at a time
+			if(!HTTPIsInflating())
+				MPFSSeek(curHTTP.file, curHTTP.nextCallback, MPFS_SEEK_START);
+			HTTPReadFile(NULL, 1);
+			do
+			{
+				if(!HTTPReadFile(&c, 1))
+					break;
+				curHTTP.byteCount++;
+			} while(c != '~');
 			curHTTP.byteCount++;
-		} while(c != '~');
-		curHTTP.byteCount++;
+
+			// Remember the length so later requests can seek instead
+			#if HTTP_VAR_LEN_CACHE > 0
+			if(entry->wCallbackID < HTTP_VAR_LEN_CACHE && curHTTP.byteCount - curHTTP.nextCallback <= 0xffu)
+				httpVarLen[entry->wCallbackID] = curHTTP.byteCount - curHTTP.nextCallback;
+			#endif
+		}
 		
-		// Read in the callback address and next offset
-		MPFSGetLong(curHTTP.offsets, &(curHTTP.callbackID));
-		if(!MPFSGetLong(curHTTP.offsets, &(curHTTP.nextCallback)))
+		// Move on to the next variable in the index
+		HTTPNextCallback();
+	}
+
+    // We are not done sending a file yet...
+    return FALSE;
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPNextCallback(void)
+
+  Description:
+	Loads curHTTP.nextCallback and curHTTP.callbackID from the next entry 
+	in the file's dynamic variable index.  Entries are read from MPFS 
+	HTTP_INDEX_BATCH at a time, and the index file is closed as soon as 
+	its last entry has been read.
+
+  Precondition:
+	curHTTP.offsets is open or invalid, and httpIndex[curHTTPID] is empty 
+	or holds entries from the same index file.
+
+  Parameters:
+	None
+
+  Returns:
+	None.  curHTTP.nextCallback is set to 0xffffffff when no variables 
+	remain.
+  ***************************************************************************/
+static void HTTPNextCallback(void)
+{
+	HTTP_INDEX_ENTRY *entry;
+
+	if(httpIndex[curHTTPID].next == httpIndex[curHTTPID].count)
+	{
+		// Read the next batch of entries in one go
+		httpIndex[curHTTPID].next = 0;
+		httpIndex[curHTTPID].count = 0;
+		if(curHTTP.offsets != MPFS_INVALID_HANDLE)
+		{
+			httpIndex[curHTTPID].count = MPFSGetArray(curHTTP.offsets, (BYTE*)httpIndex[curHTTPID].entries, sizeof(httpIndex[0].entries)) / sizeof(HTTP_INDEX_ENTRY);
+			if(MPFSGetBytesRem(curHTTP.offsets) < sizeof(HTTP_INDEX_ENTRY))
+			{
+				MPFSClose(curHTTP.offsets);
+				curHTTP.offsets = MPFS_INVALID_HANDLE;
+			}
+		}
+
+		// If no entries remain, then set next offset to huge
+		if(httpIndex[curHTTPID].count == 0u)
 		{
 			curHTTP.nextCallback = 0xffffffff;
-			MPFSClose(curHTTP.offsets);
-			curHTTP.offsets = MPFS_INVALID_HANDLE;
+			return;
 		}
 	}
 
-    // We are not done sending a file yet...
-    return FALSE;
+	entry = &httpIndex[curHTTPID].entries[httpIndex[curHTTPID].next++];
+	curHTTP.nextCallback = entry->dwOffset;
+	curHTTP.callbackID = entry->wCallbackID;
+}
+
+/*****************************************************************************
+  Function:
+	static WORD HTTPReadFile(BYTE* cData, WORD wLen)
+
+  Description:
+	Reads the body of curHTTP's file, decompressing it first if it is 
+	gzip'd and must be sent decompressed.
+
+  Precondition:
+	curHTTP.file is open for reading.
+
+  Parameters:
+	cData - where to store the data, or NULL to discard it
+	wLen - how many bytes to read
+
+  Returns:
+	The number of bytes read, which is less than wLen only at the end 
+	of the file.
+  ***************************************************************************/
+static WORD HTTPReadFile(BYTE* cData, WORD wLen)
+{
+	#if defined(STACK_USE_INFLATE)
+	if(HTTPIsInflating())
+		return InflateGetArray(&httpInflate, cData, wLen);
+	#endif
+	
+	return MPFSGetArray(curHTTP.file, cData, wLen);
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPEndInflate(void)
+
+  Description:
+	Frees the decompressor if curHTTP is using it, so that the next 
+	connection waiting to send a gzip'd file decompressed can proceed.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+	None
+  ***************************************************************************/
+#if defined(STACK_USE_INFLATE)
+static void HTTPEndInflate(void)
+{
+	if(HTTPIsInflating())
+	{
+		curHTTP.encoding &= ~HTTP_ENC_INFLATE;
+		httpInflateOwner = 0xff;
+	}
 }
+#endif
 
 /*****************************************************************************
   Function:
@@ -1105,6 +2009,52 @@ static void HTTPHeaderParseLookup(BYTE i)
 		return;
 	}
 	#endif
+
+	if(i == 3u)
+	{
+		HTTPHeaderParseConnection();
+		return;
+	}
+
+	if(i == 4u)
+	{
+		HTTPHeaderParseIfNoneMatch();
+		return;
+	}
+
+	if(i == 5u)
+	{
+		HTTPHeaderParseIfModifiedSince();
+		return;
+	}
+
+	if(i == 6u)
+	{
+		HTTPHeaderParseRange();
+		return;
+	}
+
+	if(i == 7u)
+	{
+		HTTPHeaderParseIfRange();
+		return;
+	}
+
+	#if defined(STACK_USE_INFLATE)
+	if(i == 8u)
+	{
+		HTTPHeaderParseAcceptEncoding();
+		return;
+	}
+	#endif
+
+	#if defined(HTTP_WEBSOCKET)
+	if(i == 9u)
+	{
+		HTTPHeaderParseWebSocketKey();
+		return;
+	}
+	#endif
 }
 
 /*****************************************************************************
@@ -1293,591 +2243,2303 @@ static void HTTPHeaderParseContentLength(void)
 
 /*****************************************************************************
   Function:
-	BYTE* HTTPURLDecode(BYTE* cData)
+	static void HTTPHeaderParseConnection(void)
 
   Summary:
-	Parses a string from URL encoding to plain-text.
+	Parses the "Connection:" header for a request.
 
   Description:
-	Parses a string from URL encoding to plain-text.  The following
-	conversions are made: ??to \0? ??to \0? ??to ?? and
-	?xx?to a single hex byte.
- 
-	After completion, the data has been decoded and a null terminator
-	signifies the end of a name or value.  A second null terminator (or a
-	null name parameter) indicates the end of all the data.
+	Parses the "Connection:" header to determine whether the client wants 
+	the connection to persist after the response.  "close" and 
+	"keep-alive" override the default for the request's HTTP version, 
+	which is stored in curHTTP.keepAlive.
 
   Precondition:
-	The data parameter is null terminated and has at least one extra
-	byte free.
+	None
 
   Parameters:
-	cData - The string which is to be decoded in place.
+	None
 
   Returns:
-	A pointer to the last null terminator in data, which is also the
-	first free byte for new data.
-
-  Remarks:
-	This function is called by the stack to parse GET arguments and 
-	cookie data.  User applications can use this function to decode POST
-	data, but first need to verify that the string is null-terminated.
+	None
   ***************************************************************************/
-BYTE* HTTPURLDecode(BYTE* cData)
+static void HTTPHeaderParseConnection(void)
 {
-	BYTE *pRead, *pWrite;
-	WORD wLen;
-	BYTE c;
-	WORD_VAL hex;
-	 
-	// Determine length of input
-	wLen = strlen((char*)cData);
-	 
-	// Read all characters in the string
-	for(pRead = pWrite = cData; wLen != 0; )
-	{
-		c = *pRead++;
-		wLen--;
-		
-		if(c == '=' || c == '&')
-			*pWrite++ = '\0';
-		else if(c == '+')
-			*pWrite++ = ' ';
-		else if(c == '%')
-		{
-			if(wLen < 2)
-				wLen = 0;
-			else
-			{
-				hex.v[1] = *pRead++;
-				hex.v[0] = *pRead++;
-				wLen--;
-				wLen--;
-				*pWrite++ = hexatob(hex);
-			}
-		}
-		else
-			*pWrite++ = c;
-	}
-	
-	// Double null terminate the last value
-	*pWrite++ = '\0';
-	*pWrite = '\0';
-	
-	return pWrite;
+	WORD len;
+	BYTE buf[11];
+
+	// Read up to the CRLF (only the first token matters)
+	len = TCPFindROMArray(sktHTTP, HTTP_CRLF, HTTP_CRLF_LEN, 0, FALSE);
+	len = TCPGetArray(sktHTTP, buf, mMIN(len, sizeof(buf) - 1));
+	buf[len] = '\0';
+
+	if(stricmppgm2ram(buf, (ROM BYTE*)"close") == 0)
+		curHTTP.keepAlive = FALSE;
+	else if(stricmppgm2ram(buf, (ROM BYTE*)"keep-alive") == 0)
+		curHTTP.keepAlive = TRUE;
 }
 
 /*****************************************************************************
   Function:
-	BYTE* HTTPGetArg(BYTE* cData, BYTE* cArg)
+	static void HTTPHeaderParseIfNoneMatch(void)
 
   Summary:
-	Locates a form field value in a given data array.
+	Parses the "If-None-Match:" header for a request.
 
   Description:
-	Searches through a data array to find the value associated with a
-	given argument.  It can be used to find form field values in data
-	received over GET or POST.
-	
-	The end of data is assumed to be reached when a null name parameter is
-	encountered.  This requires the string to have an even number of 
-	null-terminated strings, followed by an additional null terminator.
+	Checks whether the "If-None-Match:" header lists the ETag of the 
+	requested file, or is "*".  A gzip'd file has a second ETag for when 
+	it is sent decompressed, and since "Accept-Encoding:" may not have 
+	been parsed yet, both are checked.  The results are stored in 
+	curHTTP.conditional for SM_HTTP_PROCESS_REQUEST to act on.
 
   Precondition:
-	The data array has a valid series of null terminated name/value pairs.
+	None
 
   Parameters:
-	data - the buffer to search
-	arg - the name of the argument to find
+	None
 
   Returns:
-	A pointer to the argument value, or NULL if not found.
+	None
   ***************************************************************************/
-BYTE* HTTPGetArg(BYTE* cData, BYTE* cArg)
+static void HTTPHeaderParseIfNoneMatch(void)
 {
-	// Search through the array while bytes remain
-	while(*cData != '\0')
-	{ 
-		// Look for arg at current position
-		if(!strcmp((char*)cArg, (char*)cData))
-		{// Found it, so return parameter
-			return cData + strlen((char*)cArg) + 1;
-		}
-		
-		// Skip past two strings (NUL bytes)
-		cData += strlen((char*)cData) + 1;
-		cData += strlen((char*)cData) + 1;
+	WORD len;
+	BYTE cTag[HTTP_ETAG_INFLATED_LEN+1];
+
+	curHTTP.conditional |= HTTP_COND_ETAG_SENT;
+	if(curHTTP.file == MPFS_INVALID_HANDLE)
+		return;
+
+	// Search the list in place, since it may hold several tags
+	len = TCPFindROMArray(sktHTTP, HTTP_CRLF, HTTP_CRLF_LEN, 0, FALSE);
+	if(len == 0xffff)
+		return;
+	if(TCPFindEx(sktHTTP, '*', 0, len, FALSE) != 0xffff)
+	{
+		curHTTP.conditional |= HTTP_COND_ETAG_MATCH | HTTP_COND_ETAG_INFLATED;
+		return;
 	}
-	 	
-	// Return NULL if not found
-	return NULL;
+	HTTPGetETag(cTag, FALSE);
+	if(TCPFindArrayEx(sktHTTP, cTag, HTTP_ETAG_LEN, 0, len, FALSE) != 0xffff)
+		curHTTP.conditional |= HTTP_COND_ETAG_MATCH;
+	#if defined(STACK_USE_INFLATE)
+	if(MPFSGetFlags(curHTTP.file) & MPFS2_FLAG_ISZIPPED)
+	{
+		HTTPGetETag(cTag, TRUE);
+		if(TCPFindArrayEx(sktHTTP, cTag, HTTP_ETAG_INFLATED_LEN, 0, len, FALSE) != 0xffff)
+			curHTTP.conditional |= HTTP_COND_ETAG_INFLATED;
+	}
+	#endif
 }
 
 /*****************************************************************************
   Function:
-	BYTE* HTTPGetROMArg(BYTE* cData, ROM BYTE* cArg)
+	static void HTTPHeaderParseIfModifiedSince(void)
 
   Summary:
-	Locates a form field value in a given data array.
+	Parses the "If-Modified-Since:" header for a request.
 
   Description:
-	Searches through a data array to find the value associated with a
-	given argument.  It can be used to find form field values in data
-	received over GET or POST.
-	
-	The end of data is assumed to be reached when a null name parameter is
-	encountered.  This requires the string to have an even number of 
-	null-terminated strings, followed by an additional null terminator.
+	Browsers echo back the Last-Modified value they were given, so the 
+	file is unchanged when the header holds exactly the date this server 
+	would send for it now.  Any other date is treated as stale.  The 
+	result is stored in curHTTP.conditional.
 
   Precondition:
-	The data array has a valid series of null terminated name/value pairs.
+	None
 
   Parameters:
-	data - the buffer to search
-	arg - the name of the argument to find
+	None
 
   Returns:
-	A pointer to the argument value, or NULL if not found.
-
-  Remarks:
-  	This function is aliased to HTTPGetArg on non-PIC18 platforms.
+	None
   ***************************************************************************/
-#if defined(__18CXX)
-BYTE* HTTPGetROMArg(BYTE* cData, ROM BYTE* cArg)
+static void HTTPHeaderParseIfModifiedSince(void)
 {
-	// Search through the array while bytes remain
-	while(*cData != '\0')
-	{
-		// Look for arg at current position
-		if(!memcmppgm2ram(cData, (ROM void*)cArg, strlenpgm((ROM char*)cArg) + 1))
-		{// Found it, so skip to next string
-			return cData + strlenpgm((ROM char*)cArg) + 1;
-		}
-		
-		// Skip past two strings (NUL bytes)
-		cData += strlen((char*)cData) + 1;
-		cData += strlen((char*)cData) + 1;
-	}
-	 	
-	// Return NULL if not found
-	return NULL;
+	WORD len;
+	BYTE cDate[HTTP_DATE_LEN+1];
+
+	if(curHTTP.file == MPFS_INVALID_HANDLE)
+		return;
+
+	len = TCPFindROMArray(sktHTTP, HTTP_CRLF, HTTP_CRLF_LEN, 0, FALSE);
+	if(len != HTTP_DATE_LEN)
+		return;
+	HTTPGetLastModified(cDate);
+	if(TCPFindArrayEx(sktHTTP, cDate, HTTP_DATE_LEN, 0, len, FALSE) == 0u)
+		curHTTP.conditional |= HTTP_COND_DATE_MATCH;
 }
-#endif
 
 /*****************************************************************************
   Function:
-	HTTP_READ_STATUS HTTPReadPostName(BYTE* cData, WORD wLen)
+	static void HTTPHeaderParseRange(void)
 
   Summary:
-	Reads a name from a URL encoded string in the TCP buffer.
+	Parses the "Range:" header for a request.
 
   Description:
-	Reads a name from a URL encoded string in the TCP buffer.  This function
-	is meant to be called from an HTTPExecutePost callback to facilitate
-	easier parsing of incoming data.  This function also prevents buffer
-	overflows by forcing the programmer to indicate how many bytes are
-	expected.  At least 2 extra bytes are needed in cData over the maximum
-	length of data expected to be read.
+	Accepts a single byte range of the form "bytes=first-last", 
+	"bytes=first-", or "bytes=-suffix", and stores it in curHTTP.rangeStart 
+	and curHTTP.rangeEnd clipped to the size of the file.  A range that 
+	starts past the end of the file is flagged so a 416 can be returned.
 	
-	This function will read until the next '=' character, which indicates the
-	end of a name parameter.  It assumes that the front of the buffer is
-	the beginning of the name paramter to be read.
-	
-	This function properly updates curHTTP.byteCount by decrementing it
-	by the number of bytes read.  It also removes the delimiting '=' from
-	the buffer.
+	Multiple ranges would need a multipart/byteranges body, so requests 
+	for them, like any malformed range, are ignored and the whole file 
+	is served.
 
   Precondition:
-	Front of TCP buffer is the beginning of a name parameter, and the rest of
-	the TCP buffer contains a URL-encoded string with a name parameter 
-	terminated by a '=' character.
+	None
 
   Parameters:
-	cData - where to store the name once it is read
-	wLen - how many bytes can be written to cData
+	None
 
-  Return Values:
-	HTTP_READ_OK - name was successfully read
-	HTTP_READ_TRUNCTATED - entire name could not fit in the buffer, so the
-							value was truncated and data has been lost
-	HTTP_READ_INCOMPLETE - entire name was not yet in the buffer, so call
-							this function again later to retrieve
+  Returns:
+	None
   ***************************************************************************/
-#if defined(HTTP_USE_POST)
-HTTP_READ_STATUS HTTPReadPostName(BYTE* cData, WORD wLen)
+static void HTTPHeaderParseRange(void)
 {
-	HTTP_READ_STATUS status;
-	
-	status = HTTPReadTo('=', cData, wLen);
+	WORD len;
+	DWORD dwSize, dwFirst, dwLast;
+	BYTE buf[28], *p;
+	BOOL bFirst, bLast;
 
-	// Decode the data (if not reading to null or blank) and return
-	if(cData && !*cData)
-		HTTPURLDecode(cData);
-	return status;
-}	
-#endif
+	if(curHTTP.file == MPFS_INVALID_HANDLE)
+		return;
+
+	// Read the whole value, which can't be valid if it doesn't fit
+	len = TCPFindROMArray(sktHTTP, HTTP_CRLF, HTTP_CRLF_LEN, 0, FALSE);
+	if(len >= sizeof(buf))
+		return;
+	len = TCPGetArray(sktHTTP, buf, len);
+	buf[len] = '\0';
+	if(memcmppgm2ram(buf, (ROM void*)"bytes=", 6) != 0)
+		return;
+
+	// Read the first and last byte positions, either of which may be absent
+	p = &buf[6];
+	bFirst = HTTPReadRangePosition(&p, &dwFirst);
+	if(*p++ != '-')
+		return;
+	bLast = HTTPReadRangePosition(&p, &dwLast);
+	if(*p != '\0' || !(bFirst || bLast))
+		return;
+
+	dwSize = MPFSGetSize(curHTTP.file);
+	if(!bFirst)
+	{// Suffix range: the final dwLast bytes
+		if(dwLast == 0u || dwSize == 0u)
+		{
+			curHTTP.conditional |= HTTP_COND_RANGE_BAD;
+			return;
+		}
+		dwFirst = (dwLast < dwSize) ? dwSize - dwLast : 0;
+		dwLast = dwSize - 1;
+	}
+	else
+	{
+		if(bLast && dwLast < dwFirst)
+			return;
+		if(dwFirst >= dwSize)
+		{
+			curHTTP.conditional |= HTTP_COND_RANGE_BAD;
+			return;
+		}
+		if(!bLast || dwLast >= dwSize)
+			dwLast = dwSize - 1;
+	}
+
+	curHTTP.rangeStart = dwFirst;
+	curHTTP.rangeEnd = dwLast;
+	curHTTP.conditional |= HTTP_COND_RANGE;
+}
 
 /*****************************************************************************
   Function:
-	HTTP_READ_STATUS HTTPReadPostValue(BYTE* cData, WORD wLen)
+	static BOOL HTTPReadRangePosition(BYTE** p, DWORD* dwPos)
 
   Summary:
-	Reads a value from a URL encoded string in the TCP buffer.
+	Reads a byte position from a "Range:" header.
 
   Description:
-	Reads a value from a URL encoded string in the TCP buffer.  This function
-	is meant to be called from an HTTPExecutePost callback to facilitate
-	easier parsing of incoming data.  This function also prevents buffer
-	overflows by forcing the programmer to indicate how many bytes are
-	expected.  At least 2 extra bytes are needed in cData above the maximum
-	length of data expected to be read.
-	
-	This function will read until the next '&' character, which indicates the
-	end of a value parameter.  It assumes that the front of the buffer is
-	the beginning of the value paramter to be read.  If curHTTP.byteCount
-	indicates that all expected bytes are in the buffer, it assumes that 
-	all remaining data is the value and acts accordingly.
-	
-	This function properly updates curHTTP.byteCount by decrementing it
-	by the number of bytes read.  The terminating '&' character is also 
-	removed from the buffer.
-	
+	Reads the decimal number at *p and advances *p past it.  Positions 
+	that don't fit in a DWORD are read as 0xffffffff, which lies beyond 
+	the end of any MPFS file.
+
   Precondition:
-	Front of TCP buffer is the beginning of a name parameter, and the rest of
-	the TCP buffer contains a URL-encoded string with a name parameter 
-	terminated by a '=' character.
+	None
 
   Parameters:
-	cData - where to store the value once it is read
-	wLen - how many bytes can be written to cData
+	p - pointer to the current read position in the header value
+	dwPos - receives the position read
 
-  Return Values:
-	HTTP_READ_OK - value was successfully read
-	HTTP_READ_TRUNCTATED - entire value could not fit in the buffer, so the
-							value was truncated and data has been lost
-	HTTP_READ_INCOMPLETE - entire value was not yet in the buffer, so call
-							this function again later to retrieve
+  Returns:
+	TRUE if at least one digit was read, FALSE otherwise
   ***************************************************************************/
-#if defined(HTTP_USE_POST)
-HTTP_READ_STATUS HTTPReadPostValue(BYTE* cData, WORD wLen)
+static BOOL HTTPReadRangePosition(BYTE** p, DWORD* dwPos)
 {
-	HTTP_READ_STATUS status;
-	
-	// Try to read the value
-	status = HTTPReadTo('&', cData, wLen);
+	BYTE *c;
 	
-	// If read was incomplete, check if we're at the end
-	if(status == HTTP_READ_INCOMPLETE)
+	*dwPos = 0;
+	for(c = *p; *c >= '0' && *c <= '9'; c++)
 	{
-		// If all data has arrived, read all remaining data
-		if(curHTTP.byteCount == TCPIsGetReady(sktHTTP))
-			status = HTTPReadTo('\0', cData, wLen);
+		if(*dwPos > (0xfffffffful - 9u) / 10u)
+			*dwPos = 0xffffffff;
+		else
+			*dwPos = *dwPos * 10u + (*c - '0');
 	}
-		
-	// Decode the data (if not reading to null or blank) and return
-	if(cData && *cData)
-		HTTPURLDecode(cData);
-	return status;
-}	
-#endif
+	
+	if(c == *p)
+		return FALSE;
+	*p = c;
+	return TRUE;
+}
 
 /*****************************************************************************
   Function:
-	static HTTP_READ_STATUS HTTPReadTo(BYTE cDelim, BYTE* cData, WORD wLen)
+	static void HTTPHeaderParseIfRange(void)
 
   Summary:
-	Reads to a buffer until a specified delimiter character.
+	Parses the "If-Range:" header for a request.
 
   Description:
-	Reads from the TCP buffer to cData until either cDelim is reached, or
-	until wLen - 2 bytes have been read.  The value read is saved to cData and 
-	null terminated.  (wLen - 2 is used so that the value can be passed to
-	HTTPURLDecode later, which requires a null terminator plus one extra free
-	byte.)
-	
-	The delimiter character is removed from the buffer, but not saved to 
-	cData. If all data cannot fit into cData, it will still be removed from 
-	the buffer but will not be saved anywhere.
-
-	This function properly updates curHTTP.byteCount by decrementing it
-	by the number of bytes read. 
+	A range is only served when the "If-Range:" value is exactly the 
+	current ETag or Last-Modified date of the file, so a resumed download 
+	can't splice together two versions of it.  Otherwise the whole file 
+	is served.  Ranges are only served from the file as stored, so only 
+	its stored ETag can match.  The result is stored in curHTTP.conditional.
 
   Precondition:
 	None
 
   Parameters:
-  	cDelim - the character at which to stop reading, or NULL to read to
-  			 the end of the buffer
-	cData - where to store the data being read
-	wLen - how many bytes can be written to cData
+	None
 
-  Return Values:
-	HTTP_READ_OK - data was successfully read
-	HTTP_READ_TRUNCTATED - entire data could not fit in the buffer, so the
-							data was truncated and data has been lost
-	HTTP_READ_INCOMPLETE - delimiter character was not found
+  Returns:
+	None
   ***************************************************************************/
-#if defined(HTTP_USE_POST)
-static HTTP_READ_STATUS HTTPReadTo(BYTE cDelim, BYTE* cData, WORD wLen)
+static void HTTPHeaderParseIfRange(void)
 {
-	HTTP_READ_STATUS status;
-	WORD wPos;
-	
-	// Either look for delimiter, or read all available data
-	if(cDelim)
-		wPos = TCPFind(sktHTTP, cDelim, 0, FALSE);
+	WORD len;
+	BYTE cValue[HTTP_DATE_LEN+1];
+
+	curHTTP.conditional |= HTTP_COND_IFRANGE_SENT;
+	if(curHTTP.file == MPFS_INVALID_HANDLE)
+		return;
+
+	len = TCPFindROMArray(sktHTTP, HTTP_CRLF, HTTP_CRLF_LEN, 0, FALSE);
+	if(len == HTTP_ETAG_LEN)
+		HTTPGetETag(cValue, FALSE);
+	else if(len == HTTP_DATE_LEN)
+		HTTPGetLastModified(cValue);
 	else
-		wPos = TCPIsGetReady(sktHTTP);
-	
-	// If not found, return incomplete
-	if(wPos == 0xffff)
-		return HTTP_READ_INCOMPLETE;
-	
-	// Read the value
-	if(wLen < 2 && cData != NULL)
-	{// Buffer is too small, so read to NULL instead
-		curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, wPos);
-		status = HTTP_READ_TRUNCATED;
-	}
-	else if(cData == NULL)
-	{// Just remove the data
-		curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, wPos);
-		status = HTTP_READ_OK;
-	}
-	else if(wPos > wLen - 2)
-	{// Read data, but truncate at max length
-		curHTTP.byteCount -= TCPGetArray(sktHTTP, cData, wLen - 2);
-		curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, wPos - (wLen - 2));
-		cData[wLen - 2] = '\0';
-		status = HTTP_READ_TRUNCATED;
+		return;
+	if(TCPFindArrayEx(sktHTTP, cValue, len, 0, len, FALSE) == 0u)
+		curHTTP.conditional |= HTTP_COND_IFRANGE_MATCH;
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPHeaderParseAcceptEncoding(void)
+
+  Summary:
+	Parses the "Accept-Encoding:" header for a given request.
+
+  Description:
+	Determines whether the client will accept gzip'd content.  Only the 
+	gzip token is considered; it is accepted unless the parameters up to 
+	the next comma give it a q-value of zero.  If those parameters run 
+	past the buffer, gzip is refused, since a q=0 may have been cut off.  
+	The result is stored in curHTTP.encoding, and a request without this 
+	header receives files decompressed.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+	None
+  ***************************************************************************/
+#if defined(STACK_USE_INFLATE)
+static void HTTPHeaderParseAcceptEncoding(void)
+{
+	WORD len;
+	BOOL bWhole;
+	BYTE buf[48];
+	BYTE *ptr, *end;
+
+	len = TCPFindROMArray(sktHTTP, HTTP_CRLF, HTTP_CRLF_LEN, 0, FALSE);
+	if(len == 0xffff)
+		return;
+	bWhole = (len < sizeof(buf));
+	len = TCPGetArray(sktHTTP, buf, mMIN(len, sizeof(buf)-1));
+	buf[len] = '\0';
+	for(ptr = buf; *ptr; ptr++)
+		if(*ptr >= 'A' && *ptr <= 'Z')
+			*ptr += 'a' - 'A';
+
+	ptr = (BYTE*)strstr((char*)buf, "gzip");
+	if(ptr == NULL)
+		return;
+
+	// Limit the search for a q-value to gzip's own parameters
+	ptr += 4;
+	end = (BYTE*)strchr((char*)ptr, ',');
+	if(end != NULL)
+		*end = '\0';
+	else if(!bWhole)
+		return;
+
+	// Refuse gzip only when it is explicitly given a zero q-value
+	for(; *ptr == ' ' || *ptr == '\t'; ptr++);
+	if(*ptr == ';')
+	{
+		ptr = (BYTE*)strstr((char*)ptr, "q=");
+		if(ptr != NULL)
+		{
+			for(ptr += 2; *ptr == '0' || *ptr == '.'; ptr++);
+			if(*ptr < '1' || *ptr > '9')
+				return;
+		}
 	}
-	else
-	{// Read the data normally
-		curHTTP.byteCount -= TCPGetArray(sktHTTP, cData, wPos);
-		cData[wPos] = '\0';
-		status = HTTP_READ_OK;
+
+	curHTTP.encoding |= HTTP_ENC_GZIP;
+}
+#endif
+
+/*****************************************************************************
+  Function:
+	static void HTTPHeaderParseWebSocketKey(void)
+
+  Summary:
+	Parses the "Sec-WebSocket-Key:" header for a given request.
+
+  Description:
+	Computes the Sec-WebSocket-Accept value that completes the handshake: 
+	the Base64 encoding of the SHA-1 hash of the key followed by 
+	HTTP_WS_GUID.  The result is stored in curHTTP.wsAccept, and 
+	HTTP_WS_KEY is set in curHTTP.wsFlags.  Keys other than the 24 
+	characters that encode 16 random bytes are ignored, so the request 
+	is refused.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+	None
+  ***************************************************************************/
+#if defined(HTTP_WEBSOCKET)
+static void HTTPHeaderParseWebSocketKey(void)
+{
+	WORD len;
+	BYTE cKey[HTTP_WS_KEY_LEN];
+	BYTE vDigest[20];
+	HASH_SUM hash;
+
+	if(curHTTP.httpStatus != HTTP_WS_UPGRADE)
+		return;
+
+	len = TCPFindROMArray(sktHTTP, HTTP_CRLF, HTTP_CRLF_LEN, 0, FALSE);
+	if(len != HTTP_WS_KEY_LEN)
+		return;
+	TCPGetArray(sktHTTP, cKey, HTTP_WS_KEY_LEN);
+
+	SHA1Initialize(&hash);
+	SHA1AddData(&hash, cKey, HTTP_WS_KEY_LEN);
+	SHA1AddROMData(&hash, HTTP_WS_GUID, sizeof(HTTP_WS_GUID) - 1);
+	SHA1Calculate(&hash, vDigest);
+	Base64Encode(vDigest, sizeof(vDigest), curHTTP.wsAccept, HTTP_WS_ACCEPT_LEN);
+	curHTTP.wsFlags |= HTTP_WS_KEY;
+}
+#endif
+
+/*****************************************************************************
+  Function:
+	static void HTTPGetETag(BYTE* cTag, BOOL bInflated)
+
+  Summary:
+	Builds the ETag for curHTTP.file.
+
+  Description:
+	The ETag is the file's FAT ID and MPFS2 timestamp in hex, enclosed in 
+	quotes.  Both change whenever a new image replaces the file, so 
+	the tag can be computed without reading any file data.  A gzip'd 
+	file sent decompressed is a different representation, so its tag 
+	gets a "-d" suffix and caches can't confuse the two.
+
+  Precondition:
+	curHTTP.file is open.
+
+  Parameters:
+	cTag - buffer of at least HTTP_ETAG_INFLATED_LEN+1 bytes to receive 
+		the tag
+	bInflated - TRUE for the tag of the file sent decompressed
+
+  Returns:
+	None
+  ***************************************************************************/
+static void HTTPGetETag(BYTE* cTag, BOOL bInflated)
+{
+	DWORD_VAL dwTime;
+	WORD_VAL wID;
+	BYTE i;
+
+	wID.Val = MPFSGetID(curHTTP.file);
+	dwTime.Val = MPFSGetTimestamp(curHTTP.file);
+
+	*cTag++ = '"';
+	*cTag++ = btohexa_high(wID.v[1]);
+	*cTag++ = btohexa_low(wID.v[1]);
+	*cTag++ = btohexa_high(wID.v[0]);
+	*cTag++ = btohexa_low(wID.v[0]);
+	for(i = 4; i != 0u; i--)
+	{
+		*cTag++ = btohexa_high(dwTime.v[i-1]);
+		*cTag++ = btohexa_low(dwTime.v[i-1]);
+	}
+	if(bInflated)
+	{
+		*cTag++ = '-';
+		*cTag++ = 'd';
+	}
+	*cTag++ = '"';
+	*cTag = '\0';
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPGetLastModified(BYTE* cDate)
+
+  Summary:
+	Formats the timestamp of curHTTP.file as an RFC 1123 date.
+
+  Description:
+	Converts the MPFS2 timestamp (seconds since 1970) into the fixed 
+	length form used by Last-Modified, such as 
+	"Thu, 01 Jan 1970 00:00:00 GMT".
+
+  Precondition:
+	curHTTP.file is open.
+
+  Parameters:
+	cDate - buffer of at least HTTP_DATE_LEN+1 bytes to receive the date
+
+  Returns:
+	None
+  ***************************************************************************/
+static void HTTPGetLastModified(BYTE* cDate)
+{
+	static ROM char cDays[] = "ThuFriSatSunMonTueWed";
+	static ROM char cMonths[] = "MarAprMayJunJulAugSepOctNovDecJanFeb";
+	DWORD dwTime, dwDays, dwYear;
+	WORD wYearOfCycle, wDayOfYear, wMonth, wDay;
+	BYTE i;
+	ROM char *p;
+
+	dwTime = MPFSGetTimestamp(curHTTP.file);
+	dwDays = dwTime / 86400ul;
+	dwTime -= dwDays * 86400ul;
+
+	// Day of week, where 1970-01-01 was a Thursday
+	p = &cDays[(dwDays % 7u) * 3u];
+	*cDate++ = *p++;
+	*cDate++ = *p++;
+	*cDate++ = *p;
+	*cDate++ = ',';
+	*cDate++ = ' ';
+
+	// Convert to a civil date using years that begin on March 1st, so 
+	// leap days fall at the end of the year.  Days are counted within 
+	// the 400 year cycle starting 1600-03-01 or 2000-03-01, which 
+	// covers every 32-bit timestamp.
+	dwDays += 135080ul;
+	dwYear = 1600;
+	if(dwDays >= 146097ul)
+	{
+		dwDays -= 146097ul;
+		dwYear = 2000;
+	}
+	wYearOfCycle = (WORD)((dwDays - dwDays/1460u + dwDays/36524ul - dwDays/146096ul) / 365u);
+	wDayOfYear = (WORD)(dwDays - (365ul*wYearOfCycle + wYearOfCycle/4u - wYearOfCycle/100u));
+	dwYear += wYearOfCycle;
+	wMonth = (5u*wDayOfYear + 2u) / 153u;
+	wDay = wDayOfYear - (153u*wMonth + 2u)/5u + 1u;
+	if(wMonth >= 10u)
+		dwYear++;
+
+	*cDate++ = '0' + wDay/10u;
+	*cDate++ = '0' + wDay%10u;
+	*cDate++ = ' ';
+	p = &cMonths[wMonth * 3u];
+	*cDate++ = *p++;
+	*cDate++ = *p++;
+	*cDate++ = *p;
+	*cDate++ = ' ';
+	for(i = 4; i != 0u; i--)
+	{
+		cDate[i-1] = '0' + (BYTE)(dwYear % 10u);
+		dwYear /= 10u;
+	}
+	cDate += 4;
+	*cDate++ = ' ';
+
+	// Time of day
+	i = (BYTE)(dwTime / 3600u);
+	*cDate++ = '0' + i/10u;
+	*cDate++ = '0' + i%10u;
+	*cDate++ = ':';
+	i = (BYTE)((dwTime / 60u) % 60u);
+	*cDate++ = '0' + i/10u;
+	*cDate++ = '0' + i%10u;
+	*cDate++ = ':';
+	i = (BYTE)(dwTime % 60u);
+	*cDate++ = '0' + i/10u;
+	*cDate++ = '0' + i%10u;
+	strcpypgm2ram((char*)cDate, (ROM char*)" GMT");
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPPutValidators(void)
+
+  Summary:
+	Writes the caching headers for a static file.
+
+  Description:
+	Writes the Cache-Control, ETag, and Last-Modified headers for 
+	curHTTP.file, so browsers can revalidate it with a conditional GET 
+	once HTTP_CACHE_LEN seconds have passed.
+
+  Precondition:
+	curHTTP.file is open.
+
+  Parameters:
+	None
+
+  Returns:
+	None
+  ***************************************************************************/
+static void HTTPPutValidators(void)
+{
+	BYTE cDate[HTTP_DATE_LEN+1];
+
+	TCPPutROMString(sktHTTP, (ROM BYTE*)"Cache-Control: max-age=");
+	TCPPutROMString(sktHTTP, (ROM BYTE*)HTTP_CACHE_LEN);
+	TCPPutROMString(sktHTTP, (ROM BYTE*)"\r\nETag: ");
+	HTTPGetETag(cDate, HTTPNeedsInflate());
+	TCPPutString(sktHTTP, cDate);
+	TCPPutROMString(sktHTTP, (ROM BYTE*)"\r\nLast-Modified: ");
+	HTTPGetLastModified(cDate);
+	TCPPutString(sktHTTP, cDate);
+	TCPPutROMString(sktHTTP, HTTP_CRLF);
+}
+
+/*****************************************************************************
+  Function:
+	BYTE* HTTPURLDecode(BYTE* cData)
+
+  Summary:
+	Parses a string from URL encoding to plain-text.
+
+  Description:
+	Parses a string from URL encoding to plain-text.  The following
+	conversions are made: ??to \0? ??to \0? ??to ?? and
+	?xx?to a single hex byte.
+ 
+	After completion, the data has been decoded and a null terminator
+	signifies the end of a name or value.  A second null terminator (or a
+	null name parameter) indicates the end of all the data.
+
+  Precondition:
+	The data parameter is null terminated and has at least one extra
+	byte free.
+
+  Parameters:
+	cData - The string which is to be decoded in place.
+
+  Returns:
+	A pointer to the last null terminator in data, which is also the
+	first free byte for new data.
+
+  Remarks:
+	This function is called by the stack to parse GET arguments and 
+	cookie data.  User applications can use this function to decode POST
+	data, but first need to verify that the string is null-terminated.
+  ***************************************************************************/
+BYTE* HTTPURLDecode(BYTE* cData)
+{
+	BYTE *pRead, *pWrite;
+	WORD wLen;
+	BYTE c;
+	WORD_VAL hex;
+	 
+	// Determine length of input
+	wLen = strlen((char*)cData);
+	 
+	// Read all characters in the string
+	for(pRead = pWrite = cData; wLen != 0; )
+	{
+		c = *pRead++;
+		wLen--;
+		
+		if(c == '=' || c == '&')
+			*pWrite++ = '\0';
+		else if(c == '+')
+			*pWrite++ = ' ';
+		else if(c == '%')
+		{
+			if(wLen < 2)
+				wLen = 0;
+			else
+			{
+				hex.v[1] = *pRead++;
+				hex.v[0] = *pRead++;
+				wLen--;
+				wLen--;
+				*pWrite++ = hexatob(hex);
+			}
+		}
+		else
+			*pWrite++ = c;
 	}
 	
-	// Remove the delimiter
-	if(cDelim)
-		curHTTP.byteCount -= TCPGet(sktHTTP, NULL);
+	// Double null terminate the last value
+	*pWrite++ = '\0';
+	*pWrite = '\0';
 	
-	return status;
-}	
+	return pWrite;
+}
+
+/*****************************************************************************
+  Function:
+	BYTE* HTTPGetArg(BYTE* cData, BYTE* cArg)
+
+  Summary:
+	Locates a form field value in a given data array.
+
+  Description:
+	Searches through a data array to find the value associated with a
+	given argument.  It can be used to find form field values in data
+	received over GET or POST.
+	
+	The end of data is assumed to be reached when a null name parameter is
+	encountered.  This requires the string to have an even number of 
+	null-terminated strings, followed by an additional null terminator.
+
+  Precondition:
+	The data array has a valid series of null terminated name/value pairs.
+
+  Parameters:
+	data - the buffer to search
+	arg - the name of the argument to find
+
+  Returns:
+	A pointer to the argument value, or NULL if not found.
+  ***************************************************************************/
+BYTE* HTTPGetArg(BYTE* cData, BYTE* cArg)
+{
+	// Search through the array while bytes remain
+	while(*cData != '\0')
+	{ 
+		// Look for arg at current position
+		if(!strcmp((char*)cArg, (char*)cData))
+		{// Found it, so return parameter
+			return cData + strlen((char*)cArg) + 1;
+		}
+		
+		// Skip past two strings (NUL bytes)
+		cData += strlen((char*)cData) + 1;
+		cData += strlen((char*)cData) + 1;
+	}
+	 	
+	// Return NULL if not found
+	return NULL;
+}
+
+/*****************************************************************************
+  Function:
+	BYTE* HTTPGetROMArg(BYTE* cData, ROM BYTE* cArg)
+
+  Summary:
+	Locates a form field value in a given data array.
+
+  Description:
+	Searches through a data array to find the value associated with a
+	given argument.  It can be used to find form field values in data
+	received over GET or POST.
+	
+	The end of data is assumed to be reached when a null name parameter is
+	encountered.  This requires the string to have an even number of 
+	null-terminated strings, followed by an additional null terminator.
+
+  Precondition:
+	The data array has a valid series of null terminated name/value pairs.
+
+  Parameters:
+	data - the buffer to search
+	arg - the name of the argument to find
+
+  Returns:
+	A pointer to the argument value, or NULL if not found.
+
+  Remarks:
+  	This function is aliased to HTTPGetArg on non-PIC18 platforms.
+  ***************************************************************************/
+#if defined(__18CXX)
+BYTE* HTTPGetROMArg(BYTE* cData, ROM BYTE* cArg)
+{
+	// Search through the array while bytes remain
+	while(*cData != '\0')
+	{
+		// Look for arg at current position
+		if(!memcmppgm2ram(cData, (ROM void*)cArg, strlenpgm((ROM char*)cArg) + 1))
+		{// Found it, so skip to next string
+			return cData + strlenpgm((ROM char*)cArg) + 1;
+		}
+		
+		// Skip past two strings (NUL bytes)
+		cData += strlen((char*)cData) + 1;
+		cData += strlen((char*)cData) + 1;
+	}
+	 	
+	// Return NULL if not found
+	return NULL;
+}
+#endif
+
+/*****************************************************************************
+  Function:
+	HTTP_READ_STATUS HTTPReadPostName(BYTE* cData, WORD wLen)
+
+  Summary:
+	Reads a name from a URL encoded string in the TCP buffer.
+
+  Description:
+	Reads a name from a URL encoded string in the TCP buffer.  This function
+	is meant to be called from an HTTPExecutePost callback to facilitate
+	easier parsing of incoming data.  This function also prevents buffer
+	overflows by forcing the programmer to indicate how many bytes are
+	expected.  At least 2 extra bytes are needed in cData over the maximum
+	length of data expected to be read.
+	
+	This function will read until the next '=' character, which indicates the
+	end of a name parameter.  It assumes that the front of the buffer is
+	the beginning of the name paramter to be read.
+	
+	This function properly updates curHTTP.byteCount by decrementing it
+	by the number of bytes read.  It also removes the delimiting '=' from
+	the buffer.
+
+  Precondition:
+	Front of TCP buffer is the beginning of a name parameter, and the rest of
+	the TCP buffer contains a URL-encoded string with a name parameter 
+	terminated by a '=' character.
+
+  Parameters:
+	cData - where to store the name once it is read
+	wLen - how many bytes can be written to cData
+
+  Return Values:
+	HTTP_READ_OK - name was successfully read
+	HTTP_READ_TRUNCTATED - entire name could not fit in the buffer, so the
+							value was truncated and data has been lost
+	HTTP_READ_INCOMPLETE - entire name was not yet in the buffer, so call
+							this function again later to retrieve
+  ***************************************************************************/
+#if defined(HTTP_USE_POST)
+HTTP_READ_STATUS HTTPReadPostName(BYTE* cData, WORD wLen)
+{
+	HTTP_READ_STATUS status;
+	
+	status = HTTPReadTo('=', cData, wLen);
+
+	// Decode the data (if not reading to null or blank) and return
+	if(cData && !*cData)
+		HTTPURLDecode(cData);
+	return status;
+}	
+#endif
+
+/*****************************************************************************
+  Function:
+	HTTP_READ_STATUS HTTPReadPostValue(BYTE* cData, WORD wLen)
+
+  Summary:
+	Reads a value from a URL encoded string in the TCP buffer.
+
+  Description:
+	Reads a value from a URL encoded string in the TCP buffer.  This function
+	is meant to be called from an HTTPExecutePost callback to facilitate
+	easier parsing of incoming data.  This function also prevents buffer
+	overflows by forcing the programmer to indicate how many bytes are
+	expected.  At least 2 extra bytes are needed in cData above the maximum
+	length of data expected to be read.
+	
+	This function will read until the next '&' character, which indicates the
+	end of a value parameter.  It assumes that the front of the buffer is
+	the beginning of the value paramter to be read.  If curHTTP.byteCount
+	indicates that all expected bytes are in the buffer, it assumes that 
+	all remaining data is the value and acts accordingly.
+	
+	This function properly updates curHTTP.byteCount by decrementing it
+	by the number of bytes read.  The terminating '&' character is also 
+	removed from the buffer.
+	
+  Precondition:
+	Front of TCP buffer is the beginning of a name parameter, and the rest of
+	the TCP buffer contains a URL-encoded string with a name parameter 
+	terminated by a '=' character.
+
+  Parameters:
+	cData - where to store the value once it is read
+	wLen - how many bytes can be written to cData
+
+  Return Values:
+	HTTP_READ_OK - value was successfully read
+	HTTP_READ_TRUNCTATED - entire value could not fit in the buffer, so the
+							value was truncated and data has been lost
+	HTTP_READ_INCOMPLETE - entire value was not yet in the buffer, so call
+							this function again later to retrieve
+  ***************************************************************************/
+#if defined(HTTP_USE_POST)
+HTTP_READ_STATUS HTTPReadPostValue(BYTE* cData, WORD wLen)
+{
+	HTTP_READ_STATUS status;
+	
+	// Try to read the value
+	status = HTTPReadTo('&', cData, wLen);
+	
+	// If read was incomplete, check if we're at the end
+	if(status == HTTP_READ_INCOMPLETE)
+	{
+		// If all data has arrived, read all remaining data
+		if(curHTTP.byteCount == TCPIsGetReady(sktHTTP))
+			status = HTTPReadTo('\0', cData, wLen);
+	}
+		
+	// Decode the data (if not reading to null or blank) and return
+	if(cData && *cData)
+		HTTPURLDecode(cData);
+	return status;
+}	
+#endif
+
+/*****************************************************************************
+  Function:
+	HTTP_IO_RESULT HTTPReadMultipart(ROM HTTP_MULTIPART_SINK* sink)
+
+  Summary:
+	Reads a multipart/form-data body from the TCP buffer.
+
+  Description:
+	Parses a multipart/form-data POST body, such as a file upload, as it 
+	arrives.  This function is meant to be called from an HTTPExecutePost 
+	callback, and returns to it whenever it must wait for the network or 
+	the sink.  Each header line of each part is passed to sink->Header, 
+	and the part's data is passed to sink->Data straight from the TCP 
+	buffer, followed by a call with cData = NULL and wLen = 0 at the end 
+	of the part.  sink->Data returns how many bytes it accepted, and any 
+	it did not accept are offered again on the next call.
+	
+	The boundary is learned from the first line of the body, so the 
+	Content-Type header need not be parsed.  Data not yet searched for 
+	the boundary is searched only once, and data that cannot hold it is 
+	passed on without waiting for the rest of the part, so a part of any 
+	size can be streamed through a small RX FIFO.
+	
+	This function properly updates curHTTP.byteCount by decrementing it
+	by the number of bytes read.
+
+  Precondition:
+	Front of TCP buffer is the beginning of the POST body, or data left 
+	there by an earlier call for the same request.
+
+  Parameters:
+	sink - functions that receive the headers and data of each part
+
+  Return Values:
+	HTTP_IO_DONE - the whole body has been read
+	HTTP_IO_NEED_DATA - more data is needed from the network
+	HTTP_IO_WAITING - sink->Data accepted no data, so call again later
+
+  Remarks:
+	Header lines are read into curHTTP.data, truncated to 
+	HTTP_MAX_DATA_LEN - 1 bytes, and NUL terminated.  If the body is 
+	malformed, the rest of it is discarded, HTTP_IO_DONE is returned, 
+	and curHTTP.smPart is left at HTTP_PART_ERROR.
+  ***************************************************************************/
+#if defined(HTTP_USE_POST)
+HTTP_IO_RESULT HTTPReadMultipart(ROM HTTP_MULTIPART_SINK* sink)
+{
+	BYTE buf[64];
+	WORD wAvail, wPos, wLen;
+	
+	while(1)
+	{
+		// Don't look beyond this request into a pipelined one
+		wAvail = TCPIsGetReady(sktHTTP);
+		if(wAvail > curHTTP.byteCount)
+			wAvail = (WORD)curHTTP.byteCount;
+		
+		if(wAvail == 0u)
+		{
+			if(curHTTP.byteCount != 0u)
+				return HTTP_IO_NEED_DATA;
+			
+			// Body ended before the closing delimiter
+			if(curHTTP.smPart != HTTP_PART_END)
+				curHTTP.smPart = HTTP_PART_ERROR;
+			return HTTP_IO_DONE;
+		}
+		
+		switch(curHTTP.smPart)
+		{
+			case HTTP_PART_START:
+				// The first line is "--" and the boundary, which is 
+				// saved after a CRLF as the delimiter that ends each part
+				wPos = TCPFindROMArrayEx(sktHTTP, HTTP_CRLF, HTTP_CRLF_LEN, 0, wAvail, FALSE);
+				if(wPos == 0xffff)
+				{
+					if(wAvail < sizeof(curHTTP.partDelim) && wAvail != curHTTP.byteCount)
+						return HTTP_IO_NEED_DATA;
+					curHTTP.smPart = HTTP_PART_ERROR;
+					break;
+				}
+				if(wPos < 3u || wPos > sizeof(curHTTP.partDelim) - 2u)
+				{
+					curHTTP.smPart = HTTP_PART_ERROR;
+					break;
+				}
+				curHTTP.partDelim[0] = '\r';
+				curHTTP.partDelim[1] = '\n';
+				curHTTP.byteCount -= TCPGetArray(sktHTTP, &curHTTP.partDelim[2], wPos);
+				curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, HTTP_CRLF_LEN);
+				curHTTP.partDelimLen = (BYTE)(wPos + 2);
+				if(curHTTP.partDelim[2] != '-' || curHTTP.partDelim[3] != '-')
+				{
+					curHTTP.smPart = HTTP_PART_ERROR;
+					break;
+				}
+				curHTTP.smPart = HTTP_PART_HEADERS;
+				break;
+				
+			case HTTP_PART_HEADERS:
+				// A header line must fit in the FIFO and end before the body
+				wPos = TCPFindROMArrayEx(sktHTTP, HTTP_CRLF, HTTP_CRLF_LEN, 0, wAvail, FALSE);
+				if(wPos == 0xffff)
+				{
+					if(TCPGetRxFIFOFree(sktHTTP) != 0u && wAvail != curHTTP.byteCount)
+						return HTTP_IO_NEED_DATA;
+					curHTTP.smPart = HTTP_PART_ERROR;
+					break;
+				}
+				
+				// A blank line ends the headers
+				if(wPos == 0u)
+				{
+					curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, HTTP_CRLF_LEN);
+					curHTTP.partClear = 0;
+					curHTTP.smPart = HTTP_PART_DATA;
+					break;
+				}
+				
+				wLen = TCPGetArray(sktHTTP, curHTTP.data, mMIN(wPos, HTTP_MAX_DATA_LEN - 1));
+				curHTTP.data[wLen] = '\0';
+				TCPGetArray(sktHTTP, NULL, wPos - wLen + HTTP_CRLF_LEN);
+				curHTTP.byteCount -= wPos + HTTP_CRLF_LEN;
+				if(sink->Header)
+					sink->Header(curHTTP.data);
+				break;
+				
+			case HTTP_PART_DATA:
+				// Search only data that hasn't been searched yet
+				if(curHTTP.partClear == 0u)
+				{
+					wPos = TCPFindArrayEx(sktHTTP, curHTTP.partDelim, curHTTP.partDelimLen, 0, wAvail, FALSE);
+					if(wPos == 0u)
+					{// The part is complete
+						curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, curHTTP.partDelimLen);
+						if(sink->Data)
+							sink->Data(NULL, 0);
+						curHTTP.smPart = HTTP_PART_NEXT;
+						break;
+					}
+					if(wPos == 0xffff)
+					{// Only the last bytes might begin the delimiter
+						if(wAvail < curHTTP.partDelimLen)
+						{
+							if(wAvail == curHTTP.byteCount)
+								curHTTP.smPart = HTTP_PART_ERROR;
+							else
+								return HTTP_IO_NEED_DATA;
+							break;
+						}
+						wPos = wAvail - (curHTTP.partDelimLen - 1);
+					}
+					curHTTP.partClear = wPos;
+				}
+				
+				wLen = TCPPeekArray(sktHTTP, buf, mMIN(curHTTP.partClear, sizeof(buf)), 0);
+				if(sink->Data)
+				{
+					wLen = sink->Data(buf, wLen);
+					if(wLen == 0u)
+						return HTTP_IO_WAITING;
+				}
+				curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, wLen);
+				curHTTP.partClear -= wLen;
+				break;
+				
+			case HTTP_PART_NEXT:
+				// "--" follows the last delimiter, and a CRLF the others
+				if(wAvail < 2u)
+					return HTTP_IO_NEED_DATA;
+				TCPGetArray(sktHTTP, buf, 2);
+				curHTTP.byteCount -= 2;
+				if(buf[0] == '-' && buf[1] == '-')
+					curHTTP.smPart = HTTP_PART_END;
+				else if(buf[0] == '\r' && buf[1] == '\n')
+					curHTTP.smPart = HTTP_PART_HEADERS;
+				else
+					curHTTP.smPart = HTTP_PART_ERROR;
+				break;
+				
+			default:
+				// Discard the epilogue or the rest of a malformed body
+				curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, wAvail);
+				break;
+		}
+	}
+}
+#endif
+
+/*****************************************************************************
+  Function:
+	static HTTP_READ_STATUS HTTPReadTo(BYTE cDelim, BYTE* cData, WORD wLen)
+
+  Summary:
+	Reads to a buffer until a specified delimiter character.
+
+  Description:
+	Reads from the TCP buffer to cData until either cDelim is reached, or
+	until wLen - 2 bytes have been read.  The value read is saved to cData and 
+	null terminated.  (wLen - 2 is used so that the value can be passed to
+	HTTPURLDecode later, which requires a null terminator plus one extra free
+	byte.)
+	
+	The delimiter character is removed from the buffer, but not saved to 
+	cData. If all data cannot fit into cData, it will still be removed from 
+	the buffer but will not be saved anywhere.
+
+	This function properly updates curHTTP.byteCount by decrementing it
+	by the number of bytes read. 
+
+  Precondition:
+	None
+
+  Parameters:
+  	cDelim - the character at which to stop reading, or NULL to read to
+  			 the end of the buffer
+	cData - where to store the data being read
+	wLen - how many bytes can be written to cData
+
+  Return Values:
+	HTTP_READ_OK - data was successfully read
+	HTTP_READ_TRUNCTATED - entire data could not fit in the buffer, so the
+							data was truncated and data has been lost
+	HTTP_READ_INCOMPLETE - delimiter character was not found
+  ***************************************************************************/
+#if defined(HTTP_USE_POST)
+static HTTP_READ_STATUS HTTPReadTo(BYTE cDelim, BYTE* cData, WORD wLen)
+{
+	HTTP_READ_STATUS status;
+	WORD wPos;
+	
+	// Either look for delimiter, or read all available data
+	if(cDelim)
+		wPos = TCPFind(sktHTTP, cDelim, 0, FALSE);
+	else
+		wPos = TCPIsGetReady(sktHTTP);
+	
+	// If not found, return incomplete
+	if(wPos == 0xffff)
+		return HTTP_READ_INCOMPLETE;
+	
+	// Read the value
+	if(wLen < 2 && cData != NULL)
+	{// Buffer is too small, so read to NULL instead
+		curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, wPos);
+		status = HTTP_READ_TRUNCATED;
+	}
+	else if(cData == NULL)
+	{// Just remove the data
+		curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, wPos);
+		status = HTTP_READ_OK;
+	}
+	else if(wPos > wLen - 2)
+	{// Read data, but truncate at max length
+		curHTTP.byteCount -= TCPGetArray(sktHTTP, cData, wLen - 2);
+		curHTTP.byteCount -= TCPGetArray(sktHTTP, NULL, wPos - (wLen - 2));
+		cData[wLen - 2] = '\0';
+		status = HTTP_READ_TRUNCATED;
+	}
+	else
+	{// Read the data normally
+		curHTTP.byteCount -= TCPGetArray(sktHTTP, cData, wPos);
+		cData[wPos] = '\0';
+		status = HTTP_READ_OK;
+	}
+	
+	// Remove the delimiter
+	if(cDelim)
+		curHTTP.byteCount -= TCPGet(sktHTTP, NULL);
+	
+	return status;
+}	
+#endif
+
+/*****************************************************************************
+  Function:
+	HTTP_IO_RESULT HTTPMPFSUpload(void)
+
+  Summary:
+	Saves a file uploaded via POST as the new MPFS image in EEPROM or 
+	external Flash.
+
+  Description:
+	Allows the MPFS image in EEPROM or external Flash to be updated via a 
+	web page by accepting a file upload and storing it to the external memory.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Return Values:
+	HTTP_IO_DONE - on success
+	HTTP_IO_NEED_DATA - if more data is still expected
+	HTTP_IO_WAITING - if the external memory can't take more data yet
+
+  Remarks:
+	This function is only available when MPFS uploads are enabled.
+
+  Internal:
+	The form is read with HTTPReadMultipart, and the first part whose 
+	data begins with the MPFS version tag is written to external memory 
+	by HTTPMPFSUploadData.  Other parts are discarded.
+  ***************************************************************************/
+#if defined(HTTP_MPFS_UPLOAD)
+static HTTP_IO_RESULT HTTPMPFSUpload(void)
+{
+	static ROM HTTP_MULTIPART_SINK sink = {NULL, HTTPMPFSUploadData};
+	HTTP_IO_RESULT c;
+	
+	c = HTTPReadMultipart(&sink);
+	if(c != HTTP_IO_DONE)
+		return c;
+	
+	// Fail if no image was found, or if the form was cut short
+	if(curHTTP.httpStatus == HTTP_MPFS_UP || curHTTP.smPost != HTTP_MPFS_INSTALLED)
+		curHTTP.httpStatus = HTTP_MPFS_ERROR;
+	smHTTP = SM_HTTP_SERVE_HEADERS;
+	return HTTP_IO_DONE;
+}
+#endif
+
+/*****************************************************************************
+  Function:
+	static WORD HTTPMPFSUploadData(BYTE* cData, WORD wLen)
+
+  Summary:
+	Receives the data of each part of an MPFS upload form.
+
+  Description:
+	While curHTTP.httpStatus is HTTP_MPFS_UP, checks that a part begins 
+	with the 6 byte MPFS version tag, using curHTTP.smPost to count the 
+	bytes matched so far, and skips parts that don't.  Once the tag 
+	matches, the storage is formatted and the rest of the part is written 
+	to it as fast as it will accept data.  When that part ends, the image 
+	is installed, and any data after it is discarded.
+
+  Precondition:
+	None
+
+  Parameters:
+	cData - part data, or NULL at the end of a part
+	wLen - number of bytes in cData
+
+  Returns:
+	The number of bytes accepted.
+  ***************************************************************************/
+#if defined(HTTP_MPFS_UPLOAD)
+static WORD HTTPMPFSUploadData(BYTE* cData, WORD wLen)
+{
+	static ROM BYTE tag[] = "MPFS\x02\x01";
+	WORD wCount;
+	
+	// At the end of a part, install the image or try the next part
+	if(cData == NULL)
+	{
+		if(curHTTP.httpStatus == HTTP_MPFS_UP)
+			curHTTP.smPost = 0;
+		else if(curHTTP.httpStatus == HTTP_MPFS_OK && curHTTP.smPost != HTTP_MPFS_INSTALLED)
+		{
+			if(!MPFSPutEnd(TRUE))
+				curHTTP.httpStatus = HTTP_MPFS_ERROR;
+			curHTTP.smPost = HTTP_MPFS_INSTALLED;
+		}
+		return 0;
+	}
+	
+	switch(curHTTP.httpStatus)
+	{
+		// Make sure it's an MPFS of the correct version
+		case HTTP_MPFS_UP:
+			if(curHTTP.smPost == HTTP_MPFS_SKIP)
+				return wLen;
+			for(wCount = 0; wCount < wLen && curHTTP.smPost < sizeof(tag) - 1; wCount++)
+			{
+				if(cData[wCount] != tag[curHTTP.smPost++])
+				{
+					curHTTP.smPost = HTTP_MPFS_SKIP;
+					return wLen;
+				}
+			}
+			
+			// Read as Ver 2.1, so format MPFS storage and put 6 byte tag
+			if(curHTTP.smPost == sizeof(tag) - 1)
+			{
+				curHTTP.httpStatus = HTTP_MPFS_OK;
+				curHTTP.file = MPFSFormat();
+				MPFSPutArray(curHTTP.file, (BYTE*)tag, sizeof(tag) - 1);
+			}
+			return wCount;
+		
+		// File is verified, so write the data, leaving anything the 
+		// storage can't take yet in the TCP FIFO
+		case HTTP_MPFS_OK:
+			if(curHTTP.smPost == HTTP_MPFS_INSTALLED)
+				return wLen;
+			wCount = MPFSGetPutReady(curHTTP.file);
+			if(wLen > wCount)
+				wLen = wCount;
+			return MPFSPutArray(curHTTP.file, cData, wLen);
+		
+		// Discard data after a failure
+		default:
+			return wLen;
+	}
+}
+#endif
+
+/*****************************************************************************
+  Function:
+	void HTTPIncFile(ROM BYTE* cFile)
+
+  Summary:
+	Writes a file byte-for-byte to the currently loaded TCP socket.
+
+  Description:
+	Allows an entire file to be included as a dynamic variable, providing
+	a basic templating system for HTML web pages.  This reduces unneeded
+	duplication of visual elements such as headers, menus, etc.
+
+	When curHTTP.callbackPos is 0, the file is opened and as many bytes
+	as possible are written.  The current position is then saved to 
+	curHTTP.callbackPos and the file is closed.  On subsequent calls, 
+	reading begins at the saved location and continues.  Once the end of
+	the input file is reached, curHTTP.callbackPos is set back to 0 to 
+	indicate completion.
+
+  Precondition:
+	None
+
+  Parameters:
+	cFile - the name of the file to be sent
+
+  Returns:
+  	None
+  	
+  Remarks:
+	Users should not call this function directly, but should instead add
+	dynamic variables in the form of ~inc:filename.ext~ in their HTML code
+	to include (for example) the file "filename.ext" at that specified
+	location.  The MPFS2 Generator utility will handle the rest.
+  ***************************************************************************/
+void HTTPIncFile(ROM BYTE* cFile)
+{
+	WORD wCount, wLen;
+	BYTE data[64];
+	MPFS_HANDLE fp;
+	
+	// Check if this is a first round call
+	if(curHTTP.callbackPos == 0x00)
+	{// On initial call, open the file and save its ID
+		fp = MPFSOpenROM(cFile);
+		if(fp == MPFS_INVALID_HANDLE)
+		{// File not found, so abort
+			return;
+		}
+		((DWORD_VAL*)&curHTTP.callbackPos)->w[0] = MPFSGetID(fp);
+	}
+	else
+	{// The file was already opened, so load up its ID and seek
+		fp = MPFSOpenID(((DWORD_VAL*)&curHTTP.callbackPos)->w[0]);
+		if(fp == MPFS_INVALID_HANDLE)
+		{// No file handles available, so wait for now
+			return;
+		}
+		MPFSSeek(fp, ((DWORD_VAL*)&curHTTP.callbackPos)->w[1], MPFS_SEEK_FORWARD);
+	}
+	
+	// Get/put as many bytes as possible
+	wCount = TCPIsPutReady(sktHTTP);
+	while(wCount > 0)
+	{
+		wLen = MPFSGetArray(fp, data, mMIN(wCount, 64));
+		if(wLen == 0)
+		{// If no bytes were read, an EOF was reached
+			MPFSClose(fp);
+			curHTTP.callbackPos = 0x00;
+			return;
+		}
+		else
+		{// Write the bytes to the socket
+			TCPPutArray(sktHTTP, data, wLen);
+			wCount -= wLen;
+		}
+	}
+	
+	// Save the new address and close the file
+	((DWORD_VAL*)&curHTTP.callbackPos)->w[1] = MPFSTell(fp);
+	MPFSClose(fp);
+	
+	return;
+}
+
+/****************************************************************************
+  Section:
+	Render Cache Functions
+  ***************************************************************************/
+#if HTTP_RENDER_CACHE_SIZE > 0
+
+/*****************************************************************************
+  Function:
+	void HTTPCacheOutput(WORD wSeconds)
+
+  Summary:
+	Lets the server reuse the output of the running dynamic variable.
+
+  Description:
+	Called from an HTTPPrint_varname callback to mark what it writes as 
+	the same for every request.  The output is saved, and later requests 
+	for the same variable are sent the saved bytes without calling the 
+	callback until wSeconds have passed or HTTPCacheInvalidate is called.  
+	Once every variable in a page has been saved, the page is sent with 
+	a Content-Length and may use a persistent connection.
+
+  Precondition:
+	Called from an HTTPPrint_varname callback.
+
+  Parameters:
+	wSeconds - how long the output stays valid, or 0 to keep it until 
+		HTTPCacheInvalidate is called
+
+  Returns:
+  	None
+  	
+  Remarks:
+	Output is only saved when the callback writes all of it, no more than 
+	255 bytes, in one call.  Callbacks using curHTTP.callbackPos to 
+	continue later are simply run again next time.  The callback ID, not 
+	the variable name, identifies the output, so ~name(1)~ and 
+	~name(2)~ are saved separately.
+  ***************************************************************************/
+void HTTPCacheOutput(WORD wSeconds)
+{
+	httpCacheWanted = TRUE;
+	httpCacheExpires = 0;
+	if(wSeconds)
+	{
+		httpCacheExpires = TickGet() + (DWORD)wSeconds*TICK_SECOND;
+		if(httpCacheExpires == 0u)
+			httpCacheExpires = 1;
+	}
+}
+
+/*****************************************************************************
+  Function:
+	void HTTPCacheInvalidate(void)
+
+  Summary:
+	Discards all saved dynamic variable output.
+
+  Description:
+	Call this whenever something printed by a callback using 
+	HTTPCacheOutput changes, such as after saving new settings.  The next 
+	request for each variable calls its callback again.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+  	None
+  	
+  Remarks:
+	Responses that have already started sending saved output finish with 
+	it, since their Content-Length depends on it.
+  ***************************************************************************/
+void HTTPCacheInvalidate(void)
+{
+	httpCacheVersion++;
+	if(httpCacheUsers == 0u)
+	{
+		httpCacheCount = 0;
+		httpCacheUsed = 0;
+	}
+}
+
+/*****************************************************************************
+  Function:
+	static BYTE HTTPCacheFind(WORD wCallbackID)
+
+  Description:
+	Looks up the saved output of a dynamic variable.  A connection that is 
+	replaying a page accepts any output it finds, since the cache can't 
+	change underneath it.  Others accept only output that is still valid.
+
+  Precondition:
+	None
+
+  Parameters:
+	wCallbackID - the callback ID of the variable
+
+  Returns:
+	Index of the entry in httpCacheEntries, or 0xff if there is none.
+  ***************************************************************************/
+static BYTE HTTPCacheFind(WORD wCallbackID)
+{
+	BYTE i;
+
+	for(i = 0; i < httpCacheCount; i++)
+	{
+		if(httpCacheEntries[i].wCallbackID == wCallbackID)
+			break;
+	}
+	if(i == httpCacheCount)
+		return 0xff;
+
+	if(HTTPIsReplaying())
+		return i;
+	if(httpCacheEntries[i].bVersion != httpCacheVersion)
+		return 0xff;
+	if(httpCacheEntries[i].dwExpires && (LONG)(TickGet() - httpCacheEntries[i].dwExpires) >= (LONG)0)
+		return 0xff;
+	return i;
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPCacheStore(WORD wLen)
+
+  Description:
+	Saves the output the running callback has just written to the TX 
+	FIFO, replacing any earlier output of the same variable.  Storage is 
+	handed out in order and reclaimed all at once when it runs out.  
+	Nothing is saved while a connection is replaying a page.
+
+  Precondition:
+	The callback for curHTTP.callbackID has called HTTPCacheOutput and 
+	written its entire output.
+
+  Parameters:
+	wLen - number of bytes the callback wrote
+
+  Returns:
+  	None
+  ***************************************************************************/
+static void HTTPCacheStore(WORD wLen)
+{
+	BYTE i;
+
+	if(httpCacheUsers != 0u || wLen > 0xffu || wLen > sizeof(httpCacheData))
+		return;
+
+	// Drop the old output, whose bytes are reclaimed with the rest
+	for(i = 0; i < httpCacheCount; i++)
+	{
+		if(httpCacheEntries[i].wCallbackID == (WORD)curHTTP.callbackID)
+		{
+			httpCacheEntries[i] = httpCacheEntries[--httpCacheCount];
+			break;
+		}
+	}
+
+	// Start over once storage or entries run out
+	if(httpCacheCount == HTTP_RENDER_CACHE_ENTRIES || httpCacheUsed + wLen > sizeof(httpCacheData))
+	{
+		httpCacheCount = 0;
+		httpCacheUsed = 0;
+	}
+
+	// Read the output back from the TX FIFO
+	if(TCPPeekTxArray(sktHTTP, &httpCacheData[httpCacheUsed], wLen) != wLen)
+		return;
+
+	httpCacheEntries[httpCacheCount].dwExpires = httpCacheExpires;
+	httpCacheEntries[httpCacheCount].wCallbackID = (WORD)curHTTP.callbackID;
+	httpCacheEntries[httpCacheCount].wOffset = httpCacheUsed;
+	httpCacheEntries[httpCacheCount].bLen = (BYTE)wLen;
+	httpCacheEntries[httpCacheCount].bVersion = httpCacheVersion;
+	httpCacheCount++;
+	httpCacheUsed += wLen;
+}
+
+/*****************************************************************************
+  Function:
+	static DWORD HTTPCacheMeasure(void)
+
+  Description:
+	Works out the length of curHTTP's page with every dynamic variable 
+	replaced by its saved output.  Every ~name~ token's length must be 
+	known, from the index or httpVarLen, and every variable must have 
+	valid output in the cache.  The rest of the index is read from MPFS 
+	and the file is put back where it was.
+
+  Precondition:
+	curHTTP.file is open, and HTTPNextCallback has loaded the first 
+	variable.
+
+  Parameters:
+	None
+
+  Returns:
+	Length of the response body, or 0xffffffff if any piece of it is 
+	unknown.
+  ***************************************************************************/
+static DWORD HTTPCacheMeasure(void)
+{
+	HTTP_INDEX_ENTRY entry;
+	DWORD dwLen, dwPos;
+	WORD wLen;
+	BYTE i, j;
+
+	#if defined(STACK_USE_INFLATE)
+	if(HTTPIsInflating())
+		dwLen = httpInflate.dwSize;
+	else
+	#endif
+	dwLen = MPFSGetSize(curHTTP.file);
+
+	// Entries already read, then the rest of the index file
+	dwPos = 0;
+	if(curHTTP.offsets != MPFS_INVALID_HANDLE)
+		dwPos = MPFSTell(curHTTP.offsets);
+	i = 0;
+	while(1)
+	{
+		if(i < httpIndex[curHTTPID].count)
+			entry = httpIndex[curHTTPID].entries[i++];
+		else if(curHTTP.offsets == MPFS_INVALID_HANDLE || 
+			MPFSGetArray(curHTTP.offsets, (BYTE*)&entry, sizeof(entry)) != sizeof(entry))
+			break;
+
+		wLen = entry.wLength;
+		#if HTTP_VAR_LEN_CACHE > 0
+		if(wLen == 0u && entry.wCallbackID < HTTP_VAR_LEN_CACHE)
+			wLen = httpVarLen[entry.wCallbackID];
+		#endif
+		j = HTTPCacheFind(entry.wCallbackID);
+		if(wLen == 0u || j == 0xffu)
+		{
+			dwLen = 0xffffffff;
+			break;
+		}
+		dwLen = dwLen - wLen + httpCacheEntries[j].bLen;
+	}
+
+	if(curHTTP.offsets != MPFS_INVALID_HANDLE)
+		MPFSSeek(curHTTP.offsets, dwPos, MPFS_SEEK_START);
+	return dwLen;
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPCacheRelease(void)
+
+  Description:
+	Ends curHTTP's replay of a page, if it was replaying one, and lets the 
+	cache change again once no connection is.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+  	None
+  ***************************************************************************/
+static void HTTPCacheRelease(void)
+{
+	if(curHTTP.isReplay)
+	{
+		curHTTP.isReplay = FALSE;
+		httpCacheUsers--;
+	}
+}
+#endif
+
+/****************************************************************************
+  Section:
+	Statistics Functions
+  ***************************************************************************/
+#if defined(HTTP_STATS)
+
+/*****************************************************************************
+  Function:
+	static void HTTPStatsAdd(BYTE vStat, DWORD dwValue)
+
+  Description:
+	Counts a value in one of the HTTP_STAT histograms, in the bucket for 
+	its bit length.
+
+  Precondition:
+	None
+
+  Parameters:
+	vStat - the HTTP_STAT histogram to add to
+	dwValue - the value to count
+
+  Returns:
+  	None
+  ***************************************************************************/
+static void HTTPStatsAdd(BYTE vStat, DWORD dwValue)
+{
+	BYTE i;
+
+	for(i = 0; dwValue != 0u && i < HTTP_STATS_BUCKETS - 1; i++)
+		dwValue >>= 1;
+
+	if(httpStats.wHist[vStat][i] != 0xffffu)
+		httpStats.wHist[vStat][i]++;
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPStatsWait(void)
+
+  Description:
+	Totals the time curHTTP's response spends unable to continue for lack 
+	of TX FIFO space.  Called each time the body states run, it adds the 
+	time since the FIFO was last found full, then notes whether it is 
+	full now.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+  	None
+  ***************************************************************************/
+static void HTTPStatsWait(void)
+{
+	if(curHTTP.statBlocked)
+	{
+		curHTTP.statWait += TickGet() - curHTTP.statBlocked;
+		curHTTP.statBlocked = 0;
+	}
+	if(TCPIsPutReady(sktHTTP) < HTTP_MIN_CALLBACK_FREE)
+		curHTTP.statBlocked = TickGet() | 1;	// Never 0, which means not full
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPStatsCallback(DWORD dwStart, WORD wLen)
+
+  Description:
+	Records one call of the dynamic variable callback for 
+	curHTTP.callbackID.
+
+  Precondition:
+	None
+
+  Parameters:
+	dwStart - tick when the callback was called
+	wLen - bytes the callback wrote
+
+  Returns:
+  	None
+  	
+  Remarks:
+	Callbacks usually run for less than a tick, so the totals are only 
+	meaningful over many calls.
+  ***************************************************************************/
+static void HTTPStatsCallback(DWORD dwStart, WORD wLen)
+{
+	curHTTP.statBytes += wLen;
+	if(curHTTP.callbackID >= HTTP_STATS_CALLBACKS)
+		return;
+
+	if(httpStats.callbacks[curHTTP.callbackID].dwCalls != 0xffffffffu)
+	{
+		httpStats.callbacks[curHTTP.callbackID].dwCalls++;
+		httpStats.callbacks[curHTTP.callbackID].dwTicks += TickGet() - dwStart;
+	}
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPStatsEnd(void)
+
+  Description:
+	Records the send time, TX FIFO wait and rate of curHTTP's response 
+	once the last byte of its body has been queued.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+  	None
+  ***************************************************************************/
+static void HTTPStatsEnd(void)
+{
+	DWORD dwTicks;
+
+	if(curHTTP.statBlocked)
+		curHTTP.statWait += TickGet() - curHTTP.statBlocked;
+	curHTTP.statBlocked = 0;
+
+	dwTicks = TickGet() - curHTTP.statMark;
+	HTTPStatsAdd(HTTP_STAT_SEND, dwTicks);
+	HTTPStatsAdd(HTTP_STAT_WAIT, curHTTP.statWait);
+	HTTPStatsAdd(HTTP_STAT_RATE, (DWORD)(((QWORD)curHTTP.statBytes * TICK_SECOND) / (dwTicks ? dwTicks : 1u)));
+
+	// Stop both totals together, so their ratio stays meaningful
+	if(httpStats.dwBytes + curHTTP.statBytes >= httpStats.dwBytes &&
+		httpStats.dwTicks + dwTicks >= httpStats.dwTicks)
+	{
+		httpStats.dwBytes += curHTTP.statBytes;
+		httpStats.dwTicks += dwTicks;
+	}
+}
+
+/*****************************************************************************
+  Function:
+	static BOOL HTTPStatsPut(void)
+
+  Description:
+	Writes the next part of the statistics to curHTTP's socket.  The 
+	binary form is httpStats as stored, with curHTTP.callbackPos counting 
+	the bytes written.  The JSON form is written one value at a time, 
+	each only once the TX FIFO has room for all of it, with 
+	curHTTP.callbackPos counting the values:
+
+	{"tick":35156,"requests":2,"bytes":1480,"ticks":9,
+	"parse":[0,1,1,...],...,"rate":[...],"callbacks":[[calls,ticks],...]}
+
+  Precondition:
+	curHTTP.httpStatus is HTTP_STATS_JSON or HTTP_STATS_BINARY.
+
+  Parameters:
+	None
+
+  Return Values:
+	TRUE - the statistics have all been written
+	FALSE - more remains to be written once the TX FIFO has room
+  ***************************************************************************/
+static BOOL HTTPStatsPut(void)
+{
+	BYTE cItem[80];
+	BYTE *ptr;
+	WORD wPos, wLen, j;
+	BYTE i;
+
+	if(curHTTP.httpStatus == HTTP_STATS_BINARY)
+	{
+		curHTTP.callbackPos += TCPPutArray(sktHTTP, (BYTE*)&httpStats + curHTTP.callbackPos, sizeof(httpStats) - curHTTP.callbackPos);
+		return curHTTP.callbackPos == sizeof(httpStats);
+	}
+
+	while(1)
+	{
+		wPos = (WORD)curHTTP.callbackPos;
+		ptr = cItem;
+		if(wPos == 0u)
+		{// Totals
+			ptr = HTTPStatsAppend(ptr, "{\"tick\":", httpStats.dwTickRate);
+			ptr = HTTPStatsAppend(ptr, ",\"requests\":", httpStats.dwRequests);
+			ptr = HTTPStatsAppend(ptr, ",\"bytes\":", httpStats.dwBytes);
+			ptr = HTTPStatsAppend(ptr, ",\"ticks\":", httpStats.dwTicks);
+		}
+		else if(wPos <= HTTP_STAT_COUNT*HTTP_STATS_BUCKETS)
+		{// One histogram bucket
+			i = (wPos - 1) / HTTP_STATS_BUCKETS;
+			j = (wPos - 1) % HTTP_STATS_BUCKETS;
+			if(j == 0u)
+			{
+				*ptr++ = ',';
+				*ptr++ = '"';
+				strcpypgm2ram((char*)ptr, httpStatNames[i]);
+				ptr += strlen((char*)ptr);
+				ptr = HTTPStatsAppend(ptr, "\":[", httpStats.wHist[i][j]);
+			}
+			else
+				ptr = HTTPStatsAppend(ptr, ",", httpStats.wHist[i][j]);
+			if(j == HTTP_STATS_BUCKETS - 1)
+				*ptr++ = ']';
+		}
+		else if(wPos <= HTTP_STAT_COUNT*HTTP_STATS_BUCKETS + HTTP_STATS_CALLBACKS)
+		{// One callback ID's calls and ticks
+			j = wPos - 1 - HTTP_STAT_COUNT*HTTP_STATS_BUCKETS;
+			ptr = HTTPStatsAppend(ptr, j ? ",[" : ",\"callbacks\":[[", httpStats.callbacks[j].dwCalls);
+			ptr = HTTPStatsAppend(ptr, ",", httpStats.callbacks[j].dwTicks);
+			*ptr++ = ']';
+		}
+		else if(wPos == HTTP_STAT_COUNT*HTTP_STATS_BUCKETS + HTTP_STATS_CALLBACKS + 1)
+		{// Close the callbacks and the object
+			strcpypgm2ram((char*)ptr, HTTP_STATS_CALLBACKS ? "]}" : ",\"callbacks\":[]}");
+			ptr += strlen((char*)ptr);
+		}
+		else
+			return TRUE;
+
+		// Wait until the whole value fits
+		wLen = ptr - cItem;
+		if(TCPIsPutReady(sktHTTP) < wLen)
+			return FALSE;
+		TCPPutArray(sktHTTP, cItem, wLen);
+		curHTTP.callbackPos++;
+	}
+}
+
+/*****************************************************************************
+  Function:
+	static BYTE* HTTPStatsAppend(BYTE* cData, ROM char* cName, DWORD dwValue)
+
+  Description:
+	Writes a string followed by a number in decimal.
+
+  Precondition:
+	None
+
+  Parameters:
+	cData - where to write
+	cName - the string to write first
+	dwValue - the number to write after it
+
+  Returns:
+	A pointer to the byte after the number, which is not terminated.
+  ***************************************************************************/
+static BYTE* HTTPStatsAppend(BYTE* cData, ROM char* cName, DWORD dwValue)
+{
+	strcpypgm2ram((char*)cData, cName);
+	cData += strlen((char*)cData);
+	ultoa(dwValue, cData);
+	return cData + strlen((char*)cData);
+}
 #endif
 
+/****************************************************************************
+  Section:
+	WebSocket Functions
+  ***************************************************************************/
+#if defined(HTTP_WEBSOCKET)
+
 /*****************************************************************************
   Function:
-	HTTP_IO_RESULT HTTPMPFSUpload(void)
+	static void HTTPWebSocketReadHeader(void)
 
   Summary:
-	Saves a file uploaded via POST as the new MPFS image in EEPROM or 
-	external Flash.
+	Reads WebSocket frame headers from the TCP buffer.
 
   Description:
-	Allows the MPFS image in EEPROM or external Flash to be updated via a 
-	web page by accepting a file upload and storing it to the external memory.
+	Once the payload of the previous frame has been read, this function 
+	reads the frames that follow it.  Pings are answered with a Pong 
+	carrying the same payload, Pongs are discarded, and a Close frame 
+	is answered with a Close frame of its own.  It stops at the first 
+	data frame, leaving its payload length in curHTTP.byteCount and its 
+	masking key in curHTTP.wsMask for HTTPWebSocketGetArray.  A frame 
+	that starts a new message waits until the application has seen the 
+	end of the last one.
+	
+	Frames that break the protocol, or that are too large to count in 
+	a WORD, are answered by closing the connection.
 
   Precondition:
-	MPFSFormat() has been called.
+	The connection has been upgraded to a WebSocket.
 
   Parameters:
 	None
 
-  Return Values:
-	HTTP_IO_DONE - on success
-	HTTP_IO_NEED_DATA - if more data is still expected
+  Returns:
+	None
 
   Remarks:
-	This function is only available when MPFS uploads are enabled and
-	the MPFS image is stored in EEPROM.
-
-  Internal:
-	After the headers, the first line from the form will be the MIME
-	separator.  Following that is more headers about the file, which
-	are discarded.  After another CRLFCRLF pair the file data begins,
-	which is read 16 bytes at a time and written to external memory.
+	A control frame is only read once it has arrived in full, and a Ping 
+	only once the TX FIFO has room for its Pong.
   ***************************************************************************/
-#if defined(HTTP_MPFS_UPLOAD)
-static HTTP_IO_RESULT HTTPMPFSUpload(void)
+static void HTTPWebSocketReadHeader(void)
 {
-	BYTE c[16];
-	WORD lenA, lenB;
-	
-	switch(curHTTP.httpStatus)
+	WORD wAvail, wLen, wHeaderLen;
+	BYTE vHeader[8];
+	BYTE vOpcode, c;
+
+	while(curHTTP.byteCount == 0u && !(curHTTP.wsFlags & HTTP_WS_CLOSED))
 	{
-		// New upload, so look for the CRLFCRLF
-		case HTTP_MPFS_UP:
-		
-			lenA = TCPFindROMArray(sktHTTP, (ROM BYTE*)"\r\n\r\n", 4, 0, FALSE);
-		
-			if(lenA != 0xffff)
-			{// Found it, so remove all data up to and including
-				lenA = TCPGetArray(sktHTTP, NULL, lenA);
-				curHTTP.byteCount -= lenA;
-				
-				// Make sure first 6 bytes are also in
-				if(TCPIsGetReady(sktHTTP) < (4 + 6) )
-				{
-					lenA++;
-					return HTTP_IO_NEED_DATA;
-				}
-				
-				// Make sure it's an MPFS of the correct version
-				lenA = TCPGetArray(sktHTTP, c, 10);
-				curHTTP.byteCount -= lenA;
-				if(memcmppgm2ram(c, (ROM void*)"\r\n\r\nMPFS\x02\x01", 10) == 0)
-				{// Read as Ver 2.1
-					curHTTP.httpStatus = HTTP_MPFS_OK;
-					
-					// Format MPFS storage and put 6 byte tag
-					curHTTP.file = MPFSFormat();
-					MPFSPutArray(curHTTP.file, &c[4], 6);
-				}
-				else
-				{// Version is wrong
-					curHTTP.httpStatus = HTTP_MPFS_ERROR;
-				}
-				
-				return HTTP_IO_WAITING;
-			}
-			else
-			{// Otherwise, remove as much as possible
-				lenA = TCPGetArray(sktHTTP, NULL, TCPIsGetReady(sktHTTP) - 4);
-				curHTTP.byteCount -= lenA;
-			}
-			
-			break;
-		
-		// Received file is invalid
-		case HTTP_MPFS_ERROR:
-			curHTTP.byteCount -= TCPIsGetReady(sktHTTP);
-			TCPDiscard(sktHTTP);
-			if(curHTTP.byteCount < 100 || curHTTP.byteCount > 0x80000000)
-			{// If almost all data was read, or if we overflowed, then return
-				smHTTP = SM_HTTP_SERVE_HEADERS;
-				return HTTP_IO_DONE;
+		// The second byte tells how long the rest of the header is
+		wAvail = TCPIsGetReady(sktHTTP);
+		if(wAvail < 2u)
+			return;
+		TCPPeekArray(sktHTTP, vHeader, 2, 0);
+		vOpcode = vHeader[0] & HTTP_WS_OPCODE;
+		wLen = vHeader[1] & HTTP_WS_LEN;
+
+		// Clients must mask every frame, and no extensions were negotiated
+		if((vHeader[0] & HTTP_WS_RSV) || !(vHeader[1] & HTTP_WS_MASKED))
+		{
+			HTTPWebSocketClose(HTTP_WS_STATUS_PROTOCOL);
+			return;
+		}
+		if(wLen == 127u)
+		{
+			HTTPWebSocketClose(HTTP_WS_STATUS_TOO_BIG);
+			return;
+		}
+
+		wHeaderLen = (wLen == 126u) ? 8u : 6u;
+		if(wAvail < wHeaderLen)
+			return;
+		TCPPeekArray(sktHTTP, vHeader, wHeaderLen, 0);
+		if(wLen == 126u)
+			wLen = ((WORD)vHeader[2] << 8) | vHeader[3];
+
+		if(vOpcode & 0x08)
+		{// Control frames are short and whole, and may come between fragments
+			if(!(vHeader[0] & HTTP_WS_FIN) || wLen > 125u)
+			{
+				HTTPWebSocketClose(HTTP_WS_STATUS_PROTOCOL);
+				return;
 			}
-			break;
-		
-		// File is verified, so write the data
-		case HTTP_MPFS_OK:
-			// Determine how much to read
-			lenA = TCPIsGetReady(sktHTTP);
-			if(lenA > curHTTP.byteCount)
-				lenA = curHTTP.byteCount;
-				
-			while(lenA > 0)
+			if(wAvail < wHeaderLen + wLen || TCPIsPutReady(sktHTTP) < wLen + 4u)
+				return;
+			TCPGetArray(sktHTTP, NULL, wHeaderLen);
+			memcpy((void*)curHTTP.wsMask, (void*)&vHeader[wHeaderLen-4], 4);
+			curHTTP.wsMaskPos = 0;
+
+			switch(vOpcode)
 			{
-				lenB = TCPGetArray(sktHTTP, c, mMIN(lenA,16));
-				curHTTP.byteCount -= lenB;
-				lenA -= lenB;
-				MPFSPutArray(curHTTP.file, c, lenB);
+				case HTTP_WS_PING:
+					TCPPut(sktHTTP, HTTP_WS_FIN | HTTP_WS_PONG);
+					TCPPut(sktHTTP, (BYTE)wLen);
+					while(wLen--)
+					{
+						TCPGet(sktHTTP, &c);
+						HTTPWebSocketUnmask(&c, 1);
+						TCPPut(sktHTTP, c);
+					}
+					break;
+
+				case HTTP_WS_PONG:
+					TCPGetArray(sktHTTP, NULL, wLen);
+					break;
+
+				case HTTP_WS_CLOSE:
+					// Echo the client's status code, if it sent one
+					if(wLen == 1u)
+					{
+						HTTPWebSocketClose(HTTP_WS_STATUS_PROTOCOL);
+						return;
+					}
+					vHeader[0] = HTTP_WS_STATUS_NORMAL >> 8;
+					vHeader[1] = HTTP_WS_STATUS_NORMAL & 0xff;
+					if(wLen != 0u)
+					{
+						TCPGetArray(sktHTTP, vHeader, 2);
+						HTTPWebSocketUnmask(vHeader, 2);
+					}
+					HTTPWebSocketClose(((WORD)vHeader[0] << 8) | vHeader[1]);
+					return;
+
+				default:
+					HTTPWebSocketClose(HTTP_WS_STATUS_PROTOCOL);
+					return;
 			}
-				
-			// If we've read all the data
-			if(curHTTP.byteCount == 0)
+			continue;
+		}
+
+		// Data frames either start a message or continue the current one
+		if((vOpcode == HTTP_WS_CONTINUATION) ? !(curHTTP.wsFlags & HTTP_WS_RX_MESSAGE) :
+			(vOpcode > HTTP_WS_BINARY || (curHTTP.wsFlags & HTTP_WS_RX_MESSAGE)))
+		{
+			HTTPWebSocketClose(HTTP_WS_STATUS_PROTOCOL);
+			return;
+		}
+		if(curHTTP.wsFlags & HTTP_WS_RX_END)
+			return;
+
+		TCPGetArray(sktHTTP, NULL, wHeaderLen);
+		memcpy((void*)curHTTP.wsMask, (void*)&vHeader[wHeaderLen-4], 4);
+		curHTTP.wsMaskPos = 0;
+		curHTTP.byteCount = wLen;
+		if(vOpcode != HTTP_WS_CONTINUATION)
+		{
+			curHTTP.wsFlags &= ~HTTP_WS_RX_TEXT;
+			if(vOpcode == HTTP_WS_TEXT)
+				curHTTP.wsFlags |= HTTP_WS_RX_TEXT;
+			curHTTP.wsFlags |= HTTP_WS_RX_MESSAGE;
+		}
+		curHTTP.wsFlags &= ~HTTP_WS_RX_FIN;
+		if(vHeader[0] & HTTP_WS_FIN)
+		{
+			curHTTP.wsFlags |= HTTP_WS_RX_FIN;
+
+			// An empty final frame ends its message at once
+			if(wLen == 0u)
 			{
-				MPFSPutEnd(TRUE);
-				smHTTP = SM_HTTP_SERVE_HEADERS;
-				return HTTP_IO_DONE;
+				curHTTP.wsFlags &= ~HTTP_WS_RX_MESSAGE;
+				curHTTP.wsFlags |= HTTP_WS_RX_END;
 			}
-			
-		// Other states are not valid here
-		default:
-			break;
+		}
 	}
-		
-	// Ask for more data
-	return HTTP_IO_NEED_DATA;
-	
 }
-#endif
 
 /*****************************************************************************
   Function:
-	void HTTPIncFile(ROM BYTE* cFile)
+	static void HTTPWebSocketUnmask(BYTE* cData, WORD wLen)
 
   Summary:
-	Writes a file byte-for-byte to the currently loaded TCP socket.
+	Unmasks payload bytes read from the current frame.
 
   Description:
-	Allows an entire file to be included as a dynamic variable, providing
-	a basic templating system for HTML web pages.  This reduces unneeded
-	duplication of visual elements such as headers, menus, etc.
-
-	When curHTTP.callbackPos is 0, the file is opened and as many bytes
-	as possible are written.  The current position is then saved to 
-	curHTTP.callbackPos and the file is closed.  On subsequent calls, 
-	reading begins at the saved location and continues.  Once the end of
-	the input file is reached, curHTTP.callbackPos is set back to 0 to 
-	indicate completion.
+	XORs each byte with the next byte of the frame's masking key, 
+	advancing curHTTP.wsMaskPos.
 
   Precondition:
+	HTTPWebSocketReadHeader has loaded the frame's masking key.
+
+  Parameters:
+	cData - the bytes to unmask in place
+	wLen - how many bytes to unmask
+
+  Returns:
 	None
+  ***************************************************************************/
+static void HTTPWebSocketUnmask(BYTE* cData, WORD wLen)
+{
+	while(wLen--)
+		*cData++ ^= curHTTP.wsMask[curHTTP.wsMaskPos++ & 0x03];
+}
+
+/*****************************************************************************
+  Function:
+	static void HTTPWebSocketClose(WORD wStatus)
+
+  Summary:
+	Sends a WebSocket Close frame.
+
+  Description:
+	Writes a Close frame carrying wStatus, if the TX FIFO has room for 
+	it, and sets HTTP_WS_CLOSED so the connection is closed once the 
+	frame has been flushed.
+
+  Precondition:
+	The connection has been upgraded to a WebSocket.
 
   Parameters:
-	cFile - the name of the file to be sent
+	wStatus - status code explaining why the connection is closing
 
   Returns:
-  	None
-  	
-  Remarks:
-	Users should not call this function directly, but should instead add
-	dynamic variables in the form of ~inc:filename.ext~ in their HTML code
-	to include (for example) the file "filename.ext" at that specified
-	location.  The MPFS2 Generator utility will handle the rest.
+	None
   ***************************************************************************/
-void HTTPIncFile(ROM BYTE* cFile)
+static void HTTPWebSocketClose(WORD wStatus)
 {
-	WORD wCount, wLen;
-	BYTE data[64];
-	MPFS_HANDLE fp;
-	
-	// Check if this is a first round call
-	if(curHTTP.callbackPos == 0x00)
-	{// On initial call, open the file and save its ID
-		fp = MPFSOpenROM(cFile);
-		if(fp == MPFS_INVALID_HANDLE)
-		{// File not found, so abort
-			return;
-		}
-		((DWORD_VAL*)&curHTTP.callbackPos)->w[0] = MPFSGetID(fp);
-	}
-	else
-	{// The file was already opened, so load up its ID and seek
-		fp = MPFSOpenID(((DWORD_VAL*)&curHTTP.callbackPos)->w[0]);
-		if(fp == MPFS_INVALID_HANDLE)
-		{// No file handles available, so wait for now
-			return;
-		}
-		MPFSSeek(fp, ((DWORD_VAL*)&curHTTP.callbackPos)->w[1], MPFS_SEEK_FORWARD);
-	}
+	BYTE vFrame[4];
+
+	if(curHTTP.wsFlags & HTTP_WS_CLOSED)
+		return;
+	curHTTP.wsFlags |= HTTP_WS_CLOSED;
+	curHTTP.byteCount = 0;
+
+	if(TCPIsPutReady(sktHTTP) < sizeof(vFrame))
+		return;
+	vFrame[0] = HTTP_WS_FIN | HTTP_WS_CLOSE;
+	vFrame[1] = 2;
+	vFrame[2] = wStatus >> 8;
+	vFrame[3] = wStatus & 0xff;
+	TCPPutArray(sktHTTP, vFrame, sizeof(vFrame));
+}
+
+/*****************************************************************************
+  Function:
+	WORD HTTPWebSocketGetArray(BYTE* cData, WORD wLen)
+
+  Summary:
+	Reads part of a WebSocket message from the TCP buffer.
+
+  Description:
+	Reads up to wLen bytes of the message being received, unmasking 
+	them.  A fragmented message is read across its frames as if it 
+	were one, and reading never continues past the end of a message.  
+	Once the last byte has been read, HTTPWebSocketIsMessageEnd() is 
+	TRUE until the HTTPExecuteWebSocket callback returns.
 	
-	// Get/put as many bytes as possible
-	wCount = TCPIsPutReady(sktHTTP);
-	while(wCount > 0)
+	This function is meant to be called from HTTPExecuteWebSocket.
+
+  Precondition:
+	None
+
+  Parameters:
+	cData - where to store the bytes, or NULL to discard them
+	wLen - how many bytes can be written to cData
+
+  Returns:
+	The number of bytes read, which is 0 if no message data is waiting.
+  ***************************************************************************/
+WORD HTTPWebSocketGetArray(BYTE* cData, WORD wLen)
+{
+	WORD wRead, w;
+
+	wRead = 0;
+	while(wLen)
 	{
-		wLen = MPFSGetArray(fp, data, mMIN(wCount, 64));
-		if(wLen == 0)
-		{// If no bytes were read, an EOF was reached
-			MPFSClose(fp);
-			curHTTP.callbackPos = 0x00;
-			return;
+		// Move on to the next fragment of the current message
+		if(curHTTP.byteCount == 0u)
+		{
+			if(!(curHTTP.wsFlags & HTTP_WS_RX_MESSAGE))
+				break;
+			HTTPWebSocketReadHeader();
+			if(curHTTP.byteCount == 0u)
+				break;
+		}
+
+		w = TCPIsGetReady(sktHTTP);
+		if(w > wLen)
+			w = wLen;
+		if(w > curHTTP.byteCount)
+			w = (WORD)curHTTP.byteCount;
+		if(w == 0u)
+			break;
+
+		w = TCPGetArray(sktHTTP, cData, w);
+		if(cData)
+		{
+			HTTPWebSocketUnmask(cData, w);
+			cData += w;
 		}
 		else
-		{// Write the bytes to the socket
-			TCPPutArray(sktHTTP, data, wLen);
-			wCount -= wLen;
+			curHTTP.wsMaskPos += w;
+		wRead += w;
+		wLen -= w;
+		curHTTP.byteCount -= w;
+
+		// The message ends with the last byte of its final frame
+		if(curHTTP.byteCount == 0u && (curHTTP.wsFlags & HTTP_WS_RX_FIN))
+		{
+			curHTTP.wsFlags &= ~HTTP_WS_RX_MESSAGE;
+			curHTTP.wsFlags |= HTTP_WS_RX_END;
+			break;
 		}
 	}
+
+	return wRead;
+}
+
+/*****************************************************************************
+  Function:
+	WORD HTTPWebSocketPutArray(BYTE* cData, WORD wLen, BYTE vOpcode, 
+								BOOL bFinal)
+
+  Summary:
+	Writes part of a WebSocket message to the TCP buffer.
+
+  Description:
+	Writes as much of cData as the TX FIFO has room for, as one frame.  
+	If it can't all be written, the frame is sent as a fragment, and the 
+	next call continues the same message with the rest of the data, 
+	whatever vOpcode it passes.  The message ends with the frame that 
+	writes the last byte of a call with bFinal set.
 	
-	// Save the new address and close the file
-	((DWORD_VAL*)&curHTTP.callbackPos)->w[1] = MPFSTell(fp);
-	MPFSClose(fp);
-	
-	return;
+	This function is meant to be called from HTTPExecuteWebSocket.
+
+  Precondition:
+	None
+
+  Parameters:
+	cData - the bytes to send
+	wLen - how many bytes to send
+	vOpcode - HTTP_WS_TEXT or HTTP_WS_BINARY, for the type of message
+	bFinal - TRUE if these are the last bytes of the message
+
+  Returns:
+	The number of bytes written.  Write the rest later.
+
+  Remarks:
+	Frames with a 16-bit length need 4 bytes of header, and shorter 
+	frames 2.  An empty message can be sent once TCPIsPutReady() is at 
+	least 2.
+  ***************************************************************************/
+WORD HTTPWebSocketPutArray(BYTE* cData, WORD wLen, BYTE vOpcode, BOOL bFinal)
+{
+	WORD wAvail, w;
+	BYTE vHeader[4];
+
+	wAvail = TCPIsPutReady(sktHTTP);
+	if((curHTTP.wsFlags & HTTP_WS_CLOSED) || wAvail < 2u)
+		return 0;
+
+	// Send as much as fits, using a 16-bit length only when it's needed
+	w = wLen;
+	if(w > wAvail - 2u)
+		w = wAvail - 2u;
+	if(w > 125u && w > wAvail - 4u)
+		w = wAvail - 4u;
+	if(w == 0u && wLen != 0u)
+		return 0;
+
+	// Continue a message already begun, and end it only with its last byte
+	if(curHTTP.wsFlags & HTTP_WS_TX_MESSAGE)
+		vOpcode = HTTP_WS_CONTINUATION;
+	if(bFinal && w == wLen)
+	{
+		vOpcode |= HTTP_WS_FIN;
+		curHTTP.wsFlags &= ~HTTP_WS_TX_MESSAGE;
+	}
+	else
+		curHTTP.wsFlags |= HTTP_WS_TX_MESSAGE;
+
+	vHeader[0] = vOpcode;
+	if(w > 125u)
+	{
+		vHeader[1] = 126;
+		vHeader[2] = w >> 8;
+		vHeader[3] = w & 0xff;
+		TCPPutArray(sktHTTP, vHeader, 4);
+	}
+	else
+	{
+		vHeader[1] = (BYTE)w;
+		TCPPutArray(sktHTTP, vHeader, 2);
+	}
+
+	return TCPPutArray(sktHTTP, cData, w);
 }
 
+#endif
+
 
 #endif
@@ -949,6 +949,97 @@ WORD CalcIPChecksum(BYTE* buffer, WORD count)
 }
 
 
+/*****************************************************************************
+  Function:
+	WORD UpdateIPChecksum(WORD checksum, WORD oldVal, WORD newVal)
+
+  Summary:
+	Incrementally updates an IP checksum after a 16-bit field changes.
+
+  Description:
+	This function adjusts an existing IP checksum to account for one 16-bit 
+	word of the checksummed data changing from oldVal to newVal, without 
+	summing the data again.  It uses equation 3 of RFC 1624, 
+	HC' = ~(~HC + ~m + m'), which never produces the invalid -0 result of 
+	the older RFC 1141 method.
+
+  Precondition:
+	None
+
+  Parameters:
+	checksum - the checksum currently stored in the packet
+	oldVal - the previous value of the changed word
+	newVal - the new value of the changed word
+
+  Returns:
+	The updated checksum.
+	
+  Remarks:
+	All three values must use the same byte order.  Since one's complement 
+	sums are byte order independent, the words may be passed exactly as 
+	read from the packet.
+  ***************************************************************************/
+WORD UpdateIPChecksum(WORD checksum, WORD oldVal, WORD newVal)
+{
+	DWORD_VAL sum;
+
+	sum.Val = (DWORD)(WORD)~checksum + (DWORD)(WORD)~oldVal + (DWORD)newVal;
+
+	// Do the end-around carries
+	sum.Val = (DWORD)sum.w[0] + (DWORD)sum.w[1];
+	sum.w[0] += sum.w[1];
+
+	return ~sum.w[0];
+}
+
+
+/*****************************************************************************
+  Function:
+	DWORD CalcCRC32(DWORD crc, BYTE* buffer, WORD count)
+
+  Summary:
+	Calculates or continues a CRC-32.
+
+  Description:
+	This function calculates the CRC-32 used by Ethernet, zip and gzip 
+	(polynomial 0xEDB88320, reflected, with inverted initial value and 
+	result) over an array of input data.  A table of 16 entries is 
+	used, processing 4 bits at a time, to keep the ROM cost small.
+
+  Precondition:
+	None
+
+  Parameters:
+	crc - 0 to start a new calculation, or the result of a previous call 
+		to continue it over more data
+	buffer - pointer to the data to be checked
+	count  - number of bytes to be checked
+
+  Returns:
+	The calculated CRC-32.
+  ***************************************************************************/
+DWORD CalcCRC32(DWORD crc, BYTE* buffer, WORD count)
+{
+	static ROM DWORD table[16] = 
+	{
+		0x00000000ul, 0x1DB71064ul, 0x3B6E20C8ul, 0x26D930ACul,
+		0x76DC4190ul, 0x6B6B51F4ul, 0x4DB26158ul, 0x5005713Cul,
+		0xEDB88320ul, 0xF00F9344ul, 0xD6D6A3E8ul, 0xCB61B38Cul,
+		0x9B64C2B0ul, 0x86D3D2D4ul, 0xA00AE278ul, 0xBDBDF21Cul
+	};
+
+	crc = ~crc;
+	while(count--)
+	{
+		crc ^= *buffer++;
+		crc = (crc >> 4) ^ table[crc & 0x0f];
+		crc = (crc >> 4) ^ table[crc & 0x0f];
+	}
+
+	return ~crc;
+}
+
+
 /*****************************************************************************
   Function:
 	WORD CalcIPBufferChecksum(WORD len)
@@ -123,15 +123,18 @@ void ICMPProcess(NODE_INFO *remote, WORD len)
 		if(MACCalcRxChecksum(0+sizeof(IP_HEADER), len))
 			return;
 	
-		// Calculate new Type, Code, and Checksum values
+		// Calculate new Type, Code, and Checksum values.  Only the 
+		// Type changes, so the checksum is adjusted per RFC 1624 
+		// rather than recalculated over the whole payload.
+		dwVal.w[1] = UpdateIPChecksum(dwVal.w[1], 0x0008u, 0x0000u);
 		dwVal.v[0] = 0x00;	// Type: 0 (ICMP echo/ping reply)
-		dwVal.v[2] += 8;	// Subtract 0x0800 from the checksum
-		if(dwVal.v[2] < 8u)
-		{
-			dwVal.v[3]++;
-			if(dwVal.v[3] == 0u)
-				dwVal.v[2]++;
-		}
+
+		// Turn the request into the reply right in the RX buffer and 
+		// transmit it from there, avoiding a copy of the payload
+		#if defined(ICMP_REPLY_IN_PLACE)
+		if(IPReplyInPlace(remote, (BYTE*)&dwVal, sizeof(dwVal), len))
+			return;
+		#endif
 	
 		// Position the write pointer for the next IPPutHeader operation
 	    MACSetWritePtr(BASE_TX_ADDR + sizeof(ETHER_HEADER));
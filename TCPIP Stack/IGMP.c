@@ -0,0 +1,496 @@
+/*********************************************************************
+ *
+ *	Internet Group Management Protocol (IGMP) Host
+ *  Module for Microchip TCP/IP Stack
+ *	 -Joins and leaves IPv4 multicast groups and answers membership 
+ *	  queries so that multicast traffic reaches this node
+ *	 -Reports memberships again whenever the IP address changes
+ *	 -Reference: RFC 2236
+ *
+ *********************************************************************
+ * FileName:        IGMP.c
+ * Dependencies:    IP, MAC
+ * Processor:       CH32V307
+ * Compiler:        GCC
+ ********************************************************************/
+#define __IGMP_C
+
+#include "TCPIP Stack/TCPIP.h"
+
+#if defined(STACK_USE_IGMP)
+
+// Maximum number of multicast groups that can be joined at once
+#if !defined(IGMP_MAX_GROUPS)
+	#define IGMP_MAX_GROUPS			(4u)
+#endif
+
+// Delay before repeating the unsolicited report sent on joining a group
+#define IGMP_UNSOLICITED_REPORT_INTERVAL	(10ul*TICK_SECOND)
+
+// IGMP message types
+#define IGMP_MEMBERSHIP_QUERY		(0x11u)
+#define IGMP_V1_MEMBERSHIP_REPORT	(0x12u)
+#define IGMP_V2_MEMBERSHIP_REPORT	(0x16u)
+#define IGMP_LEAVE_GROUP			(0x17u)
+
+// 224.0.0.1 and 224.0.0.2 as stored in an IP_ADDR
+#define IGMP_ALL_HOSTS				(0x010000E0ul)
+#define IGMP_ALL_ROUTERS			(0x020000E0ul)
+
+typedef struct
+{
+	BYTE	vType;
+	BYTE	vMaxRespTime;		// Tenths of a second; 0 from IGMPv1 routers
+	WORD	wChecksum;
+	IP_ADDR	GroupAddress;
+} IGMP_PACKET;
+
+typedef struct
+{
+	IP_ADDR	Group;				// Group address, or 0 when the entry is free
+	TICK	ReportTime;			// When the pending report is due
+	BYTE	refCount;			// Outstanding IGMPJoinGroup() calls
+	struct
+	{
+		unsigned char bReportPending : 1;	// A report is scheduled for ReportTime
+		unsigned char bRepeatReport : 1;	// Send the unsolicited report once more
+		unsigned char bLastReporter : 1;	// We sent the most recent report for this group
+	} Flags;
+} IGMP_GROUP;
+
+static IGMP_GROUP Groups[IGMP_MAX_GROUPS];
+
+// Address our memberships were last announced from
+static IP_ADDR ReportedIP;
+
+// IP Router Alert option (RFC 2113) required on IGMPv2 messages
+static ROM BYTE RouterAlert[4] = {0x94, 0x04, 0x00, 0x00};
+
+static BOOL SendMessage(BYTE vType, IP_ADDR group, IP_ADDR dest);
+static void MulticastToMAC(IP_ADDR ip, MAC_ADDR *mac);
+
+
+/*****************************************************************************
+  Function:
+	void IGMPInit(void)
+
+  Summary:
+	Initializes the IGMP module.
+
+  Description:
+	Clears the group table and subscribes to the all-hosts group so that 
+	membership queries are received.
+
+  Precondition:
+	MACInit() has been called.
+
+  Parameters:
+	None
+
+  Returns:
+  	None
+  ***************************************************************************/
+void IGMPInit(void)
+{
+	MAC_ADDR mac;
+	IP_ADDR allHosts;
+
+	memset((void*)Groups, 0x00, sizeof(Groups));
+	ReportedIP.Val = 0x00000000ul;
+
+	allHosts.Val = IGMP_ALL_HOSTS;
+	MulticastToMAC(allHosts, &mac);
+	MACAddMulticast(&mac);
+}
+
+
+/*****************************************************************************
+  Function:
+	void IGMPTask(void)
+
+  Summary:
+	Transmits membership reports that have come due.
+
+  Description:
+	Sends each scheduled membership report once its random delay has 
+	expired.  A report that cannot be sent because the MAC is busy is 
+	retried on the next call.  When AppConfig.MyIPAddr changes, such as 
+	on a new DHCP lease or a configuration change, every membership is 
+	announced again with unsolicited reports, as on joining.
+
+  Precondition:
+	IGMPInit() has been called.
+
+  Parameters:
+	None
+
+  Returns:
+  	None
+  ***************************************************************************/
+void IGMPTask(void)
+{
+	BYTE i;
+	IGMP_GROUP *g;
+
+	// Routers may not have heard from us at a new address, or on the 
+	// network it was obtained from
+	if(AppConfig.MyIPAddr.Val != ReportedIP.Val)
+	{
+		ReportedIP.Val = AppConfig.MyIPAddr.Val;
+		for(i = 0; ReportedIP.Val != 0x00000000ul && i < IGMP_MAX_GROUPS; i++)
+		{
+			g = &Groups[i];
+			if(!g->refCount || g->Group.Val == IGMP_ALL_HOSTS)
+				continue;
+			g->Flags.bReportPending = 1;
+			g->Flags.bRepeatReport = 1;
+			g->ReportTime = TickGet();
+		}
+	}
+
+	for(i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		g = &Groups[i];
+		if(!g->refCount || !g->Flags.bReportPending)
+			continue;
+
+		if((LONG)(TickGet() - g->ReportTime) < 0)
+			continue;
+
+		if(!SendMessage(IGMP_V2_MEMBERSHIP_REPORT, g->Group, g->Group))
+			return;
+
+		g->Flags.bLastReporter = 1;
+		g->Flags.bReportPending = 0;
+		if(g->Flags.bRepeatReport)
+		{
+			g->Flags.bRepeatReport = 0;
+			g->Flags.bReportPending = 1;
+			g->ReportTime = TickGet() + IGMP_UNSOLICITED_REPORT_INTERVAL;
+		}
+	}
+}
+
+
+/*****************************************************************************
+  Function:
+	void IGMPProcess(NODE_INFO *remote, IP_ADDR *localIP, WORD len)
+
+  Summary:
+	Handles an incoming IGMP message.
+
+  Description:
+	Membership queries schedule a report for each matching group after a 
+	random delay bounded by the query's maximum response time.  Reports 
+	from other members of a group cancel our own pending report for it.
+
+  Precondition:
+	IPGetHeader() has returned an IGMP packet.
+
+  Parameters:
+	remote - Sender of the message
+	localIP - Destination address of the message
+	len - Length of the IGMP message
+
+  Returns:
+  	None
+  ***************************************************************************/
+void IGMPProcess(NODE_INFO *remote, IP_ADDR *localIP, WORD len)
+{
+	IGMP_PACKET packet;
+	IGMP_GROUP *g;
+	TICK maxDelay;
+	TICK delay;
+	BYTE i;
+
+	if(len < sizeof(packet))
+		return;
+
+	// Verify the checksum over the whole message (IGMPv3 queries are 
+	// longer than the IGMPv2 fields we use)
+	IPSetRxBuffer(0);
+	if(CalcIPBufferChecksum(len))
+		return;
+
+	IPSetRxBuffer(0);
+	MACGetArray((BYTE*)&packet, sizeof(packet));
+
+	switch(packet.vType)
+	{
+		case IGMP_MEMBERSHIP_QUERY:
+			// IGMPv1 queries carry no response time; use 10 seconds
+			maxDelay = packet.vMaxRespTime ? packet.vMaxRespTime : 100u;
+			maxDelay = maxDelay * TICK_SECOND / 10u;
+
+			for(i = 0; i < IGMP_MAX_GROUPS; i++)
+			{
+				g = &Groups[i];
+				if(!g->refCount || g->Group.Val == IGMP_ALL_HOSTS)
+					continue;
+
+				// General queries have a zero group address
+				if(packet.GroupAddress.Val && packet.GroupAddress.Val != g->Group.Val)
+					continue;
+
+				delay = (TICK)rand() % (maxDelay + 1u);
+				if(g->Flags.bReportPending && (LONG)(g->ReportTime - (TickGet() + delay)) <= 0)
+					continue;
+
+				g->Flags.bReportPending = 1;
+				g->ReportTime = TickGet() + delay;
+			}
+			break;
+
+		case IGMP_V1_MEMBERSHIP_REPORT:
+		case IGMP_V2_MEMBERSHIP_REPORT:
+			// Another member answered for this group; suppress our report
+			for(i = 0; i < IGMP_MAX_GROUPS; i++)
+			{
+				g = &Groups[i];
+				if(g->refCount && g->Group.Val == packet.GroupAddress.Val && g->Flags.bReportPending)
+				{
+					g->Flags.bReportPending = 0;
+					g->Flags.bRepeatReport = 0;
+					g->Flags.bLastReporter = 0;
+				}
+			}
+			break;
+	}
+}
+
+
+/*****************************************************************************
+  Function:
+	BOOL IGMPJoinGroup(IP_ADDR group)
+
+  Summary:
+	Joins an IPv4 multicast group.
+
+  Description:
+	Programs the MAC to receive the group's multicast address and 
+	announces the membership with an unsolicited report, repeated once.  
+	Joins are reference counted.
+
+  Precondition:
+	IGMPInit() has been called.
+
+  Parameters:
+	group - Class D group address to join
+
+  Return Values:
+  	TRUE - The group was joined
+  	FALSE - The address is not multicast, or no group or MAC filter 
+  		entries are free
+  ***************************************************************************/
+BOOL IGMPJoinGroup(IP_ADDR group)
+{
+	BYTE i;
+	IGMP_GROUP *g;
+	MAC_ADDR mac;
+
+	if(!IPIsMulticast(group))
+		return FALSE;
+
+	g = NULL;
+	for(i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		if(Groups[i].refCount && Groups[i].Group.Val == group.Val)
+		{
+			Groups[i].refCount++;
+			return TRUE;
+		}
+		if(!Groups[i].refCount && g == NULL)
+			g = &Groups[i];
+	}
+
+	if(g == NULL)
+		return FALSE;
+
+	MulticastToMAC(group, &mac);
+	if(!MACAddMulticast(&mac))
+		return FALSE;
+
+	memset((void*)g, 0x00, sizeof(*g));
+	g->Group.Val = group.Val;
+	g->refCount = 1;
+
+	// Membership in the all-hosts group is never reported
+	if(group.Val != IGMP_ALL_HOSTS)
+	{
+		g->Flags.bReportPending = 1;
+		g->Flags.bRepeatReport = 1;
+		g->ReportTime = TickGet();
+	}
+
+	return TRUE;
+}
+
+
+/*****************************************************************************
+  Function:
+	void IGMPLeaveGroup(IP_ADDR group)
+
+  Summary:
+	Leaves an IPv4 multicast group.
+
+  Description:
+	Undoes one IGMPJoinGroup() call.  When the last reference is dropped, 
+	a Leave Group message is sent if we were the last node to report the 
+	group, and the MAC stops receiving the group's address.
+
+  Precondition:
+	IGMPInit() has been called.
+
+  Parameters:
+	group - Group address previously joined
+
+  Returns:
+  	None
+  ***************************************************************************/
+void IGMPLeaveGroup(IP_ADDR group)
+{
+	BYTE i;
+	IGMP_GROUP *g;
+	MAC_ADDR mac;
+	IP_ADDR allRouters;
+
+	for(i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		g = &Groups[i];
+		if(!g->refCount || g->Group.Val != group.Val)
+			continue;
+
+		if(--g->refCount)
+			return;
+
+		if(g->Flags.bLastReporter)
+		{
+			allRouters.Val = IGMP_ALL_ROUTERS;
+			SendMessage(IGMP_LEAVE_GROUP, group, allRouters);
+		}
+
+		MulticastToMAC(group, &mac);
+		MACRemoveMulticast(&mac);
+		g->Group.Val = 0;
+		return;
+	}
+}
+
+
+/*****************************************************************************
+  Function:
+	BOOL IGMPIsMember(IP_ADDR group)
+
+  Summary:
+	Determines if this node has joined a multicast group.
+
+  Description:
+	Used when receiving to decide if a multicast datagram is wanted.
+
+  Precondition:
+	IGMPInit() has been called.
+
+  Parameters:
+	group - Group address to check
+
+  Return Values:
+  	TRUE - The group has been joined, or is the all-hosts group
+  	FALSE - The group has not been joined
+  ***************************************************************************/
+BOOL IGMPIsMember(IP_ADDR group)
+{
+	BYTE i;
+
+	if(group.Val == IGMP_ALL_HOSTS)
+		return TRUE;
+
+	for(i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		if(Groups[i].refCount && Groups[i].Group.Val == group.Val)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/*****************************************************************************
+  Function:
+	static BOOL SendMessage(BYTE vType, IP_ADDR group, IP_ADDR dest)
+
+  Summary:
+	Transmits an IGMPv2 message.
+
+  Description:
+	Builds an IGMP message with a TTL of 1 and the Router Alert option 
+	and sends it to the given multicast destination.
+
+  Precondition:
+	None
+
+  Parameters:
+	vType - IGMP message type
+	group - Group address field of the message
+	dest - Destination multicast address
+
+  Return Values:
+  	TRUE - The message was transmitted
+  	FALSE - The MAC was not ready; try again later
+  ***************************************************************************/
+static BOOL SendMessage(BYTE vType, IP_ADDR group, IP_ADDR dest)
+{
+	IGMP_PACKET packet;
+	NODE_INFO remote;
+
+	if(!IPIsTxReady())
+		return FALSE;
+
+	packet.vType = vType;
+	packet.vMaxRespTime = 0;
+	packet.wChecksum = 0;
+	packet.GroupAddress.Val = group.Val;
+	packet.wChecksum = CalcIPChecksum((BYTE*)&packet, sizeof(packet));
+
+	remote.IPAddr.Val = dest.Val;
+	MulticastToMAC(dest, &remote.MACAddr);
+
+	IPPutHeaderEx(&remote, IP_PROT_IGMP, sizeof(packet), 1, (BYTE*)RouterAlert, sizeof(RouterAlert));
+	MACPutArray((BYTE*)&packet, sizeof(packet));
+	MACFlush();
+
+	return TRUE;
+}
+
+
+/*****************************************************************************
+  Function:
+	static void MulticastToMAC(IP_ADDR ip, MAC_ADDR *mac)
+
+  Summary:
+	Maps a multicast IP address to its Ethernet address.
+
+  Description:
+	Places the low 23 bits of the group address after the 01:00:5E 
+	prefix, per RFC 1112.
+
+  Precondition:
+	None
+
+  Parameters:
+	ip - Class D address
+	mac - Receives the Ethernet multicast address
+
+  Returns:
+  	None
+  ***************************************************************************/
+static void MulticastToMAC(IP_ADDR ip, MAC_ADDR *mac)
+{
+	mac->v[0] = 0x01;
+	mac->v[1] = 0x00;
+	mac->v[2] = 0x5E;
+	mac->v[3] = ip.v[1] & 0x7F;
+	mac->v[4] = ip.v[2];
+	mac->v[5] = ip.v[3];
+}
+
+#endif //#if defined(STACK_USE_IGMP)
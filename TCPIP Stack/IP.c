@@ -247,17 +247,56 @@ BOOL IPGetHeader(IP_ADDR *localIP,
 WORD IPPutHeader(NODE_INFO *remote,
                  BYTE protocol,
                  WORD len)
+{
+	return IPPutHeaderEx(remote, protocol, len, MY_IP_TTL, NULL, 0);
+}
+
+/*********************************************************************
+ * Function: WORD IPPutHeaderEx(NODE_INFO *remote,
+ *           				    BYTE protocol,
+ *                			    WORD len,
+ *                			    BYTE ttl,
+ *                			    BYTE *options,
+ *                			    BYTE optionsLen)
+ *
+ * PreCondition:    IPIsTxReady() == TRUE
+ *
+ * Input:           *remote     - Destination node address
+ *                  protocol    - Current packet protocol
+ *                  len         - Current packet data length
+ *                  ttl         - Time-To-Live for this packet
+ *                  options     - IP options to append to the header,
+ *                                or NULL
+ *                  optionsLen  - Length of options; must be a
+ *                                multiple of 4
+ *
+ * Output:          (WORD)0
+ *
+ * Side Effects:    None
+ *
+ * Note:            Used by protocols such as IGMP that need a
+ *                  non-default TTL or the Router Alert option.
+ *                  Only one IP message can be transmitted at any
+ *                  time.
+ ********************************************************************/
+WORD IPPutHeaderEx(NODE_INFO *remote,
+                   BYTE protocol,
+                   WORD len,
+                   BYTE ttl,
+                   BYTE *options,
+                   BYTE optionsLen)
 {
     IP_HEADER   header;
+    WORD        checksums[2];
     
-    IPHeaderLen = sizeof(IP_HEADER);
+    IPHeaderLen = sizeof(IP_HEADER) + optionsLen;
 
-    header.VersionIHL       = IP_VERSION | IP_IHL;
+    header.VersionIHL       = IP_VERSION | (IPHeaderLen >> 2);
     header.TypeOfService    = IP_SERVICE;
-    header.TotalLength      = sizeof(header) + len;
+    header.TotalLength      = IPHeaderLen + len;
     header.Identification   = ++_Identifier;
     header.FragmentInfo     = 0;
-    header.TimeToLive       = MY_IP_TTL;
+    header.TimeToLive       = ttl;
     header.Protocol         = protocol;
     header.HeaderChecksum   = 0;
 	header.SourceAddress 	= AppConfig.MyIPAddr;
@@ -266,15 +305,95 @@ WORD IPPutHeader(NODE_INFO *remote,
 
     SwapIPHeader(&header);
 
-    header.HeaderChecksum   = CalcIPChecksum((BYTE*)&header, sizeof(header));
+    if(optionsLen)
+    {
+    	// Combine the checksums of the fixed header and the options
+    	checksums[0] = ~CalcIPChecksum((BYTE*)&header, sizeof(header));
+    	checksums[1] = ~CalcIPChecksum(options, optionsLen);
+    	header.HeaderChecksum = CalcIPChecksum((BYTE*)checksums, sizeof(checksums));
+    }
+    else
+    {
+    	header.HeaderChecksum = CalcIPChecksum((BYTE*)&header, sizeof(header));
+    }
 
-    MACPutHeader(&remote->MACAddr, MAC_IP, (sizeof(header)+len));
+    MACPutHeader(&remote->MACAddr, MAC_IP, (IPHeaderLen+len));
     MACPutArray((BYTE*)&header, sizeof(header));
+    if(optionsLen)
+    	MACPutArray(options, optionsLen);
 
     return 0x0000;
 
 }
 
+/*********************************************************************
+ * Function: BOOL IPReplyInPlace(NODE_INFO *remote,
+ *                               BYTE *header,
+ *                               BYTE headerLen,
+ *                               WORD len)
+ *
+ * PreCondition:    IPGetHeader() returned TRUE for the current RX 
+ *                  frame
+ *
+ * Input:           *remote     - Node that sent the received packet
+ *                  header      - New upper layer header to write over
+ *                                the start of the received data
+ *                  headerLen   - Length of header
+ *                  len         - Upper layer data length, including
+ *                                header
+ *
+ * Output:          TRUE if the received packet was turned into a reply
+ *                  and transmitted.  The RX frame has been discarded.
+ *                  FALSE if the reply must be built in the TX buffer
+ *                  instead.  The IP and upper layer headers of the
+ *                  RX frame may have been overwritten, but the data
+ *                  following them is intact.
+ *
+ * Side Effects:    None
+ *
+ * Note:            Avoids copying the data of echo-style replies.  
+ *                  The IP header is rewritten with swapped addresses 
+ *                  and the frame is handed to the MAC's TX ring as 
+ *                  is.  Packets with IP options are not handled since 
+ *                  some options would have to be reversed.
+ ********************************************************************/
+BOOL IPReplyInPlace(NODE_INFO *remote,
+                    BYTE *header,
+                    BYTE headerLen,
+                    WORD len)
+{
+    IP_HEADER   ipHeader;
+    BYTE        *frame;
+
+    if(IPHeaderLen != sizeof(IP_HEADER))
+        return FALSE;
+
+    // The IP header is not 4 byte aligned in the frame, so edit a copy
+    frame = MACGetRxFrame() + sizeof(ETHER_HEADER);
+    memcpy((void*)&ipHeader, (void*)frame, sizeof(ipHeader));
+
+    ipHeader.TypeOfService      = IP_SERVICE;
+    ipHeader.TotalLength        = sizeof(IP_HEADER) + len;
+    ipHeader.Identification     = _Identifier + 1;
+    ipHeader.FragmentInfo       = 0;
+    ipHeader.TimeToLive         = MY_IP_TTL;
+    ipHeader.HeaderChecksum     = 0;
+    ipHeader.SourceAddress      = AppConfig.MyIPAddr;
+    ipHeader.DestAddress.Val    = remote->IPAddr.Val;
+
+    SwapIPHeader(&ipHeader);
+    ipHeader.HeaderChecksum = CalcIPChecksum((BYTE*)&ipHeader, sizeof(ipHeader));
+
+    memcpy((void*)frame, (void*)&ipHeader, sizeof(ipHeader));
+    memcpy((void*)(frame + sizeof(ipHeader)), (void*)header, headerLen);
+
+    if(!MACFlushRxInPlace(&remote->MACAddr, sizeof(IP_HEADER) + len))
+        return FALSE;
+
+    _Identifier++;
+    return TRUE;
+}
+
 /*********************************************************************
  * Function:        IPSetRxBuffer(WORD Offset)
  *
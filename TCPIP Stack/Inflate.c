@@ -0,0 +1,567 @@
+/*********************************************************************
+ *
+ *	DEFLATE Decompression
+ *  Module for Microchip TCP/IP Stack
+ *	 -Streams gzip compressed MPFS files out decompressed, a piece at
+ *	  a time, using a small sliding window
+ *	 -Reference: RFC 1951, RFC 1952
+ *
+ *********************************************************************
+ * FileName:        Inflate.c
+ * Dependencies:    MPFS2
+ * Processor:       CH32V307
+ * Compiler:        GCC
+ ********************************************************************/
+#define __INFLATE_C
+
+#include "TCPIP Stack/TCPIP.h"
+
+#if defined(STACK_USE_INFLATE)
+
+// Decoder states for INFLATE_CTX.state
+typedef enum
+{
+	INFLATE_BLOCK = 0u,		// Expecting a block header
+	INFLATE_STORED,			// Copying an uncompressed block
+	INFLATE_CODES,			// Decoding a Huffman coded block
+	INFLATE_DONE,			// The final block has ended
+	INFLATE_ERROR			// The stream is corrupt or unsupported
+} INFLATE_STATE;
+
+// gzip header flags
+#define GZIP_FHCRC			(0x02u)	// Header CRC follows the header
+#define GZIP_FEXTRA			(0x04u)	// Extra field is present
+#define GZIP_FNAME			(0x08u)	// Original file name is present
+#define GZIP_FCOMMENT		(0x10u)	// Comment is present
+
+// Base values and extra bits for length symbols 257-285
+static ROM WORD lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static ROM BYTE lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+// Base values and extra bits for distance symbols 0-29
+static ROM WORD distBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static ROM BYTE distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Order in which code length code lengths are stored
+static ROM BYTE codeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// Code lengths of the block being set up.  Codes are built in full
+// within one call, so every context can share this.
+static BYTE codeLengths[288+32];
+
+static WORD _GetBits(INFLATE_CTX* ctx, BYTE n);
+static WORD _Decode(INFLATE_CTX* ctx, WORD* count, WORD* symbol);
+static BOOL _Construct(WORD* count, WORD* symbol, BYTE* lengths, WORD n);
+static void _BeginBlock(INFLATE_CTX* ctx);
+static BOOL _ReadCodes(INFLATE_CTX* ctx);
+
+
+/*****************************************************************************
+  Function:
+	BOOL InflateInit(INFLATE_CTX* ctx, MPFS_HANDLE hFile)
+
+  Summary:
+	Prepares to decompress a gzip file.
+
+  Description:
+	Reads the decompressed length from the gzip trailer into ctx->dwSize,
+	then skips the gzip header so that InflateGetArray can start on the
+	first DEFLATE block.
+
+  Precondition:
+	hFile is open and positioned at the start of the file.
+
+  Parameters:
+	ctx - the context to set up
+	hFile - the gzip file to decompress
+
+  Return Values:
+	TRUE - The file is a gzip stream and is ready to be read
+	FALSE - The file is not a gzip stream
+  ***************************************************************************/
+BOOL InflateInit(INFLATE_CTX* ctx, MPFS_HANDLE hFile)
+{
+	BYTE header[10];
+	WORD wLen;
+	BYTE c;
+
+	ctx->hFile = hFile;
+	ctx->dwOut = 0;
+	ctx->bitBuf = 0;
+	ctx->bitCnt = 0;
+	ctx->isLast = FALSE;
+	ctx->wRem = 0;
+	ctx->wPos = 0;
+	ctx->state = INFLATE_ERROR;
+
+	// The last four bytes hold the decompressed length
+	if(!MPFSSeek(hFile, 4, MPFS_SEEK_END) || !MPFSGetLong(hFile, &ctx->dwSize) ||
+		!MPFSSeek(hFile, 0, MPFS_SEEK_START))
+		return FALSE;
+
+	// Only DEFLATE compression is defined
+	if(MPFSGetArray(hFile, header, sizeof(header)) != sizeof(header) ||
+		header[0] != 0x1fu || header[1] != 0x8bu || header[2] != 8u)
+		return FALSE;
+
+	// Skip the optional fields
+	if(header[3] & GZIP_FEXTRA)
+	{
+		if(MPFSGetArray(hFile, (BYTE*)&wLen, 2) != 2u || !MPFSSeek(hFile, wLen, MPFS_SEEK_FORWARD))
+			return FALSE;
+	}
+	if(header[3] & GZIP_FNAME)
+	{
+		do
+		{
+			if(!MPFSGet(hFile, &c))
+				return FALSE;
+		} while(c != '\0');
+	}
+	if(header[3] & GZIP_FCOMMENT)
+	{
+		do
+		{
+			if(!MPFSGet(hFile, &c))
+				return FALSE;
+		} while(c != '\0');
+	}
+	if((header[3] & GZIP_FHCRC) && !MPFSSeek(hFile, 2, MPFS_SEEK_FORWARD))
+		return FALSE;
+
+	ctx->state = INFLATE_BLOCK;
+	return TRUE;
+}
+
+/*****************************************************************************
+  Function:
+	WORD InflateGetArray(INFLATE_CTX* ctx, BYTE* cData, WORD wLen)
+
+  Summary:
+	Reads decompressed data.
+
+  Description:
+	Decompresses up to wLen bytes of the stream.  Decoding stops as soon
+	as wLen bytes are produced, even in the middle of a match, and picks
+	up from there on the next call.  Compressed input is read from the
+	file as needed.
+
+  Precondition:
+	InflateInit returned TRUE for ctx.
+
+  Parameters:
+	ctx - the stream to read from
+	cData - where to store the data, or NULL to discard it
+	wLen - how many bytes to read
+
+  Returns:
+	The number of bytes read.  Fewer than wLen are returned only at the
+	end of the stream, or when the stream is found to be corrupt, which
+	InflateIsDone distinguishes.
+  ***************************************************************************/
+WORD InflateGetArray(INFLATE_CTX* ctx, BYTE* cData, WORD wLen)
+{
+	WORD wCount, sym;
+	BYTE c;
+
+	for(wCount = 0; wCount < wLen; )
+	{
+		switch(ctx->state)
+		{
+			case INFLATE_BLOCK:
+				_BeginBlock(ctx);
+				continue;
+
+			case INFLATE_STORED:
+				if(ctx->wRem == 0u)
+				{
+					ctx->state = ctx->isLast ? INFLATE_DONE : INFLATE_BLOCK;
+					continue;
+				}
+				c = (BYTE)_GetBits(ctx, 8);
+				ctx->wRem--;
+				break;
+
+			case INFLATE_CODES:
+				if(ctx->wRem == 0u)
+				{
+					sym = _Decode(ctx, ctx->lenCount, ctx->lenSymbol);
+					if(sym < 256u)
+					{// Literal
+						c = (BYTE)sym;
+						break;
+					}
+					if(sym == 256u)
+					{// End of block
+						ctx->state = ctx->isLast ? INFLATE_DONE : INFLATE_BLOCK;
+						continue;
+					}
+
+					// Length and distance of a match
+					sym -= 257;
+					if(sym >= 29u)
+					{
+						ctx->state = INFLATE_ERROR;
+						continue;
+					}
+					ctx->wRem = lengthBase[sym] + _GetBits(ctx, lengthExtra[sym]);
+					sym = _Decode(ctx, ctx->distCount, ctx->distSymbol);
+					if(sym >= 30u)
+					{
+						ctx->state = INFLATE_ERROR;
+						continue;
+					}
+					ctx->wDist = distBase[sym] + _GetBits(ctx, distExtra[sym]);
+
+					// The match must lie within the window and the output so far
+					if(ctx->wDist > INFLATE_WINDOW_SIZE || ctx->wDist > ctx->dwOut)
+					{
+						ctx->state = INFLATE_ERROR;
+						continue;
+					}
+				}
+				c = ctx->window[(WORD)(ctx->wPos - ctx->wDist) & (INFLATE_WINDOW_SIZE - 1)];
+				ctx->wRem--;
+				break;
+
+			default:
+				return wCount;
+		}
+
+		// Input may have run out while decoding
+		if(ctx->state == INFLATE_ERROR)
+			break;
+
+		ctx->window[ctx->wPos] = c;
+		ctx->wPos = (ctx->wPos + 1) & (INFLATE_WINDOW_SIZE - 1);
+		ctx->dwOut++;
+		if(cData)
+			*cData++ = c;
+		wCount++;
+	}
+
+	return wCount;
+}
+
+/*****************************************************************************
+  Function:
+	BOOL InflateIsDone(INFLATE_CTX* ctx)
+
+  Summary:
+	Determines if the whole stream was decompressed.
+
+  Description:
+	Reports whether the final block of the stream has been read, so that
+	a short read from InflateGetArray can be told apart from an error.
+
+  Precondition:
+	InflateInit was called for ctx.
+
+  Parameters:
+	ctx - the stream to check
+
+  Return Values:
+	TRUE - The end of the stream was reached
+	FALSE - Data remains, or the stream is corrupt
+  ***************************************************************************/
+BOOL InflateIsDone(INFLATE_CTX* ctx)
+{
+	return ctx->state == INFLATE_DONE;
+}
+
+/*****************************************************************************
+  Function:
+	static WORD _GetBits(INFLATE_CTX* ctx, BYTE n)
+
+  Description:
+	Reads bits from the stream, least significant bit first.
+
+  Precondition:
+	None
+
+  Parameters:
+	ctx - the stream to read from
+	n - how many bits to read, up to 16
+
+  Returns:
+	The bits that were read.  If the file ends first, ctx->state is set
+	to INFLATE_ERROR and 0 is returned.
+  ***************************************************************************/
+static WORD _GetBits(INFLATE_CTX* ctx, BYTE n)
+{
+	WORD w;
+	BYTE c;
+
+	while(ctx->bitCnt < n)
+	{
+		if(!MPFSGet(ctx->hFile, &c))
+		{
+			ctx->state = INFLATE_ERROR;
+			return 0;
+		}
+		ctx->bitBuf |= (DWORD)c << ctx->bitCnt;
+		ctx->bitCnt += 8;
+	}
+
+	w = (WORD)(ctx->bitBuf & ((1ul << n) - 1));
+	ctx->bitBuf >>= n;
+	ctx->bitCnt -= n;
+	return w;
+}
+
+/*****************************************************************************
+  Function:
+	static WORD _Decode(INFLATE_CTX* ctx, WORD* count, WORD* symbol)
+
+  Description:
+	Decodes one symbol of a canonical Huffman code.  Codes are read a bit
+	at a time; the codes of each length are consecutive, so the code is
+	found once it falls below the first code of the next length.
+
+  Precondition:
+	The code was set up by _Construct.
+
+  Parameters:
+	ctx - the stream to read from
+	count - the number of codes of each length
+	symbol - the symbols in code order
+
+  Returns:
+	The decoded symbol, or 0xffff with ctx->state set to INFLATE_ERROR
+	if the input is not a valid code.
+  ***************************************************************************/
+static WORD _Decode(INFLATE_CTX* ctx, WORD* count, WORD* symbol)
+{
+	WORD code, first, index;
+	BYTE len;
+
+	code = 0;
+	first = 0;
+	index = 0;
+	for(len = 1; len < 16u; len++)
+	{
+		code |= _GetBits(ctx, 1);
+		if((WORD)(code - first) < count[len])
+			return symbol[index + (code - first)];
+		index += count[len];
+		first += count[len];
+		first <<= 1;
+		code <<= 1;
+	}
+
+	ctx->state = INFLATE_ERROR;
+	return 0xffff;
+}
+
+/*****************************************************************************
+  Function:
+	static BOOL _Construct(WORD* count, WORD* symbol, BYTE* lengths, WORD n)
+
+  Description:
+	Builds a canonical Huffman code from the code length of each symbol.
+
+  Precondition:
+	None
+
+  Parameters:
+	count - receives the number of codes of each length
+	symbol - receives the symbols in code order
+	lengths - the code length of each symbol, 0 if it is unused
+	n - the number of symbols
+
+  Return Values:
+	TRUE - The code was built
+	FALSE - The lengths describe more codes than can exist
+  ***************************************************************************/
+static BOOL _Construct(WORD* count, WORD* symbol, BYTE* lengths, WORD n)
+{
+	WORD offs[16];
+	WORD sym;
+	BYTE len;
+	SHORT left;
+
+	for(len = 0; len < 16u; len++)
+		count[len] = 0;
+	for(sym = 0; sym < n; sym++)
+		count[lengths[sym]]++;
+
+	// Each length doubles the codes available, less those already used
+	left = 1;
+	for(len = 1; len < 16u; len++)
+	{
+		left <<= 1;
+		left -= count[len];
+		if(left < 0)
+			return FALSE;
+	}
+
+	// Sort the symbols by code length, then by value
+	offs[1] = 0;
+	for(len = 1; len < 15u; len++)
+		offs[len+1] = offs[len] + count[len];
+	for(sym = 0; sym < n; sym++)
+	{
+		if(lengths[sym] != 0u)
+			symbol[offs[lengths[sym]]++] = sym;
+	}
+
+	return TRUE;
+}
+
+/*****************************************************************************
+  Function:
+	static void _BeginBlock(INFLATE_CTX* ctx)
+
+  Description:
+	Reads the header of the next DEFLATE block and sets up ctx->state,
+	and the Huffman codes for compressed blocks.
+
+  Precondition:
+	ctx->state is INFLATE_BLOCK.
+
+  Parameters:
+	ctx - the stream to read from
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _BeginBlock(INFLATE_CTX* ctx)
+{
+	WORD i;
+
+	ctx->isLast = _GetBits(ctx, 1);
+	switch(_GetBits(ctx, 2))
+	{
+		case 0:
+			// Stored blocks start on a byte boundary with their length
+			// and its complement
+			ctx->bitBuf >>= ctx->bitCnt & 0x07;
+			ctx->bitCnt &= ~0x07;
+			ctx->wRem = _GetBits(ctx, 16);
+			i = _GetBits(ctx, 16);
+			if(ctx->state != INFLATE_ERROR)
+				ctx->state = ((WORD)(ctx->wRem ^ i) == 0xffffu) ? INFLATE_STORED : INFLATE_ERROR;
+			return;
+
+		case 1:
+			// Fixed codes
+			for(i = 0; i < 144u; i++)
+				codeLengths[i] = 8;
+			for(; i < 256u; i++)
+				codeLengths[i] = 9;
+			for(; i < 280u; i++)
+				codeLengths[i] = 7;
+			for(; i < 288u; i++)
+				codeLengths[i] = 8;
+			for(; i < 288u+30u; i++)
+				codeLengths[i] = 5;
+			_Construct(ctx->lenCount, ctx->lenSymbol, codeLengths, 288);
+			_Construct(ctx->distCount, ctx->distSymbol, &codeLengths[288], 30);
+			break;
+
+		case 2:
+			// Codes described at the start of the block
+			if(!_ReadCodes(ctx))
+			{
+				ctx->state = INFLATE_ERROR;
+				return;
+			}
+			break;
+
+		default:
+			ctx->state = INFLATE_ERROR;
+			return;
+	}
+
+	if(ctx->state != INFLATE_ERROR)
+	{
+		ctx->wRem = 0;
+		ctx->state = INFLATE_CODES;
+	}
+}
+
+/*****************************************************************************
+  Function:
+	static BOOL _ReadCodes(INFLATE_CTX* ctx)
+
+  Description:
+	Reads the literal/length and distance codes of a dynamic block.  Their
+	code lengths are themselves Huffman coded, with runs of repeated
+	lengths and zeros.
+
+  Precondition:
+	The block type has just been read.
+
+  Parameters:
+	ctx - the stream to read from
+
+  Return Values:
+	TRUE - The codes were read
+	FALSE - The codes are invalid, or the file ended
+  ***************************************************************************/
+static BOOL _ReadCodes(INFLATE_CTX* ctx)
+{
+	WORD nLen, nDist, nCode, index, sym;
+	WORD clCount[16], clSymbol[19];
+	BYTE len;
+
+	nLen = _GetBits(ctx, 5) + 257;
+	nDist = _GetBits(ctx, 5) + 1;
+	nCode = _GetBits(ctx, 4) + 4;
+	if(nLen > 286u || nDist > 30u)
+		return FALSE;
+
+	// Build the code length code
+	for(index = 0; index < nCode; index++)
+		codeLengths[codeLengthOrder[index]] = _GetBits(ctx, 3);
+	for(; index < 19u; index++)
+		codeLengths[codeLengthOrder[index]] = 0;
+	if(!_Construct(clCount, clSymbol, codeLengths, 19))
+		return FALSE;
+
+	// Read the lengths of both codes as one sequence
+	index = 0;
+	while(index < nLen + nDist)
+	{
+		sym = _Decode(ctx, clCount, clSymbol);
+		if(ctx->state == INFLATE_ERROR)
+			return FALSE;
+		if(sym < 16u)
+		{
+			codeLengths[index++] = sym;
+			continue;
+		}
+
+		len = 0;
+		if(sym == 16u)
+		{// Repeat the previous length
+			if(index == 0u)
+				return FALSE;
+			len = codeLengths[index-1];
+			sym = 3 + _GetBits(ctx, 2);
+		}
+		else if(sym == 17u)
+			sym = 3 + _GetBits(ctx, 3);
+		else
+			sym = 11 + _GetBits(ctx, 7);
+
+		if(index + sym > nLen + nDist)
+			return FALSE;
+		while(sym--)
+			codeLengths[index++] = len;
+	}
+
+	// A block can't end without an end-of-block code
+	if(codeLengths[256] == 0u)
+		return FALSE;
+
+	return _Construct(ctx->lenCount, ctx->lenSymbol, codeLengths, nLen) &&
+		_Construct(ctx->distCount, ctx->distSymbol, &codeLengths[nLen], nDist) &&
+		ctx->state != INFLATE_ERROR;
+}
+
+#endif //#if defined(STACK_USE_INFLATE)
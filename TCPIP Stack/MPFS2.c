@@ -126,12 +126,108 @@ static MPFS_FAT_RECORD fatCache;
 // ID of currently loaded fatCache
 static WORD fatCacheID;
 
-// Number of files in this MPFS image
-static WORD numFiles;
+#if defined(MPFS_USE_SPI_FLASH)
+	// Images in SPI Flash alternate between two banks
+	#define MPFS_BANKS			(2u)
+	#define _BankBase(b)		((MPFS_PTR)(b) * MPFS_BANK_SIZE)
+#else
+	#define MPFS_BANKS			(1u)
+	#define _BankBase(b)		(0ul)
+#endif
+
+// FAT IDs of files in the second bank carry this bit, so open handles 
+// and TCPSendFile transfers keep reading the bank they started in.  The 
+// bank's generation is also kept in the ID, so that an ID from an image 
+// that has since been overwritten is never taken for a file of the new one.
+#define MPFS_BANK_ID			(0x8000u)
+#define MPFS_GEN_ID				(0x7000u)
+#define MPFS_GEN_SHIFT			(12u)
+#define MPFS_FILE_ID			(0x0fffu)
+#define _BankID(b)				(((b) ? MPFS_BANK_ID : 0u) | ((WORD)bankGen[b] << MPFS_GEN_SHIFT))
+#define _BankOfID(id)			(((id) & MPFS_BANK_ID) ? 1u : 0u)
+#define _FileOfID(id)			((id) & MPFS_FILE_ID)
+
+// TRUE if id names a file in one of the loaded images
+#define _IsFileID(id)			(_BankOfID(id) < MPFS_BANKS && \
+								((id) & (MPFS_BANK_ID | MPFS_GEN_ID)) == _BankID(_BankOfID(id)) && \
+								_FileOfID(id) < numFiles[_BankOfID(id)])
+
+// Bank holding the image that MPFSOpen searches
+static BYTE activeBank;
+
+// Number of files in the image in each bank
+static WORD numFiles[MPFS_BANKS];
+
+// Times each bank has been rewritten, modulo 8
+static BYTE bankGen[MPFS_BANKS];
 
 
 static void _LoadFATRecord(WORD fatID);
-static void _Validate(void);
+static BOOL _Validate(BYTE bank, DWORD dwLen);
+static BOOL _CompareName(WORD fatID, BYTE* cFile);
+
+#if defined(MPFS_USE_SPI_FLASH)
+	// Selects the active bank.  Records alternate between the two 
+	// sectors after the banks, and the valid one with the highest 
+	// sequence number wins.
+	typedef struct
+	{
+		DWORD seq;			// Incremented on every switch
+		WORD bank;			// Index of the active bank
+		WORD check;			// Rejects erased and partly written records
+	} MPFS_BANK_RECORD;
+
+	// Sequence number of the most recent bank record
+	static DWORD bankSeq;
+
+	// Space left in the bank being written by MPFSPutArray
+	static DWORD bankPutRem;
+
+	static BYTE _ReadBankRecord(void);
+	static void _WriteBankRecord(BYTE bank);
+#endif
+
+#if MPFS_INDEX_MAX_FILES > 0
+	// Entry of the file name index
+	typedef struct
+	{
+		WORD hash;			// Name hash, as stored in the image
+		WORD fatID;			// File with this hash
+	} MPFS_INDEX_ENTRY;
+
+	// Name hashes of every file, sorted by hash so MPFSOpen can do a 
+	// binary search instead of scanning the hash table in the image
+	static MPFS_INDEX_ENTRY fileIndex[MPFS_INDEX_MAX_FILES];
+
+	// TRUE when fileIndex holds every file in the image
+	static BOOL isIndexValid;
+
+	static void _BuildIndex(void);
+#endif
+
+#if defined(MPFS_USE_CACHE)
+	// A block of the image held in RAM
+	typedef struct
+	{
+		MPFS_PTR addr;		// Image address of the first byte, or MPFS_INVALID
+		DWORD lastUse;		// cacheClock at the most recent access
+		BYTE data[MPFS_CACHE_BLOCK_SIZE];
+	} MPFS_CACHE_BLOCK;
+
+	// Least recently used block cache shared by all handles
+	static MPFS_CACHE_BLOCK cacheBlocks[MPFS_CACHE_BLOCKS];
+
+	// Incremented on every block lookup to order cacheBlocks by age
+	static DWORD cacheClock;
+
+	// Address of the block most recently read from flash
+	static MPFS_PTR lastLoadedBlock;
+
+	MPFS_CACHE_STATS MPFSCacheStats;
+
+	static void _CacheInvalidate(void);
+	static void _ReadCached(MPFS_PTR addr, BYTE* cData, WORD wLen);
+#endif
 
 /****************************************************************************
   Section:
@@ -152,6 +248,10 @@ static void _Validate(void);
 
 	// Beginning address of MPFS Image
 	#define MPFS_HEAD		MPFS_RESERVE_BLOCK
+
+	// Sectors holding the bank records, after both banks
+	#define MPFS_BANK_RECORD_ADDR	(MPFS_HEAD + MPFS_BANKS*MPFS_BANK_SIZE)
+	#define _BankCheck(r)	((WORD)~((WORD)(r)->seq ^ (WORD)((r)->seq >> 16) ^ (r)->bank))
 	
 #else
 
@@ -179,8 +279,8 @@ static void _Validate(void);
 	Initializes the MPFS module.
 
   Description:
-	Sets all MPFS handles to closed, and initializes access to the EEPROM
-	if necessary.
+	Sets all MPFS handles to closed, initializes access to the EEPROM
+	if necessary, and loads the active image.
 
   Precondition:
 	None
@@ -214,8 +314,25 @@ void MPFSInit(void)
 	SPIFlashInit();
 	#endif
 
+	#if defined(MPFS_USE_CACHE)
+	_CacheInvalidate();
+	memset((void*)&MPFSCacheStats, 0x00, sizeof(MPFSCacheStats));
+	#endif
+
 	// Validate the image and load numFiles
-	_Validate();
+	#if defined(MPFS_USE_SPI_FLASH)
+	// Fall back to the other bank if the selected one is damaged
+	activeBank = _ReadBankRecord();
+	if(!_Validate(activeBank, MPFS_BANK_SIZE) && _Validate(activeBank ^ 1u, MPFS_BANK_SIZE))
+		activeBank ^= 1u;
+	#else
+	activeBank = 0;
+	_Validate(activeBank, MPFS_INVALID);
+	#endif
+	
+	#if MPFS_INDEX_MAX_FILES > 0
+	_BuildIndex();
+	#endif
 
 	isMPFSLocked = FALSE;
 
@@ -248,10 +365,8 @@ MPFS_HANDLE MPFSOpen(BYTE* cFile)
 	MPFS_HANDLE hMPFS;
 	WORD nameHash, i;
 	WORD hashCache[8];
-	BYTE *ptr, c;
-	
-	// Initialize c to avoid "may be used uninitialized" compiler warning
-	c = 0;
+	BYTE *ptr;
+	WORD wBankID;
 	
 	// Make sure MPFS is unlocked and we got a filename
 	if(*cFile == '\0' || isMPFSLocked == TRUE)
@@ -268,44 +383,61 @@ MPFS_HANDLE MPFSOpen(BYTE* cFile)
 	for(hMPFS = 1; hMPFS <= MAX_MPFS_HANDLES; hMPFS++)
 		if(MPFSStubs[hMPFS].addr == MPFS_INVALID)
 			break;
-	if(hMPFS == MAX_MPFS_HANDLES)
+	if(hMPFS > MAX_MPFS_HANDLES)
 		return MPFS_INVALID_HANDLE;
+
+	#if MPFS_INDEX_MAX_FILES > 0
+	if(isIndexValid)
+	{
+		WORD lo, hi;
+
+		// Binary search for the first index entry with this hash
+		lo = 0;
+		hi = numFiles[activeBank];
+		while(lo < hi)
+		{
+			i = (lo + hi) >> 1;
+			if(fileIndex[i].hash < nameHash)
+				lo = i + 1;
+			else
+				hi = i;
+		}
+
+		// Compare the full filename of each file with this hash
+		for(; lo < numFiles[activeBank] && fileIndex[lo].hash == nameHash; lo++)
+		{
+			if(_CompareName(fileIndex[lo].fatID, cFile))
+			{
+				MPFSStubs[hMPFS].addr = fatCache.data;
+				MPFSStubs[hMPFS].bytesRem = fatCache.len;
+				MPFSStubs[hMPFS].fatID = fileIndex[lo].fatID;
+				return hMPFS;
+			}
+		}
+
+		return MPFS_INVALID_HANDLE;
+	}
+	#endif
 		
 	// Read in hashes, and check remainder on a match.  Store 8 in cache for performance
-	for(i = 0; i < numFiles; i++)
+	wBankID = _BankID(activeBank);
+	for(i = 0; i < numFiles[activeBank]; i++)
 	{
 		// For new block of 8, read in data
 		if((i & 0x07) == 0)
 		{
-			MPFSStubs[0].addr = 8 + i*2;
+			MPFSStubs[0].addr = _BankBase(activeBank) + 8 + i*2;
 			MPFSStubs[0].bytesRem = 16;
 			MPFSGetArray(0, (BYTE*)hashCache, 16);
 		}
 		
 		// If the hash matches, compare the full filename
-		if(hashCache[i&0x07] == nameHash)
-		{
-			_LoadFATRecord(i);
-			MPFSStubs[0].addr = fatCache.string;
-			MPFSStubs[0].bytesRem = 255;
-			
-			// Loop over filename to perform comparison
-			for(ptr = cFile; *ptr != '\0'; ptr++)
-			{
-				MPFSGet(0, &c);
-				if(*ptr != c)
-					break;
-			}
-			
-			MPFSGet(0, &c);
-
-			if(c == '\0' && *ptr == '\0')
-			{// Filename matches, so return true
-				MPFSStubs[hMPFS].addr = fatCache.data;
-				MPFSStubs[hMPFS].bytesRem = fatCache.len;
-				MPFSStubs[hMPFS].fatID = i;
-				return hMPFS;
-			}
+		if(hashCache[i&0x07] == nameHash && _CompareName(i | wBankID, cFile))
+		{// Filename matches, so return true
+			MPFSStubs[hMPFS].addr = fatCache.data;
+			MPFSStubs[hMPFS].bytesRem = fatCache.len;
+			MPFSStubs[hMPFS].fatID = i | wBankID;
+			return hMPFS;
 		}
 	}
 	
@@ -313,6 +445,45 @@ MPFS_HANDLE MPFSOpen(BYTE* cFile)
 	return MPFS_INVALID_HANDLE;
 }
 
+/*****************************************************************************
+  Function:
+	static BOOL _CompareName(WORD fatID, BYTE* cFile)
+
+  Description:
+	Compares a file name against the name of a file in the image.
+	
+  Precondition:
+	None
+
+  Parameters:
+	fatID - the ID of the file to compare against
+	cFile - a null terminated file name
+
+  Return Values:
+	TRUE - The names match.  The file's FAT record is in fatCache.
+	FALSE - The names differ
+  ***************************************************************************/
+static BOOL _CompareName(WORD fatID, BYTE* cFile)
+{
+	BYTE c;
+
+	_LoadFATRecord(fatID);
+	MPFSStubs[0].addr = fatCache.string;
+	MPFSStubs[0].bytesRem = 255;
+	
+	// Loop over filename to perform comparison
+	for(; *cFile != '\0'; cFile++)
+	{
+		MPFSGet(0, &c);
+		if(*cFile != c)
+			return FALSE;
+	}
+	
+	// The stored name must end here too
+	MPFSGet(0, &c);
+	return (c == '\0');
+}
+
 /*****************************************************************************
   Function:
 	MPFS_HANDLE MPFSOpenROM(ROM BYTE* cFile) 
@@ -341,6 +512,7 @@ MPFS_HANDLE MPFSOpenROM(ROM BYTE* cFile)
 	WORD hashCache[8];
 	ROM BYTE *ptr;
 	BYTE c;
+	WORD wBankID;
 	
 	// Make sure MPFS is unlocked and we got a filename
 	if(*cFile == '\0' || isMPFSLocked == TRUE)
@@ -361,12 +533,13 @@ MPFS_HANDLE MPFSOpenROM(ROM BYTE* cFile)
 		return MPFS_INVALID_HANDLE;
 		
 	// Read in hashes, and check remainder on a match.  Store 8 in cache for performance
-	for(i = 0; i < numFiles; i++)
+	wBankID = _BankID(activeBank);
+	for(i = 0; i < numFiles[activeBank]; i++)
 	{
 		// For new block of 8, read in data
 		if((i & 0x07) == 0)
 		{
-			MPFSStubs[0].addr = 8 + i*2;
+			MPFSStubs[0].addr = _BankBase(activeBank) + 8 + i*2;
 			MPFSStubs[0].bytesRem = 16;
 			MPFSGetArray(0, (BYTE*)hashCache, 16);
 		}
@@ -374,7 +547,7 @@ MPFS_HANDLE MPFSOpenROM(ROM BYTE* cFile)
 		// If the hash matches, compare the full filename
 		if(hashCache[i&0x07] == nameHash)
 		{
-			_LoadFATRecord(i);
+			_LoadFATRecord(i | wBankID);
 			MPFSStubs[0].addr = fatCache.string;
 			MPFSStubs[0].bytesRem = 255;
 			
@@ -392,7 +565,7 @@ MPFS_HANDLE MPFSOpenROM(ROM BYTE* cFile)
 			{// Filename matches, so return true
 				MPFSStubs[hMPFS].addr = fatCache.data;
 				MPFSStubs[hMPFS].bytesRem = fatCache.len;
-				MPFSStubs[hMPFS].fatID = i;
+				MPFSStubs[hMPFS].fatID = i | wBankID;
 				return hMPFS;
 			}
 		}
@@ -424,20 +597,26 @@ MPFS_HANDLE MPFSOpenROM(ROM BYTE* cFile)
   Returns:
 	An MPFS_HANDLE to the opened file if found, or MPFS_INVALID_HANDLE
 	if the file could not be found or no free handles exist.
+
+  Remarks:
+	IDs from MPFSGetID name the image bank the file was in, so a file 
+	can be re-opened after an upload switches banks, until the next 
+	upload overwrites its bank.  Use MPFSIsFileID to tell an ID that 
+	can no longer be opened from a lack of free handles.
   ***************************************************************************/
 MPFS_HANDLE MPFSOpenID(WORD hFatID)
 {
 	MPFS_HANDLE hMPFS;
 	
 	// Make sure MPFS is unlocked and we got a valid id
-	if(isMPFSLocked == TRUE || hFatID > numFiles)
+	if(isMPFSLocked == TRUE || !_IsFileID(hFatID))
 		return MPFS_INVALID_HANDLE;
 
 	// Find a free file handle to use
 	for(hMPFS = 1; hMPFS <= MAX_MPFS_HANDLES; hMPFS++)
 		if(MPFSStubs[hMPFS].addr == MPFS_INVALID)
 			break;
-	if(hMPFS == MAX_MPFS_HANDLES)
+	if(hMPFS > MAX_MPFS_HANDLES)
 		return MPFS_INVALID_HANDLE;
 	
 	// Load the FAT record
@@ -451,6 +630,34 @@ MPFS_HANDLE MPFSOpenID(WORD hFatID)
 	return hMPFS;
 }
 
+/*****************************************************************************
+  Function:
+	BOOL MPFSIsFileID(WORD hFatID)
+
+  Summary:
+	Determines if a FAT ID still names a file.
+
+  Description:
+	Determines if an ID returned by MPFSGetID still names a file in one 
+	of the loaded images.  Once the image holding the file has been 
+	overwritten, the ID can never be opened again, even after the new 
+	image is complete.
+	
+  Precondition:
+	None
+
+  Parameters:
+	hFatID - the ID of a previous opened file in the FAT
+
+  Return Values:
+	TRUE - The file can be opened with MPFSOpenID when a handle is free
+	FALSE - The file is gone
+  ***************************************************************************/
+BOOL MPFSIsFileID(WORD hFatID)
+{
+	return _IsFileID(hFatID) ? TRUE : FALSE;
+}
+
 /*****************************************************************************
   Function:
 	void MPFSClose(MPFS_HANDLE hMPFS)
@@ -528,7 +735,11 @@ BOOL MPFSGet(MPFS_HANDLE hMPFS, BYTE* c)
 		lastRead = MPFSStubs[hMPFS].addr;
 		MPFSStubs[hMPFS].addr++;
 	#elif defined(MPFS_USE_SPI_FLASH)
+		#if defined(MPFS_USE_CACHE)
+		_ReadCached(MPFSStubs[hMPFS].addr, c, 1);
+		#else
 		SPIFlashReadArray(MPFSStubs[hMPFS].addr + MPFS_HEAD, c, 1);
+		#endif
 		MPFSStubs[hMPFS].addr++;
 	#else
 		#if defined(__C30__)
@@ -629,7 +840,11 @@ WORD MPFSGetArray(MPFS_HANDLE hMPFS, BYTE* cData, WORD wLen)
 		MPFSStubs[hMPFS].bytesRem -= wLen;
 		lastRead = MPFS_INVALID;
 	#elif defined(MPFS_USE_SPI_FLASH)
+		#if defined(MPFS_USE_CACHE)
+		_ReadCached(MPFSStubs[hMPFS].addr, cData, wLen);
+		#else
 		SPIFlashReadArray(MPFSStubs[hMPFS].addr+MPFS_HEAD, cData, wLen);
+		#endif
 		MPFSStubs[hMPFS].addr += wLen;
 		MPFSStubs[hMPFS].bytesRem -= wLen;
 	#else
@@ -814,8 +1029,10 @@ BOOL MPFSSeek(MPFS_HANDLE hMPFS, DWORD dwOffset, MPFS_SEEK_MODE tMode)
 	Prepares the MPFS image for writing.
 
   Description:
-	Prepares the MPFS image for writing and locks the image so that other
-	processes may not access it.
+	Prepares the MPFS image for writing.  In SPI Flash, the new image is
+	written to the bank that is not being served, and files in the active
+	image can still be opened.  In EEPROM, the image is overwritten in 
+	place and locked so that other processes may not access it.
 	
   Precondition:
 	None
@@ -828,9 +1045,10 @@ BOOL MPFSSeek(MPFS_HANDLE hMPFS, DWORD dwOffset, MPFS_SEEK_MODE tMode)
 	MPFS_INVALID_HANDLE when the EEPROM failed to initialize for writing.
 
   Remarks:
-	In order to prevent misreads, the MPFS will be inaccessible until 
-	MPFSClose is called.  This function is not available when the MPFS 
-	is stored in internal Flash program memory.
+	In order to prevent misreads, an EEPROM image will be inaccessible 
+	until MPFSPutEnd is called.  Files still open in the SPI Flash bank
+	being written are closed.  This function is not available when the 
+	MPFS is stored in internal Flash program memory.
   ***************************************************************************/
 #if defined(MPFS_USE_EEPROM) || defined(MPFS_USE_SPI_FLASH)
 MPFS_HANDLE MPFSFormat(void)
@@ -838,12 +1056,29 @@ MPFS_HANDLE MPFSFormat(void)
 
 	BYTE i;
 	
+	#if defined(MPFS_USE_EEPROM)
 	// Close all files
 	for(i = 0; i < MAX_MPFS_HANDLES; i++)
 		MPFSStubs[i].addr = MPFS_INVALID;
 	
 	// Lock the image
 	isMPFSLocked = TRUE;
+	bankGen[0] = (bankGen[0] + 1u) & (MPFS_GEN_ID >> MPFS_GEN_SHIFT);
+	#else
+	// Close files left open in the inactive bank since the last switch
+	for(i = 1; i <= MAX_MPFS_HANDLES; i++)
+		if(_BankOfID(MPFSStubs[i].fatID) != activeBank)
+			MPFSStubs[i].addr = MPFS_INVALID;
+	numFiles[activeBank ^ 1u] = 0;
+	bankGen[activeBank ^ 1u] = (bankGen[activeBank ^ 1u] + 1u) & (MPFS_GEN_ID >> MPFS_GEN_SHIFT);
+	fatCacheID = MPFS_INVALID_FAT;
+	bankPutRem = MPFS_BANK_SIZE;
+	#endif
+
+	#if defined(MPFS_USE_CACHE)
+	// Cached blocks are about to be overwritten
+	_CacheInvalidate();
+	#endif
 	
 	#if defined(MPFS_USE_EEPROM)
 		// Set FAT ptr for writing
@@ -858,7 +1093,7 @@ MPFS_HANDLE MPFSFormat(void)
 		return MPFS_INVALID_HANDLE;
 	#else
 		// Set up SPI Flash for writing
-		SPIFlashBeginWrite(MPFS_HEAD);
+		SPIFlashBeginWrite(MPFS_HEAD + _BankBase(activeBank ^ 1u));
 		return 0x00;
 	#endif
 }
@@ -913,15 +1148,55 @@ WORD MPFSPutArray(MPFS_HANDLE hMPFS, BYTE* cData, WORD wLen)
 		return count;
 	
 	#else
-		// Write to the SPI Flash
-		SPIFlashWriteArray(cData, wLen);
+		// Queue the data for the SPI Flash, which writes it in the 
+		// background.  Data that does not fit in the bank is dropped, 
+		// and MPFSPutEnd then rejects the image.
+		if(wLen > bankPutRem)
+			wLen = (WORD)bankPutRem;
+		wLen = SPIFlashPutArray(cData, wLen);
+		bankPutRem -= wLen;
+		return wLen;
 	#endif
 }
 #endif
 
 /*****************************************************************************
   Function:
-	void MPFSPutEnd(void)
+	WORD MPFSGetPutReady(MPFS_HANDLE hMPFS)
+
+  Description:
+	Determines how many bytes MPFSPutArray can accept without waiting.
+	
+  Precondition:
+	MPFSFormat was sucessfully called.
+
+  Parameters:
+	hMPFS - the file handle for writing
+
+  Returns:
+	The number of bytes the next call to MPFSPutArray will accept.
+
+  Remarks:
+	SPI Flash writes are queued and completed by the stack in the 
+	background, so callers streaming an image should write only this 
+	much and try again later, instead of stalling during sector erases.
+	EEPROM writes complete before MPFSPutArray returns, so any amount 
+	is accepted.
+  ***************************************************************************/
+#if defined(MPFS_USE_EEPROM) || defined(MPFS_USE_SPI_FLASH)
+WORD MPFSGetPutReady(MPFS_HANDLE hMPFS)
+{
+	#if defined(MPFS_USE_EEPROM)
+		return 0xffff;
+	#else
+		return SPIFlashGetPutReady();
+	#endif
+}
+#endif
+
+/*****************************************************************************
+  Function:
+	BOOL MPFSPutEnd(BOOL final)
 
   Description:
 	Finalizes an MPFS writing operation.
@@ -934,20 +1209,52 @@ WORD MPFSPutArray(MPFS_HANDLE hMPFS, BYTE* cData, WORD wLen)
 		this function locally.
 
   Returns:
-	None
+	FALSE if final is TRUE and the new image is invalid, otherwise TRUE.
+
+  Remarks:
+	In SPI Flash, a complete new image becomes active by writing a bank 
+	record, so a power failure at any point leaves one of the two 
+	images in use.  An invalid image is discarded and the active one 
+	keeps being served.
   ***************************************************************************/
 #if defined(MPFS_USE_EEPROM) || defined(MPFS_USE_SPI_FLASH)
-void MPFSPutEnd(BOOL final)
+BOOL MPFSPutEnd(BOOL final)
 {
+	BOOL bValid;
+	
 	isMPFSLocked = FALSE;
 	
 	#if defined(MPFS_USE_EEPROM)
 	    XEEEndWrite();
     	while(XEEIsBusy());
+	#else
+		SPIFlashPutEnd();
+		while(SPIFlashIsBusy());
     #endif
+
+	#if defined(MPFS_USE_CACHE)
+	_CacheInvalidate();
+	#endif
     
-	if(final)
-		_Validate();
+	if(!final)
+		return TRUE;
+
+	#if defined(MPFS_USE_SPI_FLASH)
+	bValid = _Validate(activeBank ^ 1u, MPFS_BANK_SIZE - bankPutRem);
+	if(bValid)
+	{
+		_WriteBankRecord(activeBank ^ 1u);
+		activeBank ^= 1u;
+	}
+	#else
+	bValid = _Validate(activeBank, MPFS_INVALID);
+	#endif
+
+	#if MPFS_INDEX_MAX_FILES > 0
+	_BuildIndex();
+	#endif
+	
+	return bValid;
 }
 #endif
 
@@ -974,17 +1281,25 @@ void MPFSPutEnd(BOOL final)
 	None
 
   Remarks:
-	The FAT record will be stored in fatCache.
+	The FAT record will be stored in fatCache, with its addresses made 
+	relative to MPFS_HEAD rather than to the image's bank.
   ***************************************************************************/
 static void _LoadFATRecord(WORD fatID)
 {
-	if(fatID == fatCacheID || fatID >= numFiles)
+	MPFS_PTR base;
+	WORD wFile;
+	
+	if(fatID == fatCacheID || !_IsFileID(fatID))
 		return;
 	
 	// Read the FAT record to the cache
+	base = _BankBase(_BankOfID(fatID));
+	wFile = _FileOfID(fatID);
 	MPFSStubs[0].bytesRem = 22;
-	MPFSStubs[0].addr = 8 + numFiles*2 + fatID*22;
+	MPFSStubs[0].addr = base + 8 + numFiles[_BankOfID(fatID)]*2 + wFile*22;
 	MPFSGetArray(0, (BYTE*)&fatCache, 22);
+	fatCache.string += base;
+	fatCache.data += base;
 	fatCacheID = fatID;
 }
 
@@ -1288,35 +1603,375 @@ WORD MPFSGetID(MPFS_HANDLE hMPFS)
 
 /*****************************************************************************
   Function:
-	void _Validate(void)
+	static BOOL _Validate(BYTE bank, DWORD dwLen)
 
   Summary:
 	Validates the MPFS Image
 
   Description:
-	Verifies that the MPFS image is valid, and reads the number of 
-	available files from the image header.  This function is called on
-	boot, and again after any image is written.
+	Verifies that the MPFS image in a bank is valid, and reads the number
+	of available files from the image header.  In SPI Flash, the data of
+	every file must also lie within the first dwLen bytes of the bank, 
+	which catches images that were cut short or did not fit.  This 
+	function is called on boot, and again after any image is written.
 
   Precondition:
 	None
 
   Parameters:
-	None
+	bank - the bank holding the image
+	dwLen - the number of bytes written to the bank
 
-  Returns:
-	None
+  Return Values:
+	TRUE - The image is valid
+	FALSE - The image is invalid, and is treated as having no files
   ***************************************************************************/
-static void _Validate(void)
+static BOOL _Validate(BYTE bank, DWORD dwLen)
 {
+	WORD i;
+	
 	// Validate the image and update numFiles
-	MPFSStubs[0].addr = 0;
+	fatCacheID = MPFS_INVALID_FAT;
+	numFiles[bank] = 0;
+	MPFSStubs[0].addr = _BankBase(bank);
 	MPFSStubs[0].bytesRem = 8;
 	MPFSGetArray(0, (BYTE*)&fatCache, 6);
-	if(!memcmppgm2ram((void*)&fatCache, (ROM void*)"MPFS\x02\x01", 6))
-		MPFSGetArray(0, (BYTE*)&numFiles, 2);
-	else
-		numFiles = 0;
-	fatCacheID = MPFS_INVALID_FAT;
+	if(memcmppgm2ram((void*)&fatCache, (ROM void*)"MPFS\x02\x01", 6))
+		return FALSE;
+	MPFSGetArray(0, (BYTE*)&i, 2);
+	if(i > MPFS_FILE_ID)
+		return FALSE;
+	numFiles[bank] = i;
+
+	#if defined(MPFS_USE_SPI_FLASH)
+	for(i = 0; i < numFiles[bank]; i++)
+	{
+		_LoadFATRecord(i | _BankID(bank));
+		if(fatCache.len > dwLen || fatCache.data - _BankBase(bank) > dwLen - fatCache.len)
+		{
+			numFiles[bank] = 0;
+			fatCacheID = MPFS_INVALID_FAT;
+			return FALSE;
+		}
+	}
+	#endif
+	
+	return TRUE;
 }	
+
+/*****************************************************************************
+  Function:
+	static void _BuildIndex(void)
+
+  Summary:
+	Builds the RAM index of file name hashes.
+
+  Description:
+	Reads the name hash table from the active image once and sorts it by
+	hash into fileIndex, so that MPFSOpen needs no flash reads to find 
+	candidate files.  Images with more than MPFS_INDEX_MAX_FILES files 
+	are not indexed and MPFSOpen falls back to scanning the image.
+
+  Precondition:
+	numFiles has been loaded by _Validate.
+
+  Parameters:
+	None
+
+  Returns:
+	None
+  ***************************************************************************/
+#if MPFS_INDEX_MAX_FILES > 0
+static void _BuildIndex(void)
+{
+	WORD i, j;
+	WORD hash;
+
+	isIndexValid = FALSE;
+	if(numFiles[activeBank] > MPFS_INDEX_MAX_FILES)
+		return;
+
+	MPFSStubs[0].addr = _BankBase(activeBank) + 8;
+	MPFSStubs[0].bytesRem = numFiles[activeBank]*2;
+	for(i = 0; i < numFiles[activeBank]; i++)
+	{
+		MPFSGetArray(0, (BYTE*)&hash, 2);
+
+		// Insertion sort; the image is only indexed at startup and 
+		// after an upload
+		for(j = i; j > 0u && fileIndex[j-1].hash > hash; j--)
+			fileIndex[j] = fileIndex[j-1];
+		fileIndex[j].hash = hash;
+		fileIndex[j].fatID = i | _BankID(activeBank);
+	}
+
+	isIndexValid = TRUE;
+}
+#endif
+
+/*****************************************************************************
+  Function:
+	static BYTE _ReadBankRecord(void)
+
+  Summary:
+	Finds the active image bank.
+
+  Description:
+	Reads the bank record from each of the two record sectors and keeps 
+	the valid one with the highest sequence number.  The sequence number
+	is saved in bankSeq for the next switch.
+
+  Precondition:
+	SPIFlashInit has been called.
+
+  Parameters:
+	None
+
+  Returns:
+	The bank named by the newest record, or 0 when there is none, as on
+	a part programmed before image banks were used.
+  ***************************************************************************/
+#if defined(MPFS_USE_SPI_FLASH)
+static BYTE _ReadBankRecord(void)
+{
+	MPFS_BANK_RECORD rec;
+	BYTE i, bank;
+
+	bank = 0;
+	bankSeq = 0;
+	for(i = 0; i < 2u; i++)
+	{
+		SPIFlashReadArray(MPFS_BANK_RECORD_ADDR + i*4096ul, (BYTE*)&rec, sizeof(rec));
+		if(rec.check == _BankCheck(&rec) && rec.bank < MPFS_BANKS && rec.seq > bankSeq)
+		{
+			bankSeq = rec.seq;
+			bank = (BYTE)rec.bank;
+		}
+	}
+	
+	return bank;
+}
+
+/*****************************************************************************
+  Function:
+	static void _WriteBankRecord(BYTE bank)
+
+  Summary:
+	Makes a bank the active one.
+
+  Description:
+	Writes a bank record with the next sequence number.  Records 
+	alternate between the two record sectors, so the previous record 
+	is intact until the new one is complete, and a power failure 
+	during the write leaves the old bank active.
+
+  Precondition:
+	The image in bank has been validated.
+
+  Parameters:
+	bank - the bank to make active
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _WriteBankRecord(BYTE bank)
+{
+	MPFS_BANK_RECORD rec;
+
+	rec.seq = bankSeq + 1;
+	rec.bank = bank;
+	rec.check = _BankCheck(&rec);
+	
+	// Writing the start of the sector erases it first
+	SPIFlashBeginWrite(MPFS_BANK_RECORD_ADDR + (rec.seq & 1)*4096ul);
+	SPIFlashWriteArray((BYTE*)&rec, sizeof(rec));
+	bankSeq = rec.seq;
+}
+#endif
+
+/****************************************************************************
+  Section:
+	Block Cache Functions
+  ***************************************************************************/
+#if defined(MPFS_USE_CACHE)
+
+/*****************************************************************************
+  Function:
+	static void _CacheInvalidate(void)
+
+  Summary:
+	Empties the block cache.
+
+  Description:
+	Marks every cached block as empty.  Called at startup and whenever the 
+	image is rewritten.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _CacheInvalidate(void)
+{
+	BYTE i;
+
+	for(i = 0; i < MPFS_CACHE_BLOCKS; i++)
+	{
+		cacheBlocks[i].addr = MPFS_INVALID;
+		cacheBlocks[i].lastUse = 0;
+	}
+	cacheClock = 0;
+	lastLoadedBlock = MPFS_INVALID;
+}
+
+/*****************************************************************************
+  Function:
+	static MPFS_CACHE_BLOCK* _CacheFind(MPFS_PTR blockAddr)
+
+  Summary:
+	Looks up a block in the cache.
+
+  Description:
+	Searches the cache for the block starting at blockAddr.
+
+  Precondition:
+	None
+
+  Parameters:
+	blockAddr - block aligned image address
+
+  Returns:
+	The cached block, or NULL if it is not in the cache.
+  ***************************************************************************/
+static MPFS_CACHE_BLOCK* _CacheFind(MPFS_PTR blockAddr)
+{
+	BYTE i;
+
+	for(i = 0; i < MPFS_CACHE_BLOCKS; i++)
+	{
+		if(cacheBlocks[i].addr == blockAddr)
+			return &cacheBlocks[i];
+	}
+
+	return NULL;
+}
+
+/*****************************************************************************
+  Function:
+	static MPFS_CACHE_BLOCK* _CacheLoad(MPFS_PTR blockAddr)
+
+  Summary:
+	Reads a block from flash into the cache.
+
+  Description:
+	Replaces the least recently used block with the block starting at 
+	blockAddr.
+
+  Precondition:
+	The block is not already cached.
+
+  Parameters:
+	blockAddr - block aligned image address
+
+  Returns:
+	The newly filled block.
+  ***************************************************************************/
+static MPFS_CACHE_BLOCK* _CacheLoad(MPFS_PTR blockAddr)
+{
+	MPFS_CACHE_BLOCK *block;
+	BYTE i;
+
+	// Empty blocks have a lastUse of 0 and are picked first
+	block = &cacheBlocks[0];
+	for(i = 1; i < MPFS_CACHE_BLOCKS; i++)
+	{
+		if(cacheBlocks[i].lastUse < block->lastUse)
+			block = &cacheBlocks[i];
+	}
+
+	SPIFlashReadArray(blockAddr + MPFS_HEAD, block->data, MPFS_CACHE_BLOCK_SIZE);
+	block->addr = blockAddr;
+	block->lastUse = cacheClock;
+	lastLoadedBlock = blockAddr;
+
+	return block;
+}
+
+/*****************************************************************************
+  Function:
+	static void _ReadCached(MPFS_PTR addr, BYTE* cData, WORD wLen)
+
+  Summary:
+	Reads image data through the block cache.
+
+  Description:
+	Copies data from cached blocks, reading any missing blocks from flash.  
+	When a miss immediately follows the block last read from flash, the 
+	access is assumed to be sequential and the next block is read as 
+	well, continuing the same flash read.
+
+  Precondition:
+	None
+
+  Parameters:
+	addr - image address to read from
+	cData - where to store the data
+	wLen - how many bytes to read
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _ReadCached(MPFS_PTR addr, BYTE* cData, WORD wLen)
+{
+	MPFS_CACHE_BLOCK *block;
+	MPFS_PTR blockAddr;
+	WORD offset, count;
+	BOOL sequential;
+
+	while(wLen)
+	{
+		blockAddr = addr & ~(MPFS_PTR)(MPFS_CACHE_BLOCK_SIZE - 1);
+		cacheClock++;
+
+		block = _CacheFind(blockAddr);
+		if(block)
+		{
+			MPFSCacheStats.dwHits++;
+			block->lastUse = cacheClock;
+		}
+		else
+		{
+			MPFSCacheStats.dwMisses++;
+			sequential = (blockAddr == lastLoadedBlock + MPFS_CACHE_BLOCK_SIZE);
+			block = _CacheLoad(blockAddr);
+
+			// The block just loaded is the most recently used, so the 
+			// read-ahead can't evict it
+			#if MPFS_CACHE_BLOCKS > 1
+			if(sequential && _CacheFind(blockAddr + MPFS_CACHE_BLOCK_SIZE) == NULL)
+			{
+				_CacheLoad(blockAddr + MPFS_CACHE_BLOCK_SIZE);
+				MPFSCacheStats.dwReadAheads++;
+			}
+			#endif
+		}
+
+		// Copy out as much as this block holds
+		offset = (WORD)(addr - blockAddr);
+		count = MPFS_CACHE_BLOCK_SIZE - offset;
+		if(count > wLen)
+			count = wLen;
+		memcpy((void*)cData, (void*)&block->data[offset], count);
+
+		cData += count;
+		addr += count;
+		wLen -= count;
+	}
+}
+#endif //#if defined(MPFS_USE_CACHE)
+
 #endif //#if defined(STACK_USE_MPFS2)
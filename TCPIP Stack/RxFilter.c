@@ -0,0 +1,289 @@
+/*********************************************************************
+ *
+ *	Early Receive Filter
+ *  Module for Microchip TCP/IP Stack
+ *	 -Drops received frames that no socket or service will accept 
+ *	  before any IP or transport checksum work is done
+ *
+ *********************************************************************
+ * FileName:        RxFilter.c
+ * Dependencies:    MAC, UDP, TCP
+ * Processor:       CH32V307
+ * Compiler:        GCC
+ ********************************************************************/
+#define __RXFILTER_C
+
+#include "TCPIP Stack/TCPIP.h"
+
+#if defined(STACK_USE_RX_FILTER)
+
+// Number of bits in each port table.  Must be a power of 2.
+#define RX_FILTER_TABLE_BITS	(256u)
+
+// Folds a port number into a port table bit index
+#define PortBit(port)			((BYTE)(((port) ^ ((port) >> 8)) & (RX_FILTER_TABLE_BITS - 1)))
+
+// Leading bytes of an IP datagram needed to make a filtering decision
+typedef struct
+{
+	IP_HEADER	IP;
+	WORD		SourcePort;		// First WORD of a UDP or TCP header
+	WORD		DestPort;		// Second WORD of a UDP or TCP header
+} RX_FILTER_PEEK;
+
+RX_FILTER_STATS RxFilterStats;
+
+// Bitmaps of local ports that have a socket bound to them.  Several 
+// ports can share a bit, so a set bit only means "maybe open" and the 
+// frame is left for the full protocol handler to decide.  A clear bit 
+// means no socket can possibly want the frame.
+static BYTE UDPPortTable[RX_FILTER_TABLE_BITS/8];
+static BYTE TCPPortTable[RX_FILTER_TABLE_BITS/8];
+
+// Set when sockets are opened or closed; the tables are rebuilt before 
+// the next frame is filtered
+static BOOL bTablesDirty;
+
+static void RebuildTables(void);
+
+
+/*****************************************************************************
+  Function:
+	void RxFilterInit(void)
+
+  Summary:
+	Initializes the RX filter.
+
+  Description:
+	Clears the drop counters and schedules the port tables to be built 
+	from the currently open sockets.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+  	None
+  ***************************************************************************/
+void RxFilterInit(void)
+{
+	memset((void*)&RxFilterStats, 0x00, sizeof(RxFilterStats));
+	bTablesDirty = TRUE;
+}
+
+
+/*****************************************************************************
+  Function:
+	void RxFilterInvalidate(void)
+
+  Summary:
+	Marks the port tables as out of date.
+
+  Description:
+	Called by the UDP and TCP modules whenever a local port is bound or
+	released.  The tables are regenerated lazily by the next call to 
+	RxFilterAccept().
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+  	None
+  ***************************************************************************/
+void RxFilterInvalidate(void)
+{
+	bTablesDirty = TRUE;
+}
+
+
+/*****************************************************************************
+  Function:
+	void RxFilterAddPort(BYTE protocol, WORD port)
+
+  Summary:
+	Adds a local port to the filter tables.
+
+  Description:
+	Called back by UDPAddRxFilterPorts() and TCPAddRxFilterPorts() while 
+	the tables are being rebuilt.
+
+  Precondition:
+	None
+
+  Parameters:
+	protocol - IP_PROT_UDP or IP_PROT_TCP
+	port - Local port number in host byte order
+
+  Returns:
+  	None
+  ***************************************************************************/
+void RxFilterAddPort(BYTE protocol, WORD port)
+{
+	BYTE i;
+
+	i = PortBit(port);
+	if(protocol == IP_PROT_UDP)
+		UDPPortTable[i>>3] |= 1u<<(i & 0x07);
+	else if(protocol == IP_PROT_TCP)
+		TCPPortTable[i>>3] |= 1u<<(i & 0x07);
+}
+
+
+/*****************************************************************************
+  Function:
+	BOOL RxFilterAccept(BYTE cFrameType)
+
+  Summary:
+	Decides whether the current RX frame is worth processing.
+
+  Description:
+	Peeks at the IP header and the port fields of the transport header 
+	of the frame returned by MACGetHeader(), without validating any 
+	checksum, and rejects frames that will certainly be ignored: unknown 
+	EtherTypes, fragments, multicast traffic, unhandled IP protocols, and 
+	UDP or TCP segments addressed to closed ports.  Each rejection is 
+	counted in RxFilterStats.
+
+  Precondition:
+	MACGetHeader() returned TRUE and the read pointer has not been moved.
+
+  Parameters:
+	cFrameType - Frame type returned by MACGetHeader()
+
+  Return Values:
+  	TRUE - The frame should be dispatched normally.  The read pointer is 
+  		left at the start of the IP header.
+  	FALSE - The frame should be discarded.
+  ***************************************************************************/
+BOOL RxFilterAccept(BYTE cFrameType)
+{
+	RX_FILTER_PEEK peek;
+	BYTE i;
+
+	if(cFrameType == MAC_ARP)
+	{
+		RxFilterStats.dwAccepted++;
+		return TRUE;
+	}
+
+	if(cFrameType != MAC_IP)
+	{
+		RxFilterStats.dwUnknownType++;
+		return FALSE;
+	}
+
+	if(bTablesDirty)
+		RebuildTables();
+
+	// Pull in the fixed IP header, then the first 4 bytes following any 
+	// IP options
+	MACGetArray((BYTE*)&peek.IP, sizeof(peek.IP));
+	MACSetReadPtrInRx((peek.IP.VersionIHL & 0x0F) << 2);
+	MACGetArray((BYTE*)&peek.SourcePort, 2*sizeof(WORD));
+	MACSetReadPtrInRx(0);
+
+	if(((peek.IP.VersionIHL & 0xF0) != 0x40u) || (peek.IP.FragmentInfo & 0xFF1F))
+	{
+		RxFilterStats.dwBadIPHeader++;
+		return FALSE;
+	}
+
+	// Class D (224.0.0.0/4) destinations, unless the group has been 
+	// joined.  Skipped while we are still being configured so nothing 
+	// interferes with address acquisition.
+	#if defined(STACK_USE_IGMP)
+	if(IPIsMulticast(peek.IP.DestAddress) && !IGMPIsMember(peek.IP.DestAddress) && !AppConfig.Flags.bInConfigMode)
+	#else
+	if(IPIsMulticast(peek.IP.DestAddress) && !AppConfig.Flags.bInConfigMode)
+	#endif
+	{
+		RxFilterStats.dwMulticast++;
+		return FALSE;
+	}
+
+	switch(peek.IP.Protocol)
+	{
+		#if defined(STACK_USE_ICMP_SERVER) || defined(STACK_USE_ICMP_CLIENT)
+		case IP_PROT_ICMP:
+			break;
+		#endif
+
+		#if defined(STACK_USE_IGMP)
+		case IP_PROT_IGMP:
+			break;
+		#endif
+
+		#if defined(STACK_USE_UDP)
+		case IP_PROT_UDP:
+			i = PortBit(swaps(peek.DestPort));
+			if(!(UDPPortTable[i>>3] & (1u<<(i & 0x07))))
+			{
+				RxFilterStats.dwUDPClosedPort++;
+				return FALSE;
+			}
+			break;
+		#endif
+
+		#if defined(STACK_USE_TCP)
+		case IP_PROT_TCP:
+			i = PortBit(swaps(peek.DestPort));
+			if(!(TCPPortTable[i>>3] & (1u<<(i & 0x07))))
+			{
+				RxFilterStats.dwTCPClosedPort++;
+				return FALSE;
+			}
+			break;
+		#endif
+
+		default:
+			RxFilterStats.dwUnknownProtocol++;
+			return FALSE;
+	}
+
+	RxFilterStats.dwAccepted++;
+	return TRUE;
+}
+
+
+/*****************************************************************************
+  Function:
+	static void RebuildTables(void)
+
+  Summary:
+	Regenerates the port tables from the open sockets.
+
+  Description:
+	Clears both port tables and has the UDP and TCP modules add the local
+	port of every socket that is open, listening, or connecting.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+
+  Returns:
+  	None
+  ***************************************************************************/
+static void RebuildTables(void)
+{
+	memset((void*)UDPPortTable, 0x00, sizeof(UDPPortTable));
+	memset((void*)TCPPortTable, 0x00, sizeof(TCPPortTable));
+
+	#if defined(STACK_USE_UDP)
+	UDPAddRxFilterPorts();
+	#endif
+
+	#if defined(STACK_USE_TCP)
+	TCPAddRxFilterPorts();
+	#endif
+
+	bTablesDirty = FALSE;
+}
+
+#endif //#if defined(STACK_USE_RX_FILTER)
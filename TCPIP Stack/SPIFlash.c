@@ -97,15 +97,75 @@
 #define SET_CS         do { CS_PORT->BSHR = CS_PIN; } while (0)
 #define CLR_CS         do { CS_PORT->BCR = CS_PIN; } while (0)
 
+// DMA channels serving SPI1 RX and TX requests
+#define DMA_RX_CHANNEL		DMA1_Channel2
+#define DMA_TX_CHANNEL		DMA1_Channel3
+#define DMA_RX_FLAGS		(DMA1_FLAG_GL2)
+#define DMA_TX_FLAGS		(DMA1_FLAG_GL3)
+#define DMA_RX_FLAG_TC		(DMA1_FLAG_TC2)
+
+// Reads of at least this many bytes are done by DMA.  Shorter reads are 
+// polled since setting up the channels costs about as much as a few bytes.
+#if !defined(SPI_FLASH_DMA_THRESHOLD)
+	#define SPI_FLASH_DMA_THRESHOLD		(16u)
+#endif
+
+// dwReadAddr value when no read is in progress
+#define READ_CLOSED			(0xFFFFFFFFul)
+
+// Pages buffered by SPIFlashPutArray.  One can be filled while the 
+// other is erased and programmed in the background.
+#if !defined(SPI_FLASH_QUEUE_PAGES)
+	#define SPI_FLASH_QUEUE_PAGES		(2u)
+#endif
+
+// A page of data waiting to be programmed
+typedef struct
+{
+	DWORD dwAddr;						// Flash address of vData[0]
+	WORD wLen;							// Number of bytes in vData
+	BYTE vData[SPI_FLASH_PAGE_SIZE];	// Data to program
+} SPI_FLASH_PAGE;
+
 
 // Internal pointer to address being written
 static DWORD dwWriteAddr;
 
+// Address of the next byte of the FAST_READ left open by the last read.  
+// Chip select stays asserted between sequential reads so they can 
+// continue without a new command and address.
+static DWORD dwReadAddr = READ_CLOSED;
+
+// Clocked out by the TX DMA channel while reading
+static const BYTE dummyByte = DUMMY;
+
 static BOOL initialized = FALSE;
 
+// Queue of pages for SPIFlashTask to program.  The page after the last 
+// queued one is being filled, and is empty when wLen is 0.
+static SPI_FLASH_PAGE pageQueue[SPI_FLASH_QUEUE_PAGES];
+static BYTE queueHead;			// Oldest queued page, the one being written
+static BYTE queueCount;			// Number of pages queued for programming
+
+// Background write state machine
+static enum
+{
+	SM_FLASH_IDLE = 0u,			// Waiting for a page to be queued
+	SM_FLASH_ERASE,				// Erasing the sector that starts the head page
+	SM_FLASH_PROGRAM			// Programming the head page
+} smFlash = SM_FLASH_IDLE;
+
 static void _SendCmd(BYTE cmd);
 static void _WaitWhileBusy(void);
+static BOOL _IsBusy(void);
 static void _EraseSector(DWORD dwAddr);
+static void _StartErase(DWORD dwAddr);
+static void _StartProgram(DWORD dwAddr, BYTE *vData, WORD wLen);
+static void _FlushQueue(void);
+static void _PrepareRead(DWORD dwAddress, WORD wLength);
+static void _ReadPending(DWORD dwAddress, BYTE *vData, WORD wLength);
+static void _EndRead(void);
+static void _ReadDMA(BYTE *vData, WORD wLength);
 
 static BYTE SPIWriteReadData(BYTE dat)
 {
@@ -143,11 +203,13 @@ void SPIFlashInit(void)
 {
     GPIO_InitTypeDef GPIO_InitStructure;
     SPI_InitTypeDef  SPI_InitStructure;
+    DMA_InitTypeDef  DMA_InitStructure;
 
     if (initialized)
         return;
 
     RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA | RCC_APB2Periph_SPI1, ENABLE);
+    RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
 
     GPIO_InitStructure.GPIO_Pin = GPIO_Pin_4;
     GPIO_InitStructure.GPIO_Mode = GPIO_Mode_Out_PP;
@@ -182,8 +244,38 @@ void SPIFlashInit(void)
     SPI_InitStructure.SPI_CRCPolynomial = 7;
     SPI_Init(SPI, &SPI_InitStructure);
 
+    // RX channel stores each received byte.  It has the higher priority 
+    // so that it is never overrun by the TX channel.
+    DMA_DeInit(DMA_RX_CHANNEL);
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (u32)&SPI->DATAR;
+    DMA_InitStructure.DMA_MemoryBaseAddr = 0;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+    DMA_InitStructure.DMA_BufferSize = 0;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init(DMA_RX_CHANNEL, &DMA_InitStructure);
+
+    // TX channel repeatedly sends the dummy byte to generate the clock
+    DMA_DeInit(DMA_TX_CHANNEL);
+    DMA_InitStructure.DMA_MemoryBaseAddr = (u32)&dummyByte;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Disable;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+    DMA_Init(DMA_TX_CHANNEL, &DMA_InitStructure);
+
+    // Requests are ignored while the channels are disabled, so polled 
+    // transfers are unaffected
+    SPI_I2S_DMACmd(SPI, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, ENABLE);
+
     SPI_Cmd(SPI, ENABLE);
 
+    dwReadAddr = READ_CLOSED;
+
     initialized = TRUE;
 }
 
@@ -206,32 +298,66 @@ void SPIFlashInit(void)
 
   Returns:
 	None
+
+  Remarks:
+	Reads are done with FAST_READ and chip select is left asserted 
+	afterwards.  A read starting where the previous one ended continues 
+	the same transfer without resending the command and address, so 
+	sequential reads run at close to the SPI clock rate.  Any other 
+	flash operation ends the transfer first.
+	
+	A read waits for the erase or program already running on the chip, 
+	but only waits for queued pages when they hold data in the range 
+	being read.  Bytes still in the partially filled page are copied from 
+	RAM, so the page is not ended early.
   ***************************************************************************/
 void SPIFlashReadArray(DWORD dwAddress, BYTE *vData, WORD wLength)
 {
+	BYTE *vStart;
+	WORD wCount;
+
 	// Ignore operations when the destination is NULL or nothing to read
 	if(vData == NULL || wLength == 0)
 		return;
 	
-	// Activate chip select
-	CLR_CS;
+	_PrepareRead(dwAddress, wLength);
 
-	// Send READ opcode
-	SPIWriteReadData(COMMAND_READ);
+	// Start a new transfer unless this read continues the open one
+	if(dwAddress != dwReadAddr)
+	{
+		_EndRead();
+
+		// Activate chip select
+		CLR_CS;
+
+		// Send FAST_READ opcode
+		SPIWriteReadData(COMMAND_FREAD);
 	
-	// Send address
-	SPIWriteReadData((dwAddress >> 16) & 0xff);
-    SPIWriteReadData((dwAddress >> 8) & 0xff);
-    SPIWriteReadData(dwAddress & 0xff);
+		// Send address, followed by the required dummy byte
+		SPIWriteReadData((dwAddress >> 16) & 0xff);
+	    SPIWriteReadData((dwAddress >> 8) & 0xff);
+	    SPIWriteReadData(dwAddress & 0xff);
+		SPIWriteReadData(DUMMY);
+	}
+
+	dwReadAddr = dwAddress + wLength;
 	
 	// Read data
-	while(wLength--)
+	if(wLength >= SPI_FLASH_DMA_THRESHOLD)
 	{
-		*vData++ = SPIWriteReadData(DUMMY);
+		_ReadDMA(vData, wLength);
 	}
-	
-	// Deactivate chip select
-	SET_CS;
+	else
+	{
+		vStart = vData;
+		wCount = wLength;
+		while(wCount--)
+		{
+			*vStart++ = SPIWriteReadData(DUMMY);
+		}
+	}
+
+	_ReadPending(dwAddress, vData, wLength);
 }
 
 /*****************************************************************************
@@ -272,9 +398,37 @@ void SPIFlashReadArray(DWORD dwAddress, BYTE *vData, WORD wLength)
   ***************************************************************************/
 void SPIFlashBeginWrite(DWORD dwAddr)
 {
+	_FlushQueue();
 	dwWriteAddr = dwAddr;
 }
 
+/*****************************************************************************
+  Function:
+	DWORD SPIFlashGetWriteAddr(void)
+
+  Summary:
+	Returns the address the next write will go to.
+
+  Description:
+	Lets a module that writes to its own area of the chip save the write 
+	pointer, and restore it afterwards with SPIFlashBeginWrite, so that a 
+	series of writes by another module (such as an MPFS upload queued 
+	with SPIFlashPutArray) continues where it left off.
+
+  Precondition:
+	SPIFlashInit has been called.
+
+  Parameters:
+	None
+
+  Returns:
+	The current write address.
+  ***************************************************************************/
+DWORD SPIFlashGetWriteAddr(void)
+{
+	return dwWriteAddr;
+}
+
 /*****************************************************************************
   Function:
 	void SPIFlashWrite(BYTE vData)
@@ -306,6 +460,8 @@ void SPIFlashBeginWrite(DWORD dwAddr)
   ***************************************************************************/
 void SPIFlashWrite(BYTE vData)
 {
+	_FlushQueue();
+
 	// If address is a 4k boundary, erase a sector first
 	if((dwWriteAddr & SPI_FLASH_SECTOR_MASK) == 0)
 	    _EraseSector(dwWriteAddr);
@@ -368,6 +524,8 @@ void SPIFlashWriteArray(BYTE* vData, WORD wLen)
 {
 	DWORD BytesToWrite;
 
+	_FlushQueue();
+
 	while (wLen > 0)
 	{
 		// If address is a sector boundary
@@ -380,32 +538,359 @@ void SPIFlashWriteArray(BYTE* vData, WORD wLen)
 		    BytesToWrite = wLen;
 		}
 
-		// Enable writing
-		_SendCmd(COMMAND_WREN);
+		_StartProgram(dwWriteAddr, vData, BytesToWrite);
+
+		vData += BytesToWrite;
+		wLen -= BytesToWrite;
+		dwWriteAddr += BytesToWrite;
+
+		// Don't do anything until chip is ready
+		_WaitWhileBusy();
+	}
+}
+
+/*****************************************************************************
+  Function:
+	WORD SPIFlashPutArray(BYTE* vData, WORD wLen)
+
+  Summary:
+	Queues an array of bytes to be written to the SPI Flash part.
+
+  Description:
+	This function writes to the SPI Flash part like SPIFlashWriteArray, 
+	but without waiting for the chip.  Data is copied into a queue of 
+	page buffers, and SPIFlashTask erases sectors and programs the pages 
+	in the background while the rest of the stack keeps running.  When 
+	the queue is full, only part of the data is accepted, and the caller 
+	should try the rest again later.
 	
-		CLR_CS;
-        SPIWriteReadData(COMMAND_WRITE);
+  Precondition:
+	SPIFlashInit and SPIFlashBeginWrite have been called, and the current
+	address is either the front of a 4kB sector or has already been erased.
 
-        // Send address
-        SPIWriteReadData((dwWriteAddr >> 16) & 0xff);
-        SPIWriteReadData((dwWriteAddr >> 8) & 0xff);
-        SPIWriteReadData(dwWriteAddr & 0xff);
+  Parameters:
+	vData - The array to write to the next memory location
+	wLen - The length of the data to be written
 
-		DWORD count = BytesToWrite;
-        while (count--)
-        {
-            SPIWriteReadData(*vData++);
-        }
+  Returns:
+	The number of bytes accepted.
 
-		wLen -= BytesToWrite;
+  Remarks:
+	A partially filled page is not programmed until it is completed or 
+	SPIFlashPutEnd is called.  SPIFlashReadArray only waits for queued 
+	pages it reads from, while the other SPI Flash functions first wait 
+	for all queued data to be written.
+  ***************************************************************************/
+WORD SPIFlashPutArray(BYTE* vData, WORD wLen)
+{
+	SPI_FLASH_PAGE *page;
+	WORD wCount, wTotal;
 
-		dwWriteAddr += BytesToWrite;
+	SPIFlashTask();
+
+	wTotal = 0;
+	while(wLen > 0u && queueCount < SPI_FLASH_QUEUE_PAGES)
+	{
+		page = &pageQueue[(queueHead + queueCount) % SPI_FLASH_QUEUE_PAGES];
+		if(page->wLen == 0u)
+			page->dwAddr = dwWriteAddr;
+
+		// Fill up to the end of the flash page
+		wCount = SPI_FLASH_PAGE_SIZE - (dwWriteAddr & SPI_FLASH_PAGE_SIZE_MASK);
+		if(wCount > wLen)
+			wCount = wLen;
+		memcpy(&page->vData[page->wLen], vData, wCount);
+		page->wLen += wCount;
+		dwWriteAddr += wCount;
+		vData += wCount;
+		wLen -= wCount;
+		wTotal += wCount;
+
+		// Queue complete pages for programming
+		if((dwWriteAddr & SPI_FLASH_PAGE_SIZE_MASK) == 0u)
+			queueCount++;
+	}
 
-		SET_CS;
+	SPIFlashTask();
 
-		// Don't do anything until chip is ready
-		_WaitWhileBusy();
+	return wTotal;
+}
+
+/*****************************************************************************
+  Function:
+	WORD SPIFlashGetPutReady(void)
+
+  Summary:
+	Determines how many bytes SPIFlashPutArray can accept.
+
+  Description:
+	Runs SPIFlashTask, then returns the free space in the page queue.
+	
+  Precondition:
+	SPIFlashInit and SPIFlashBeginWrite have been called.
+
+  Parameters:
+	None
+
+  Returns:
+	The number of bytes the next call to SPIFlashPutArray will accept.
+  ***************************************************************************/
+WORD SPIFlashGetPutReady(void)
+{
+	SPIFlashTask();
+
+	if(queueCount == SPI_FLASH_QUEUE_PAGES)
+		return 0;
+
+	return (WORD)(SPI_FLASH_PAGE_SIZE - (dwWriteAddr & SPI_FLASH_PAGE_SIZE_MASK)) +
+		(WORD)(SPI_FLASH_QUEUE_PAGES - 1u - queueCount) * (WORD)SPI_FLASH_PAGE_SIZE;
+}
+
+/*****************************************************************************
+  Function:
+	void SPIFlashPutEnd(void)
+
+  Summary:
+	Queues any partially filled page for programming.
+
+  Description:
+	Ends a series of SPIFlashPutArray calls, so that the last bytes are 
+	programmed even though they don't fill a page.  Use SPIFlashIsBusy 
+	to find out when all of the data has been written.
+	
+  Precondition:
+	SPIFlashInit has been called.
+
+  Parameters:
+	None
+
+  Returns:
+	None
+  ***************************************************************************/
+void SPIFlashPutEnd(void)
+{
+	if(queueCount < SPI_FLASH_QUEUE_PAGES && 
+		pageQueue[(queueHead + queueCount) % SPI_FLASH_QUEUE_PAGES].wLen != 0u)
+		queueCount++;
+
+	SPIFlashTask();
+}
+
+/*****************************************************************************
+  Function:
+	BOOL SPIFlashIsBusy(void)
+
+  Summary:
+	Determines if queued data is still being written.
+
+  Description:
+	Runs SPIFlashTask, then checks if any pages queued by 
+	SPIFlashPutArray or SPIFlashPutEnd have not been written yet.
+	
+  Precondition:
+	SPIFlashInit has been called.
+
+  Parameters:
+	None
+
+  Returns:
+	TRUE if queued pages remain, FALSE otherwise.
+  ***************************************************************************/
+BOOL SPIFlashIsBusy(void)
+{
+	SPIFlashTask();
+	
+	return queueCount != 0u;
+}
+
+/*****************************************************************************
+  Function:
+	void SPIFlashTask(void)
+
+  Summary:
+	Writes queued pages in the background.
+
+  Description:
+	Advances the background write state machine by at most one step.  
+	When the chip is busy with an erase or program, its status register 
+	is read once and the function returns, rather than waiting.  Once it 
+	is idle, the next queued page is programmed, after erasing its sector 
+	first if the page starts one.
+	
+  Precondition:
+	SPIFlashInit has been called.
+
+  Parameters:
+	None
+
+  Returns:
+	None
+
+  Remarks:
+	This function is called by StackTask, and by the other SPIFlashPut 
+	functions.
+  ***************************************************************************/
+void SPIFlashTask(void)
+{
+	SPI_FLASH_PAGE *page;
+
+	switch(smFlash)
+	{
+		case SM_FLASH_IDLE:
+			if(queueCount == 0u)
+				return;
+
+			// Erase the sector first when this page starts one
+			page = &pageQueue[queueHead];
+			if((page->dwAddr & SPI_FLASH_SECTOR_MASK) == 0u)
+			{
+				_StartErase(page->dwAddr);
+				smFlash = SM_FLASH_ERASE;
+				return;
+			}
+			_StartProgram(page->dwAddr, page->vData, page->wLen);
+			smFlash = SM_FLASH_PROGRAM;
+			return;
+
+		case SM_FLASH_ERASE:
+			if(_IsBusy())
+				return;
+
+			page = &pageQueue[queueHead];
+			_StartProgram(page->dwAddr, page->vData, page->wLen);
+			smFlash = SM_FLASH_PROGRAM;
+			return;
+
+		case SM_FLASH_PROGRAM:
+			if(_IsBusy())
+				return;
+
+			// Free the page for SPIFlashPutArray
+			pageQueue[queueHead].wLen = 0;
+			if(++queueHead == SPI_FLASH_QUEUE_PAGES)
+				queueHead = 0;
+			queueCount--;
+			smFlash = SM_FLASH_IDLE;
+			return;
+	}
+}
+
+/*****************************************************************************
+  Function:
+	void _FlushQueue(void)
+
+  Summary:
+	Waits until all data given to SPIFlashPutArray has been written.
+
+  Description:
+	Queues any partially filled page, then waits for the background 
+	writes to finish so that the chip can be used directly.
+	
+  Precondition:
+	SPIFlashInit has been called.
+
+  Parameters:
+	None
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _FlushQueue(void)
+{
+	if(smFlash == SM_FLASH_IDLE && queueCount == 0u && 
+		pageQueue[queueHead].wLen == 0u)
+		return;
+
+	SPIFlashPutEnd();
+	while(SPIFlashIsBusy());
+}
+
+/*****************************************************************************
+  Function:
+	void _PrepareRead(DWORD dwAddress, WORD wLength)
+
+  Summary:
+	Waits until a range of the chip can be read.
+
+  Description:
+	Programs any queued pages that hold data in the range, then waits 
+	for the erase or program running on the chip to finish.  Other 
+	queued pages are left for SPIFlashTask.
+	
+  Precondition:
+	SPIFlashInit has been called.
+
+  Parameters:
+	dwAddress - Address the read will start at
+	wLength - Length of the read
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _PrepareRead(DWORD dwAddress, WORD wLength)
+{
+	SPI_FLASH_PAGE *page;
+	BYTE i, vRemain;
+
+	// Find how many pages must be written to reach the last overlapping one
+	vRemain = queueCount;
+	for(i = 0; i < queueCount; i++)
+	{
+		page = &pageQueue[(queueHead + i) % SPI_FLASH_QUEUE_PAGES];
+		if(page->dwAddr < dwAddress + wLength && dwAddress < page->dwAddr + page->wLen)
+			vRemain = queueCount - i - 1u;
 	}
+	while(queueCount > vRemain)
+		SPIFlashTask();
+
+	// The chip can't be read during an erase or program
+	if(smFlash != SM_FLASH_IDLE)
+		while(_IsBusy());
+}
+
+/*****************************************************************************
+  Function:
+	void _ReadPending(DWORD dwAddress, BYTE *vData, WORD wLength)
+
+  Summary:
+	Copies bytes of the partially filled page into read data.
+
+  Description:
+	Bytes given to SPIFlashPutArray that don't fill a page stay in RAM 
+	until the page is completed.  Any of them in the range just read 
+	replace the erased bytes read from the chip.
+	
+  Precondition:
+	SPIFlashInit has been called.
+
+  Parameters:
+	dwAddress - Address the read started at
+	vData - The data read from the chip
+	wLength - Length of the read
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _ReadPending(DWORD dwAddress, BYTE *vData, WORD wLength)
+{
+	SPI_FLASH_PAGE *page;
+	DWORD dwStart, dwEnd;
+
+	if(queueCount == SPI_FLASH_QUEUE_PAGES)
+		return;
+
+	page = &pageQueue[(queueHead + queueCount) % SPI_FLASH_QUEUE_PAGES];
+	if(page->wLen == 0u)
+		return;
+
+	dwStart = page->dwAddr > dwAddress ? page->dwAddr : dwAddress;
+	dwEnd = page->dwAddr + page->wLen;
+	if(dwEnd > dwAddress + wLength)
+		dwEnd = dwAddress + wLength;
+	if(dwStart >= dwEnd)
+		return;
+
+	memcpy(&vData[dwStart - dwAddress], &page->vData[dwStart - page->dwAddr], dwEnd - dwStart);
 }
 
 
@@ -435,6 +920,34 @@ void SPIFlashWriteArray(BYTE* vData, WORD wLen)
 	memory parts.
   ***************************************************************************/
 static void _EraseSector(DWORD dwAddr)
+{
+	_StartErase(dwAddr);
+	
+	// Wait for erase to complete
+	_WaitWhileBusy();
+}
+
+/*****************************************************************************
+  Function:
+	void _StartErase(DWORD dwAddr)
+
+  Summary:
+	Starts erasing a 4kB sector.
+
+  Description:
+	Issues the sector erase command and returns while the chip performs 
+	the erase.
+	
+  Precondition:
+	SPIFlashInit has been called, and the chip is idle.
+
+  Parameters:
+	dwAddr - The address of the sector to be erased.
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _StartErase(DWORD dwAddr)
 {
 	// Enable writing
 	_SendCmd(COMMAND_WREN);
@@ -445,15 +958,57 @@ static void _EraseSector(DWORD dwAddr)
 	// Issue ERASE_4K command with address
 	SPIWriteReadData(COMMAND_SE);
 
-	SPIWriteReadData((dwWriteAddr >> 16) & 0xff);
-    SPIWriteReadData((dwWriteAddr >> 8) & 0xff);
-    SPIWriteReadData(dwWriteAddr & 0xff);
+	SPIWriteReadData((dwAddr >> 16) & 0xff);
+    SPIWriteReadData((dwAddr >> 8) & 0xff);
+    SPIWriteReadData(dwAddr & 0xff);
 	
 	// Deactivate chip select to perform the erase
 	SET_CS;
+}
+
+/*****************************************************************************
+  Function:
+	void _StartProgram(DWORD dwAddr, BYTE *vData, WORD wLen)
+
+  Summary:
+	Starts programming data within one page.
+
+  Description:
+	Transfers the data with a page program command and returns while the 
+	chip programs it.
 	
-	// Wait for erase to complete
-	_WaitWhileBusy();
+  Precondition:
+	SPIFlashInit has been called, the chip is idle, and the data does not 
+	cross a page boundary.
+
+  Parameters:
+	dwAddr - Address where the data will be written
+	vData - The data to write
+	wLen - The length of the data
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _StartProgram(DWORD dwAddr, BYTE *vData, WORD wLen)
+{
+	// Enable writing
+	_SendCmd(COMMAND_WREN);
+
+	CLR_CS;
+	SPIWriteReadData(COMMAND_WRITE);
+
+	// Send address
+	SPIWriteReadData((dwAddr >> 16) & 0xff);
+	SPIWriteReadData((dwAddr >> 8) & 0xff);
+	SPIWriteReadData(dwAddr & 0xff);
+
+	while(wLen--)
+	{
+		SPIWriteReadData(*vData++);
+	}
+
+	// Deactivate chip select to start programming
+	SET_CS;
 }
 
 /*****************************************************************************
@@ -480,6 +1035,8 @@ static void _EraseSector(DWORD dwAddr)
   ***************************************************************************/
 static void _SendCmd(BYTE cmd)
 {
+	_EndRead();
+
 	// Activate chip select
 	CLR_CS;
 	
@@ -515,6 +1072,8 @@ static void _WaitWhileBusy(void)
 {
 	BYTE_VAL result;
 
+	_EndRead();
+
 	// Activate chip select
     CLR_CS;
 
@@ -532,5 +1091,118 @@ static void _WaitWhileBusy(void)
 }
 
 
+/*****************************************************************************
+  Function:
+	BOOL _IsBusy(void)
+
+  Summary:
+	Checks once whether the SPI Flash part is busy.
+
+  Description:
+	Reads the status register a single time and reports the write in 
+	progress bit, so background operations can be polled without 
+	waiting.
+	
+  Precondition:
+	SPIFlashInit has been called.
+
+  Parameters:
+	None
+
+  Returns:
+	TRUE if an erase or program is in progress, FALSE otherwise
+  ***************************************************************************/
+static BOOL _IsBusy(void)
+{
+	BYTE result;
+
+	_EndRead();
+
+	// Activate chip select
+	CLR_CS;
+
+	// Send Read Status Register instruction
+	SPIWriteReadData(COMMAND_RDSR);
+	result = SPIWriteReadData(DUMMY);
+
+	// Deactivate chip select
+	SET_CS;
+
+	return (result & STATUS_WIP) != 0u;
+}
+
+
+/*****************************************************************************
+  Function:
+	void _EndRead(void)
+
+  Summary:
+	Ends any read left open by SPIFlashReadArray.
+
+  Description:
+	Deactivates the chip select if a FAST_READ is still in progress, so 
+	that a new command can be sent.
+	
+  Precondition:
+	SPIFlashInit has been called.
+
+  Parameters:
+	None
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _EndRead(void)
+{
+	if(dwReadAddr == READ_CLOSED)
+		return;
+
+	// Deactivate chip select
+	SET_CS;
+
+	dwReadAddr = READ_CLOSED;
+}
+
+/*****************************************************************************
+  Function:
+	void _ReadDMA(BYTE *vData, WORD wLength)
+
+  Summary:
+	Reads a block of data from the open read using DMA.
+
+  Description:
+	The TX channel clocks out dummy bytes while the RX channel stores the 
+	received data, so the bus runs back to back without CPU involvement.  
+	Returns when the last byte has been stored.
+	
+  Precondition:
+	A FAST_READ is in progress and no received byte is pending.
+
+  Parameters:
+	vData - Where to store data that has been read
+	wLength - Length of data to read
+
+  Returns:
+	None
+  ***************************************************************************/
+static void _ReadDMA(BYTE *vData, WORD wLength)
+{
+	DMA_RX_CHANNEL->MADDR = (u32)vData;
+	DMA_RX_CHANNEL->CNTR = wLength;
+	DMA_TX_CHANNEL->CNTR = wLength;
+	DMA_ClearFlag(DMA_RX_FLAGS);
+	DMA_ClearFlag(DMA_TX_FLAGS);
+
+	// Enable RX first so the first byte can't be missed
+	DMA_Cmd(DMA_RX_CHANNEL, ENABLE);
+	DMA_Cmd(DMA_TX_CHANNEL, ENABLE);
+
+	while(DMA_GetFlagStatus(DMA_RX_FLAG_TC) == RESET);
+
+	DMA_Cmd(DMA_TX_CHANNEL, DISABLE);
+	DMA_Cmd(DMA_RX_CHANNEL, DISABLE);
+}
+
+
 #endif //#if defined(SPIFLASH_CS_TRIS)
 
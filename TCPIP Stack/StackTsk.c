@@ -123,6 +123,14 @@ void StackInit(void)
 
     ARPInit();
 
+#if defined(STACK_USE_IGMP)
+	IGMPInit();
+#endif
+
+#if defined(STACK_USE_RX_FILTER)
+	RxFilterInit();
+#endif
+
 #if defined(STACK_USE_UDP)
     UDPInit();
 #endif
@@ -169,13 +177,13 @@ void StackInit(void)
 }
 
 /*********************************************************************
- * Function:        void StackTask(void)
+ * Function:        WORD StackTask(void)
  *
  * PreCondition:    StackInit() is already called.
  *
  * Input:           None
  *
- * Output:          Stack FSM is executed.
+ * Output:          Number of received frames handled during this call
  *
  * Side Effects:    None
  *
@@ -183,13 +191,19 @@ void StackInit(void)
  *                  and routes it to appropriate stack components.
  *                  It also performs timed operations.
  *
+ *                  At most STACK_RX_BUDGET frames are handled per
+ *                  call so that a flood of traffic cannot starve
+ *                  StackApplications().  Frames beyond the budget
+ *                  stay queued in the MAC RX ring for the next call.
+ *
  *                  This function must be called periodically to
  *                  ensure timely responses.
  *
  ********************************************************************/
-void StackTask(void)
+WORD StackTask(void)
 {
     WORD dataCount;
+    WORD wFrames;
     IP_ADDR tempLocalIP;
 	BYTE cFrameType;
 	BYTE cIPFrameType;
@@ -236,8 +250,18 @@ void StackTask(void)
 	UDPTask();
 	#endif
 
-	// Process as many incomming packets as we can
-	while(1)
+	#if defined(STACK_USE_IGMP)
+	IGMPTask();
+	#endif
+
+	#if defined(MPFS_USE_SPI_FLASH) && (defined(STACK_USE_MPFS) || defined(STACK_USE_MPFS2))
+	// Continue SPI Flash writes queued in the background
+	SPIFlashTask();
+	#endif
+
+	// Process as many incomming packets as the RX budget allows
+	wFrames = 0;
+	while(wFrames < STACK_RX_BUDGET)
 	{
 		//if using the random module, generate entropy
 		#if defined(STACK_USE_RANDOM)
@@ -255,6 +279,17 @@ void StackTask(void)
 		// yet)
 		if(!MACGetHeader(&remoteNode.MACAddr, &cFrameType))
 			break;
+		wFrames++;
+
+		#if defined(STACK_USE_RX_FILTER)
+		// Drop frames that no socket or service wants before spending 
+		// any time on IP and transport checksums
+		if(!RxFilterAccept(cFrameType))
+		{
+			MACDiscardRx();
+			continue;
+		}
+		#endif
 
 		// Dispatch the packet to the appropriate handler
 		switch(cFrameType)
@@ -299,6 +334,14 @@ void StackTask(void)
 				}
 				#endif
 				
+				#if defined(STACK_USE_IGMP)
+				if(cIPFrameType == IP_PROT_IGMP)
+				{
+					IGMPProcess(&remoteNode, &tempLocalIP, dataCount);
+					break;
+				}
+				#endif
+
 				#if defined(STACK_USE_TCP)
 				if(cIPFrameType == IP_PROT_TCP)
 				{
@@ -312,13 +355,15 @@ void StackTask(void)
 				{
 					// Stop processing packets if we came upon a UDP frame with application data in it
 					if(UDPProcess(&remoteNode, &tempLocalIP, dataCount))
-						return;
+						return wFrames;
 				}
 				#endif
 
 				break;
 		}
 	}
+
+	return wFrames;
 }
 
 /*********************************************************************
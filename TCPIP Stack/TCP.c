@@ -213,6 +213,15 @@ static TCP_SOCKET hCurrentTCP = INVALID_SOCKET;		// Current TCP socket
 static TCP_SYN_QUEUE SYNQueue[TCP_SYN_QUEUE_MAX_ENTRIES];	// Array of saved incoming SYN requests that need to be serviced later
 #endif
 
+// Bytes of TCPSendFile() data in MyTCB not yet sent, and sent but not yet ACKed
+#if defined(STACK_USE_MPFS2)
+	#define TCPFileUnsent()		(MyTCB.txFile.dwLen - MyTCB.txFile.dwSent)
+	#define TCPFileInFlight()	(MyTCB.txFile.dwSent - MyTCB.txFile.dwAcked)
+#else
+	#define TCPFileUnsent()		(0ul)
+	#define TCPFileInFlight()	(0ul)
+#endif
+
 /****************************************************************************
   Section:
 	Function Prototypes
@@ -220,6 +229,10 @@ static TCP_SYN_QUEUE SYNQueue[TCP_SYN_QUEUE_MAX_ENTRIES];	// Array of saved inco
 
 static void TCPRAMCopy(PTR_BASE wDest, BYTE vDestType, PTR_BASE wSource, BYTE vSourceType, WORD wLength);
 #define TCPRAMCopyROM(a,b,c,d)	TCPRAMCopy(a,b,c,TCP_PIC_RAM,d)
+static BYTE TCPRxByte(WORD wOffset);
+
+// Converts c to upper case for case-insensitive searches
+#define TCPFoldCase(c, bTextCompare)	(((bTextCompare) && (c) >= 'a' && (c) <= 'z') ? (BYTE)((c) - ('a' - 'A')) : (BYTE)(c))
 
 
 static void SendTCP(BYTE vTCPFlags, BYTE vSendFlags);
@@ -228,6 +241,9 @@ static BOOL FindMatchingSocket(TCP_HEADER* h, NODE_INFO* remote);
 static void SwapTCPHeader(TCP_HEADER* header);
 static void CloseSocket(void);
 static void SyncTCB(void);
+#if defined(STACK_USE_MPFS2)
+static WORD PutTCPFileData(WORD wOffset, BYTE* vTCPFlags);
+#endif
 
 // Indicates if this packet is a retransmission (no reset) or a new packet (reset required)
 #define SENDTCP_RESET_TIMERS	0x01
@@ -554,6 +570,10 @@ TCP_SOCKET TCPOpen(DWORD dwRemoteHost, BYTE vRemoteHostType, WORD wPort, BYTE vS
 			}	
 			#endif
 		}
+
+		#if defined(STACK_USE_RX_FILTER)
+		RxFilterInvalidate();
+		#endif
 		
 		return hTCP;		
 	}
@@ -613,6 +633,45 @@ BOOL TCPWasReset(TCP_SOCKET hTCP)
 }
 
 
+/*****************************************************************************
+  Function:
+	BOOL TCPWasActive(TCP_SOCKET hTCP)
+
+  Summary:
+	Self-clearing semaphore indicating socket activity.
+
+  Description:
+	This function is a self-clearing semaphore indicating whether or not
+	a segment has arrived for the socket, or the socket has been closed, 
+	since the previous call.  Any change in the amount of RX data, free 
+	TX space, or the connection state is caused by one of these events, 
+	so servers with many sockets can skip those that were not active 
+	instead of polling each one on every pass.
+
+  Precondition:
+	TCP is initialized.
+
+  Parameters:
+	hTCP - The socket to check.
+
+  Return Values:
+  	TRUE - The socket has been active since the previous call.
+  	FALSE - The socket has not been active since the previous call.
+  ***************************************************************************/
+BOOL TCPWasActive(TCP_SOCKET hTCP)
+{
+	SyncTCBStub(hTCP);
+	
+	if(MyTCBStub.Flags.bActivity)
+	{
+		MyTCBStub.Flags.bActivity = 0;
+		return TRUE;
+	}	
+	
+	return FALSE;
+}
+
+
 /*****************************************************************************
   Function:
 	BOOL TCPIsConnected(TCP_SOCKET hTCP)
@@ -833,7 +892,7 @@ void TCPFlush(TCP_SOCKET hTCP)
 
 	// NOTE: Pending SSL data will NOT be transferred here
 
-	if(MyTCBStub.txHead != MyTCB.txUnackedTail)
+	if((MyTCBStub.txHead != MyTCB.txUnackedTail) || TCPFileUnsent())
 	{
 		// Send the TCP segment with all unacked bytes
 		SendTCP(ACK, SENDTCP_RESET_TIMERS);
@@ -875,6 +934,10 @@ WORD TCPIsPutReady(TCP_SOCKET hTCP)
 	if(!( (i == TCP_ESTABLISHED) || (i == TCP_CLOSE_WAIT) ))
 		return 0;
 
+	// Nothing may be queued behind TCPSendFile() data until it is all ACKed
+	if(MyTCBStub.Flags.bTXFile)
+		return 0;
+
 	// Calculate the free space in this socket's TX FIFO
 	#if defined(STACK_USE_SSL)
 	if(MyTCBStub.sslStubID != SSL_INVALID_ID)
@@ -1153,6 +1216,91 @@ WORD TCPGetTxFIFOFull(TCP_SOCKET hTCP)
 	return wFIFOSize - wDataLen;
 }
 
+#if defined(STACK_USE_MPFS2)
+/*****************************************************************************
+  Function:
+	DWORD TCPSendFile(TCP_SOCKET hTCP, MPFS_HANDLE hMPFS, DWORD dwLen)
+
+  Summary:
+	Queues MPFS file data for transmission without copying it into the 
+	TCP TX FIFO.
+
+  Description:
+	This function queues up to dwLen bytes, starting at the current 
+	position of hMPFS, to be sent after any data already in the TX FIFO.  
+	Nothing is copied when this function is called.  Instead, each 
+	segment is read from MPFS directly into the outgoing frame at 
+	transmit time, and retransmissions read the same bytes again from 
+	MPFS by file offset.  On return, hMPFS has been advanced past the 
+	queued bytes as if they had been read.
+
+  Precondition:
+	TCP is initialized and hMPFS is an open file.
+
+  Parameters:
+	hTCP - The socket to which data is to be written.
+	hMPFS - The file to send data from.
+	dwLen - Maximum number of bytes to send.
+
+  Returns:
+	The number of bytes queued.  Zero is returned if the socket is not 
+	connected, is secured by SSL, or still has earlier file data that has 
+	not been acknowledged.
+
+  Remarks:
+	Only one file transfer can be outstanding per socket.  Until every 
+	queued byte has been acknowledged, TCPIsPutReady() returns zero and 
+	no more data can be written to the socket.  TCPDisconnect() may be 
+	called right away; the FIN is sent after the last byte of file data.
+	
+	hMPFS may be closed once this function returns.  If the image holding 
+	the file is overwritten before the transfer completes, the rest of the 
+	file can't be sent and the connection is reset.
+  ***************************************************************************/
+DWORD TCPSendFile(TCP_SOCKET hTCP, MPFS_HANDLE hMPFS, DWORD dwLen)
+{
+	DWORD dwRem;
+	BYTE i;
+
+	SyncTCBStub(hTCP);
+
+	i = MyTCBStub.smState;
+
+	// Unconnected sockets shouldn't be transmitting anything.
+	if(!( (i == TCP_ESTABLISHED) || (i == TCP_CLOSE_WAIT) ))
+		return 0;
+
+	if(MyTCBStub.Flags.bTXFile)
+		return 0;
+
+	#if defined(STACK_USE_SSL)
+	// SSL records must be encrypted, so they have to go through the FIFO
+	if(MyTCBStub.sslStubID != SSL_INVALID_ID)
+		return 0;
+	#endif
+
+	dwRem = MPFSGetBytesRem(hMPFS);
+	if(dwLen > dwRem)
+		dwLen = dwRem;
+	if(dwLen == 0u)
+		return 0;
+
+	SyncTCB();
+	MyTCB.txFile.wFatID = MPFSGetID(hMPFS);
+	MyTCB.txFile.dwStart = MPFSGetPosition(hMPFS);
+	MyTCB.txFile.dwLen = dwLen;
+	MyTCB.txFile.dwSent = 0;
+	MyTCB.txFile.dwAcked = 0;
+	MyTCBStub.Flags.bTXFile = 1;
+	MPFSSeek(hMPFS, dwLen, MPFS_SEEK_FORWARD);
+
+	// Start transmitting on the next TCPTick()
+	MyTCBStub.Flags.bTXASAP = 1;
+
+	return dwLen;
+}
+#endif
+
 
 
 /****************************************************************************
@@ -1346,6 +1494,150 @@ WORD TCPGetArray(TCP_SOCKET hTCP, BYTE* buffer, WORD len)
 }
 
 
+/*****************************************************************************
+  Function:
+	WORD TCPPeekArray(TCP_SOCKET hTCP, BYTE *vBuffer, WORD wLen, WORD wStart)
+
+  Summary:
+  	Reads a specified number of data bytes from the TCP RX FIFO without 
+  	removing them from the buffer.
+
+  Description:
+	Reads a specified number of data bytes from the TCP RX FIFO without 
+  	removing them from the buffer.  No TCP control actions are taken as a 
+  	result of this function (ex: no window update is sent to the remote 
+  	node).  This lets a caller look at data before deciding how much of 
+  	it to consume with TCPGetArray.
+	
+  Precondition:
+	TCP is initialized.
+
+  Parameters:
+	hTCP - The socket to peek from (read without removing from stream).
+	vBuffer - Destination to write the peeked data bytes.
+	wLen - Length of bytes to peek from the RX FIFO and copy to vBuffer.
+	wStart - Zero-indexed starting position within the FIFO to start peeking 
+		from.
+
+  Return Values:
+	Number of bytes actually peeked from the stream and copied to vBuffer.  
+	This value can be less than wLen if wStart + wLen is greater than the 
+	deepest possible character in the RX FIFO.
+  ***************************************************************************/
+WORD TCPPeekArray(TCP_SOCKET hTCP, BYTE *vBuffer, WORD wLen, WORD wStart)
+{
+	PTR_BASE ptrRead;
+	WORD w;
+	WORD wBytesUntilWrap;
+
+	if(wLen == 0u)
+		return 0u;
+
+	// Decrease the read length if wStart + wLen is beyond the data 
+	// in the RX FIFO
+	w = TCPIsGetReady(hTCP);
+	if(wStart >= w)
+		return 0u;
+	if(wLen > w - wStart)
+		wLen = w - wStart;
+
+	SyncTCBStub(hTCP);
+
+	// Find the read start location
+	ptrRead = MyTCBStub.rxTail + wStart;
+	if(ptrRead > MyTCBStub.bufferEnd)
+		ptrRead -= MyTCBStub.bufferEnd - MyTCBStub.bufferRxStart + 1;
+
+	// Calculate how many bytes can be read in a single go
+	wBytesUntilWrap = MyTCBStub.bufferEnd - ptrRead + 1;
+	if(wLen <= wBytesUntilWrap)
+	{
+		// Read all at once
+		TCPRAMCopy((PTR_BASE)vBuffer, TCP_PIC_RAM, ptrRead, MyTCBStub.vMemoryMedium, wLen);
+	}
+	else
+	{
+		// Read all bytes up to the wrap position and then read remaining bytes 
+		// at the start of the buffer
+		TCPRAMCopy((PTR_BASE)vBuffer, TCP_PIC_RAM, ptrRead, MyTCBStub.vMemoryMedium, wBytesUntilWrap);
+		TCPRAMCopy((PTR_BASE)vBuffer+wBytesUntilWrap, TCP_PIC_RAM, MyTCBStub.bufferRxStart, MyTCBStub.vMemoryMedium, wLen - wBytesUntilWrap);
+	}
+
+	return wLen;
+}
+
+
+/*****************************************************************************
+  Function:
+	WORD TCPPeekTxArray(TCP_SOCKET hTCP, BYTE *vBuffer, WORD wLen)
+
+  Summary:
+  	Reads back the most recently written bytes of the TCP TX FIFO.
+
+  Description:
+	Copies the last wLen bytes placed in the TX FIFO by TCPPut and its 
+	relatives into vBuffer, oldest first.  The data is left in the FIFO 
+	to be sent as usual.  This lets a caller capture output it has just 
+	generated without buffering it twice.
+	
+  Precondition:
+	TCP is initialized.
+
+  Parameters:
+	hTCP - The socket to read back from.
+	vBuffer - Destination to write the bytes to.
+	wLen - Number of bytes to read, counting back from the end of the 
+		written data.
+
+  Return Values:
+	Number of bytes copied to vBuffer.  This is 0 if fewer than wLen bytes 
+	are still in the TX FIFO, or if the socket is using SSL, since its 
+	FIFO then holds encrypted records.
+  ***************************************************************************/
+WORD TCPPeekTxArray(TCP_SOCKET hTCP, BYTE *vBuffer, WORD wLen)
+{
+	PTR_BASE ptrRead;
+	WORD wBytesUntilWrap;
+
+	if(wLen == 0u)
+		return 0u;
+
+	SyncTCBStub(hTCP);
+
+	#if defined(STACK_USE_SSL)
+	if(MyTCBStub.sslStubID != SSL_INVALID_ID)
+		return 0u;
+	#endif
+
+	// Make sure all of the requested bytes are still waiting to be ACKed
+	if(MyTCBStub.txHead >= MyTCBStub.txTail)
+		wBytesUntilWrap = MyTCBStub.txHead - MyTCBStub.txTail;
+	else
+		wBytesUntilWrap = (MyTCBStub.bufferRxStart - MyTCBStub.txTail) + (MyTCBStub.txHead - MyTCBStub.bufferTxStart);
+	if(wLen > wBytesUntilWrap)
+		return 0u;
+
+	// Find the read start location
+	if(MyTCBStub.txHead - MyTCBStub.bufferTxStart >= wLen)
+	{
+		// Read all at once
+		ptrRead = MyTCBStub.txHead - wLen;
+		TCPRAMCopy((PTR_BASE)vBuffer, TCP_PIC_RAM, ptrRead, MyTCBStub.vMemoryMedium, wLen);
+	}
+	else
+	{
+		// Read the bytes before the wrap position from the end of the 
+		// buffer, then the rest from its start
+		wBytesUntilWrap = wLen - (MyTCBStub.txHead - MyTCBStub.bufferTxStart);
+		ptrRead = MyTCBStub.bufferRxStart - wBytesUntilWrap;
+		TCPRAMCopy((PTR_BASE)vBuffer, TCP_PIC_RAM, ptrRead, MyTCBStub.vMemoryMedium, wBytesUntilWrap);
+		TCPRAMCopy((PTR_BASE)vBuffer+wBytesUntilWrap, TCP_PIC_RAM, MyTCBStub.bufferTxStart, MyTCBStub.vMemoryMedium, wLen - wBytesUntilWrap);
+	}
+
+	return wLen;
+}
+
+
 /*****************************************************************************
   Function:
 	WORD TCPGetRxFIFOFree(TCP_SOCKET hTCP)
@@ -1425,6 +1717,12 @@ WORD TCPGetRxFIFOFree(TCP_SOCKET hTCP)
 	For example, if the buffer contains "I love PIC MCUs!" and the search
 	array is "love" with a length of 4, a value of 2 will be returned.
 
+	Arrays of more than one byte are found with the Boyer-Moore-Horspool 
+	algorithm: the last byte under the array decides how far it can 
+	slide, so most of the buffer is skipped over rather than compared.  
+	The FIFO is read in place, following its wrap around the end of the 
+	buffer.
+
   Precondition:
 	TCP is initialized.
 
@@ -1441,140 +1739,125 @@ WORD TCPGetRxFIFOFree(TCP_SOCKET hTCP)
 	Otherwise - Zero-indexed position of the first occurrance
 
   Remarks:
-	Since this function usually must transfer data from external storage
-	to internal RAM for comparison, its performance degrades significantly
-	when the buffer is full and the array is not found.  For better 
-	performance, try to search for characters that are expected to exist or
-	limit the scope of the search as much as possible.  The HTTP2 module, 
-	for example, uses this function to parse headers.  However, it searches 
-	for newlines, then the separating colon, then reads the header name to 
-	RAM for final comparison.  This has proven to be significantly faster  
-	than searching for full header name strings outright.
+	When the array is not found, no match starts before 
+	TCPIsGetReady() - wLen + 1, or before wStart + wSearchLen - wLen + 1 
+	if the search was limited.  Callers waiting for an array to arrive 
+	can save this position and pass it as wStart once more data is 
+	received, so that the data already searched isn't searched again and 
+	the total work stays proportional to the data received.  Data must 
+	not be read from the socket in the meantime, or the saved position 
+	must be reduced by the amount read.
   ***************************************************************************/
 WORD TCPFindArrayEx(TCP_SOCKET hTCP, BYTE* cFindArray, WORD wLen, WORD wStart, WORD wSearchLen, BOOL bTextCompare)
 {
-	PTR_BASE ptrRead;
+	// Distance from each byte's last occurrence in the search array, 
+	// excluding its final byte, to the end of the array.  Shared by all 
+	// sockets since a search runs to completion.
+	static BYTE skip[256];
 	WORD wDataLen;
-	WORD wBytesUntilWrap;
-	PTR_BASE ptrLocation;
-	WORD wLenStart;
-	BYTE *cFindArrayStart;
-	BYTE i, j, k;
-	BOOL isFinding;
-	BYTE buffer[32];
+	WORD wPos, i;
+	BYTE cLast, c;
 
 	if(wLen == 0u)
 		return 0u;
 
-	SyncTCBStub(hTCP);
-
 	// Find out how many bytes are in the RX FIFO and return 
 	// immediately if we won't possibly find a match
-	wDataLen = TCPIsGetReady(hTCP) - wStart;
-	if(wDataLen < wLen)
+	wDataLen = TCPIsGetReady(hTCP);
+	if(wStart > wDataLen)
 		return 0xFFFFu;
+	wDataLen -= wStart;
 	if(wSearchLen && wDataLen > wSearchLen)
 		wDataLen = wSearchLen;
+	if(wDataLen < wLen)
+		return 0xFFFFu;
 
-	ptrLocation = MyTCBStub.rxTail + wStart;
-	if(ptrLocation > MyTCBStub.bufferEnd)
-		ptrLocation -= MyTCBStub.bufferEnd - MyTCBStub.bufferRxStart + 1;
-	ptrRead = ptrLocation;
-	wBytesUntilWrap = MyTCBStub.bufferEnd - ptrLocation + 1;
-	ptrLocation = wStart;
-	wLenStart = wLen;
-	cFindArrayStart = cFindArray;
-	j = *cFindArray++;
-	isFinding = FALSE;
-	if(bTextCompare)
-	{
-		if(j >= 'a' && j <= 'z')
-			j += 'A'-'a';
-	}
+	SyncTCBStub(hTCP);
 
-	// Search for the array
-	while(1)
+	cLast = TCPFoldCase(cFindArray[wLen-1], bTextCompare);
+	
+	// Short arrays like "\r\n" can't skip far enough to repay building 
+	// the table, so just step through the data one byte at a time
+	if(wLen < 4u)
 	{
-		// Figure out how big of a chunk to read
-		k = sizeof(buffer);
-		if(k > wBytesUntilWrap)
-			k = wBytesUntilWrap;
-		if((WORD)k > wDataLen)
-			k = wDataLen;
-
-		// Read a chunk of data into the buffer
-		TCPRAMCopy((PTR_BASE)buffer, TCP_PIC_RAM, ptrRead, MyTCBStub.vMemoryMedium, (WORD)k);
-		ptrRead += k;
-		wBytesUntilWrap -= k;
-
-		if(wBytesUntilWrap == 0u)
-		{
-			ptrRead = MyTCBStub.bufferRxStart;
-			wBytesUntilWrap = 0xFFFFu;
-		}
-
-		// Convert everything to uppercase
-		if(bTextCompare)
+		for(wPos = wStart; wPos <= wStart + wDataLen - wLen; wPos++)
 		{
-			for(i = 0; i < k; i++)
+			if(TCPFoldCase(TCPRxByte(wPos + wLen - 1), bTextCompare) != cLast)
+				continue;
+			for(i = wLen - 1; i != 0u; i--)
 			{
-				if(buffer[i] >= 'a' && buffer[i] <= 'z')
-					buffer[i] += 'A'-'a';
-
-				if(j == buffer[i])
-				{
-					if(--wLen == 0u)
-						return ptrLocation-wLenStart + i + 1;
-					j = *cFindArray++;
-					isFinding = TRUE;
-					if(j >= 'a' && j <= 'z')
-						j += 'A'-'a';
-				}
-				else
-				{
-					wLen = wLenStart;
-					if(isFinding)
-					{
-						cFindArray = cFindArrayStart;
-						j = *cFindArray++;
-						if(j >= 'a' && j <= 'z')
-							j += 'A'-'a';
-						isFinding = FALSE;
-					}
-				}
+				if(TCPFoldCase(TCPRxByte(wPos + i - 1), bTextCompare) != TCPFoldCase(cFindArray[i-1], bTextCompare))
+					break;
 			}
+			if(i == 0u)
+				return wPos;
 		}
-		else	// Compare as is
+		return 0xFFFFu;
+	}
+
+	// Build the skip table.  Bytes that don't occur in the array let it 
+	// slide its whole length.
+	memset(skip, wLen > 255u ? 255u : wLen, sizeof(skip));
+	for(i = 0; i < wLen - 1; i++)
+	{
+		c = TCPFoldCase(cFindArray[i], bTextCompare);
+		skip[c] = ((WORD)(wLen - 1 - i) > 255u) ? 255u : (BYTE)(wLen - 1 - i);
+	}
+
+	// Slide the array along the data, checking its last byte first
+	for(wPos = wStart; wPos <= wStart + wDataLen - wLen; wPos += skip[c])
+	{
+		c = TCPFoldCase(TCPRxByte(wPos + wLen - 1), bTextCompare);
+		if(c != cLast)
+			continue;
+
+		for(i = wLen - 1; i != 0u; i--)
 		{
-			for(i = 0; i < k; i++)
-			{
-				if(j == buffer[i])
-				{
-					if(--wLen == 0)
-						return ptrLocation-wLenStart + i + 1;
-					j = *cFindArray++;
-					isFinding = TRUE;
-				}
-				else
-				{
-					wLen = wLenStart;
-					if(isFinding)
-					{
-						cFindArray = cFindArrayStart;
-						j = *cFindArray++;
-						isFinding = FALSE;
-					}
-				}
-			}
+			if(TCPFoldCase(TCPRxByte(wPos + i - 1), bTextCompare) != TCPFoldCase(cFindArray[i-1], bTextCompare))
+				break;
 		}
+		if(i == 0u)
+			return wPos;
+	}
+
+	return 0xFFFFu;
+}
+
+/*****************************************************************************
+  Function:
+	static BYTE TCPRxByte(WORD wOffset)
 
-		// Check to see if it is impossible to find a match
-		wDataLen -= k;
-		if(wDataLen < wLen)
-			return 0xFFFFu;
+  Summary:
+  	Reads a byte from the current socket's RX FIFO without removing it.
 
-		ptrLocation += k;
-	}
+  Description:
+	Returns the byte wOffset bytes after the front of the RX FIFO of 
+	MyTCBStub, following the wrap around the end of the buffer.
+
+  Precondition:
+	SyncTCBStub has been called, and wOffset is less than 
+	TCPIsGetReady().
+
+  Parameters:
+	wOffset - Zero-indexed position within the RX FIFO.
+
+  Returns:
+	The byte at that position.
+  ***************************************************************************/
+static BYTE TCPRxByte(WORD wOffset)
+{
+	PTR_BASE ptrRead;
+	BYTE c;
+
+	ptrRead = MyTCBStub.rxTail + wOffset;
+	if(ptrRead > MyTCBStub.bufferEnd)
+		ptrRead -= MyTCBStub.bufferEnd - MyTCBStub.bufferRxStart + 1;
+
+	if(MyTCBStub.vMemoryMedium == TCP_PIC_RAM)
+		return *(BYTE*)ptrRead;
+
+	TCPRAMCopy((PTR_BASE)&c, TCP_PIC_RAM, ptrRead, MyTCBStub.vMemoryMedium, 1);
+	return c;
 }
 
 /*****************************************************************************
@@ -1684,6 +1967,21 @@ void TCPTick(void)
 		}
 		#endif
 		
+		#if defined(STACK_USE_MPFS2)
+		// Reset connections whose file was in an image that has since been 
+		// overwritten, since its remaining bytes can never be sent
+		if(MyTCBStub.Flags.bTXFile)
+		{
+			SyncTCB();
+			if(!MPFSIsFileID(MyTCB.txFile.wFatID))
+			{
+				SendTCP(RST | ACK, 0);
+				CloseSocket();
+				continue;
+			}
+		}
+		#endif
+		
 		vFlags = 0x00;
 		bRetransmit = FALSE;
 		bCloseSocket = FALSE;
@@ -2039,6 +2337,10 @@ void TCPTick(void)
 				if(MyTCB.txUnackedTail < MyTCBStub.txTail)
 					MyTCB.MySEQ -= (LONG)(SHORT)(MyTCBStub.bufferRxStart - MyTCBStub.bufferTxStart);
 				MyTCB.txUnackedTail = MyTCBStub.txTail;		
+				#if defined(STACK_USE_MPFS2)
+				MyTCB.MySEQ -= TCPFileInFlight();
+				MyTCB.txFile.dwSent = MyTCB.txFile.dwAcked;
+				#endif
 				SendTCP(vFlags, 0);
 			}
 			else
@@ -2343,6 +2645,12 @@ static void SendTCP(BYTE vTCPFlags, BYTE vSendFlags)
 			if(MyTCB.txUnackedTail >= MyTCBStub.bufferRxStart)
 				MyTCB.txUnackedTail -= MyTCBStub.bufferRxStart-MyTCBStub.bufferTxStart;
 		}
+
+		#if defined(STACK_USE_MPFS2)
+		// File data queued by TCPSendFile() follows everything in the FIFO
+		if((MyTCBStub.txHead == MyTCB.txUnackedTail) && TCPFileUnsent())
+			len += PutTCPFileData(len, &vTCPFlags);
+		#endif
 	}
 
 	// Ensure that all packets with data of some kind are 
@@ -2498,6 +2806,95 @@ static void SendTCP(BYTE vTCPFlags, BYTE vSendFlags)
 	MACFlush();
 }
 
+#if defined(STACK_USE_MPFS2)
+/*****************************************************************************
+  Function:
+	static WORD PutTCPFileData(WORD wOffset, BYTE* vTCPFlags)
+
+  Summary:
+	Reads TCPSendFile() data from MPFS into the segment being assembled.
+
+  Description:
+	Appends as much unsent file data as the segment size and remote window 
+	allow, reading it from MPFS directly into the MAC TX buffer after 
+	wOffset bytes of FIFO data.  The file is located by FAT ID and offset, 
+	so retransmissions simply read the same bytes again.
+
+  Precondition:
+	Called from SendTCP() with MyTCB loaded, all FIFO data sent, and file 
+	data left to send.
+
+  Parameters:
+	wOffset - Number of payload bytes already in this segment
+	vTCPFlags - TCP flags for this segment.  FIN is removed, or added once 
+		the last file byte fits with room to spare in the window.
+
+  Returns:
+	Number of payload bytes added to the segment
+  ***************************************************************************/
+static WORD PutTCPFileData(WORD wOffset, BYTE* vTCPFlags)
+{
+	DWORD dwInFlight;
+	WORD wMax;
+	WORD wLen;
+	MPFS_HANDLE hFile;
+
+	// The FIN can only follow the last byte of file data
+	*vTCPFlags &= ~FIN;
+
+	// Everything sent but not yet ACKed counts against the remote window
+	if(MyTCB.txUnackedTail >= MyTCBStub.txTail)
+		dwInFlight = MyTCB.txUnackedTail - MyTCBStub.txTail;
+	else
+		dwInFlight = (MyTCBStub.bufferRxStart - MyTCBStub.bufferTxStart) - (MyTCBStub.txTail - MyTCB.txUnackedTail);
+	dwInFlight += TCPFileInFlight();
+
+	wMax = 0;
+	if(dwInFlight < (DWORD)MyTCB.remoteWindow)
+		wMax = MyTCB.remoteWindow - (WORD)dwInFlight;
+	if(wMax > TCP_MAX_SEG_SIZE - wOffset)
+		wMax = TCP_MAX_SEG_SIZE - wOffset;
+
+	wLen = wMax;
+	if((DWORD)wLen > TCPFileUnsent())
+		wLen = (WORD)TCPFileUnsent();
+
+	if(wLen)
+	{
+		hFile = MPFSOpenID(MyTCB.txFile.wFatID);
+		if(hFile == MPFS_INVALID_HANDLE)
+		{
+			// No free MPFS handle right now, so try again on the next tick.  
+			// If the file is gone instead, TCPTick() resets the connection.
+			MyTCBStub.Flags.bTXASAPWithoutTimerReset = 1;
+			return 0;
+		}
+
+		MPFSSeek(hFile, MyTCB.txFile.dwStart + MyTCB.txFile.dwSent, MPFS_SEEK_START);
+		wLen = MPFSGetArray(hFile, MACGetTxFrame() + BASE_TX_ADDR + sizeof(ETHER_HEADER) + sizeof(IP_HEADER) + sizeof(TCP_HEADER) + wOffset, wLen);
+		MPFSClose(hFile);
+		MyTCB.txFile.dwSent += wLen;
+	}
+
+	if(TCPFileUnsent())
+	{
+		// Only the segment size held us back, so keep going right away
+		if(wLen == TCP_MAX_SEG_SIZE - wOffset)
+			MyTCBStub.Flags.bTXASAPWithoutTimerReset = 1;
+	}
+	else if(MyTCBStub.Flags.bTXFIN)
+	{
+		// Send the FIN now if there is room, otherwise in its own segment
+		if(wLen != wMax)
+			*vTCPFlags |= FIN;
+		else
+			MyTCBStub.Flags.bTXASAPWithoutTimerReset = 1;
+	}
+
+	return wLen;
+}
+#endif
+
 /*****************************************************************************
   Function:
 	static BOOL FindMatchingSocket(TCP_HEADER* h, NODE_INFO* remote)
@@ -2756,7 +3153,9 @@ static void CloseSocket(void)
 	MyTCBStub.Flags.bTXASAP = 0;
 	MyTCBStub.Flags.bTXASAPWithoutTimerReset = 0;
 	MyTCBStub.Flags.bTXFIN = 0;
+	MyTCBStub.Flags.bTXFile = 0;
 	MyTCBStub.Flags.bSocketReset = 1;
+	MyTCBStub.Flags.bActivity = 1;
 
 	#if defined(STACK_USE_SSL)
 	// If SSL is active, then we need to close it
@@ -2789,6 +3188,15 @@ static void CloseSocket(void)
 	((DWORD_VAL*)(&MyTCB.MySEQ))->w[1] = rand();
 	MyTCB.sHoleSize = -1;
 	MyTCB.remoteWindow = 1;
+	#if defined(STACK_USE_MPFS2)
+	memset((void*)&MyTCB.txFile, 0x00, sizeof(MyTCB.txFile));
+	#endif
+
+	// Client sockets give up their local port when closed
+	#if defined(STACK_USE_RX_FILTER)
+	if(!MyTCBStub.Flags.bServer)
+		RxFilterInvalidate();
+	#endif
 }
 
 
@@ -2829,6 +3237,7 @@ static void HandleTCPSeg(TCP_HEADER* h, WORD len)
 	DWORD localSeqNumber;
 	WORD wSegmentLength;
 	BOOL bSegmentAcceptable;
+	DWORD dwFileACK;
 
 	// Cache a few variables in local RAM.  
 	// PIC18s take a fair amount of code and execution time to 
@@ -2837,6 +3246,10 @@ static void HandleTCPSeg(TCP_HEADER* h, WORD len)
 	localAckNumber = h->AckNumber;
 	localSeqNumber = h->SeqNumber;
 
+	// Let the application know there may be new data, free TX space, 
+	// or a state change to act on
+	MyTCBStub.Flags.bActivity = 1;
+
 	// We received a packet, reset the keep alive timer and count
 	#if defined(TCP_KEEP_ALIVE_TIMEOUT)
 		MyTCBStub.Flags.vUnackedKeepalives = 0;
@@ -3060,7 +3473,7 @@ static void HandleTCPSeg(TCP_HEADER* h, WORD len)
 			wTemp = MyTCBStub.txHead - MyTCB.txUnackedTail;
 			if((SHORT)wTemp < (SHORT)0)
 				wTemp += MyTCBStub.bufferRxStart - MyTCBStub.bufferTxStart;
-			dwTemp = MyTCB.MySEQ + (DWORD)wTemp;
+			dwTemp = MyTCB.MySEQ + (DWORD)wTemp + TCPFileUnsent();
 
 			// Drop the packet if it ACKs something we haven't sent
 			if((LONG)(dwTemp - localAckNumber) < (LONG)0)
@@ -3074,9 +3487,50 @@ static void HandleTCPSeg(TCP_HEADER* h, WORD len)
 			dwTemp = MyTCB.MySEQ - (LONG)(SHORT)(MyTCB.txUnackedTail - MyTCBStub.txTail);
 			if(MyTCB.txUnackedTail < MyTCBStub.txTail)
 				dwTemp -= MyTCBStub.bufferRxStart - MyTCBStub.bufferTxStart;
+			dwTemp -= TCPFileInFlight();
 	
 			// Calcluate how many bytes were ACKed with this packet
 			dwTemp = localAckNumber - dwTemp;
+
+			dwFileACK = 0;
+			#if defined(STACK_USE_MPFS2)
+			// Anything ACKed beyond the FIFO contents is TCPSendFile() data
+			if(MyTCBStub.Flags.bTXFile && ((LONG)(dwTemp) > (LONG)0))
+			{
+				wTemp = MyTCBStub.txHead - MyTCBStub.txTail;
+				if((SHORT)wTemp < (SHORT)0)
+					wTemp += MyTCBStub.bufferRxStart - MyTCBStub.bufferTxStart;
+				if(dwTemp > (DWORD)wTemp)
+				{
+					dwFileACK = dwTemp - (DWORD)wTemp;
+					dwTemp = wTemp;
+
+					MyTCB.flags.bRXNoneACKed1 = 0;
+					MyTCB.flags.bRXNoneACKed2 = 0;
+					MyTCB.txFile.dwAcked += dwFileACK;
+					
+					// An ACK past a rolled back send position skips ahead
+					if(MyTCB.txFile.dwSent < MyTCB.txFile.dwAcked)
+					{
+						MyTCB.MySEQ += MyTCB.txFile.dwAcked - MyTCB.txFile.dwSent;
+						MyTCB.txFile.dwSent = MyTCB.txFile.dwAcked;
+					}
+
+					if(MyTCB.txFile.dwAcked == MyTCB.txFile.dwLen)
+					{
+						// All file data delivered, the FIFO may be used again
+						memset((void*)&MyTCB.txFile, 0x00, sizeof(MyTCB.txFile));
+						MyTCBStub.Flags.bTXFile = 0;
+					}
+					else if(TCPFileUnsent())
+					{
+						// The window has moved, so keep the file flowing
+						MyTCBStub.Flags.bTXASAP = 1;
+					}
+				}
+			}
+			#endif
+
 			if(((LONG)(dwTemp) > (LONG)0) && (dwTemp <= MyTCBStub.bufferRxStart - MyTCBStub.bufferTxStart))
 			{
 				MyTCB.flags.bRXNoneACKed1 = 0;
@@ -3108,10 +3562,10 @@ static void HandleTCPSeg(TCP_HEADER* h, WORD len)
 				if(MyTCB.txUnackedTail >= MyTCBStub.bufferRxStart)
 					MyTCB.txUnackedTail -= MyTCBStub.bufferRxStart - MyTCBStub.bufferTxStart;
 			}
-			else
+			else if(dwFileACK == 0u)
 			{
 				// See if we have outstanding TX data that is waiting for an ACK
-				if(MyTCBStub.txTail != MyTCB.txUnackedTail)
+				if((MyTCBStub.txTail != MyTCB.txUnackedTail) || TCPFileInFlight())
 				{
 					if(MyTCB.flags.bRXNoneACKed1)
 					{
@@ -3123,6 +3577,10 @@ static void HandleTCPSeg(TCP_HEADER* h, WORD len)
 							if(MyTCB.txUnackedTail < MyTCBStub.txTail)
 								MyTCB.MySEQ -= (LONG)(SHORT)(MyTCBStub.bufferRxStart - MyTCBStub.bufferTxStart);
 							MyTCB.txUnackedTail = MyTCBStub.txTail;
+							#if defined(STACK_USE_MPFS2)
+							MyTCB.MySEQ -= TCPFileInFlight();
+							MyTCB.txFile.dwSent = MyTCB.txFile.dwAcked;
+							#endif
 							MyTCBStub.Flags.bTXASAPWithoutTimerReset = 1;
 						}
 						MyTCB.flags.bRXNoneACKed2 = 1;
@@ -3132,7 +3590,7 @@ static void HandleTCPSeg(TCP_HEADER* h, WORD len)
 			}
 
 			// No need to keep our retransmit timer going if we have nothing that needs ACKing anymore
-			if(MyTCBStub.txTail == MyTCBStub.txHead)
+			if((MyTCBStub.txTail == MyTCBStub.txHead) && !MyTCBStub.Flags.bTXFile)
 			{
 				// Make sure there isn't a "FIN byte in our TX FIFO"
 				if(MyTCBStub.Flags.bTXFIN == 0)
@@ -3162,7 +3620,7 @@ static void HandleTCPSeg(TCP_HEADER* h, WORD len)
 			if(MyTCBStub.smState == TCP_FIN_WAIT_1)
 			{
 				// Check to see if our FIN has been ACKnowledged
-				if(MyTCB.MySEQ == localAckNumber)
+				if((MyTCB.MySEQ == localAckNumber) && !MyTCBStub.Flags.bTXFile)
 				{
 					// Reset our timer for forced closure if the remote node 
 					// doesn't send us a FIN in a timely manner.
@@ -3483,6 +3941,50 @@ static void HandleTCPSeg(TCP_HEADER* h, WORD len)
 	}
 }
 
+/*****************************************************************************
+  Function:
+	void TCPAddRxFilterPorts(void)
+
+  Summary:
+	Adds the local port of every active TCP socket to the RX filter.
+
+  Description:
+	This function is called by the RX filter module whenever it rebuilds 
+	its port tables.  Listening, connecting, and connected sockets all 
+	contribute their local port (and SSL port, when one is assigned).
+
+  Precondition:
+	TCP is initialized.
+
+  Parameters:
+	None
+
+  Returns:
+	None
+  ***************************************************************************/
+#if defined(STACK_USE_RX_FILTER)
+void TCPAddRxFilterPorts(void)
+{
+	TCP_SOCKET hTCP;
+
+	for(hTCP = 0; hTCP < TCP_SOCKET_COUNT; hTCP++)
+	{
+		SyncTCBStub(hTCP);
+		if(MyTCBStub.smState == TCP_CLOSED)
+			continue;
+
+		SyncTCB();
+		RxFilterAddPort(IP_PROT_TCP, MyTCB.localPort.Val);
+
+		#if defined(STACK_USE_SSL_SERVER)
+		if(MyTCB.localSSLPort.Val)
+			RxFilterAddPort(IP_PROT_TCP, MyTCB.localSSLPort.Val);
+		#endif
+	}
+}
+#endif
+
+
 /****************************************************************************
   Section:
 	Buffer Management Functions
@@ -3915,6 +4417,10 @@ BOOL TCPAddSSLListener(TCP_SOCKET hTCP, WORD port)
 	MyTCB.localSSLPort.Val = port;
 	MyTCBStub.sslTxHead = port;
 
+	#if defined(STACK_USE_RX_FILTER)
+	RxFilterInvalidate();
+	#endif
+
 	return TRUE;
 }
 #endif // SSL Server
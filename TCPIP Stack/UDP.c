@@ -101,6 +101,16 @@
 // Last port number for randomized local port number selection
 #define LOCAL_UDP_PORT_END_NUMBER   (8192u)
 
+// Number of datagrams that can be under construction or waiting for a 
+// free MAC TX descriptor at the same time.  Each one costs 
+// UDP_MAX_PAYLOAD + 40 bytes of RAM.
+#if !defined(UDP_TX_STAGING_BUFFERS)
+	#define UDP_TX_STAGING_BUFFERS	(2u)
+#endif
+
+// Largest UDP payload that fits in a single Ethernet frame
+#define UDP_MAX_PAYLOAD		(MAC_TX_BUFFER_SIZE - sizeof(IP_HEADER) - sizeof(UDP_HEADER))
+
 /****************************************************************************
   Section:
 	UDP Global Variables
@@ -118,6 +128,31 @@ static UDP_SOCKET	LastPutSocket = INVALID_UDP_SOCKET;	// Indicates the last sock
 static WORD wPutOffset;		// Offset from beginning of payload where data is to be written.
 static WORD wGetOffset;		// Offset from beginning of payload from where data is to be read.
 
+// Stores a datagram while it is being built by its owning socket and, 
+// once flushed, until a MAC TX descriptor is available to send it.  
+// Sockets build their datagrams independently of each other, so 
+// switching between sockets with UDPIsPutReady() no longer throws 
+// away data written to the previous socket.
+typedef struct
+{
+	UDP_SOCKET	Owner;			// Socket building into this buffer, or INVALID_UDP_SOCKET
+	BYTE		bPending;		// Datagram is complete and queued for transmission
+	WORD		wTxCount;		// Saved UDPTxCount while the owner is not active
+	WORD		wPutOffset;		// Saved wPutOffset while the owner is not active
+	NODE_INFO	remoteNode;		// Destination captured by UDPFlush()
+	BYTE		vData[sizeof(UDP_HEADER) + UDP_MAX_PAYLOAD];	// UDP header followed by payload
+} UDP_TX_STAGE;
+
+static UDP_TX_STAGE UDPTxStage[UDP_TX_STAGING_BUFFERS];
+
+// Staging buffer of the currently active TX socket, or NULL
+static UDP_TX_STAGE *activeTxStage;
+
+// FIFO of flushed staging buffers in the order they must be transmitted
+static BYTE TxQueue[UDP_TX_STAGING_BUFFERS];
+static BYTE TxQueueHead;
+static BYTE TxQueueCount;
+
 // Stores various flags for the UDP module
 static struct
 {
@@ -135,6 +170,8 @@ static UDP_SOCKET SocketWithRxData = INVALID_UDP_SOCKET;
 
 static UDP_SOCKET FindMatchingSocket(UDP_HEADER *h, NODE_INFO *remoteNode,
                                     IP_ADDR *localIP);
+static void SaveActiveTxStage(void);
+static void TransmitPending(void);
 
 /****************************************************************************
   Section:
@@ -167,9 +204,23 @@ static UDP_SOCKET FindMatchingSocket(UDP_HEADER *h, NODE_INFO *remoteNode,
 void UDPInit(void)
 {
     UDP_SOCKET s;
+    BYTE i;
+
+	for(i = 0; i < UDP_TX_STAGING_BUFFERS; i++)
+	{
+		UDPTxStage[i].Owner = INVALID_UDP_SOCKET;
+		UDPTxStage[i].bPending = 0;
+	}
+	activeTxStage = NULL;
+	LastPutSocket = INVALID_UDP_SOCKET;
+	TxQueueHead = 0;
+	TxQueueCount = 0;
 
     for ( s = 0; s < MAX_UDP_SOCKETS; s++ )
     {
+		#if defined(STACK_USE_IGMP)
+		UDPSocketInfo[s].multicastGroup.Val = 0x00000000;
+		#endif
 		UDPClose(s);
     }
 	Flags.bWasDiscarded = 1;
@@ -197,13 +248,13 @@ void UDPInit(void)
   	None
   	
   Remarks:
-	UDPTask() is called once per StackTask() iteration to ensure that calls 
-	to UDPIsPutReady() always update the Ethernet Write pointer location 
-	between StackTask() iterations.
+	UDPTask() is called once per StackTask() iteration to transmit, in a 
+	single pass over the MAC TX descriptors, any datagrams that UDPFlush() 
+	had to queue because no descriptor was free at the time.
   ***************************************************************************/
 void UDPTask(void)
 {
-	LastPutSocket = INVALID_UDP_SOCKET;
+	TransmitPending();
 }
 
 
@@ -284,6 +335,10 @@ UDP_SOCKET UDPOpen(UDP_PORT localPort,
 
             p->remotePort   = remotePort;
 
+			#if defined(STACK_USE_RX_FILTER)
+			RxFilterInvalidate();
+			#endif
+
             // Mark this socket as active.
             // Once an active socket is set, subsequent operation can be
             // done without explicitely supply socket identifier.
@@ -321,14 +376,38 @@ UDP_SOCKET UDPOpen(UDP_PORT localPort,
   	
   Remarks:
 	This function does not affect the previously designated active socket.
+	Any unflushed TX data is discarded, but datagrams already passed to 
+	UDPFlush() are still transmitted.
   ***************************************************************************/
 void UDPClose(UDP_SOCKET s)
 {
+	BYTE i;
+
 	if(s == INVALID_UDP_SOCKET)
 		return;
 
+	#if defined(STACK_USE_IGMP)
+	UDPLeaveGroup(s);
+	#endif
+
 	UDPSocketInfo[s].localPort = INVALID_UDP_PORT;
 	UDPSocketInfo[s].remoteNode.IPAddr.Val = 0x00000000;
+
+	#if defined(STACK_USE_RX_FILTER)
+	RxFilterInvalidate();
+	#endif
+
+	// Release any partially built datagram
+	for(i = 0; i < UDP_TX_STAGING_BUFFERS; i++)
+	{
+		if(UDPTxStage[i].Owner == s && !UDPTxStage[i].bPending)
+			UDPTxStage[i].Owner = INVALID_UDP_SOCKET;
+	}
+	if(LastPutSocket == s)
+	{
+		LastPutSocket = INVALID_UDP_SOCKET;
+		activeTxStage = NULL;
+	}
 }
 
 
@@ -357,7 +436,6 @@ void UDPClose(UDP_SOCKET s)
   ***************************************************************************/
 void UDPSetTxBuffer(WORD wOffset)
 {
-	IPSetTxBuffer(wOffset+sizeof(UDP_HEADER));
 	wPutOffset = wOffset;
 }
 
@@ -418,22 +496,80 @@ void UDPSetRxBuffer(WORD wOffset)
 
   Returns:
   	The number of bytes that can be written to this socket.
+
+  Remarks:
+	Each socket builds its datagram in its own staging buffer, so data 
+	written to a socket is retained when another socket is made active, 
+	as long as a staging buffer is free.  When none is, the buffer of a 
+	datagram that another socket started but has not flushed is taken 
+	over, preferring one that holds no data yet, and that datagram is 
+	lost.  Zero is returned only while every buffer is queued for 
+	transmission, and the queue is drained so that a later call will 
+	succeed.
   ***************************************************************************/
 WORD UDPIsPutReady(UDP_SOCKET s)
 {
-	if(!MACIsTxReady())
-		return 0;
+	UDP_TX_STAGE *stage;
+	UDP_TX_STAGE *freeStage;
+	UDP_TX_STAGE *idleStage;
+	BYTE i;
 
 	if(LastPutSocket != s)
 	{
+		SaveActiveTxStage();
+
+		// Look for a datagram this socket already started, or a free 
+		// staging buffer to start a new one in
+		stage = NULL;
+		freeStage = NULL;
+		idleStage = NULL;
+		for(i = 0; i < UDP_TX_STAGING_BUFFERS; i++)
+		{
+			if(UDPTxStage[i].bPending)
+				continue;
+			if(UDPTxStage[i].Owner == s)
+			{
+				stage = &UDPTxStage[i];
+				break;
+			}
+			if(UDPTxStage[i].Owner == INVALID_UDP_SOCKET)
+			{
+				if(freeStage == NULL)
+					freeStage = &UDPTxStage[i];
+			}
+			else if(idleStage == NULL || UDPTxStage[i].wTxCount == 0u)
+			{
+				idleStage = &UDPTxStage[i];
+			}
+		}
+
+		if(stage == NULL)
+		{
+			// Sockets that call UDPIsPutReady() without ever flushing must 
+			// not starve the others, so take over one of their buffers
+			if(freeStage == NULL)
+				freeStage = idleStage;
+			if(freeStage == NULL)
+			{
+				// Every buffer is queued; make room by draining the queue
+				TransmitPending();
+				return 0;
+			}
+			stage = freeStage;
+			stage->Owner = s;
+			stage->wTxCount = 0;
+			stage->wPutOffset = 0;
+		}
+
+		activeTxStage = stage;
 		LastPutSocket = s;
-		UDPTxCount = 0;
-		UDPSetTxBuffer(0);
+		UDPTxCount = stage->wTxCount;
+		wPutOffset = stage->wPutOffset;
 	}
 
 	activeUDPSocket = s;
 
-	return MAC_TX_BUFFER_SIZE - sizeof(IP_HEADER) - sizeof(UDP_HEADER) - UDPTxCount;
+	return UDP_MAX_PAYLOAD - UDPTxCount;
 }
 
 /*****************************************************************************
@@ -461,13 +597,13 @@ WORD UDPIsPutReady(UDP_SOCKET s)
 BOOL UDPPut(BYTE v)
 {
 	// See if we are out of transmit space.
-	if(wPutOffset >= (MAC_TX_BUFFER_SIZE - sizeof(IP_HEADER) - sizeof(UDP_HEADER)))
+	if(activeTxStage == NULL || wPutOffset >= UDP_MAX_PAYLOAD)
 	{
 		return FALSE;
 	}
 
     // Load application data byte
-    MACPut(v);
+    activeTxStage->vData[sizeof(UDP_HEADER) + wPutOffset] = v;
 	wPutOffset++;
 	if(wPutOffset > UDPTxCount)
 		UDPTxCount = wPutOffset;
@@ -503,17 +639,20 @@ WORD UDPPutArray(BYTE *cData, WORD wDataLen)
 {
 	WORD wTemp;
 
-	wTemp = (MAC_TX_BUFFER_SIZE - sizeof(IP_HEADER) - sizeof(UDP_HEADER)) - wPutOffset;
+	if(activeTxStage == NULL)
+		return 0;
+
+	wTemp = UDP_MAX_PAYLOAD - wPutOffset;
 	if(wTemp < wDataLen)
 		wDataLen = wTemp;
 
+    // Load application data bytes
+    memcpy((void*)&activeTxStage->vData[sizeof(UDP_HEADER) + wPutOffset], (void*)cData, wDataLen);
+
 	wPutOffset += wDataLen;
 	if(wPutOffset > UDPTxCount)
 		UDPTxCount = wPutOffset;
 
-    // Load application data bytes
-    MACPutArray(cData, wDataLen);
-
     return wDataLen;
 }
 
@@ -550,17 +689,20 @@ WORD UDPPutROMArray(ROM BYTE *cData, WORD wDataLen)
 {
 	WORD wTemp;
 
-	wTemp = (MAC_TX_BUFFER_SIZE - sizeof(IP_HEADER) - sizeof(UDP_HEADER)) - wPutOffset;
+	if(activeTxStage == NULL)
+		return 0;
+
+	wTemp = UDP_MAX_PAYLOAD - wPutOffset;
 	if(wTemp < wDataLen)
 		wDataLen = wTemp;
 
+    // Load application data bytes
+    memcpypgm2ram((void*)&activeTxStage->vData[sizeof(UDP_HEADER) + wPutOffset], (ROM void*)cData, wDataLen);
+
 	wPutOffset += wDataLen;
 	if(wPutOffset > UDPTxCount)
 		UDPTxCount = wPutOffset;
 
-    // Load application data bytes
-    MACPutROMArray(cData, wDataLen);
-
     return wDataLen;
 }
 #endif
@@ -659,24 +801,27 @@ ROM BYTE* UDPPutROMString(ROM BYTE *strData)
   ***************************************************************************/
 void UDPFlush(void)
 {
-    UDP_HEADER      h;
+    UDP_HEADER      *h;
     UDP_SOCKET_INFO *p;
-    WORD 			wReadPtrSave;
-    WORD			wChecksum;
     WORD			wUDPLength;
 
+	if(activeTxStage == NULL)
+		return;
+
     p = &UDPSocketInfo[activeUDPSocket];
+    h = (UDP_HEADER*)activeTxStage->vData;
 
 	wUDPLength = UDPTxCount + sizeof(UDP_HEADER);
 
 	// Generate the correct UDP header
-    h.SourcePort        = swaps(p->localPort);
-    h.DestinationPort   = swaps(p->remotePort);
-    h.Length            = swaps(wUDPLength);
-	h.Checksum 			= 0x0000;
+    h->SourcePort        = swaps(p->localPort);
+    h->DestinationPort   = swaps(p->remotePort);
+    h->Length            = swaps(wUDPLength);
+	h->Checksum 		 = 0x0000;
     
-	// Calculate IP pseudoheader checksum if we are going to enable 
-	// the checksum field
+	// Calculate the checksum over the IP pseudoheader, UDP header and 
+	// payload, if enabled.  Seeding the checksum field with the 
+	// pseudoheader sum folds both into a single pass over the buffer.
 	#if defined(UDP_USE_TX_CHECKSUM)
 	{
 		PSEUDO_HEADER   pseudoHeader;
@@ -687,39 +832,110 @@ void UDPFlush(void)
 		pseudoHeader.Protocol       = IP_PROT_UDP;
 		pseudoHeader.Length			= wUDPLength;
 		SwapPseudoHeader(pseudoHeader);
-		h.Checksum = ~CalcIPChecksum((BYTE*)&pseudoHeader, sizeof(pseudoHeader));
+		h->Checksum = ~CalcIPChecksum((BYTE*)&pseudoHeader, sizeof(pseudoHeader));
+		h->Checksum = CalcIPChecksum(activeTxStage->vData, wUDPLength);
 	}
 	#endif
 
-	// Position the hardware write pointer where we will need to 
-	// begin writing the IP header
-	MACSetWritePtr(BASE_TX_ADDR + sizeof(ETHER_HEADER));
-	
-	// Write IP header to packet
-	IPPutHeader(&p->remoteNode, IP_PROT_UDP, wUDPLength);
+	// Capture the destination now; the socket may be closed or 
+	// redirected before the datagram actually leaves
+	memcpy((void*)&activeTxStage->remoteNode, (void*)&p->remoteNode, sizeof(activeTxStage->remoteNode));
+	activeTxStage->wTxCount = wUDPLength;
+	activeTxStage->bPending = 1;
 
-    // Write UDP header to packet
-    MACPutArray((BYTE*)&h, sizeof(h));
-    
-	// Calculate the final UDP checksum and write it in, if enabled
-	#if defined(UDP_USE_TX_CHECKSUM)
-	{
-		wReadPtrSave = MACSetReadPtr(BASE_TX_ADDR + sizeof(ETHER_HEADER) + sizeof(IP_HEADER));
-		BYTE rxToRxSave = MACSetReadPtrToRx(FALSE);
-		wChecksum = CalcIPBufferChecksum(wUDPLength);
-		MACSetReadPtrToRx(rxToRxSave);
-		MACSetReadPtr(wReadPtrSave);
-		MACSetWritePtr(BASE_TX_ADDR + sizeof(ETHER_HEADER) + sizeof(IP_HEADER) + 6);	// 6 is the offset to the Checksum field in UDP_HEADER
-		MACPutArray((BYTE*)&wChecksum, sizeof(wChecksum));
-	}
-	#endif
-    
-	// Transmit the packet
-    MACFlush();
+	// Queue the datagram behind any others still waiting for the MAC
+	TxQueue[(TxQueueHead + TxQueueCount) % UDP_TX_STAGING_BUFFERS] = (BYTE)(activeTxStage - UDPTxStage);
+	TxQueueCount++;
 
 	// Reset packet size counter for the next TX operation
     UDPTxCount = 0;
+	wPutOffset = 0;
+	activeTxStage = NULL;
 	LastPutSocket = INVALID_UDP_SOCKET;
+
+	// Transmit the packet, if the MAC has room for it
+	TransmitPending();
+}
+
+/*****************************************************************************
+  Function:
+	static void SaveActiveTxStage(void)
+
+  Summary:
+	Saves the write state of the currently active TX socket.
+	
+  Description:
+	Copies UDPTxCount and the write offset back into the staging buffer of 
+	the socket that is currently active for writing, so that the socket 
+	can resume its datagram when it is made active again.
+
+  Precondition:
+	None
+
+  Parameters:
+	None
+	
+  Returns:
+  	None
+  ***************************************************************************/
+static void SaveActiveTxStage(void)
+{
+	if(activeTxStage == NULL)
+		return;
+
+	activeTxStage->wTxCount = UDPTxCount;
+	activeTxStage->wPutOffset = wPutOffset;
+}
+
+/*****************************************************************************
+  Function:
+	static void TransmitPending(void)
+
+  Summary:
+	Transmits queued datagrams while MAC TX descriptors are available.
+	
+  Description:
+	Walks the queue of flushed datagrams in order, copying each one into 
+	the next free MAC TX descriptor behind a freshly generated IP header.  
+	Stops at the first datagram that cannot be sent so that ordering is 
+	preserved.
+
+  Precondition:
+	UDPInit() must have been previously called.
+
+  Parameters:
+	None
+	
+  Returns:
+  	None
+  ***************************************************************************/
+static void TransmitPending(void)
+{
+	UDP_TX_STAGE *stage;
+
+	while(TxQueueCount)
+	{
+		if(!MACIsTxReady())
+			return;
+
+		stage = &UDPTxStage[TxQueue[TxQueueHead]];
+
+		// Position the hardware write pointer where we will need to 
+		// begin writing the IP header
+		MACSetWritePtr(BASE_TX_ADDR + sizeof(ETHER_HEADER));
+
+		// Write IP header to packet, followed by UDP header and payload
+		IPPutHeader(&stage->remoteNode, IP_PROT_UDP, stage->wTxCount);
+		MACPutArray(stage->vData, stage->wTxCount);
+		MACFlush();
+
+		stage->bPending = 0;
+		stage->Owner = INVALID_UDP_SOCKET;
+
+		if(++TxQueueHead >= UDP_TX_STAGING_BUFFERS)
+			TxQueueHead = 0;
+		TxQueueCount--;
+	}
 }
 
 
@@ -977,6 +1193,106 @@ BOOL UDPProcess(NODE_INFO *remoteNode, IP_ADDR *localIP, WORD len)
     return TRUE;
 }
 
+/*****************************************************************************
+  Function:
+	void UDPAddRxFilterPorts(void)
+
+  Summary:
+	Adds the local port of every open UDP socket to the RX filter.
+	
+  Description:
+	This function is called by the RX filter module whenever it rebuilds 
+	its port tables.
+
+  Precondition:
+	UDPInit() must have been previously called.
+
+  Parameters:
+	None
+	
+  Returns:
+  	None
+  ***************************************************************************/
+#if defined(STACK_USE_RX_FILTER)
+void UDPAddRxFilterPorts(void)
+{
+    UDP_SOCKET s;
+
+    for ( s = 0; s < MAX_UDP_SOCKETS; s++ )
+    {
+		if(UDPSocketInfo[s].localPort != INVALID_UDP_PORT)
+			RxFilterAddPort(IP_PROT_UDP, UDPSocketInfo[s].localPort);
+    }
+}
+#endif
+
+#if defined(STACK_USE_IGMP)
+/*****************************************************************************
+  Function:
+	BOOL UDPJoinGroup(UDP_SOCKET s, IP_ADDR group)
+
+  Summary:
+	Subscribes a UDP socket to an IPv4 multicast group.
+	
+  Description:
+	Joins the multicast group through the IGMP module so that datagrams 
+	sent to the group and the socket's local port are delivered to this 
+	socket.  Any group previously joined by the socket is left first.
+
+  Precondition:
+	UDPOpen() has been called for the socket.
+
+  Parameters:
+	s - The socket to subscribe.
+	group - The class D group address to join.
+	
+  Return Values:
+  	TRUE - The socket is now a member of the group
+  	FALSE - The group could not be joined
+  ***************************************************************************/
+BOOL UDPJoinGroup(UDP_SOCKET s, IP_ADDR group)
+{
+	if(s >= MAX_UDP_SOCKETS || UDPSocketInfo[s].localPort == INVALID_UDP_PORT)
+		return FALSE;
+
+	UDPLeaveGroup(s);
+	if(!IGMPJoinGroup(group))
+		return FALSE;
+
+	UDPSocketInfo[s].multicastGroup.Val = group.Val;
+	return TRUE;
+}
+
+/*****************************************************************************
+  Function:
+	void UDPLeaveGroup(UDP_SOCKET s)
+
+  Summary:
+	Removes a UDP socket from its multicast group.
+	
+  Description:
+	Leaves the group joined with UDPJoinGroup(), if any.  This is done 
+	automatically when the socket is closed.
+
+  Precondition:
+	None
+
+  Parameters:
+	s - The socket to unsubscribe.
+	
+  Returns:
+  	None
+  ***************************************************************************/
+void UDPLeaveGroup(UDP_SOCKET s)
+{
+	if(s >= MAX_UDP_SOCKETS || UDPSocketInfo[s].multicastGroup.Val == 0x00000000ul)
+		return;
+
+	IGMPLeaveGroup(UDPSocketInfo[s].multicastGroup);
+	UDPSocketInfo[s].multicastGroup.Val = 0x00000000;
+}
+#endif
+
 /*****************************************************************************
   Function:
 	static UDP_SOCKET FindMatchingSocket(UDP_HEADER *h, NODE_INFO *remoteNode,
@@ -1020,6 +1336,15 @@ static UDP_SOCKET FindMatchingSocket(UDP_HEADER *h,
         //    OR this socket had transmitted packet with destination address as broadcast (subnet or limited broadcast).
         if ( p->localPort == h->DestinationPort )
         {
+			#if defined(STACK_USE_IGMP)
+			// Multicast datagrams only go to sockets that joined the group
+			if(IPIsMulticast(*localIP) && p->multicastGroup.Val != localIP->Val)
+			{
+				p++;
+				continue;
+			}
+			#endif
+
             if(p->remotePort == h->SourcePort)
             {
                 if( (p->remoteNode.IPAddr.Val == remoteNode->IPAddr.Val) ||
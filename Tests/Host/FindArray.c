@@ -0,0 +1,212 @@
+/*********************************************************************
+ *
+ *  Host test and benchmark of TCPFindArrayEx
+ *
+ *********************************************************************
+ * FileName:        FindArray.c
+ * Dependencies:    TCPIP Stack/TCP.c
+ * Compiler:        gcc on a PC, see run.sh
+ *
+ * TCPFindArrayEx is copied out of TCP.c by extract.awk and checked
+ * against a naive search on 200,000 random inputs, with the data
+ * wrapping around the end of the RX FIFO at random points.  It is then
+ * timed on the searches HTTP2 makes in a 1.5 KB browser header block.
+ ********************************************************************/
+#include "TCPIP Stack/TCPIP.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CHECK(x)	do { if(!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); exit(1); } } while(0)
+
+static TCB_STUB MyTCBStub;
+static BYTE fifo[2049];
+
+static void SyncTCBStub(TCP_SOCKET hTCP)
+{
+}
+
+static void TCPRAMCopy(PTR_BASE ptrDest, BYTE vDestType, PTR_BASE ptrSource, BYTE vSourceType, WORD wLength)
+{
+	memcpy((void*)ptrDest, (void*)ptrSource, wLength);
+}
+
+WORD TCPIsGetReady(TCP_SOCKET hTCP)
+{
+	if(MyTCBStub.rxHead >= MyTCBStub.rxTail)
+		return MyTCBStub.rxHead - MyTCBStub.rxTail;
+	return MyTCBStub.bufferEnd - MyTCBStub.bufferRxStart + 1 - (MyTCBStub.rxTail - MyTCBStub.rxHead);
+}
+
+static BYTE TCPRxByte(WORD wOffset);
+
+#include "FindArray_ext.c"
+
+// Puts len bytes in the RX FIFO, starting wOffset bytes into it
+static void Load(const BYTE* cData, int len, int wOffset)
+{
+	int i;
+
+	MyTCBStub.vMemoryMedium = TCP_PIC_RAM;
+	MyTCBStub.bufferRxStart = (PTR_BASE)fifo;
+	MyTCBStub.bufferEnd = (PTR_BASE)&fifo[sizeof(fifo) - 1];
+	for(i = 0; i < len; i++)
+		fifo[(wOffset + i) % sizeof(fifo)] = cData[i];
+	MyTCBStub.rxTail = (PTR_BASE)&fifo[wOffset];
+	MyTCBStub.rxHead = (PTR_BASE)&fifo[(wOffset + len) % sizeof(fifo)];
+}
+
+static BYTE Fold(BYTE c, BOOL bTextCompare)
+{
+	return (bTextCompare && c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+// Reference search with the same arguments as TCPFindArrayEx
+static WORD NaiveFind(const BYTE* cData, int len, const BYTE* cFind, int wLen, int wStart, int wSearchLen, BOOL bTextCompare)
+{
+	int i, k, wEnd;
+
+	wEnd = len - wStart;
+	if(wSearchLen && wEnd > wSearchLen)
+		wEnd = wSearchLen;
+	for(i = 0; i + wLen <= wEnd; i++)
+	{
+		for(k = 0; k < wLen; k++)
+			if(Fold(cData[wStart + i + k], bTextCompare) != Fold(cFind[k], bTextCompare))
+				break;
+		if(k == wLen)
+			return wStart + i;
+	}
+	return 0xFFFFu;
+}
+
+static void TestRandom(void)
+{
+	// Few distinct bytes, so that partial matches are common
+	static const char cAlphabet[] = "ab\r\n-AB";
+	BYTE cData[2000], cFind[80];
+	int it, i, len, wLen, wStart, wSearchLen;
+	BOOL bTextCompare;
+	WORD r, ref;
+
+	srand(3);
+	for(it = 0; it < 200000; it++)
+	{
+		len = rand() % sizeof(cData);
+		for(i = 0; i < len; i++)
+			cData[i] = cAlphabet[rand() % 7];
+		wLen = 1 + rand() % (rand() % 2 ? 4 : 70);
+		for(i = 0; i < wLen; i++)
+			cFind[i] = cAlphabet[rand() % 7];
+		if(rand() % 3 == 0 && len > wLen)
+			memcpy(&cData[rand() % (len - wLen)], cFind, wLen);
+		wStart = rand() % 3 ? 0 : rand() % (len + 2);
+		wSearchLen = rand() % 3 ? 0 : rand() % (len + 1);
+		bTextCompare = rand() % 2;
+
+		Load(cData, len, rand() % sizeof(fifo));
+		r = TCPFindArrayEx(0, cFind, wLen, wStart, wSearchLen, bTextCompare);
+		ref = NaiveFind(cData, len, cFind, wLen, wStart, wSearchLen, bTextCompare);
+		if(r != ref)
+			printf("len %d wLen %d wStart %d wSearchLen %d bTextCompare %d: %u, expected %u\n",
+				len, wLen, wStart, wSearchLen, bTextCompare, r, ref);
+		CHECK(r == ref);
+	}
+}
+
+static void Benchmark(void)
+{
+	static const char* cLines[] = {
+		"POST /protect/config.htm?x=1 HTTP/1.1\r\n",
+		"Host: 192.168.1.100\r\n",
+		"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36 Edg/120.0.0.0\r\n",
+		"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n",
+		"Accept-Encoding: gzip, deflate\r\n",
+		"Accept-Language: en-US,en;q=0.9,de;q=0.8,fr;q=0.7\r\n",
+		"Cache-Control: max-age=0\r\n",
+		"Connection: keep-alive\r\n",
+		"Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; lang=en; tracking=abcdefabcdefabcdefabcdefabcdefabcdefabcdefabcdef; consent=yes\r\n",
+		"If-None-Match: \"0012abcd5678ef90\"\r\n",
+		"If-Modified-Since: Tue, 15 Nov 1994 08:12:31 GMT\r\n",
+		"Referer: http://192.168.1.100/protect/config.htm\r\n",
+		"Upgrade-Insecure-Requests: 1\r\n",
+		"Sec-Fetch-Site: same-origin\r\n",
+		"Sec-Fetch-Mode: navigate\r\n",
+		"Sec-Fetch-User: ?1\r\n",
+		"Sec-Fetch-Dest: document\r\n",
+		"sec-ch-ua: \"Not_A Brand\";v=\"8\", \"Chromium\";v=\"120\", \"Microsoft Edge\";v=\"120\"\r\n",
+		"sec-ch-ua-mobile: ?0\r\n",
+		"sec-ch-ua-platform: \"Windows\"\r\n",
+		"Content-Type: multipart/form-data; boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW\r\n",
+	};
+	static const BYTE cBoundary[] = "\r\n------WebKitFormBoundary7MA4YWxkTrZu0gW";
+	char cBlock[2048];
+	int i, len, pass, wPos;
+	int N = 20000;
+	clock_t t;
+	volatile WORD r = 0;
+	WORD w;
+
+	// Pad the captured request out to 1.5 KB
+	len = 0;
+	for(i = 0; i < (int)(sizeof(cLines)/sizeof(cLines[0])); i++)
+		len += sprintf(&cBlock[len], "%s", cLines[i]);
+	while(len < 1536 - 40)
+		len += sprintf(&cBlock[len], "X-Pad: %.30s\r\n", "zzzzzzzzzzzzzzzzzzzzzzzzzzzzzz");
+	len += sprintf(&cBlock[len], "\r\n");
+	printf("Header block of %d bytes, %d passes\n", len, N);
+
+	for(pass = 0; pass < 2; pass++)
+	{
+		// Whole block searches for the end of the headers, a multipart
+		// boundary and a header name
+		t = clock();
+		for(i = 0; i < N; i++)
+		{
+			Load((BYTE*)cBlock, len, 1000);
+			if(pass)
+			{
+				r += TCPFindArrayEx(0, (BYTE*)cBoundary, sizeof(cBoundary) - 1, 0, 0, FALSE);
+				r += TCPFindArrayEx(0, (BYTE*)"\r\n\r\n", 4, 0, 0, FALSE);
+				r += TCPFindArrayEx(0, (BYTE*)"cookie:", 7, 0, 0, TRUE);
+			}
+			else
+			{
+				r += NaiveFind((BYTE*)cBlock, len, cBoundary, sizeof(cBoundary) - 1, 0, 0, FALSE);
+				r += NaiveFind((BYTE*)cBlock, len, (BYTE*)"\r\n\r\n", 4, 0, 0, FALSE);
+				r += NaiveFind((BYTE*)cBlock, len, (BYTE*)"cookie:", 7, 0, 0, TRUE);
+			}
+		}
+		printf("%-14s 3 whole block searches: %6.2f us\n", pass ? "TCPFindArrayEx" : "Naive",
+			(double)(clock() - t) / CLOCKS_PER_SEC * 1e6 / N);
+
+		// Line by line CRLF scan, as HTTP2 parses headers
+		t = clock();
+		for(i = 0; i < N; i++)
+		{
+			Load((BYTE*)cBlock, len, 1000);
+			for(wPos = 0; ; wPos = w + 2)
+			{
+				if(pass)
+					w = TCPFindArrayEx(0, (BYTE*)"\r\n", 2, wPos, 0, FALSE);
+				else
+					w = NaiveFind((BYTE*)cBlock, len, (BYTE*)"\r\n", 2, wPos, 0, FALSE);
+				if(w == 0xFFFFu)
+					break;
+				r += w;
+			}
+		}
+		printf("%-14s CRLF scan by line:      %6.2f us\n", pass ? "TCPFindArrayEx" : "Naive",
+			(double)(clock() - t) / CLOCKS_PER_SEC * 1e6 / N);
+	}
+}
+
+int main(void)
+{
+	TestRandom();
+	printf("FindArray: ok\n");
+
+	if(getenv("HOST_BENCH"))
+		Benchmark();
+	return 0;
+}
@@ -0,0 +1,614 @@
+/*********************************************************************
+ *
+ *  Host test and benchmark of HTTPServer over mock sockets
+ *
+ *********************************************************************
+ * FileName:        HTTPLoad.c
+ * Dependencies:    TCPIP Stack/HTTP2.c, Hashes.c, Helpers.c, Inflate.c,
+ *                  Stubs.c
+ * Compiler:        gcc on a PC, see run.sh
+ *
+ * HTTP2.c is built whole with the demo configuration, against mock
+ * sockets and a mock MPFS holding a few static files.  Each socket has
+ * a 300 byte TX FIFO that the client drains after every call to
+ * HTTPServer, and TCPSendFile completes at once.  Clients on every
+ * connection send keep-alive GETs, and each response must match its
+ * file.  A gzip'd file checks the ETag and Accept-Encoding handling.
+ *
+ * With HOST_BENCH set, requests/s is measured with 1 to
+ * MAX_HTTP_CONNECTIONS busy clients, while the other connections are
+ * idle.  Only the server's CPU time is measured, not the network.
+ ********************************************************************/
+#include "TCPIP Stack/TCPIP.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CHECK(x)	do { if(!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); exit(1); } } while(0)
+
+#define TX_FIFO		(300)
+
+// The HTTPPrint_ stubs, made from HTTPPrint.h by run.sh
+#include "HTTPPrint_stubs.c"
+
+HTTP_IO_RESULT HTTPExecuteGet(void)			{ return HTTP_IO_DONE; }
+HTTP_IO_RESULT HTTPExecutePost(void)		{ return HTTP_IO_DONE; }
+HTTP_IO_RESULT HTTPExecuteEvents(void)		{ return HTTP_IO_DONE; }
+HTTP_IO_RESULT HTTPExecuteWebSocket(void)	{ return HTTP_IO_DONE; }
+
+static DWORD dwTick;
+
+DWORD TickGet(void)
+{
+	return dwTick;
+}
+
+
+/****************************************************************************
+  Section:
+	Mock MPFS
+  ***************************************************************************/
+static struct
+{
+	const char* cName;
+	BYTE* vData;
+	DWORD dwLen;
+	WORD wFlags;
+} files[3];
+
+static struct
+{
+	BYTE vFile;
+	DWORD dwPos;
+	BOOL bOpen;
+} handles[MAX_MPFS_HANDLES + 1];
+
+static int openHandles;
+
+MPFS_HANDLE MPFSOpenID(WORD hFatID)
+{
+	MPFS_HANDLE h;
+
+	if(hFatID >= sizeof(files)/sizeof(files[0]) || !files[hFatID].cName)
+		return MPFS_INVALID_HANDLE;
+	for(h = 1; h <= MAX_MPFS_HANDLES; h++)
+	{
+		if(!handles[h].bOpen)
+		{
+			handles[h].vFile = hFatID;
+			handles[h].dwPos = 0;
+			handles[h].bOpen = TRUE;
+			openHandles++;
+			return h;
+		}
+	}
+	return MPFS_INVALID_HANDLE;
+}
+
+MPFS_HANDLE MPFSOpen(BYTE* cFile)
+{
+	WORD i;
+
+	for(i = 0; i < sizeof(files)/sizeof(files[0]); i++)
+		if(files[i].cName && strcmp((char*)cFile, files[i].cName) == 0)
+			return MPFSOpenID(i);
+	return MPFS_INVALID_HANDLE;
+}
+
+void MPFSClose(MPFS_HANDLE hMPFS)
+{
+	if(hMPFS != MPFS_INVALID_HANDLE && handles[hMPFS].bOpen)
+	{
+		handles[hMPFS].bOpen = FALSE;
+		openHandles--;
+	}
+}
+
+DWORD MPFSGetSize(MPFS_HANDLE hMPFS)
+{
+	return files[handles[hMPFS].vFile].dwLen;
+}
+
+DWORD MPFSGetBytesRem(MPFS_HANDLE hMPFS)
+{
+	return MPFSGetSize(hMPFS) - handles[hMPFS].dwPos;
+}
+
+DWORD MPFSGetPosition(MPFS_HANDLE hMPFS)
+{
+	return handles[hMPFS].dwPos;
+}
+
+WORD MPFSGetArray(MPFS_HANDLE hMPFS, BYTE* cData, WORD wLen)
+{
+	if(wLen > MPFSGetBytesRem(hMPFS))
+		wLen = MPFSGetBytesRem(hMPFS);
+	if(cData)
+		memcpy(cData, &files[handles[hMPFS].vFile].vData[handles[hMPFS].dwPos], wLen);
+	handles[hMPFS].dwPos += wLen;
+	return wLen;
+}
+
+BOOL MPFSGet(MPFS_HANDLE hMPFS, BYTE* c)
+{
+	return MPFSGetArray(hMPFS, c, 1) == 1u;
+}
+
+BOOL MPFSGetLong(MPFS_HANDLE hMPFS, DWORD* ul)
+{
+	return MPFSGetArray(hMPFS, (BYTE*)ul, 4) == 4u;
+}
+
+BOOL MPFSSeek(MPFS_HANDLE hMPFS, DWORD dwOffset, MPFS_SEEK_MODE tMode)
+{
+	DWORD dwSize = MPFSGetSize(hMPFS);
+
+	switch(tMode)
+	{
+		case MPFS_SEEK_START:	if(dwOffset > dwSize) return FALSE; handles[hMPFS].dwPos = dwOffset; break;
+		case MPFS_SEEK_END:		if(dwOffset > dwSize) return FALSE; handles[hMPFS].dwPos = dwSize - dwOffset; break;
+		case MPFS_SEEK_FORWARD:	if(dwOffset > MPFSGetBytesRem(hMPFS)) return FALSE; handles[hMPFS].dwPos += dwOffset; break;
+		default:				if(dwOffset > handles[hMPFS].dwPos) return FALSE; handles[hMPFS].dwPos -= dwOffset; break;
+	}
+	return TRUE;
+}
+
+WORD MPFSGetID(MPFS_HANDLE hMPFS)				{ return handles[hMPFS].vFile; }
+WORD MPFSGetFlags(MPFS_HANDLE hMPFS)			{ return files[handles[hMPFS].vFile].wFlags; }
+DWORD MPFSGetTimestamp(MPFS_HANDLE hMPFS)		{ return 0x5f000000ul; }
+MPFS_HANDLE MPFSFormat(void)					{ return MPFS_INVALID_HANDLE; }
+WORD MPFSPutArray(MPFS_HANDLE hMPFS, BYTE* cData, WORD wLen)	{ return 0; }
+BOOL MPFSPutEnd(BOOL final)						{ return FALSE; }
+WORD MPFSGetPutReady(MPFS_HANDLE hMPFS)			{ return 0; }
+
+
+/****************************************************************************
+  Section:
+	Mock sockets
+  ***************************************************************************/
+// Each socket keeps everything the server sent in tx, while txPend
+// counts the bytes written to the FIFO since the client last drained it
+static struct
+{
+	BYTE rx[1024];
+	int rxHead, rxLen;
+	BYTE tx[16384];
+	int txLen, txPend;
+	BOOL bActive, bReset, bClosed;
+} skt[MAX_HTTP_CONNECTIONS];
+
+static int sockets;
+
+TCP_SOCKET TCPOpen(DWORD dwRemoteHost, BYTE vRemoteHostType, WORD wPort, BYTE vSocketPurpose)
+{
+	if(sockets == MAX_HTTP_CONNECTIONS)
+		return INVALID_SOCKET;
+	skt[sockets].bReset = TRUE;
+	return sockets++;
+}
+
+BOOL TCPWasReset(TCP_SOCKET hTCP)
+{
+	BOOL b = skt[hTCP].bReset;
+
+	skt[hTCP].bReset = FALSE;
+	return b;
+}
+
+BOOL TCPWasActive(TCP_SOCKET hTCP)
+{
+	BOOL b = skt[hTCP].bActive;
+
+	skt[hTCP].bActive = FALSE;
+	return b;
+}
+
+BOOL TCPIsConnected(TCP_SOCKET hTCP)			{ return !skt[hTCP].bClosed; }
+void TCPFlush(TCP_SOCKET hTCP)					{ }
+BOOL TCPAdjustFIFOSize(TCP_SOCKET hTCP, WORD wMinRXSize, WORD wMinTXSize, BYTE vFlags)	{ return TRUE; }
+
+void TCPDisconnect(TCP_SOCKET hTCP)
+{
+	skt[hTCP].bClosed = TRUE;
+	skt[hTCP].rxLen = 0;
+}
+
+WORD TCPIsPutReady(TCP_SOCKET hTCP)
+{
+	return skt[hTCP].bClosed ? 0 : TX_FIFO - skt[hTCP].txPend;
+}
+
+WORD TCPGetTxFIFOFull(TCP_SOCKET hTCP)
+{
+	return skt[hTCP].txPend;
+}
+
+WORD TCPPutArray(TCP_SOCKET hTCP, BYTE* Data, WORD Len)
+{
+	if(Len > TCPIsPutReady(hTCP))
+		Len = TCPIsPutReady(hTCP);
+	CHECK(skt[hTCP].txLen + Len <= (int)sizeof(skt[hTCP].tx));
+	memcpy(&skt[hTCP].tx[skt[hTCP].txLen], Data, Len);
+	skt[hTCP].txLen += Len;
+	skt[hTCP].txPend += Len;
+	return Len;
+}
+
+BOOL TCPPut(TCP_SOCKET hTCP, BYTE byte)
+{
+	return TCPPutArray(hTCP, &byte, 1) == 1u;
+}
+
+BYTE* TCPPutString(TCP_SOCKET hTCP, BYTE* Data)
+{
+	return Data + TCPPutArray(hTCP, Data, strlen((char*)Data));
+}
+
+WORD TCPPeekTxArray(TCP_SOCKET hTCP, BYTE *vBuffer, WORD wLen)
+{
+	if(wLen > skt[hTCP].txPend)
+		return 0;
+	memcpy(vBuffer, &skt[hTCP].tx[skt[hTCP].txLen - wLen], wLen);
+	return wLen;
+}
+
+// File data goes straight to the client, as if ACKed at once
+DWORD TCPSendFile(TCP_SOCKET hTCP, MPFS_HANDLE hMPFS, DWORD dwLen)
+{
+	CHECK(skt[hTCP].txLen + dwLen <= sizeof(skt[hTCP].tx));
+	dwLen = MPFSGetArray(hMPFS, &skt[hTCP].tx[skt[hTCP].txLen], dwLen);
+	skt[hTCP].txLen += dwLen;
+	return dwLen;
+}
+
+WORD TCPIsGetReady(TCP_SOCKET hTCP)
+{
+	return skt[hTCP].rxLen;
+}
+
+WORD TCPGetRxFIFOFree(TCP_SOCKET hTCP)
+{
+	return sizeof(skt[hTCP].rx) - skt[hTCP].rxHead - skt[hTCP].rxLen;
+}
+
+WORD TCPGetArray(TCP_SOCKET hTCP, BYTE* buffer, WORD count)
+{
+	if(count > skt[hTCP].rxLen)
+		count = skt[hTCP].rxLen;
+	if(buffer)
+		memcpy(buffer, &skt[hTCP].rx[skt[hTCP].rxHead], count);
+	skt[hTCP].rxHead += count;
+	skt[hTCP].rxLen -= count;
+	if(skt[hTCP].rxLen == 0)
+		skt[hTCP].rxHead = 0;
+	return count;
+}
+
+BOOL TCPGet(TCP_SOCKET hTCP, BYTE* byte)
+{
+	return TCPGetArray(hTCP, byte, 1) == 1u;
+}
+
+void TCPDiscard(TCP_SOCKET hTCP)
+{
+	TCPGetArray(hTCP, NULL, skt[hTCP].rxLen);
+}
+
+WORD TCPPeekArray(TCP_SOCKET hTCP, BYTE *vBuffer, WORD wLen, WORD wStart)
+{
+	if(wStart >= skt[hTCP].rxLen)
+		return 0;
+	if(wLen > skt[hTCP].rxLen - wStart)
+		wLen = skt[hTCP].rxLen - wStart;
+	memcpy(vBuffer, &skt[hTCP].rx[skt[hTCP].rxHead + wStart], wLen);
+	return wLen;
+}
+
+WORD TCPFindArrayEx(TCP_SOCKET hTCP, BYTE* cFindArray, WORD wLen, WORD wStart, WORD wSearchLen, BOOL bTextCompare)
+{
+	BYTE* p = &skt[hTCP].rx[skt[hTCP].rxHead];
+	int i, k, wEnd;
+
+	wEnd = skt[hTCP].rxLen;
+	if(wSearchLen && wStart + wSearchLen < wEnd)
+		wEnd = wStart + wSearchLen;
+	for(i = wStart; i + wLen <= wEnd; i++)
+	{
+		for(k = 0; k < wLen; k++)
+			if(bTextCompare ? toupper(p[i+k]) != toupper(cFindArray[k]) : p[i+k] != cFindArray[k])
+				break;
+		if(k == wLen)
+			return i;
+	}
+	return 0xffff;
+}
+
+WORD TCPFindEx(TCP_SOCKET hTCP, BYTE cFind, WORD wStart, WORD wSearchLen, BOOL bTextCompare)
+{
+	return TCPFindArrayEx(hTCP, &cFind, 1, wStart, wSearchLen, bTextCompare);
+}
+
+
+/****************************************************************************
+  Section:
+	Clients
+  ***************************************************************************/
+static void Request(TCP_SOCKET s, const char* cReq)
+{
+	int len = strlen(cReq);
+
+	memcpy(&skt[s].rx[skt[s].rxHead + skt[s].rxLen], cReq, len);
+	skt[s].rxLen += len;
+	skt[s].bActive = TRUE;
+}
+
+// Returns the length of the complete response at the start of tx, or 0
+static int Response(TCP_SOCKET s)
+{
+	char* cEnd;
+	char* cLen;
+	int hdr;
+
+	skt[s].tx[skt[s].txLen] = '\0';
+	cEnd = strstr((char*)skt[s].tx, "\r\n\r\n");
+	if(!cEnd)
+		return 0;
+	hdr = cEnd + 4 - (char*)skt[s].tx;
+	if(memcmp(skt[s].tx, "HTTP/1.1 304", 12) == 0)
+		return hdr;
+	cLen = strstr((char*)skt[s].tx, "Content-Length: ");
+	if(cLen && cLen < cEnd)
+		return skt[s].txLen >= hdr + atoi(cLen + 16) ? hdr + atoi(cLen + 16) : 0;
+	return skt[s].bClosed ? skt[s].txLen : 0;
+}
+
+// Drains the TX FIFO, which arrives as an ACK segment
+static void Drain(TCP_SOCKET s)
+{
+	if(skt[s].txPend)
+		skt[s].bActive = TRUE;
+	skt[s].txPend = 0;
+}
+
+static void Consume(TCP_SOCKET s, int len)
+{
+	memmove(skt[s].tx, &skt[s].tx[len], skt[s].txLen - len);
+	skt[s].txLen -= len;
+}
+
+// A closed socket comes back as a new connection
+static void Reconnect(TCP_SOCKET s)
+{
+	skt[s].rxHead = skt[s].rxLen = 0;
+	skt[s].txLen = skt[s].txPend = 0;
+	skt[s].bClosed = FALSE;
+	skt[s].bReset = TRUE;
+}
+
+// Runs HTTPServer until a response is complete on socket s
+static int Serve(TCP_SOCKET s)
+{
+	int i, len;
+
+	for(i = 0; i < 10000; i++)
+	{
+		HTTPServer();
+		dwTick++;
+		Drain(s);
+		if((len = Response(s)) != 0)
+			return len;
+	}
+	CHECK(!"response never completed");
+	return 0;
+}
+
+static void LoadFiles(void)
+{
+	static BYTE vIndex[1400], vPage[5000];
+	static BYTE vZipped[] = {
+		0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xf3, 0x48, 0xcd, 0xc9, 0xc9, 0xd7,
+		0x51, 0xc8, 0x40, 0xa2, 0x14, 0xd2, 0x8a, 0xf2, 0x73, 0x15, 0x12, 0x15, 0xd2, 0xab, 0x32, 0x0b,
+		0xd4, 0x53, 0x14, 0xd2, 0x32, 0x73, 0x52, 0xb9, 0x00, 0x34, 0x32, 0x99, 0xe3, 0x27, 0x00, 0x00,
+		0x00,
+	};
+	int i;
+
+	for(i = 0; i < (int)sizeof(vIndex); i++)
+		vIndex[i] = 'a' + i % 26;
+	for(i = 0; i < (int)sizeof(vPage); i++)
+		vPage[i] = ' ' + i % 95;
+	files[0].cName = "index.htm";
+	files[0].vData = vIndex;
+	files[0].dwLen = sizeof(vIndex);
+	files[1].cName = "page.css";
+	files[1].vData = vPage;
+	files[1].dwLen = sizeof(vPage);
+
+	// "Hello, hello, hello from a gzip'd file\n"
+	files[2].cName = "data.txt";
+	files[2].vData = vZipped;
+	files[2].dwLen = sizeof(vZipped);
+	files[2].wFlags = MPFS2_FLAG_ISZIPPED;
+}
+
+static void TestServe(void)
+{
+	static const char cGet[] = "GET / HTTP/1.1\r\nHost: 192.168.1.100\r\nAccept-Encoding: gzip\r\n\r\n";
+	TCP_SOCKET s;
+	int len, round;
+	char* cBody;
+
+	// Every connection serves three requests on the same socket, with
+	// all of them in progress at once
+	for(round = 0; round < 3; round++)
+	{
+		for(s = 0; s < MAX_HTTP_CONNECTIONS; s++)
+			Request(s, s & 1 ? "GET /page.css HTTP/1.1\r\nConnection: keep-alive\r\n\r\n" : cGet);
+		for(s = 0; s < MAX_HTTP_CONNECTIONS; s++)
+		{
+			len = Serve(s);
+			CHECK(memcmp(skt[s].tx, "HTTP/1.1 200 OK\r\n", 17) == 0);
+			CHECK(strstr((char*)skt[s].tx, "Connection: keep-alive\r\n") != NULL);
+			cBody = strstr((char*)skt[s].tx, "\r\n\r\n") + 4;
+			CHECK(len - (cBody - (char*)skt[s].tx) == (int)files[s & 1].dwLen);
+			CHECK(memcmp(cBody, files[s & 1].vData, files[s & 1].dwLen) == 0);
+			CHECK(!skt[s].bClosed);
+			Consume(s, len);
+		}
+	}
+
+	// A missing file closes its connection, and the others keep going
+	Request(0, "GET /missing.htm HTTP/1.1\r\n\r\n");
+	Request(1, cGet);
+	len = Serve(0);
+	CHECK(memcmp(skt[0].tx, "HTTP/1.1 404 Not found\r\n", 24) == 0);
+	CHECK(skt[0].bClosed);
+	len = Serve(1);
+	CHECK(memcmp(skt[1].tx, "HTTP/1.1 200 OK\r\n", 17) == 0);
+	Consume(1, len);
+
+	// The closed socket comes back as a new connection
+	Reconnect(0);
+	Request(0, cGet);
+	len = Serve(0);
+	CHECK(memcmp(skt[0].tx, "HTTP/1.1 200 OK\r\n", 17) == 0);
+	Consume(0, len);
+
+	// Nothing is left open once every response is complete
+	for(s = 0; s < MAX_HTTP_CONNECTIONS; s++)
+		HTTPServer();
+	CHECK(openHandles == 0);
+}
+
+// Requests data.txt with the given headers, and returns the status code
+// with the response left in skt[0].tx
+static int Get(const char* cHeaders)
+{
+	char cReq[256];
+	int len;
+
+	Consume(0, skt[0].txLen);
+	if(skt[0].bClosed)
+		Reconnect(0);
+	sprintf(cReq, "GET /data.txt HTTP/1.1\r\n%s\r\n", cHeaders);
+	Request(0, cReq);
+	len = Serve(0);
+	CHECK(len == skt[0].txLen);
+	skt[0].tx[len] = '\0';
+	return atoi((char*)skt[0].tx + 9);
+}
+
+// Copies the value of a response header
+static void Header(const char* cName, char* cValue)
+{
+	char* p;
+
+	p = strstr((char*)skt[0].tx, cName);
+	CHECK(p != NULL);
+	p += strlen(cName);
+	while(*p != '\r')
+		*cValue++ = *p++;
+	*cValue = '\0';
+}
+
+static void TestValidators(void)
+{
+	char cZipTag[32], cTag[32], cReq[64];
+
+	// The file sent as stored and sent decompressed have different ETags
+	CHECK(Get("Accept-Encoding: gzip, deflate\r\n") == 200);
+	CHECK(strstr((char*)skt[0].tx, "Content-Encoding: gzip\r\n") != NULL);
+	Header("ETag: ", cZipTag);
+	CHECK(Get("") == 200);
+	CHECK(strstr((char*)skt[0].tx, "Content-Encoding") == NULL);
+	CHECK(strstr((char*)skt[0].tx, "from a gzip'd file\n") != NULL);
+	Header("ETag: ", cTag);
+	CHECK(strcmp(cTag, cZipTag) != 0);
+
+	// Each tag only validates its own representation, whichever order
+	// the headers come in
+	sprintf(cReq, "If-None-Match: %s\r\n", cZipTag);
+	CHECK(Get(cReq) == 200);
+	strcat(cReq, "Accept-Encoding: gzip\r\n");
+	CHECK(Get(cReq) == 304);
+	sprintf(cReq, "Accept-Encoding: gzip\r\nIf-None-Match: %s\r\n", cTag);
+	CHECK(Get(cReq) == 200);
+	sprintf(cReq, "If-None-Match: %s\r\n", cTag);
+	CHECK(Get(cReq) == 304);
+	Header("ETag: ", cReq);
+	CHECK(strcmp(cReq, cTag) == 0);
+
+	// gzip with a zero q-value is refused, but other q-values are not
+	CHECK(Get("Accept-Encoding: gzip;q=0, deflate\r\n") == 200);
+	CHECK(strstr((char*)skt[0].tx, "Content-Encoding") == NULL);
+	CHECK(Get("Accept-Encoding: gzip; q=0.000\r\n") == 200);
+	CHECK(strstr((char*)skt[0].tx, "Content-Encoding") == NULL);
+	CHECK(Get("Accept-Encoding: gzip;q=0.5, br;q=0\r\n") == 200);
+	CHECK(strstr((char*)skt[0].tx, "Content-Encoding: gzip\r\n") != NULL);
+
+	// A q-value cut off by the end of the buffer may have been zero
+	CHECK(Get("Accept-Encoding: deflate, br, zstd, compress, identity, gzip;level=1;q=0\r\n") == 200);
+	CHECK(strstr((char*)skt[0].tx, "Content-Encoding") == NULL);
+	CHECK(openHandles == 0);
+}
+
+static void Benchmark(void)
+{
+	static const char cGet[] = "GET / HTTP/1.1\r\nHost: 192.168.1.100\r\nUser-Agent: Mozilla/5.0\r\nAccept: */*\r\nAccept-Encoding: gzip\r\n\r\n";
+	int busy, n, len, N = 200000;
+	long lRequests;
+	TCP_SOCKET s;
+	clock_t t;
+
+	printf("index.htm of %u bytes, %d requests per run, %u connections open\n",
+		(unsigned)files[0].dwLen, N, MAX_HTTP_CONNECTIONS);
+	for(busy = 1; busy <= MAX_HTTP_CONNECTIONS; busy *= 2)
+	{
+		// Each busy client sends its next request as soon as the last
+		// response is complete
+		// Connections left idle by the last run may have timed out
+		lRequests = 0;
+		for(s = 0; s < busy; s++)
+		{
+			if(skt[s].bClosed)
+				Reconnect(s);
+			Request(s, cGet);
+		}
+		t = clock();
+		for(n = 0; lRequests < N; n++)
+		{
+			HTTPServer();
+			dwTick++;
+			for(s = 0; s < busy; s++)
+			{
+				Drain(s);
+				if((len = Response(s)) != 0)
+				{
+					Consume(s, len);
+					Request(s, cGet);
+					lRequests++;
+				}
+			}
+		}
+		printf("%2d busy: %8.0f requests/s, %5.2f HTTPServer calls per request\n", busy,
+			lRequests / ((double)(clock() - t) / CLOCKS_PER_SEC), (double)n / lRequests);
+
+		// Let the last requests finish
+		for(s = 0; s < busy; s++)
+			Consume(s, Serve(s));
+	}
+}
+
+int main(void)
+{
+	LoadFiles();
+	HTTPInit();
+	CHECK(sockets == MAX_HTTP_CONNECTIONS);
+	TestServe();
+	TestValidators();
+	printf("HTTPLoad: ok\n");
+
+	if(getenv("HOST_BENCH"))
+		Benchmark();
+	return 0;
+}
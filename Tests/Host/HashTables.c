@@ -0,0 +1,170 @@
+/*********************************************************************
+ *
+ *  Host check of the HTTP2 name lookup tables
+ *
+ *********************************************************************
+ * FileName:        HashTables.c
+ * Dependencies:    TCPIP Stack/HTTP2.c, Helpers.c, Stubs.c
+ * Compiler:        gcc on a PC, see run.sh
+ *
+ * httpHeaderSlots and httpExtensionSlots are copied out of HTTP2.c by
+ * extract.awk, along with the names they index and HTTPNameHash.  The
+ * tables are rebuilt from the names, and any difference or collision
+ * fails the check.  A table that needs rebuilding is printed ready to
+ * paste into HTTP2.c.
+ *
+ * With HOST_BENCH set, the lookup is also timed against a linear
+ * search on header names captured from browser requests.
+ ********************************************************************/
+#include "TCPIP Stack/TCPIP.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "HashTables_ext.c"
+
+// Rebuilds one table, returning TRUE if it matches the one in HTTP2.c
+static BOOL CheckTable(const char* cTable, ROM char** cNames, BYTE vCount, ROM BYTE* vSlots)
+{
+	BYTE vBuilt[HTTP_HASH_SLOTS];
+	char cEntry[8];
+	BYTE i, h;
+	BOOL bOK;
+
+	bOK = TRUE;
+	memset(vBuilt, 0xff, sizeof(vBuilt));
+	for(i = 0; i < vCount; i++)
+	{
+		h = HTTPNameHash(cNames[i], strlen(cNames[i]));
+		if(vBuilt[h] != 0xffu)
+		{
+			printf("%s: \"%s\" and \"%s\" both hash to slot %u, so HTTPNameHash must change\n",
+				cTable, cNames[vBuilt[h]], cNames[i], h);
+			bOK = FALSE;
+		}
+		vBuilt[h] = i;
+	}
+	if(!bOK)
+		return FALSE;
+
+	if(memcmp(vBuilt, vSlots, sizeof(vBuilt)) == 0)
+		return TRUE;
+
+	printf("%s is out of date, and should be:\n\t{", cTable);
+	for(i = 0; i < HTTP_HASH_SLOTS; i++)
+	{
+		if(i % 8u == 0u)
+			printf("\n\t\t");
+		if(vBuilt[i] == 0xffu)
+			strcpy(cEntry, "0xff");
+		else
+			sprintf(cEntry, "%u", vBuilt[i]);
+		if(i != HTTP_HASH_SLOTS - 1u)
+			strcat(cEntry, ",");
+		printf(i % 8u == 7u ? "%s" : "%-6s", cEntry);
+	}
+	printf("\n\t};\n");
+	return FALSE;
+}
+
+// The lookup made by HTTP2, returning the header index or 0xff
+static BYTE HashFind(BYTE* cName, WORD wLen)
+{
+	BYTE i;
+
+	i = httpHeaderSlots[HTTPNameHash(cName, wLen)];
+	if(i != 0xffu && stricmppgm2ram(cName, (ROM BYTE*)HTTPRequestHeaders[i]) == 0)
+		return i;
+	return 0xff;
+}
+
+// The lookup HTTP2 made before the tables, comparing against each name
+static BYTE LinearFind(BYTE* cName, WORD wLen)
+{
+	BYTE i;
+
+	for(i = 0; i < HTTP_NUM_HEADERS; i++)
+		if(stricmppgm2ram(cName, (ROM BYTE*)HTTPRequestHeaders[i]) == 0)
+			return i;
+	return 0xff;
+}
+
+static void Benchmark(void)
+{
+	// Header names of a Chrome page load, a Firefox form POST, and a
+	// WebSocket upgrade
+	static const char* cCaptured[] = {
+		"Host", "Connection", "Cache-Control", "sec-ch-ua", "sec-ch-ua-mobile",
+		"sec-ch-ua-platform", "Upgrade-Insecure-Requests", "User-Agent", "Accept",
+		"Sec-Fetch-Site", "Sec-Fetch-Mode", "Sec-Fetch-User", "Sec-Fetch-Dest",
+		"Referer", "Accept-Encoding", "Accept-Language", "Cookie", "If-None-Match",
+		"If-Modified-Since",
+		"Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding",
+		"Content-Type", "Content-Length", "Origin", "Authorization", "Connection",
+		"Referer", "Cookie", "Upgrade-Insecure-Requests", "Sec-Fetch-Dest",
+		"Sec-Fetch-Mode", "Sec-Fetch-Site", "Sec-Fetch-User", "Priority",
+		"Host", "Connection", "Pragma", "Cache-Control", "User-Agent", "Upgrade",
+		"Origin", "Sec-WebSocket-Version", "Accept-Encoding", "Accept-Language",
+		"Sec-WebSocket-Key", "Sec-WebSocket-Extensions",
+	};
+	BYTE cName[HTTP_MAX_HEADER_LEN + 16];
+	int i, k, pass, N = 200000;
+	WORD wLen;
+	clock_t t;
+	volatile BYTE r = 0;
+
+	for(i = 0; i < (int)(sizeof(cCaptured)/sizeof(cCaptured[0])); i++)
+	{
+		strcpy((char*)cName, cCaptured[i]);
+		if(HashFind(cName, strlen(cCaptured[i])) != LinearFind(cName, strlen(cCaptured[i])))
+		{
+			printf("Lookups differ on \"%s\"\n", cCaptured[i]);
+			exit(1);
+		}
+	}
+
+	printf("%d captured header names, %d passes\n", (int)(sizeof(cCaptured)/sizeof(cCaptured[0])), N);
+	for(pass = 0; pass < 2; pass++)
+	{
+		t = clock();
+		for(k = 0; k < N; k++)
+		{
+			for(i = 0; i < (int)(sizeof(cCaptured)/sizeof(cCaptured[0])); i++)
+			{
+				wLen = strlen(cCaptured[i]);
+				memcpy(cName, cCaptured[i], wLen + 1);
+				r += pass ? HashFind(cName, wLen) : LinearFind(cName, wLen);
+			}
+		}
+		printf("%-6s lookup of every name: %6.2f us\n", pass ? "Hash" : "Linear",
+			(double)(clock() - t) / CLOCKS_PER_SEC * 1e6 / N);
+	}
+}
+
+int main(void)
+{
+	BOOL bOK;
+	BYTE i, vMax;
+
+	bOK = CheckTable("httpHeaderSlots", (ROM char**)HTTPRequestHeaders, HTTP_NUM_HEADERS, httpHeaderSlots);
+	bOK &= CheckTable("httpExtensionSlots", (ROM char**)httpFileExtensions, HTTP_UNKNOWN, httpExtensionSlots);
+
+	// The header buffer must hold the longest name and its colon
+	vMax = 0;
+	for(i = 0; i < HTTP_NUM_HEADERS; i++)
+		if(strlen(HTTPRequestHeaders[i]) + 1u > vMax)
+			vMax = strlen(HTTPRequestHeaders[i]) + 1u;
+	if(vMax != HTTP_MAX_HEADER_LEN)
+	{
+		printf("HTTP_MAX_HEADER_LEN should be (%uu)\n", vMax);
+		bOK = FALSE;
+	}
+
+	if(!bOK)
+		return 1;
+	printf("HashTables: ok\n");
+
+	if(getenv("HOST_BENCH"))
+		Benchmark();
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*********************************************************************
+ *
+ *  Host test of the HTTP2 multipart/form-data parser
+ *
+ *********************************************************************
+ * FileName:        Multipart.c
+ * Dependencies:    TCPIP Stack/HTTP2.c
+ * Compiler:        gcc on a PC, see run.sh
+ *
+ * HTTPReadMultipart is copied out of HTTP2.c by extract.awk and run
+ * against a mock socket with a 300 byte RX FIFO.  Bodies are revealed
+ * from 1 to 300 bytes at a time, so that delimiters and the CRLFs
+ * ending header lines are split at every offset, and a pipelined
+ * request after the body must be left unread.
+ ********************************************************************/
+#include "TCPIP Stack/TCPIP.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(x)	do { if(!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); exit(1); } } while(0)
+
+#define RX_FIFO		(300)
+
+HTTP_CONN conn;
+HTTP_CONN *pCurHTTP = &conn;
+HTTP_STUB httpStubs[MAX_HTTP_CONNECTIONS];
+BYTE curHTTPID;
+
+// Mock socket.  Only rx[rxHead, rxVisible) can be read, while the
+// request is held up to rxTail.
+static BYTE rx[8192];
+static int rxHead, rxVisible, rxTail;
+
+WORD TCPIsGetReady(TCP_SOCKET hTCP)
+{
+	return rxVisible - rxHead;
+}
+
+WORD TCPGetRxFIFOFree(TCP_SOCKET hTCP)
+{
+	return RX_FIFO - (rxVisible - rxHead);
+}
+
+WORD TCPGetArray(TCP_SOCKET hTCP, BYTE* buffer, WORD count)
+{
+	if(count > rxVisible - rxHead)
+		count = rxVisible - rxHead;
+	if(buffer)
+		memcpy(buffer, &rx[rxHead], count);
+	rxHead += count;
+	return count;
+}
+
+WORD TCPPeekArray(TCP_SOCKET hTCP, BYTE *vBuffer, WORD wLen, WORD wStart)
+{
+	memcpy(vBuffer, &rx[rxHead + wStart], wLen);
+	return wLen;
+}
+
+WORD TCPFindArrayEx(TCP_SOCKET hTCP, BYTE* cFindArray, WORD wLen, WORD wStart, WORD wSearchLen, BOOL bTextCompare)
+{
+	int i, wEnd;
+
+	wEnd = rxVisible - rxHead;
+	if(wSearchLen && wStart + wSearchLen < wEnd)
+		wEnd = wStart + wSearchLen;
+	for(i = wStart; i + wLen <= wEnd; i++)
+		if(memcmp(&rx[rxHead + i], cFindArray, wLen) == 0)
+			return i;
+	return 0xffff;
+}
+
+#include "Multipart_ext.c"
+
+// What the sink was given.  Headers are separated by '|', and parts by
+// '#' at the end of each.
+static char cHeaders[1024];
+static BYTE vData[4096];
+static int dataLen, dataCalls;
+
+static void SinkHeader(BYTE* cLine)
+{
+	strcat(cHeaders, (char*)cLine);
+	strcat(cHeaders, "|");
+}
+
+// Takes up to 5 bytes, and none on every fourth call
+static WORD SinkData(BYTE* cData, WORD wLen)
+{
+	if(cData == NULL)
+	{
+		vData[dataLen++] = '#';
+		return 0;
+	}
+	if(++dataCalls % 4 == 0)
+		return 0;
+	if(wLen > 5u)
+		wLen = 5;
+	memcpy(&vData[dataLen], cData, wLen);
+	dataLen += wLen;
+	return wLen;
+}
+
+static ROM HTTP_MULTIPART_SINK sink = {SinkHeader, SinkData};
+
+// Loads a body, followed by bytes of the next request on the connection
+static void Load(const char* cBody, const char* cNext)
+{
+	memset(&conn, 0, sizeof(conn));
+	conn.smPart = HTTP_PART_START;
+	conn.byteCount = strlen(cBody);
+	rxHead = rxVisible = 0;
+	rxTail = sprintf((char*)rx, "%s%s", cBody, cNext);
+	cHeaders[0] = '\0';
+	dataLen = dataCalls = 0;
+}
+
+// Parses the loaded body, revealing step bytes whenever the parser
+// needs data, and returns the state it ended in
+static SM_HTTP_PART Parse(int step)
+{
+	HTTP_IO_RESULT r;
+	int i;
+
+	for(i = 0; i < 100000; i++)
+	{
+		r = HTTPReadMultipart(&sink);
+		if(r == HTTP_IO_DONE)
+			return conn.smPart;
+		if(r == HTTP_IO_NEED_DATA)
+		{
+			CHECK(rxVisible < rxTail && TCPGetRxFIFOFree(0) != 0u);
+			rxVisible += step;
+			if(rxVisible > rxTail)
+				rxVisible = rxTail;
+			if(rxVisible > rxHead + RX_FIFO)
+				rxVisible = rxHead + RX_FIFO;
+		}
+	}
+	CHECK(!"parser never finished");
+	return HTTP_PART_ERROR;
+}
+
+static void TestParts(int step)
+{
+	static const char cBody[] =
+		"------WebKitFormBoundary7MA4YWxkTrZu0gW\r\n"
+		"Content-Disposition: form-data; name=\"text\"\r\n"
+		"\r\n"
+		"hello\r\n-\r\n--\r\n------WebKitFormBoundary7MA4YWxkTrZu0g\r\n"
+		"------WebKitFormBoundary7MA4YWxkTrZu0gW\r\n"
+		"Content-Disposition: form-data; name=\"file\"; filename=\"a.bin\"\r\n"
+		"Content-Type: application/octet-stream\r\n"
+		"\r\n"
+		"\r\n\r\n"
+		"------WebKitFormBoundary7MA4YWxkTrZu0gW\r\n"
+		"\r\n"
+		"\r\n"
+		"------WebKitFormBoundary7MA4YWxkTrZu0gW--\r\n"
+		"epilogue";
+	static const char cNext[] = "GET / HTTP/1.1\r\n\r\n";
+	char cLong[1024];
+	int len;
+
+	// Data holding partial delimiters, an empty part, and a third part
+	// with no headers
+	Load(cBody, cNext);
+	CHECK(Parse(step) == HTTP_PART_END);
+	CHECK(strcmp(cHeaders,
+		"Content-Disposition: form-data; name=\"text\"|"
+		"Content-Disposition: form-data; name=\"file\"; filename=\"a.bin\"|"
+		"Content-Type: application/octet-stream|") == 0);
+	CHECK(dataLen == 57 && memcmp(vData, "hello\r\n-\r\n--\r\n------WebKitFormBoundary7MA4YWxkTrZu0g#\r\n##", 57) == 0);
+	CHECK(conn.byteCount == 0u);
+	CHECK(rxHead == (int)strlen(cBody));
+
+	// Headers longer than HTTP_MAX_DATA_LEN are truncated
+	len = sprintf(cLong, "--b\r\nX: %0260d\r\n\r\nd\r\n--b--", 0);
+	Load(cLong, cNext);
+	CHECK(Parse(step) == HTTP_PART_END);
+	CHECK(strlen(cHeaders) == HTTP_MAX_DATA_LEN - 1 + 1);
+	CHECK(dataLen == 2 && vData[0] == 'd');
+	CHECK(rxHead == len);
+
+	// A header line that can't fit in the FIFO
+	sprintf(cLong, "--b\r\nX: %0400d\r\n\r\nd\r\n--b--", 0);
+	Load(cLong, cNext);
+	CHECK(Parse(step) == HTTP_PART_ERROR);
+	CHECK(conn.byteCount == 0u && cHeaders[0] == '\0');
+	CHECK(rxHead == (int)strlen(cLong));
+
+	// The body ends inside the headers, with and without half a CRLF
+	Load("--b\r\nContent-Disposition: form-data", cNext);
+	CHECK(Parse(step) == HTTP_PART_ERROR && rxHead == 35);
+	Load("--b\r\nContent-Disposition: form-data\r", cNext);
+	CHECK(Parse(step) == HTTP_PART_ERROR && rxHead == 36);
+
+	// The body ends before the closing delimiter
+	Load("--b\r\n\r\ndata\r\n--b", cNext);
+	CHECK(Parse(step) == HTTP_PART_ERROR && rxHead == 16);
+
+	// The first line isn't a delimiter
+	Load("b\r\n\r\ndata\r\n--b--", cNext);
+	CHECK(Parse(step) == HTTP_PART_ERROR && rxHead == 16);
+}
+
+int main(void)
+{
+	int step;
+
+	for(step = 1; step <= RX_FIFO; step += step < 8 ? 1 : 37)
+		TestParts(step);
+
+	printf("Multipart: ok\n");
+	return 0;
+}
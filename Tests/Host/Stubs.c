@@ -0,0 +1,31 @@
+/*********************************************************************
+ *
+ *  Peripheral stubs for the host tests
+ *
+ *********************************************************************
+ * FileName:        Stubs.c
+ * Compiler:        gcc on a PC, see run.sh
+ *
+ * Stands in for the peripheral library functions that linked stack
+ * sources call.
+ ********************************************************************/
+#include "TCPIP Stack/TCPIP.h"
+
+// Helpers.c seeds its generator from the hardware RNG
+void RNG_Cmd(FunctionalState NewState)
+{
+}
+
+void RNG_ClearFlag(uint8_t RNG_FLAG)
+{
+}
+
+FlagStatus RNG_GetFlagStatus(uint8_t RNG_FLAG)
+{
+	return SET;
+}
+
+uint32_t RNG_GetRandomNumber(void)
+{
+	return 0;
+}
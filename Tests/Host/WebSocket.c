@@ -0,0 +1,334 @@
+/*********************************************************************
+ *
+ *  Host test of the HTTP2 WebSocket handshake and frame codec
+ *
+ *********************************************************************
+ * FileName:        WebSocket.c
+ * Dependencies:    TCPIP Stack/HTTP2.c, Hashes.c, Helpers.c, Stubs.c
+ * Compiler:        gcc on a PC, see run.sh
+ *
+ * The WebSocket functions are copied out of HTTP2.c by extract.awk
+ * and run against a mock socket.  Received frames are revealed 1, 14,
+ * 27 and 40 bytes at a time, so that headers and payloads are split at
+ * every offset the server has to handle.
+ ********************************************************************/
+#include "TCPIP Stack/TCPIP.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(x)	do { if(!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); exit(1); } } while(0)
+
+HTTP_CONN conn;
+HTTP_CONN *pCurHTTP = &conn;
+HTTP_STUB httpStubs[MAX_HTTP_CONNECTIONS];
+BYTE curHTTPID;
+
+// Mock socket.  Only rx[rxHead, rxVisible) can be read, while frames
+// are appended at rxTail.
+static BYTE rx[1024];
+static int rxHead, rxVisible, rxTail;
+static BYTE tx[2048];
+static int txLen, txCap;
+
+WORD TCPIsGetReady(TCP_SOCKET hTCP)
+{
+	return rxVisible - rxHead;
+}
+
+WORD TCPIsPutReady(TCP_SOCKET hTCP)
+{
+	return txCap - txLen;
+}
+
+WORD TCPGetArray(TCP_SOCKET hTCP, BYTE* buffer, WORD count)
+{
+	if(count > rxVisible - rxHead)
+		count = rxVisible - rxHead;
+	if(buffer)
+		memcpy(buffer, &rx[rxHead], count);
+	rxHead += count;
+	return count;
+}
+
+BOOL TCPGet(TCP_SOCKET hTCP, BYTE* byte)
+{
+	return TCPGetArray(hTCP, byte, 1) == 1u;
+}
+
+WORD TCPPeekArray(TCP_SOCKET hTCP, BYTE *vBuffer, WORD wLen, WORD wStart)
+{
+	memcpy(vBuffer, &rx[rxHead + wStart], wLen);
+	return wLen;
+}
+
+WORD TCPPutArray(TCP_SOCKET hTCP, BYTE* data, WORD len)
+{
+	if(len > txCap - txLen)
+		len = txCap - txLen;
+	memcpy(&tx[txLen], data, len);
+	txLen += len;
+	return len;
+}
+
+BOOL TCPPut(TCP_SOCKET hTCP, BYTE byte)
+{
+	return TCPPutArray(hTCP, &byte, 1) == 1u;
+}
+
+WORD TCPFindArrayEx(TCP_SOCKET hTCP, BYTE* cFindArray, WORD wLen, WORD wStart, WORD wSearchLen, BOOL bTextCompare)
+{
+	int i;
+
+	for(i = rxHead + wStart; i + wLen <= rxVisible; i++)
+		if(memcmp(&rx[i], cFindArray, wLen) == 0)
+			return i - rxHead;
+	return 0xffff;
+}
+
+#include "WebSocket_ext.c"
+
+static void ResetConn(void)
+{
+	memset(&conn, 0, sizeof(conn));
+	conn.httpStatus = HTTP_WS_UPGRADE;
+	rxHead = rxVisible = rxTail = 0;
+	txLen = 0;
+	txCap = sizeof(tx);
+}
+
+// Appends a frame from the client, masked with the RFC 6455 example key
+static void Frame(BYTE vFirst, const BYTE* cData, int len, BOOL bMasked)
+{
+	static const BYTE vMask[4] = {0x37, 0xfa, 0x21, 0x3d};
+	int i;
+
+	rx[rxTail++] = vFirst;
+	if(len < 126)
+	{
+		rx[rxTail++] = (bMasked ? 0x80 : 0x00) | len;
+	}
+	else
+	{
+		rx[rxTail++] = (bMasked ? 0x80 : 0x00) | 126;
+		rx[rxTail++] = len >> 8;
+		rx[rxTail++] = len;
+	}
+	if(bMasked)
+	{
+		memcpy(&rx[rxTail], vMask, 4);
+		rxTail += 4;
+	}
+	for(i = 0; i < len; i++)
+		rx[rxTail++] = cData[i] ^ (bMasked ? vMask[i & 3] : 0x00);
+}
+
+// Messages the application has read
+static BYTE msg[1024];
+static int msgLen, msgCount;
+static BOOL msgText;
+
+// One pass of SM_HTTP_SERVE_WEBSOCKET, with an application that reads
+// 7 bytes at a time
+static void Serve(void)
+{
+	WORD n;
+
+	HTTPWebSocketReadHeader();
+	if(conn.wsFlags & HTTP_WS_CLOSED)
+		return;
+
+	do
+	{
+		n = HTTPWebSocketGetArray(&msg[msgLen], 7);
+		msgLen += n;
+	} while(n);
+
+	if(conn.wsFlags & HTTP_WS_RX_END)
+	{
+		msgCount++;
+		msgText = HTTPWebSocketIsText();
+		conn.wsFlags &= ~HTTP_WS_RX_END;
+	}
+}
+
+// Delivers everything appended so far, step bytes at a time
+static void Run(int step)
+{
+	int i;
+
+	while(rxVisible < rxTail)
+	{
+		rxVisible += step;
+		if(rxVisible > rxTail)
+			rxVisible = rxTail;
+		Serve();
+	}
+	for(i = 0; i < 3; i++)
+		Serve();
+}
+
+// Checks that the server closed the connection with the given status
+static BOOL ClosedWith(WORD wStatus)
+{
+	return (conn.wsFlags & HTTP_WS_CLOSED) && txLen >= 4 &&
+		tx[txLen-4] == 0x88u && tx[txLen-3] == 2u &&
+		tx[txLen-2] == (BYTE)(wStatus >> 8) && tx[txLen-1] == (BYTE)wStatus;
+}
+
+static void TestHandshake(void)
+{
+	// Example key and accept value from RFC 6455 section 1.3
+	ResetConn();
+	strcpy((char*)rx, "dGhlIHNhbXBsZSBub25jZQ==\r\n");
+	rxVisible = rxTail = strlen((char*)rx);
+	HTTPHeaderParseWebSocketKey();
+	CHECK(conn.wsFlags & HTTP_WS_KEY);
+	CHECK(memcmp(conn.wsAccept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", HTTP_WS_ACCEPT_LEN) == 0);
+
+	// Keys that don't hold 16 bytes are refused
+	ResetConn();
+	strcpy((char*)rx, "short\r\n");
+	rxVisible = rxTail = strlen((char*)rx);
+	HTTPHeaderParseWebSocketKey();
+	CHECK(!(conn.wsFlags & HTTP_WS_KEY));
+}
+
+static void TestReceive(int step)
+{
+	static const BYTE vHello[] = {0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58};
+	static const BYTE vClose[] = {0x03, 0xe9};
+	static const BYTE vTooBig[] = {0x82, 0xff, 0, 0, 0, 0, 0, 1, 0, 0, 0x37, 0xfa, 0x21, 0x3d};
+	BYTE vBig[300];
+	int i;
+
+	for(i = 0; i < (int)sizeof(vBig); i++)
+		vBig[i] = i * 7;
+
+	// Single frame example from RFC 6455 section 5.7
+	ResetConn();
+	msgLen = msgCount = 0;
+	memcpy(rx, vHello, sizeof(vHello));
+	rxTail = sizeof(vHello);
+	Run(step);
+	CHECK(msgCount == 1 && msgLen == 5 && memcmp(msg, "Hello", 5) == 0 && msgText);
+
+	// Fragmented message with a Ping between its fragments
+	ResetConn();
+	msgLen = msgCount = 0;
+	Frame(0x01, (BYTE*)"Hel", 3, TRUE);
+	Frame(0x89, (BYTE*)"pp", 2, TRUE);
+	Frame(0x80, (BYTE*)"lo", 2, TRUE);
+	Run(step);
+	CHECK(msgCount == 1 && msgLen == 5 && memcmp(msg, "Hello", 5) == 0);
+	CHECK(txLen == 4 && tx[0] == 0x8Au && tx[1] == 2u && memcmp(&tx[2], "pp", 2) == 0);
+
+	// Empty message
+	Frame(0x81, NULL, 0, TRUE);
+	Run(step);
+	CHECK(msgCount == 2 && msgLen == 5);
+
+	// Binary message with a 16 bit length and an empty fragment
+	Frame(0x02, vBig, 100, TRUE);
+	Frame(0x00, &vBig[100], 0, TRUE);
+	Frame(0x80, &vBig[100], 200, TRUE);
+	Run(step);
+	CHECK(msgCount == 3 && msgLen == 305 && memcmp(&msg[5], vBig, 300) == 0 && !msgText);
+
+	// A Close frame is echoed
+	Frame(0x88, vClose, 2, TRUE);
+	Run(step);
+	CHECK(ClosedWith(1001u));
+
+	// Unmasked frame
+	ResetConn();
+	Frame(0x81, (BYTE*)"x", 1, FALSE);
+	Run(step);
+	CHECK(ClosedWith(HTTP_WS_STATUS_PROTOCOL));
+
+	// Continuation with no message to continue
+	ResetConn();
+	Frame(0x80, (BYTE*)"x", 1, TRUE);
+	Run(step);
+	CHECK(ClosedWith(HTTP_WS_STATUS_PROTOCOL));
+
+	// New message before the last one ended
+	ResetConn();
+	Frame(0x01, (BYTE*)"x", 1, TRUE);
+	Frame(0x01, (BYTE*)"x", 1, TRUE);
+	Run(step);
+	CHECK(ClosedWith(HTTP_WS_STATUS_PROTOCOL));
+
+	// 64 bit length too large for a WORD
+	ResetConn();
+	memcpy(rx, vTooBig, sizeof(vTooBig));
+	rxTail = sizeof(vTooBig);
+	Run(step);
+	CHECK(ClosedWith(HTTP_WS_STATUS_TOO_BIG));
+
+	// Fragmented control frame
+	ResetConn();
+	Frame(0x09, (BYTE*)"x", 1, TRUE);
+	Run(step);
+	CHECK(ClosedWith(HTTP_WS_STATUS_PROTOCOL));
+}
+
+static void TestSend(void)
+{
+	BYTE vData[1000], vOut[1000];
+	int sent, outLen, frames, hdr, len;
+	WORD n;
+
+	for(sent = 0; sent < (int)sizeof(vData); sent++)
+		vData[sent] = sent;
+
+	// Limited TX space splits a message into fragments
+	ResetConn();
+	sent = outLen = frames = 0;
+	while(sent < (int)sizeof(vData))
+	{
+		txLen = 0;
+		txCap = 50 + sent % 300;
+		n = HTTPWebSocketPutArray(&vData[sent], sizeof(vData) - sent, HTTP_WS_BINARY, TRUE);
+		sent += n;
+
+		hdr = 2;
+		len = tx[1];
+		if(len == 126)
+		{
+			hdr = 4;
+			len = tx[2] << 8 | tx[3];
+		}
+		CHECK(len == n && hdr + len == txLen);
+		CHECK((tx[0] & 0x0f) == (frames ? 0x00 : HTTP_WS_BINARY));
+		CHECK(((tx[0] & 0x80) != 0) == (sent == (int)sizeof(vData)));
+		memcpy(&vOut[outLen], &tx[hdr], len);
+		outLen += len;
+		frames++;
+	}
+	CHECK(frames > 1 && outLen == sizeof(vData) && memcmp(vOut, vData, sizeof(vData)) == 0);
+	CHECK(!(conn.wsFlags & HTTP_WS_TX_MESSAGE));
+
+	// Nothing is sent when even a header doesn't fit
+	txLen = 0;
+	txCap = 2;
+	CHECK(HTTPWebSocketPutArray(vData, 5, HTTP_WS_TEXT, TRUE) == 0u && txLen == 0);
+
+	// 16 bit length
+	txLen = 0;
+	txCap = sizeof(tx);
+	CHECK(HTTPWebSocketPutArray(vData, 130, HTTP_WS_TEXT, TRUE) == 130u);
+	CHECK(tx[0] == 0x81u && tx[1] == 126u && tx[2] == 0u && tx[3] == 130u);
+}
+
+int main(void)
+{
+	int step;
+
+	TestHandshake();
+	for(step = 1; step <= 40; step += 13)
+		TestReceive(step);
+	TestSend();
+
+	printf("WebSocket: ok\n");
+	return 0;
+}
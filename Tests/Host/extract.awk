@@ -0,0 +1,55 @@
+# Copies the parts of a stack source file that a host test builds on its 
+# own: every "#if defined(<feature>)" block outside a function body, the 
+# definitions of the functions and tables named by <names>, and any other 
+# top level line matching <keep>.
+#
+#   awk -v feature=HTTP_WEBSOCKET -v keep='#define HTTP_WS_' -f extract.awk HTTP2.c
+#   awk -v names='TCPFindArrayEx|TCPRxByte' -f extract.awk TCP.c
+
+BEGIN {
+	depth = 0		# Brace depth of the code
+	nest = 0		# Preprocessor depth inside a copied block
+	body = 0		# Copying a function or table definition
+	comment = 0		# Inside a block comment
+}
+
+{
+	# Strip comments and literals before counting braces
+	code = $0
+	if(comment)
+	{
+		if(!sub(/^.*\*\//, "", code))
+			code = ""
+		else
+			comment = 0
+	}
+	gsub(/\/\*.*\*\//, "", code)
+	if(sub(/\/\*.*$/, "", code))
+		comment = 1
+	sub(/\/\/.*$/, "", code)
+	gsub(/"([^"\\]|\\.)*"/, "", code)
+	gsub(/'([^'\\]|\\.)*'/, "", code)
+
+	if(nest == 0 && depth == 0 && names != "" && code ~ "^[ \t]*[A-Za-z_].*[ \t*](" names ")[[(]" && code !~ /;[ \t]*$/)
+		body = 1
+
+	if(feature != "" && nest == 0 && depth == 0 && code ~ "^[ \t]*#if defined\\(" feature "\\)[ \t]*$")
+		nest = 1
+	else if(nest > 0 && code ~ /^[ \t]*#if/)
+		nest++
+	else if(nest > 0 && code ~ /^[ \t]*#endif/)
+	{
+		print
+		nest--
+		next
+	}
+
+	if(nest > 0 || body > 0 || (depth == 0 && keep != "" && $0 ~ keep))
+		print
+
+	depth += gsub(/\{/, "", code) - gsub(/\}/, "", code)
+	if(body == 1 && depth > 0)
+		body = 2
+	else if(body == 2 && depth == 0)
+		body = 0
+}
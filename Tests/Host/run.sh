@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# Builds and runs the host tests.  They check stack code with gcc on a
+# PC, and are not part of the firmware build.
+#
+#   sh Tests/Host/run.sh [bench]
+#
+# With "bench", the tests that have benchmarks also run them.
+#
+set -e
+
+if [ "$1" = bench ]; then
+	HOST_BENCH=1
+	export HOST_BENCH
+fi
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(cd "$HERE/../.." && pwd)
+STACK="$ROOT/TCPIP Stack"
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# GenericTypeDefs.h relies on a 32 bit long, so shadow it with a copy
+# using int for the 32 bit types
+mkdir "$OUT/shadow"
+sed -e 's/^typedef unsigned long\([[:space:]]*DWORD;\)/typedef unsigned int\1/' \
+	-e 's/^typedef signed long\([[:space:]]*LONG;\)/typedef signed int\1/' \
+	"$ROOT/Include/GenericTypeDefs.h" > "$OUT/shadow/GenericTypeDefs.h"
+
+CC=${CC:-gcc}
+CFLAGS="-std=gnu99 -O2 -w -I$OUT -I$OUT/shadow -I$HERE -I$ROOT/App -I$ROOT/Bsp -I$ROOT/Core -I$ROOT/Debug -I$ROOT/Include -I$ROOT/Peripheral/inc"
+
+# WebSocket handshake and frame codec
+awk -v feature=HTTP_WEBSOCKET \
+	-v keep='#define HTTP_WS_|#define HTTP_CRLF_LEN|static ROM BYTE HTTP_(CRLF|WS_GUID)\\[\\]' \
+	-f "$HERE/extract.awk" "$STACK/HTTP2.c" > "$OUT/WebSocket_ext.c"
+$CC $CFLAGS -o "$OUT/WebSocket" "$HERE/WebSocket.c" "$HERE/Stubs.c" "$STACK/Hashes.c" "$STACK/Helpers.c"
+"$OUT/WebSocket"
+
+# multipart/form-data parser
+awk -v names='HTTPReadMultipart' -v keep='#define (mMIN|HTTP_CRLF_LEN)|static ROM BYTE HTTP_CRLF\\[\\]' \
+	-f "$HERE/extract.awk" "$STACK/HTTP2.c" > "$OUT/Multipart_ext.c"
+$CC $CFLAGS -o "$OUT/Multipart" "$HERE/Multipart.c"
+"$OUT/Multipart"
+
+# TCPFindArrayEx against a naive search, and its benchmark
+awk -v names='TCPFindArrayEx|TCPRxByte' -v keep='#define TCPFoldCase' \
+	-f "$HERE/extract.awk" "$STACK/TCP.c" > "$OUT/FindArray_ext.c"
+$CC $CFLAGS -o "$OUT/FindArray" "$HERE/FindArray.c"
+"$OUT/FindArray"
+
+# httpHeaderSlots and httpExtensionSlots against their names
+awk -v names='httpHeaderSlots|httpExtensionSlots|HTTPRequestHeaders|httpFileExtensions' \
+	-v keep='#define (HTTP_HASH_SLOTS|HTTPNameHash|HTTP_NUM_HEADERS|HTTP_MAX_HEADER_LEN)[ \t(]' \
+	-f "$HERE/extract.awk" "$STACK/HTTP2.c" > "$OUT/HashTables_ext.c"
+$CC $CFLAGS -o "$OUT/HashTables" "$HERE/HashTables.c" "$HERE/Stubs.c" "$STACK/Helpers.c"
+"$OUT/HashTables"
+
+# HTTPServer over mock sockets, and its requests/s by connection count
+sed -n 's/^void \(HTTPPrint_[A-Za-z0-9_]*\)(.*);$/void \1() {}/p' "$ROOT/App/HTTPPrint.h" > "$OUT/HTTPPrint_stubs.c"
+$CC $CFLAGS -o "$OUT/HTTPLoad" "$HERE/HTTPLoad.c" "$HERE/Stubs.c" "$STACK/HTTP2.c" "$STACK/Hashes.c" "$STACK/Helpers.c" "$STACK/Inflate.c"
+"$OUT/HTTPLoad"